@@ -0,0 +1,63 @@
+#!/bin/sh
+#
+# clusters.sh: Round-trip a file through images of every cluster size
+#
+# Usage: bench/clusters.sh BINDIR [IMAGE]
+#
+# For each of 1, 2, 4, 8 and 16 sectors per cluster, makes an empty image
+# (IMAGE, default obj/clusters.img) with mkfs, writes a file spanning
+# several clusters and ending partway through one, cats it back, fills a
+# directory past its first cluster, and runs fsck. Exits with status 1
+# unless every file reads back as it was written and fsck finds no
+# problems with every image.
+
+if [ $# -lt 1 ] || [ $# -gt 2 ]; then
+  echo "Usage: $0 BINDIR [IMAGE]"
+  exit 2
+fi
+
+bindir=$1
+image=${2:-obj/clusters.img}
+
+work=$(mktemp -d) || exit 2
+trap 'rm -rf "$work" "$image"' EXIT
+
+failed=0
+for sectors in 1 2 4 8 16; do
+  # Five and a half clusters of data.
+  bytes=$((sectors * 512))
+  head -c $((bytes * 5 + bytes / 2)) /dev/urandom > "$work/data"
+  if ! "$bindir/mkfs" -c $sectors -t $((2880 * sectors)) -n 0 -d 0 \
+       "$image" > /dev/null; then
+    echo "$sectors sectors per cluster: mkfs failed"
+    failed=1
+    continue
+  fi
+
+  # A cluster holds 16 directory entries per sector, with '.' and '..'.
+  {
+    echo "< $work/data write /DATA.BIN"
+    echo "cat /DATA.BIN > $work/copy"
+    echo "mkdir /DIR"
+    i=0
+    while [ $i -lt $((sectors * 16)) ]; do
+      echo "touch /DIR/F$i"
+      i=$((i + 1))
+    done
+    echo "fsck"
+  } | "$bindir/shell" "$image" > "$work/out" 2>&1
+
+  if ! cmp -s "$work/data" "$work/copy"; then
+    echo "$sectors sectors per cluster: file read back wrong"
+    failed=1
+  elif grep -q -i 'error' "$work/out" ||
+       ! grep -q 'No problems found' "$work/out"; then
+    echo "$sectors sectors per cluster:"
+    sed 's/Enter a command: //g' "$work/out" | grep -v '^$'
+    failed=1
+  else
+    echo "$sectors sectors per cluster: passed"
+  fi
+done
+
+exit $failed
@@ -0,0 +1,70 @@
+#!/bin/sh
+#
+# compare.sh: Compare benchmark results against a baseline
+#
+# Usage: bench/compare.sh BASELINE_CSV RESULTS_CSV [THRESHOLD_PERCENT]
+#
+# Both files are CSV written by 'bench -c'. Each benchmark's median (p50)
+# time is compared, since it is the least affected by noise. A benchmark
+# that got slower by more than the threshold (default 10%) is flagged as a
+# regression, and the script exits with status 1 if there are any. With no
+# baseline yet, there is nothing to compare, so it exits with status 0 (run
+# 'make bench-baseline' to store one).
+
+if [ $# -lt 2 ] || [ $# -gt 3 ]; then
+  echo "Usage: $0 BASELINE_CSV RESULTS_CSV [THRESHOLD_PERCENT]"
+  exit 2
+fi
+
+baseline=$1
+results=$2
+threshold=${3:-10}
+
+if [ ! -f "$baseline" ]; then
+  echo "No baseline at $baseline (run 'make bench-baseline' to store one)"
+  exit 0
+fi
+
+awk -F, -v threshold="$threshold" '
+  FNR == 1 {
+    # Find the columns by name, so columns can be added later.
+    for (i = 1; i <= NF; i++)
+      column[$i] = i
+    next
+  }
+  FNR == NR {
+    baseline[$column["benchmark"]] = $column["p50_us"]
+    next
+  }
+  {
+    name = $column["benchmark"]
+    now = $column["p50_us"]
+    if (!(name in baseline)) {
+      printf "%-24s %12s %12.3f %9s  new\n", name, "-", now, "-"
+      next
+    }
+    before = baseline[name]
+    change = (before > 0 ? (now - before) * 100.0 / before : 0)
+    status = ""
+    if (change > threshold) {
+      status = "REGRESSION"
+      numRegressions++
+    } else if (change < -threshold) {
+      status = "improved"
+    }
+    printf "%-24s %12.3f %12.3f %+8.1f%%  %s\n", name, before, now, change,
+           status
+  }
+  BEGIN {
+    printf "%-24s %12s %12s %9s\n", "Benchmark", "base p50 us", "p50 us",
+           "change"
+  }
+  END {
+    if (numRegressions > 0) {
+      printf "%d benchmark(s) regressed by more than %s%%\n", numRegressions,
+             threshold
+      exit 1
+    }
+    printf "No regressions (threshold %s%%)\n", threshold
+  }
+' "$baseline" "$results"
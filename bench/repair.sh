@@ -0,0 +1,62 @@
+#!/bin/sh
+#
+# repair.sh: Check that 'fsck -r' leaves nothing for the next fsck to find
+#
+# Usage: bench/repair.sh BINDIR [IMAGE]
+#
+# Makes a 1.44 MB image (IMAGE, default obj/repair.img) with mkfs, writes a
+# file to it, then damages the FAT on disk: a lost cluster in the first
+# copy, and the second copy zeroed. A shell runs 'fsck -r', then, before
+# it exits (and syncs), starts a second shell, which reads the FAT afresh
+# from the image, to run 'fsck'. Exits with status 1 unless the first
+# finds and repairs the problems and the second finds none.
+
+if [ $# -lt 1 ] || [ $# -gt 2 ]; then
+  echo "Usage: $0 BINDIR [IMAGE]"
+  exit 2
+fi
+
+bindir=$1
+image=${2:-obj/repair.img}
+
+work=$(mktemp -d) || exit 2
+trap 'rm -rf "$work" "$image"' EXIT
+
+# One reserved sector, then two copies of the FAT of 9 sectors each.
+fat0=512
+fat1=$((512 * 10))
+
+"$bindir/mkfs" -n 0 -d 0 "$image" > /dev/null || exit 2
+head -c 5000 /dev/urandom > "$work/data"
+echo "< $work/data write /DATA.BIN" | "$bindir/shell" "$image" > /dev/null
+
+# Mark cluster 1000 (its entry starts 1500 bytes in) as the end of a chain
+# no file owns, and wipe the second copy.
+printf '\377\017' | dd of="$image" bs=1 seek=$((fat0 + 1500)) conv=notrunc \
+  2> /dev/null
+dd if=/dev/zero of="$image" bs=512 seek=$((fat1 / 512)) count=9 \
+  conv=notrunc 2> /dev/null
+
+cat > "$work/check" <<END
+#!/bin/sh
+echo fsck | "$bindir/shell" "$image" > "$work/check.out" 2>&1
+END
+chmod +x "$work/check"
+printf 'fsck -r\n!%s\n' "$work/check" | "$bindir/shell" "$image" \
+  > "$work/repair.out" 2>&1
+
+failed=0
+if ! grep -q 'problems found and repaired' "$work/repair.out"; then
+  echo "fsck -r didn't repair the image:"
+  failed=1
+elif ! grep -q 'No problems found' "$work/check.out"; then
+  echo "fsck found problems after fsck -r:"
+  failed=1
+fi
+if [ $failed -ne 0 ]; then
+  sed 's/Enter a command: //g' "$work/repair.out" "$work/check.out" |
+    grep -v '^$'
+  exit 1
+fi
+echo "Repair test passed"
+exit 0
@@ -0,0 +1,84 @@
+#!/bin/sh
+#
+# stress.sh: Run parallel readers and writers against one disk image
+#
+# Usage: bench/stress.sh BINDIR IMAGE [READERS] [WRITERS] [ROUNDS]
+#
+# Starts READERS shells (default 4) that list directories, cat files and
+# run df, and WRITERS shells (default 4) that write, mkdir, touch, rm and
+# rmdir files of their own, all at the same time on IMAGE, each for ROUNDS
+# rounds (default 50). Each shell is a session of its own, so they only
+# stay out of each other's way through the image's locks. Once they have
+# all finished, fsck must find no problems, or the script exits with
+# status 1.
+
+if [ $# -lt 2 ] || [ $# -gt 5 ]; then
+  echo "Usage: $0 BINDIR IMAGE [READERS] [WRITERS] [ROUNDS]"
+  exit 2
+fi
+
+bindir=$1
+image=$2
+readers=${3:-4}
+writers=${4:-4}
+rounds=${5:-50}
+
+work=$(mktemp -d) || exit 2
+trap 'rm -rf "$work"' EXIT
+
+# A file spanning several clusters, for the writers to write.
+head -c 20000 /dev/urandom > "$work/data"
+
+# Pick a file to cat from the generated tree, if there is one.
+file=$(printf 'find / -type f\n' | "$bindir/shell" "$image" |
+       grep -o '/[A-Z0-9/]*\.DAT' | head -n 1)
+
+reader() {
+  i=0
+  while [ $i -lt "$rounds" ]; do
+    echo "ls /"
+    [ -n "$file" ] && echo "cat $file"
+    echo "df"
+    i=$((i + 1))
+  done | "$bindir/shell" "$image" > "$work/reader$1.out" 2>&1
+}
+
+writer() {
+  i=0
+  while [ $i -lt "$rounds" ]; do
+    echo "< $work/data write /W$1.DAT"
+    echo "mkdir /D$1"
+    echo "touch /D$1/T.TXT"
+    echo "cat /W$1.DAT > $work/copy$1"
+    echo "rm /D$1/T.TXT"
+    echo "rmdir /D$1"
+    echo "rm /W$1.DAT"
+    i=$((i + 1))
+  done | "$bindir/shell" "$image" > "$work/writer$1.out" 2>&1
+  cmp -s "$work/data" "$work/copy$1" || echo "writer $1 read back bad data"
+}
+
+n=0
+while [ $n -lt "$readers" ]; do
+  reader $n &
+  n=$((n + 1))
+done
+n=0
+while [ $n -lt "$writers" ]; do
+  writer $n &
+  n=$((n + 1))
+done
+wait
+
+# Anything the shells said other than their prompts and normal output is
+# worth showing.
+grep -h -i 'error\|warning\|could not' "$work"/*.out | sort | uniq -c
+
+fsck=$(printf 'fsck\n' | "$bindir/shell" "$image")
+echo "$fsck" | grep -v 'Enter a command'
+if echo "$fsck" | grep -q 'No problems found'; then
+  echo "Stress test passed ($readers readers, $writers writers, $rounds rounds)"
+  exit 0
+fi
+echo "Stress test FAILED"
+exit 1
@@ -0,0 +1,693 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function definitions for the asynchronous I/O engine.
+ *
+ *              io_uring is used through its system calls directly: the
+ *              submission and completion rings are mapped into this process,
+ *              each run becomes one read or write request, and the batch is
+ *              submitted with a single io_uring_enter(). A run the kernel
+ *              only partly completes is finished with pread() or pwrite().
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "asyncIo.h"
+#include "fat.h"
+#include "threadPool.h"
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * IoEngine - the ways runs can be read and written.
+ *****************************************************************************/
+typedef enum
+{
+  IO_ENGINE_NONE = 0, // not started yet
+  IO_ENGINE_SYNC,
+  IO_ENGINE_THREADS,
+  IO_ENGINE_URING,
+} IoEngine;
+
+/******************************************************************************
+ * RunTask - a run in the batch, and how it went.
+ *****************************************************************************/
+typedef struct
+{
+  SectorRun* run;
+  int        isWrite;
+  int        result; // 0, or -1 if it failed
+} RunTask;
+
+/******************************************************************************
+ * Ring - the parts of an io_uring's rings mapped into this process.
+ *****************************************************************************/
+typedef struct
+{
+  int                  fd;
+  unsigned int         numEntries; // in the submission ring
+  void*                submissionRing;
+  size_t               submissionRingSize;
+  void*                completionRing; // the same mapping if single-mapped
+  size_t               completionRingSize;
+  struct io_uring_sqe* requests;
+  size_t               requestsSize;
+  unsigned int*        submissionHead;
+  unsigned int*        submissionTail;
+  unsigned int*        submissionMask;
+  unsigned int*        submissionArray;
+  unsigned int*        completionHead;
+  unsigned int*        completionTail;
+  unsigned int*        completionMask;
+  struct io_uring_cqe* completions;
+} Ring;
+
+
+//-----------------------------------------------------------------------------
+// Variables
+//-----------------------------------------------------------------------------
+
+static IoEngine        engine = IO_ENGINE_NONE;
+static IoEngine        batchEngine; // the engine used for the batch in flight
+static pid_t           enginePid; // the process that started the engine
+static Ring            ring = { -1 };
+static ThreadPool*     threadPool = NULL;
+
+// The batch in flight. The mutex is held from starting a batch until it is
+// finished.
+static pthread_mutex_t batchMutex = PTHREAD_MUTEX_INITIALIZER;
+static RunTask*        tasks = NULL;
+static unsigned int    maxTasks = 0;
+static unsigned int    numTasks = 0;
+static unsigned int    numInFlight = 0;
+static unsigned int    numQueued = 0; // in the ring, but not yet submitted
+static int             batchResult = 0;
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * startEngine - Pick the engine to use, if this process hasn't yet.
+ *
+ * Return - none
+ *****************************************************************************/
+static void startEngine();
+
+/******************************************************************************
+ * setUpRing - Create an io_uring and map its rings.
+ *
+ * Return - 0 on success, -1 if io_uring isn't available
+ *****************************************************************************/
+static int setUpRing();
+
+/******************************************************************************
+ * tearDownRing - Unmap and close the io_uring, if there is one.
+ *
+ * Return - none
+ *****************************************************************************/
+static void tearDownRing();
+
+/******************************************************************************
+ * startBatch - Start reading or writing a batch of runs. The batch mutex
+ *              must be held.
+ *
+ * runs - the runs
+ * numRuns - the number of runs
+ * isWrite - 1 to write them, 0 to read them
+ * isWaited - 1 if the batch will be finished straight away, so a single run
+ *            might as well be transferred now
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int startBatch(SectorRun* runs, unsigned int numRuns, int isWrite,
+                      int isWaited);
+
+/******************************************************************************
+ * finishBatch - Wait for the batch in flight, then release the batch mutex.
+ *
+ * Return - 0 on success, -1 if any run failed
+ *****************************************************************************/
+static int finishBatch();
+
+/******************************************************************************
+ * queueRequest - Add a request for a run to the submission ring, which must
+ *                have room for it.
+ *
+ * index - the index of the run's task
+ *
+ * Return - none
+ *****************************************************************************/
+static void queueRequest(unsigned int index);
+
+/******************************************************************************
+ * enterRing - Submit the queued requests, and wait for some to complete.
+ *
+ * minComplete - the number of completions to wait for (may be 0)
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int enterRing(unsigned int minComplete);
+
+/******************************************************************************
+ * reapCompletions - Handle every completion in the completion ring,
+ *                   finishing any run that was only partly done.
+ *
+ * Return - none
+ *****************************************************************************/
+static void reapCompletions();
+
+/******************************************************************************
+ * transferRun - Read or write the rest of a run with pread() or pwrite().
+ *
+ * task - the run's task
+ * numDone - the number of the run's bytes already transferred
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int transferRun(RunTask* task, unsigned int numDone);
+
+/******************************************************************************
+ * runTransferTask - transfer a whole run on a thread pool worker.
+ *
+ * argument - the run's task
+ *
+ * Return - none
+ *****************************************************************************/
+static void runTransferTask(void* argument);
+
+
+//-----------------------------------------------------------------------------
+// Asynchronous I/O interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * startReadingSectorRuns
+ *****************************************************************************/
+int startReadingSectorRuns(SectorRun* runs, unsigned int numRuns)
+{
+  pthread_mutex_lock(&batchMutex);
+  return startBatch(runs, numRuns, 0, 0);
+}
+
+/******************************************************************************
+ * finishReadingSectorRuns
+ *****************************************************************************/
+int finishReadingSectorRuns()
+{
+  return finishBatch();
+}
+
+/******************************************************************************
+ * readSectorRuns
+ *****************************************************************************/
+int readSectorRuns(SectorRun* runs, unsigned int numRuns)
+{
+  pthread_mutex_lock(&batchMutex);
+  startBatch(runs, numRuns, 0, 1);
+  return finishBatch();
+}
+
+/******************************************************************************
+ * writeSectorRuns
+ *****************************************************************************/
+int writeSectorRuns(SectorRun* runs, unsigned int numRuns)
+{
+  unsigned int bytesPerSector = fatFileSystem.bootSector.bytesPerSector;
+  unsigned int i;
+
+  // Writes into an open transaction only reach the image when it is
+  // checkpointed.
+  if (isFatTransactionActive())
+  {
+    for (i = 0; i < numRuns; i++)
+    {
+      unsigned int numWholeSectors = runs[i].numBytes / bytesPerSector;
+      unsigned int numLeftOver = runs[i].numBytes % bytesPerSector;
+      if (numWholeSectors > 0 && write_sectors(runs[i].sector,
+          numWholeSectors, runs[i].buffer) == -1)
+        return -1;
+      if (numLeftOver != 0 && write_sector(runs[i].sector + numWholeSectors,
+          runs[i].buffer + (numWholeSectors * bytesPerSector),
+          numLeftOver) == -1)
+        return -1;
+    }
+    return 0;
+  }
+
+  pthread_mutex_lock(&batchMutex);
+  startBatch(runs, numRuns, 1, 1);
+  return finishBatch();
+}
+
+/******************************************************************************
+ * getAsyncIoEngineName
+ *****************************************************************************/
+const char* getAsyncIoEngineName()
+{
+  const char* name;
+
+  pthread_mutex_lock(&batchMutex);
+  startEngine();
+  name = (engine == IO_ENGINE_URING ? "uring" :
+          engine == IO_ENGINE_THREADS ? "threads" : "sync");
+  pthread_mutex_unlock(&batchMutex);
+  return name;
+}
+
+/******************************************************************************
+ * closeAsyncIo
+ *****************************************************************************/
+void closeAsyncIo()
+{
+  pthread_mutex_lock(&batchMutex);
+  if (engine != IO_ENGINE_NONE && enginePid == getpid())
+  {
+    tearDownRing();
+    if (threadPool != NULL)
+      destroyThreadPool(threadPool);
+  }
+  threadPool = NULL;
+  engine = IO_ENGINE_NONE;
+  free(tasks);
+  tasks = NULL;
+  maxTasks = 0;
+  pthread_mutex_unlock(&batchMutex);
+}
+
+
+//-----------------------------------------------------------------------------
+// Internal Functions
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * startEngine
+ *****************************************************************************/
+static void startEngine()
+{
+  const char* name = getenv(FAT12_IO_ENGINE_ENV_VAR);
+
+  // A child process shares its parent's ring, and has none of its threads,
+  // so it starts its own engine.
+  if (engine != IO_ENGINE_NONE && enginePid != getpid())
+  {
+    if (ring.fd != -1)
+    {
+      munmap(ring.requests, ring.requestsSize);
+      if (ring.completionRing != ring.submissionRing)
+        munmap(ring.completionRing, ring.completionRingSize);
+      munmap(ring.submissionRing, ring.submissionRingSize);
+      close(ring.fd);
+      ring.fd = -1;
+    }
+    threadPool = NULL;
+    engine = IO_ENGINE_NONE;
+  }
+  if (engine != IO_ENGINE_NONE)
+    return;
+
+  if (name != NULL && strcmp(name, "sync") == 0)
+    engine = IO_ENGINE_SYNC;
+  else if ((name == NULL || strcmp(name, "threads") != 0) && setUpRing() == 0)
+    engine = IO_ENGINE_URING;
+  else if ((threadPool = createThreadPool(0)) != NULL)
+    engine = IO_ENGINE_THREADS;
+  else
+    engine = IO_ENGINE_SYNC;
+  enginePid = getpid();
+}
+
+/******************************************************************************
+ * setUpRing
+ *****************************************************************************/
+static int setUpRing()
+{
+  struct io_uring_params params;
+  unsigned char* submissionRing;
+  unsigned char* completionRing;
+
+  memset(&params, 0, sizeof(params));
+  ring.fd = syscall(__NR_io_uring_setup, ASYNC_IO_QUEUE_DEPTH, &params);
+  if (ring.fd < 0)
+  {
+    ring.fd = -1;
+    return -1;
+  }
+  ring.numEntries = params.sq_entries;
+
+  // Newer kernels map both rings at once.
+  ring.submissionRingSize = params.sq_off.array +
+                            (params.sq_entries * sizeof(unsigned int));
+  ring.completionRingSize = params.cq_off.cqes +
+                            (params.cq_entries * sizeof(struct io_uring_cqe));
+  if ((params.features & IORING_FEAT_SINGLE_MMAP) &&
+      ring.completionRingSize > ring.submissionRingSize)
+    ring.submissionRingSize = ring.completionRingSize;
+  ring.requestsSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  ring.submissionRing = mmap(NULL, ring.submissionRingSize, PROT_READ |
+    PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+  ring.completionRing = ring.submissionRing;
+  if (ring.submissionRing != MAP_FAILED &&
+      !(params.features & IORING_FEAT_SINGLE_MMAP))
+  {
+    ring.completionRing = mmap(NULL, ring.completionRingSize, PROT_READ |
+      PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+  }
+  ring.requests = (struct io_uring_sqe*) mmap(NULL, ring.requestsSize,
+    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd,
+    IORING_OFF_SQES);
+  if (ring.submissionRing == MAP_FAILED || ring.completionRing == MAP_FAILED ||
+      ring.requests == MAP_FAILED)
+  {
+    tearDownRing();
+    return -1;
+  }
+
+  submissionRing = (unsigned char*) ring.submissionRing;
+  completionRing = (unsigned char*) ring.completionRing;
+  ring.submissionHead  = (unsigned int*) (submissionRing + params.sq_off.head);
+  ring.submissionTail  = (unsigned int*) (submissionRing + params.sq_off.tail);
+  ring.submissionMask  = (unsigned int*) (submissionRing +
+                                          params.sq_off.ring_mask);
+  ring.submissionArray = (unsigned int*) (submissionRing +
+                                          params.sq_off.array);
+  ring.completionHead  = (unsigned int*) (completionRing + params.cq_off.head);
+  ring.completionTail  = (unsigned int*) (completionRing + params.cq_off.tail);
+  ring.completionMask  = (unsigned int*) (completionRing +
+                                          params.cq_off.ring_mask);
+  ring.completions     = (struct io_uring_cqe*) (completionRing +
+                                                 params.cq_off.cqes);
+  return 0;
+}
+
+/******************************************************************************
+ * tearDownRing
+ *****************************************************************************/
+static void tearDownRing()
+{
+  if (ring.fd == -1)
+    return;
+
+  if (ring.requests != NULL && ring.requests != MAP_FAILED)
+    munmap(ring.requests, ring.requestsSize);
+  if (ring.completionRing != ring.submissionRing &&
+      ring.completionRing != NULL && ring.completionRing != MAP_FAILED)
+    munmap(ring.completionRing, ring.completionRingSize);
+  if (ring.submissionRing != NULL && ring.submissionRing != MAP_FAILED)
+    munmap(ring.submissionRing, ring.submissionRingSize);
+  close(ring.fd);
+  memset(&ring, 0, sizeof(ring));
+  ring.fd = -1;
+}
+
+/******************************************************************************
+ * startBatch
+ *****************************************************************************/
+static int startBatch(SectorRun* runs, unsigned int numRuns, int isWrite,
+                      int isWaited)
+{
+  unsigned int i;
+
+  // Handing a single run to the kernel or another thread, only to wait for
+  // it, costs more than just transferring it (several times over for a
+  // sector already in the page cache). The engine isn't even started until
+  // a batch needs it, since setting up a ring costs more than most commands.
+  // Block devices with no descriptor to hand the kernel (the image is in
+  // memory, or behind a cache of our own) transfer every run themselves.
+  batchEngine = IO_ENGINE_SYNC;
+  if ((!isWaited || numRuns > 1) && fatFileSystem.blockDevice->fd != -1)
+  {
+    startEngine();
+    batchEngine = engine;
+  }
+
+  if (numRuns > maxTasks)
+  {
+    free(tasks);
+    maxTasks = numRuns;
+    tasks = (RunTask*) malloc(maxTasks * sizeof(RunTask));
+  }
+  for (i = 0; i < numRuns; i++)
+  {
+    tasks[i].run = &runs[i];
+    tasks[i].isWrite = isWrite;
+    tasks[i].result = 0;
+  }
+  numTasks = numRuns;
+  batchResult = 0;
+  if (numRuns == 0)
+    return 0;
+
+  // Anything still buffered in the image's stream has to reach the file
+  // first, and anything it read ahead may be about to change.
+  flush_sectors();
+  if (batchEngine != IO_ENGINE_SYNC)
+    FAT_STAT_ADD(FAT_STAT_IO_SUBMISSIONS, 1);
+
+  if (batchEngine == IO_ENGINE_URING)
+  {
+    for (i = 0; i < numRuns; i++)
+    {
+      // When the ring is full, submit what's queued and wait for room.
+      while (numInFlight == ring.numEntries)
+      {
+        if (enterRing(1) != 0)
+        {
+          batchResult = -1;
+          return -1;
+        }
+        reapCompletions();
+      }
+      queueRequest(i);
+    }
+    if (enterRing(0) != 0)
+    {
+      batchResult = -1;
+      return -1;
+    }
+  }
+  else if (batchEngine == IO_ENGINE_THREADS)
+  {
+    for (i = 0; i < numRuns; i++)
+      submitTask(threadPool, runTransferTask, &tasks[i]);
+  }
+  else
+  {
+    for (i = 0; i < numRuns; i++)
+      tasks[i].result = transferRun(&tasks[i], 0);
+  }
+  return 0;
+}
+
+/******************************************************************************
+ * finishBatch
+ *****************************************************************************/
+static int finishBatch()
+{
+  unsigned int bytesPerSector = fatFileSystem.bootSector.bytesPerSector;
+  unsigned int i;
+  unsigned int j;
+
+  if (batchEngine == IO_ENGINE_URING)
+  {
+    while (numInFlight > 0 && batchResult == 0)
+    {
+      if (enterRing(1) != 0)
+        batchResult = -1;
+      reapCompletions();
+    }
+
+    // If the ring stopped working, the requests in it can't be trusted to
+    // finish, so give up on it for the rest of this process.
+    if (batchResult != 0)
+    {
+      tearDownRing();
+      numInFlight = 0;
+      numQueued = 0;
+      engine = IO_ENGINE_SYNC;
+      batchResult = 0;
+      for (i = 0; i < numTasks; i++)
+        tasks[i].result = transferRun(&tasks[i], 0);
+    }
+  }
+  else if (batchEngine == IO_ENGINE_THREADS && numTasks > 0)
+  {
+    waitForTasks(threadPool);
+  }
+
+  for (i = 0; i < numTasks; i++)
+  {
+    SectorRun* run = tasks[i].run;
+    unsigned int numSectors = (run->numBytes + bytesPerSector - 1) /
+                              bytesPerSector;
+    if (tasks[i].result != 0)
+    {
+      printf("Error %s sectors %d to %d\n", (tasks[i].isWrite ? "writing" :
+             "reading"), run->sector, run->sector + numSectors - 1);
+      batchResult = -1;
+    }
+    else if (tasks[i].isWrite)
+    {
+      FAT_STAT_ADD(FAT_STAT_WRITE_CALLS, 1);
+      FAT_STAT_ADD(FAT_STAT_SECTORS_WRITTEN, numSectors);
+      FAT_STAT_ADD(FAT_STAT_BYTES_WRITTEN, run->numBytes);
+    }
+    else
+    {
+      FAT_STAT_ADD(FAT_STAT_READ_CALLS, 1);
+      FAT_STAT_ADD(FAT_STAT_SECTORS_READ, numSectors);
+      FAT_STAT_ADD(FAT_STAT_BYTES_READ, run->numBytes);
+
+      // Sectors written by a journaled transaction replace what's on disk.
+      for (j = 0; j < numSectors; j++)
+      {
+        if (journalReadSector(run->sector + j, run->buffer +
+                              (j * bytesPerSector)))
+          FAT_STAT_ADD(FAT_STAT_JOURNAL_READS, 1);
+      }
+    }
+  }
+
+  int result = batchResult;
+  numTasks = 0;
+  pthread_mutex_unlock(&batchMutex);
+  return result;
+}
+
+/******************************************************************************
+ * queueRequest
+ *****************************************************************************/
+static void queueRequest(unsigned int index)
+{
+  RunTask* task = &tasks[index];
+  unsigned int tail = *ring.submissionTail;
+  unsigned int slot = tail & *ring.submissionMask;
+  struct io_uring_sqe* request = &ring.requests[slot];
+
+  memset(request, 0, sizeof(*request));
+  request->opcode = (task->isWrite ? IORING_OP_WRITE : IORING_OP_READ);
+  request->fd = fatFileSystem.blockDevice->fd;
+  request->addr = (unsigned long) task->run->buffer;
+  request->len = task->run->numBytes;
+  request->off = (unsigned long long) task->run->sector *
+                 fatFileSystem.bootSector.bytesPerSector;
+  request->user_data = index;
+  ring.submissionArray[slot] = slot;
+
+  // The kernel mustn't see the new tail before the request it points past.
+  __atomic_store_n(ring.submissionTail, tail + 1, __ATOMIC_RELEASE);
+  numInFlight++;
+  numQueued++;
+}
+
+/******************************************************************************
+ * enterRing
+ *****************************************************************************/
+static int enterRing(unsigned int minComplete)
+{
+  int rc;
+
+  if (numQueued == 0 && minComplete == 0)
+    return 0;
+
+  do
+  {
+    rc = syscall(__NR_io_uring_enter, ring.fd, numQueued, minComplete,
+                 (minComplete > 0 ? IORING_ENTER_GETEVENTS : 0), NULL, 0);
+  } while (rc < 0 && (errno == EINTR || errno == EAGAIN));
+
+  if (rc < 0)
+    return -1;
+  numQueued -= rc;
+  return 0;
+}
+
+/******************************************************************************
+ * reapCompletions
+ *****************************************************************************/
+static void reapCompletions()
+{
+  unsigned int head = *ring.completionHead;
+  unsigned int tail = __atomic_load_n(ring.completionTail, __ATOMIC_ACQUIRE);
+
+  for (; head != tail; head++)
+  {
+    struct io_uring_cqe* completion =
+      &ring.completions[head & *ring.completionMask];
+    RunTask* task = &tasks[completion->user_data];
+
+    // Finish short transfers (and ones the kernel couldn't do
+    // asynchronously) the ordinary way.
+    if (completion->res != (int) task->run->numBytes)
+      task->result = transferRun(task, (completion->res > 0 ?
+                                        completion->res : 0));
+    numInFlight--;
+  }
+
+  __atomic_store_n(ring.completionHead, head, __ATOMIC_RELEASE);
+}
+
+/******************************************************************************
+ * transferRun
+ *****************************************************************************/
+static int transferRun(RunTask* task, unsigned int numDone)
+{
+  int fd = fatFileSystem.blockDevice->fd;
+  off_t offset = (off_t) task->run->sector *
+                 fatFileSystem.bootSector.bytesPerSector;
+  ssize_t numTransferred;
+
+  if (fd == -1)
+  {
+    unsigned int numLeft = task->run->numBytes - numDone;
+    if (task->isWrite)
+      numTransferred = writeBlockDevice(fatFileSystem.blockDevice,
+        offset + numDone, numLeft, task->run->buffer + numDone);
+    else
+      numTransferred = readBlockDevice(fatFileSystem.blockDevice,
+        offset + numDone, numLeft, task->run->buffer + numDone);
+    return (numTransferred == (ssize_t) numLeft ? 0 : -1);
+  }
+
+  while (numDone < task->run->numBytes)
+  {
+    if (task->isWrite)
+      numTransferred = pwrite(fd, task->run->buffer + numDone,
+                              task->run->numBytes - numDone, offset + numDone);
+    else
+      numTransferred = pread(fd, task->run->buffer + numDone,
+                             task->run->numBytes - numDone, offset + numDone);
+
+    if (numTransferred < 0 && errno == EINTR)
+      continue;
+    if (numTransferred <= 0)
+      return -1;
+    numDone += numTransferred;
+  }
+  return 0;
+}
+
+/******************************************************************************
+ * runTransferTask
+ *****************************************************************************/
+static void runTransferTask(void* argument)
+{
+  RunTask* task = (RunTask*) argument;
+  task->result = transferRun(task, 0);
+}
@@ -0,0 +1,122 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function headers for the asynchronous I/O engine, which reads
+ *              and writes a batch of sector runs (such as the runs of
+ *              consecutive clusters in a chain) with as many of them in
+ *              flight at once as the device will take.
+ *
+ *              The engine is picked the first time it is used:
+ *
+ *                uring   - io_uring: the whole batch is handed to the kernel
+ *                          in one system call, and reaped as it completes
+ *                threads - a thread pool doing pread() and pwrite(), used
+ *                          when io_uring isn't available
+ *                sync    - one pread() or pwrite() after another
+ *
+ *              The FAT12_IO_ENGINE environment variable can ask for one of
+ *              them by name, for comparing them (see Readme.txt).
+ *
+ *              Like read_sectors() and write_sectors(), reads see sectors
+ *              still in the journal, and writes made while a journaled
+ *              transaction is open go into the transaction instead.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#ifndef _ASYNC_IO_H_
+#define _ASYNC_IO_H_
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+
+// The environment variable naming the engine to use (uring, threads or
+// sync), instead of the best one available.
+#define FAT12_IO_ENGINE_ENV_VAR "FAT12_IO_ENGINE"
+
+// The most runs the engine keeps in flight at once.
+#define ASYNC_IO_QUEUE_DEPTH 64
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * SectorRun - consecutive sectors to read or write, with one buffer.
+ *****************************************************************************/
+typedef struct
+{
+  unsigned int   sector; // the first sector
+  unsigned int   numBytes; // whole sectors, except the end of a write
+  unsigned char* buffer;
+} SectorRun;
+
+
+//-----------------------------------------------------------------------------
+// Asynchronous I/O interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * startReadingSectorRuns - Start reading a batch of sector runs, returning
+ *                          while they are still being read. Only one batch
+ *                          is in flight at a time per process: other threads
+ *                          wait here until the batch is finished.
+ *
+ * runs - the runs to read, which must stay valid until the batch is finished
+ * numRuns - the number of runs
+ *
+ * Return - 0 on success, -1 if the reads couldn't be started (the batch must
+ *          still be finished)
+ *****************************************************************************/
+int startReadingSectorRuns(SectorRun* runs, unsigned int numRuns);
+
+/******************************************************************************
+ * finishReadingSectorRuns - Wait for the batch started by
+ *                           startReadingSectorRuns() to be read.
+ *
+ * Return - 0 on success, -1 if any run couldn't be read
+ *****************************************************************************/
+int finishReadingSectorRuns();
+
+/******************************************************************************
+ * readSectorRuns - Read a batch of sector runs, all in flight at once.
+ *
+ * runs - the runs to read
+ * numRuns - the number of runs
+ *
+ * Return - 0 on success, -1 if any run couldn't be read
+ *****************************************************************************/
+int readSectorRuns(SectorRun* runs, unsigned int numRuns);
+
+/******************************************************************************
+ * writeSectorRuns - Write a batch of sector runs, all in flight at once.
+ *
+ * runs - the runs to write
+ * numRuns - the number of runs
+ *
+ * Return - 0 on success, -1 if any run couldn't be written
+ *****************************************************************************/
+int writeSectorRuns(SectorRun* runs, unsigned int numRuns);
+
+/******************************************************************************
+ * getAsyncIoEngineName - Get the name of the engine in use, starting it if
+ *                        it hasn't been yet.
+ *
+ * Return - "uring", "threads" or "sync"
+ *****************************************************************************/
+const char* getAsyncIoEngineName();
+
+/******************************************************************************
+ * closeAsyncIo - Stop the engine, if it was started. It starts again the next
+ *                time it is used.
+ *
+ * Return - none
+ *****************************************************************************/
+void closeAsyncIo();
+
+
+#endif //_ASYNC_IO_H_
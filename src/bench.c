@@ -0,0 +1,846 @@
+/******************************************************************************
+ * bench.c: Benchmarks
+ *
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Times the file system's hot paths on a disk image made by
+ *              mkfs (see 'make bench'). This runs on its own, outside of the
+ *              shell, and works on a scratch copy of the image, so the image
+ *              itself is never changed. Each benchmark is run for a number of
+ *              warmup repetitions that aren't counted, then for a number of
+ *              repetitions that are. Every operation is timed on its own.
+ *
+ *              Usage: bench [OPTIONS] IMAGE
+ *                -w WARMUP   warmup repetitions (default 2)
+ *                -r REPS     counted repetitions (default 10)
+ *                -b FILTER   only run benchmarks whose name contains FILTER
+ *                -c FILE     also write the results to FILE as CSV
+ *                -j FILE     also write the results to FILE as JSON
+ *                -d DEVICE   the block device to read and write the image
+ *                            with (stdio, pread, mmap, memory or direct;
+ *                            default stdio), so that I/O costs can be told
+ *                            apart from CPU costs
+ *
+ *              Launching a command is timed with fork() and execve() (as the
+ *              shell used to) and with posix_spawn() (as it does now), running
+ *              the pwd executable next to this one.
+ *
+ *              Path resolution is timed down the chain of directories that
+ *              mkfs creates first (/D0000001/D0000002/...), so the image
+ *              should be made with a depth (-D) of at least 24.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ *****************************************************************************/
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "fat.h"
+#include "histogram.h"
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+
+// The number of entries in the large directory that lookups are timed in.
+#define LARGE_DIRECTORY_ENTRIES 1024
+
+// The size of the file that reads and writes are timed on.
+#define LARGE_FILE_SIZE (256 * 1024)
+
+// The deepest path that resolution is timed on.
+#define MAX_BENCH_DEPTH 24
+
+// The maximum number of benchmarks.
+#define MAX_BENCHMARKS 32
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * Benchmark - an operation to time, and its results.
+ *****************************************************************************/
+typedef struct
+{
+  char         name[32];
+  unsigned int numOps; // operations per repetition
+  int          parameter; // passed to run() (such as a depth)
+  int          (*run)(int parameter, unsigned int op); // 0 on success
+  int          isMountNeeded; // 0 if it must run while not mounted
+  Histogram    opTime; // in nanoseconds
+  unsigned long long sectorsRead; // by every counted operation
+  unsigned long long sectorsWritten;
+  int          isRun;
+} Benchmark;
+
+
+//-----------------------------------------------------------------------------
+// Variables
+//-----------------------------------------------------------------------------
+
+static Benchmark benchmarks[MAX_BENCHMARKS];
+static int       numBenchmarks = 0;
+
+// The fixtures that the benchmarks run on.
+static char            depthPaths[MAX_BENCH_DEPTH + 1][
+                                  FAT12_MAX_PATH_NAME_LENGTH];
+static unsigned int    maxDepth = 0;
+static unsigned int    largeDirectoryFlc;
+static DirectoryEntry* largeDirectory;
+static unsigned int    churnDirectoryFlc;
+static unsigned int    readFileFlc;
+static unsigned int    writeFileFlc;
+static unsigned int    readFileClusters;
+static unsigned char*  fileData;
+static unsigned long long randomState = 0x9E3779B97F4A7C15ULL;
+static char            pathToPwd[FAT12_MAX_IMAGE_PATH_LENGTH];
+static char*           pwdArguments[] = { "pwd", NULL };
+static posix_spawn_file_actions_t pwdFileActions;
+
+extern char** environ;
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+static void usage();
+static int copyFile(const char* fromFileName, const char* toFileName);
+static void addBenchmark(const char* name, unsigned int numOps,
+                         int (*run)(int, unsigned int), int parameter,
+                         int isMountNeeded);
+static void runBenchmark(Benchmark* benchmark, unsigned int numWarmups,
+                         unsigned int numRepetitions);
+static int createFixtures();
+static unsigned int createEntry(unsigned int parentFlc, const char* name,
+                                int isDirectory);
+static unsigned long long getNanoseconds();
+static unsigned int randomBelow(unsigned int limit);
+static void printResults(FILE* stream);
+static void writeCsvResults(FILE* stream);
+static void writeJsonResults(FILE* stream);
+
+static int benchMount(int parameter, unsigned int op);
+static int benchForkExec(int parameter, unsigned int op);
+static int benchPosixSpawn(int parameter, unsigned int op);
+static int benchResolvePath(int parameter, unsigned int op);
+static int benchFindEntry(int parameter, unsigned int op);
+static int benchFindMissingEntry(int parameter, unsigned int op);
+static int benchCreateDelete(int parameter, unsigned int op);
+static int benchSequentialRead(int parameter, unsigned int op);
+static int benchRandomRead(int parameter, unsigned int op);
+static int benchLargeWrite(int parameter, unsigned int op);
+static int benchDf(int parameter, unsigned int op);
+
+
+/******************************************************************************
+ * main - runs the bench program.
+ *****************************************************************************/
+int main(int argc, char* argv[])
+{
+  unsigned int numWarmups = 2;
+  unsigned int numRepetitions = 10;
+  const char* filter = NULL;
+  const char* csvFileName = NULL;
+  const char* jsonFileName = NULL;
+  int blockDeviceType = BLOCK_DEVICE_STDIO;
+  char scratchFileName[FAT12_MAX_IMAGE_PATH_LENGTH];
+  int rc = 0;
+  int opt;
+  int i;
+
+  while ((opt = getopt(argc, argv, "w:r:b:c:j:d:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'w': numWarmups = strtoul(optarg, NULL, 10); break;
+      case 'r': numRepetitions = strtoul(optarg, NULL, 10); break;
+      case 'b': filter = optarg; break;
+      case 'c': csvFileName = optarg; break;
+      case 'j': jsonFileName = optarg; break;
+      case 'd':
+        blockDeviceType = getBlockDeviceType(optarg);
+        if (blockDeviceType == -1)
+        {
+          usage();
+          return -1;
+        }
+        break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+  if (optind != argc - 1 || numRepetitions == 0)
+  {
+    usage();
+    return -1;
+  }
+
+  // Work on a scratch copy of the image, in a session of our own.
+  if (snprintf(scratchFileName, sizeof(scratchFileName), "%s.bench",
+               argv[optind]) >= (int) sizeof(scratchFileName) ||
+      copyFile(argv[optind], scratchFileName) != 0)
+  {
+    printf("Error: %s: unable to copy disk image file\n", argv[optind]);
+    return -1;
+  }
+  if (createFatSession(scratchFileName) != 0)
+  {
+    unlink(scratchFileName);
+    return -1;
+  }
+  if (blockDeviceType != BLOCK_DEVICE_STDIO &&
+      setFatBlockDevice(blockDeviceType) != 0)
+  {
+    destroyFatSession();
+    unlink(scratchFileName);
+    return -1;
+  }
+
+  // The commands launched are next to this executable, and print to
+  // /dev/null.
+  ssize_t pathLength = readlink("/proc/self/exe", pathToPwd,
+                                sizeof(pathToPwd) - 5);
+  if (pathLength == -1)
+    pathLength = 0;
+  pathToPwd[pathLength] = '\0';
+  char* finalSlash = strrchr(pathToPwd, '/');
+  strcpy(finalSlash != NULL ? finalSlash + 1 : pathToPwd, "pwd");
+  posix_spawn_file_actions_init(&pwdFileActions);
+  posix_spawn_file_actions_addopen(&pwdFileActions, STDOUT_FILENO,
+                                   "/dev/null", O_WRONLY, 0);
+
+  addBenchmark("mount", 100, benchMount, 0, 0);
+  addBenchmark("launch_fork_exec", 50, benchForkExec, 0, 0);
+  addBenchmark("launch_posix_spawn", 50, benchPosixSpawn, 0, 0);
+  addBenchmark("resolve_depth_1", 1000, benchResolvePath, 1, 1);
+  addBenchmark("resolve_depth_4", 1000, benchResolvePath, 4, 1);
+  addBenchmark("resolve_depth_8", 1000, benchResolvePath, 8, 1);
+  addBenchmark("resolve_depth_16", 500, benchResolvePath, 16, 1);
+  addBenchmark("resolve_depth_24", 500, benchResolvePath, MAX_BENCH_DEPTH,
+               1);
+  addBenchmark("find_entry_large_dir", 1000, benchFindEntry, 0, 1);
+  addBenchmark("find_missing_large_dir", 1000, benchFindMissingEntry, 0, 1);
+  addBenchmark("create_delete", 200, benchCreateDelete, 0, 1);
+  addBenchmark("sequential_read_256k", 20, benchSequentialRead, 0, 1);
+  addBenchmark("random_read_sector", 1000, benchRandomRead, 0, 1);
+  addBenchmark("large_write_256k", 20, benchLargeWrite, 0, 1);
+  addBenchmark("df", 1000, benchDf, 0, 1);
+
+  // Mounting and launching commands are timed before the fixtures are made,
+  // since the other benchmarks keep the image mounted (and locked) the whole
+  // time.
+  for (i = 0; i < numBenchmarks; i++)
+  {
+    if (!benchmarks[i].isMountNeeded &&
+        (filter == NULL || strstr(benchmarks[i].name, filter) != NULL))
+      runBenchmark(&benchmarks[i], numWarmups, numRepetitions);
+  }
+
+  if (initializeFatFileSystem(FAT_LOCK_EXCLUSIVE) != 0)
+  {
+    destroyFatSession();
+    unlink(scratchFileName);
+    return -1;
+  }
+  if (createFixtures() != 0)
+  {
+    rc = -1;
+  }
+  else
+  {
+    for (i = 0; i < numBenchmarks; i++)
+    {
+      if (benchmarks[i].isMountNeeded &&
+          (filter == NULL || strstr(benchmarks[i].name, filter) != NULL))
+        runBenchmark(&benchmarks[i], numWarmups, numRepetitions);
+    }
+  }
+  terminateFatFileSystem();
+  destroyFatSession();
+  unlink(scratchFileName);
+  closeDirectory(largeDirectory);
+  free(fileData);
+  posix_spawn_file_actions_destroy(&pwdFileActions);
+
+  printResults(stdout);
+  if (csvFileName != NULL)
+  {
+    FILE* file = fopen(csvFileName, "w");
+    if (file == NULL)
+    {
+      perror(csvFileName);
+      return -1;
+    }
+    writeCsvResults(file);
+    fclose(file);
+  }
+  if (jsonFileName != NULL)
+  {
+    FILE* file = fopen(jsonFileName, "w");
+    if (file == NULL)
+    {
+      perror(jsonFileName);
+      return -1;
+    }
+    writeJsonResults(file);
+    fclose(file);
+  }
+  return rc;
+}
+
+/******************************************************************************
+ * usage - prints the usage statement.
+ *****************************************************************************/
+static void usage()
+{
+  printf("Usage: bench [-w WARMUP] [-r REPS] [-b FILTER] [-c CSV_FILE] "
+         "[-j JSON_FILE]\n"
+         "             [-d stdio|pread|mmap|memory|direct] IMAGE\n");
+}
+
+/******************************************************************************
+ * copyFile - copy a file on the host. Blocks of zeros are skipped over
+ *            rather than written, so a large, mostly empty image stays
+ *            sparse.
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int copyFile(const char* fromFileName, const char* toFileName)
+{
+  static const unsigned char zeros[65536];
+  unsigned char buffer[65536];
+  size_t numBytes;
+  off_t size = 0;
+  int rc = 0;
+
+  FILE* fromFile = fopen(fromFileName, "r");
+  if (fromFile == NULL)
+    return -1;
+  FILE* toFile = fopen(toFileName, "w");
+  if (toFile == NULL)
+  {
+    fclose(fromFile);
+    return -1;
+  }
+
+  while ((numBytes = fread(buffer, 1, sizeof(buffer), fromFile)) > 0)
+  {
+    if (memcmp(buffer, zeros, numBytes) == 0)
+    {
+      if (fseeko(toFile, numBytes, SEEK_CUR) != 0)
+        rc = -1;
+    }
+    else if (fwrite(buffer, 1, numBytes, toFile) != numBytes)
+      rc = -1;
+    size += numBytes;
+  }
+
+  // Skipping zeros at the end doesn't extend the file on its own.
+  if (fflush(toFile) != 0 || ftruncate(fileno(toFile), size) != 0)
+    rc = -1;
+  if (ferror(fromFile) || fclose(toFile) != 0)
+    rc = -1;
+  fclose(fromFile);
+  return rc;
+}
+
+/******************************************************************************
+ * addBenchmark - add a benchmark to the list to run.
+ *****************************************************************************/
+static void addBenchmark(const char* name, unsigned int numOps,
+                         int (*run)(int, unsigned int), int parameter,
+                         int isMountNeeded)
+{
+  Benchmark* benchmark = &benchmarks[numBenchmarks++];
+
+  strcpy(benchmark->name, name);
+  benchmark->numOps = numOps;
+  benchmark->run = run;
+  benchmark->parameter = parameter;
+  benchmark->isMountNeeded = isMountNeeded;
+  initHistogram(&benchmark->opTime);
+}
+
+/******************************************************************************
+ * runBenchmark - run a benchmark's warmups and repetitions, timing each
+ *                operation of the repetitions.
+ *****************************************************************************/
+static void runBenchmark(Benchmark* benchmark, unsigned int numWarmups,
+                         unsigned int numRepetitions)
+{
+  unsigned long long startTime;
+  unsigned long long sectorsRead;
+  unsigned long long sectorsWritten;
+  unsigned int repetition;
+  unsigned int op;
+
+  for (repetition = 0; repetition < numWarmups; repetition++)
+  {
+    for (op = 0; op < benchmark->numOps; op++)
+    {
+      if (benchmark->run(benchmark->parameter, op) != 0)
+        return;
+    }
+  }
+
+  sectorsRead = fatStatCounters[FAT_STAT_SECTORS_READ];
+  sectorsWritten = fatStatCounters[FAT_STAT_SECTORS_WRITTEN];
+  for (repetition = 0; repetition < numRepetitions; repetition++)
+  {
+    for (op = 0; op < benchmark->numOps; op++)
+    {
+      startTime = getNanoseconds();
+      if (benchmark->run(benchmark->parameter, op) != 0)
+        return;
+      recordHistogramValue(&benchmark->opTime,
+                           getNanoseconds() - startTime);
+    }
+  }
+  benchmark->sectorsRead = fatStatCounters[FAT_STAT_SECTORS_READ] -
+                           sectorsRead;
+  benchmark->sectorsWritten = fatStatCounters[FAT_STAT_SECTORS_WRITTEN] -
+                              sectorsWritten;
+  benchmark->isRun = 1;
+}
+
+/******************************************************************************
+ * createFixtures - find and create what the benchmarks run on: the paths
+ *                  down mkfs's chain of directories, a large directory, a
+ *                  directory to create and delete files in, and a large file
+ *                  to read and one to write.
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int createFixtures()
+{
+  FilePath filePath;
+  DirectoryEntry* directory;
+  unsigned int numBytes;
+  unsigned int i;
+
+  // Find how far down mkfs's chain of directories goes.
+  strcpy(depthPaths[0], "/");
+  for (i = 1; i <= MAX_BENCH_DEPTH; i++)
+  {
+    snprintf(depthPaths[i], sizeof(depthPaths[i]), "%s%sD%07u",
+             depthPaths[i - 1], (i == 1 ? "" : "/"), i);
+    initFilePath(&filePath);
+    if (changeFilePath(&filePath, depthPaths[i], PATH_TYPE_DIRECTORY) != 0)
+      break;
+    maxDepth = i;
+  }
+
+  // Make the large directory, writing its entries all at once (none of them
+  // have any clusters).
+  largeDirectoryFlc = createEntry(0, "BENCHBIG", 1);
+  churnDirectoryFlc = createEntry(0, "BENCHTMP", 1);
+  readFileFlc = createEntry(0, "BENCHRD.DAT", 0);
+  writeFileFlc = createEntry(0, "BENCHWR.DAT", 0);
+  if (largeDirectoryFlc == 0 || churnDirectoryFlc == 0 || readFileFlc == 0 ||
+      writeFileFlc == 0)
+  {
+    printf("Error: not enough room on the disk image for the benchmarks\n");
+    return -1;
+  }
+
+  numBytes = (LARGE_DIRECTORY_ENTRIES + 3) * sizeof(DirectoryEntry);
+  directory = openDirectory(largeDirectoryFlc);
+  directory = (DirectoryEntry*) realloc(directory, numBytes);
+  memset(directory + 2, 0, numBytes - (2 * sizeof(DirectoryEntry)));
+  for (i = 0; i < LARGE_DIRECTORY_ENTRIES; i++)
+  {
+    char name[FAT12_MAX_FILE_NAME_LENGTH];
+    snprintf(name, sizeof(name), "E%07u.DAT", i);
+    setEntryName(&directory[i + 2], name);
+    directory[i + 2].attributes = DIR_ENTRY_ATTRIB_ARCHIVE;
+  }
+  if (writeFileContents(largeDirectoryFlc, (unsigned char*) directory,
+                        numBytes) != 0)
+  {
+    closeDirectory(directory);
+    return -1;
+  }
+  closeDirectory(directory);
+  largeDirectory = openDirectory(largeDirectoryFlc);
+
+  // Write the large files.
+  fileData = (unsigned char*) malloc(LARGE_FILE_SIZE);
+  for (i = 0; i < LARGE_FILE_SIZE; i++)
+    fileData[i] = (unsigned char) i;
+  if (writeFileContents(readFileFlc, fileData, LARGE_FILE_SIZE) != 0 ||
+      writeFileContents(writeFileFlc, fileData, LARGE_FILE_SIZE) != 0)
+  {
+    printf("Error: not enough room on the disk image for the benchmarks\n");
+    return -1;
+  }
+  readFileClusters = getFatEntryChainLength(readFileFlc);
+  return 0;
+}
+
+/******************************************************************************
+ * createEntry - create a file or directory in a directory, like touch and
+ *               mkdir do.
+ *
+ * Return - the new entry's first logical cluster, or 0 on failure
+ *****************************************************************************/
+static unsigned int createEntry(unsigned int parentFlc, const char* name,
+                                int isDirectory)
+{
+  DirectoryEntry* parentDir = openDirectory(parentFlc);
+  DirectoryEntry* directory;
+  unsigned int flc;
+  int index;
+
+  if (findEntryByName(parentDir, name) >= 0 ||
+      createNewEntry(parentFlc, &parentDir, name, &index) != 0)
+  {
+    closeDirectory(parentDir);
+    return 0;
+  }
+  flc = getEntryCluster(&parentDir[index]);
+
+  if (isDirectory)
+  {
+    parentDir[index].attributes = DIR_ENTRY_ATTRIB_SUBDIRECTORY;
+
+    // Create the '.' and '..' entries.
+    directory = openDirectory(flc);
+    memset(directory, 0, 3 * sizeof(DirectoryEntry));
+    memset(directory[0].name, ' ', sizeof(directory[0].name) +
+                                   sizeof(directory[0].extension));
+    directory[0].name[0] = '.';
+    directory[0].attributes = DIR_ENTRY_ATTRIB_SUBDIRECTORY;
+    setEntryCluster(&directory[0], flc);
+    memset(directory[1].name, ' ', sizeof(directory[1].name) +
+                                   sizeof(directory[1].extension));
+    directory[1].name[0] = '.';
+    directory[1].name[1] = '.';
+    directory[1].attributes = DIR_ENTRY_ATTRIB_SUBDIRECTORY;
+    setEntryCluster(&directory[1], parentFlc);
+    saveDirectory(flc, directory);
+    closeDirectory(directory);
+  }
+  else
+  {
+    parentDir[index].fileSize = LARGE_FILE_SIZE;
+  }
+
+  saveDirectory(parentFlc, parentDir);
+  closeDirectory(parentDir);
+  return flc;
+}
+
+/******************************************************************************
+ * getNanoseconds - get the time on the monotonic clock.
+ *****************************************************************************/
+static unsigned long long getNanoseconds()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec * 1000000000ULL) + now.tv_nsec;
+}
+
+/******************************************************************************
+ * randomBelow - get a random number from 0 to limit - 1 (xorshift64*). The
+ *               sequence is the same on every run.
+ *****************************************************************************/
+static unsigned int randomBelow(unsigned int limit)
+{
+  randomState ^= randomState >> 12;
+  randomState ^= randomState << 25;
+  randomState ^= randomState >> 27;
+  return (unsigned int) (((randomState * 0x2545F4914F6CDD1DULL) >> 32) %
+                         limit);
+}
+
+
+//-----------------------------------------------------------------------------
+// Benchmarks
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * benchMount - mount and unmount the image, as every command does.
+ *****************************************************************************/
+static int benchMount(int parameter, unsigned int op)
+{
+  if (initializeFatFileSystem(FAT_LOCK_SHARED) != 0)
+    return -1;
+  terminateFatFileSystem();
+  return 0;
+}
+
+/******************************************************************************
+ * benchForkExec - run the pwd command with fork() and execve().
+ *****************************************************************************/
+static int benchForkExec(int parameter, unsigned int op)
+{
+  int status;
+  pid_t pid;
+
+  pid = fork();
+  if (pid == 0)
+  {
+    int fd = open("/dev/null", O_WRONLY);
+    dup2(fd, STDOUT_FILENO);
+    execve(pathToPwd, pwdArguments, environ);
+    _exit(127);
+  }
+  if (pid == -1 || waitpid(pid, &status, 0) != pid ||
+      !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+  {
+    printf("Error: %s: could not be run\n", pathToPwd);
+    return -1;
+  }
+  return 0;
+}
+
+/******************************************************************************
+ * benchPosixSpawn - run the pwd command with posix_spawn().
+ *****************************************************************************/
+static int benchPosixSpawn(int parameter, unsigned int op)
+{
+  int status;
+  pid_t pid;
+
+  if (posix_spawn(&pid, pathToPwd, &pwdFileActions, NULL, pwdArguments,
+                  environ) != 0 || waitpid(pid, &status, 0) != pid ||
+      !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+  {
+    printf("Error: %s: could not be run\n", pathToPwd);
+    return -1;
+  }
+  return 0;
+}
+
+/******************************************************************************
+ * benchResolvePath - resolve an absolute path to a directory at a depth.
+ *****************************************************************************/
+static int benchResolvePath(int parameter, unsigned int op)
+{
+  FilePath filePath;
+
+  if ((unsigned int) parameter > maxDepth)
+  {
+    printf("Error: the image's directories are only %u deep (make it with "
+           "mkfs -D %d)\n", maxDepth, parameter);
+    return -1;
+  }
+
+  initFilePath(&filePath);
+  return changeFilePath(&filePath, depthPaths[parameter],
+                        PATH_TYPE_DIRECTORY);
+}
+
+/******************************************************************************
+ * benchFindEntry - look up a random name in the large directory.
+ *****************************************************************************/
+static int benchFindEntry(int parameter, unsigned int op)
+{
+  char name[FAT12_MAX_FILE_NAME_LENGTH];
+
+  snprintf(name, sizeof(name), "E%07u.DAT",
+           randomBelow(LARGE_DIRECTORY_ENTRIES));
+  return (findEntryByName(largeDirectory, name) >= 0 ? 0 : -1);
+}
+
+/******************************************************************************
+ * benchFindMissingEntry - look up a name that isn't in the large directory.
+ *****************************************************************************/
+static int benchFindMissingEntry(int parameter, unsigned int op)
+{
+  return (findEntryByName(largeDirectory, "MISSING.DAT") < 0 ? 0 : -1);
+}
+
+/******************************************************************************
+ * benchCreateDelete - create a file, then delete it, like touch and rm do.
+ *****************************************************************************/
+static int benchCreateDelete(int parameter, unsigned int op)
+{
+  DirectoryEntry* directory;
+  int index;
+
+  directory = openDirectory(churnDirectoryFlc);
+  if (findEntryByName(directory, "CHURN.DAT") >= 0 ||
+      createNewEntry(churnDirectoryFlc, &directory, "CHURN.DAT",
+                     &index) != 0)
+  {
+    closeDirectory(directory);
+    return -1;
+  }
+  saveDirectory(churnDirectoryFlc, directory);
+  closeDirectory(directory);
+
+  directory = openDirectory(churnDirectoryFlc);
+  index = findEntryByName(directory, "CHURN.DAT");
+  removeEntry(directory, index);
+  organizeDirectory(directory);
+  saveDirectory(churnDirectoryFlc, directory);
+  closeDirectory(directory);
+  return 0;
+}
+
+/******************************************************************************
+ * benchSequentialRead - read the whole of a large file.
+ *****************************************************************************/
+static int benchSequentialRead(int parameter, unsigned int op)
+{
+  unsigned char* data;
+  unsigned int numBytes;
+
+  if (readFileContents(readFileFlc, &data, &numBytes) != 0)
+    return -1;
+  free(data);
+  return 0;
+}
+
+/******************************************************************************
+ * benchRandomRead - read one sector from a random place in a large file,
+ *                   following its chain there.
+ *****************************************************************************/
+static int benchRandomRead(int parameter, unsigned int op)
+{
+  unsigned char sector[4096];
+  unsigned int cluster = readFileFlc;
+  unsigned int entryValue;
+  int entryType;
+  unsigned int i;
+
+  for (i = randomBelow(readFileClusters); i > 0; i--)
+  {
+    getFatEntry(cluster, &entryValue, &entryType);
+    if (entryType != FAT_ENTRY_TYPE_NEXT_SECTOR)
+      return -1;
+    cluster = entryValue;
+  }
+  return (read_sector(logicalToPhysicalCluster(cluster), sector) == -1 ?
+          -1 : 0);
+}
+
+/******************************************************************************
+ * benchLargeWrite - overwrite the whole of a large file.
+ *****************************************************************************/
+static int benchLargeWrite(int parameter, unsigned int op)
+{
+  return writeFileContents(writeFileFlc, fileData, LARGE_FILE_SIZE);
+}
+
+/******************************************************************************
+ * benchDf - count the used and total blocks, as df does.
+ *****************************************************************************/
+static int benchDf(int parameter, unsigned int op)
+{
+  unsigned int numUsedBlocks;
+  unsigned int totalBlocks;
+
+  getNumberOfUsedBlocks(&numUsedBlocks, &totalBlocks);
+  return 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Results
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * printResults - print a table of the results.
+ *****************************************************************************/
+static void printResults(FILE* stream)
+{
+  int i;
+
+  fprintf(stream, "%-24s%8s%11s%11s%11s%11s%11s%10s%10s\n", "Benchmark",
+          "Ops", "mean us", "p50 us", "p95 us", "p99 us", "max us",
+          "rd sec/op", "wr sec/op");
+  for (i = 0; i < numBenchmarks; i++)
+  {
+    Benchmark* benchmark = &benchmarks[i];
+    Histogram* histogram = &benchmark->opTime;
+    if (!benchmark->isRun)
+      continue;
+
+    fprintf(stream, "%-24s%8llu%11.3f%11.3f%11.3f%11.3f%11.3f%10.2f%10.2f\n",
+            benchmark->name, histogram->totalCount,
+            getHistogramMean(histogram) / 1000.0,
+            getHistogramPercentile(histogram, 50.0) / 1000.0,
+            getHistogramPercentile(histogram, 95.0) / 1000.0,
+            getHistogramPercentile(histogram, 99.0) / 1000.0,
+            histogram->maxValue / 1000.0,
+            (double) benchmark->sectorsRead / histogram->totalCount,
+            (double) benchmark->sectorsWritten / histogram->totalCount);
+  }
+  if (!FAT12_STATS_ENABLED)
+    fprintf(stream, "(sector counts are 0: statistics are compiled out)\n");
+}
+
+/******************************************************************************
+ * writeCsvResults - write the results as CSV, one line per benchmark.
+ *****************************************************************************/
+static void writeCsvResults(FILE* stream)
+{
+  int i;
+
+  fprintf(stream, "benchmark,ops,mean_us,p50_us,p95_us,p99_us,max_us,"
+          "sectors_read_per_op,sectors_written_per_op\n");
+  for (i = 0; i < numBenchmarks; i++)
+  {
+    Benchmark* benchmark = &benchmarks[i];
+    Histogram* histogram = &benchmark->opTime;
+    if (!benchmark->isRun)
+      continue;
+
+    fprintf(stream, "%s,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%.2f,%.2f\n",
+            benchmark->name, histogram->totalCount,
+            getHistogramMean(histogram) / 1000.0,
+            getHistogramPercentile(histogram, 50.0) / 1000.0,
+            getHistogramPercentile(histogram, 95.0) / 1000.0,
+            getHistogramPercentile(histogram, 99.0) / 1000.0,
+            histogram->maxValue / 1000.0,
+            (double) benchmark->sectorsRead / histogram->totalCount,
+            (double) benchmark->sectorsWritten / histogram->totalCount);
+  }
+}
+
+/******************************************************************************
+ * writeJsonResults - write the results as a JSON array.
+ *****************************************************************************/
+static void writeJsonResults(FILE* stream)
+{
+  const char* separator = "";
+  int i;
+
+  fprintf(stream, "[");
+  for (i = 0; i < numBenchmarks; i++)
+  {
+    Benchmark* benchmark = &benchmarks[i];
+    Histogram* histogram = &benchmark->opTime;
+    if (!benchmark->isRun)
+      continue;
+
+    fprintf(stream, "%s\n  {\"benchmark\": \"%s\", \"ops\": %llu, "
+            "\"mean_us\": %.3f, \"p50_us\": %.3f, \"p95_us\": %.3f, "
+            "\"p99_us\": %.3f, \"max_us\": %.3f, "
+            "\"sectors_read_per_op\": %.2f, "
+            "\"sectors_written_per_op\": %.2f}",
+            separator, benchmark->name, histogram->totalCount,
+            getHistogramMean(histogram) / 1000.0,
+            getHistogramPercentile(histogram, 50.0) / 1000.0,
+            getHistogramPercentile(histogram, 95.0) / 1000.0,
+            getHistogramPercentile(histogram, 99.0) / 1000.0,
+            histogram->maxValue / 1000.0,
+            (double) benchmark->sectorsRead / histogram->totalCount,
+            (double) benchmark->sectorsWritten / histogram->totalCount);
+    separator = ",";
+  }
+  fprintf(stream, "\n]\n");
+}
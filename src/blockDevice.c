@@ -0,0 +1,762 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function definitions for block devices.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#define _GNU_SOURCE // for fallocate()
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "blockDevice.h"
+#include "compressedImage.h"
+#include "directIo.h"
+#include "overlay.h"
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * The operations of each kind of block device (see BlockDeviceOps).
+ *****************************************************************************/
+static long long readStdio(BlockDevice* device, long long offset,
+                           unsigned int numBytes, unsigned char* buffer);
+static long long writeStdio(BlockDevice* device, long long offset,
+                            unsigned int numBytes, unsigned char* buffer);
+static int discardStdio(BlockDevice* device, long long offset,
+                        long long numBytes);
+static int flushStdio(BlockDevice* device, int isDurable);
+static void closeStdio(BlockDevice* device);
+
+static long long readPread(BlockDevice* device, long long offset,
+                           unsigned int numBytes, unsigned char* buffer);
+static long long writePread(BlockDevice* device, long long offset,
+                            unsigned int numBytes, unsigned char* buffer);
+static int discardFile(BlockDevice* device, long long offset,
+                       long long numBytes);
+static int flushPread(BlockDevice* device, int isDurable);
+
+static long long readMemory(BlockDevice* device, long long offset,
+                            unsigned int numBytes, unsigned char* buffer);
+static long long writeMemory(BlockDevice* device, long long offset,
+                             unsigned int numBytes, unsigned char* buffer);
+static int discardMemory(BlockDevice* device, long long offset,
+                         long long numBytes);
+static int flushMapping(BlockDevice* device, int isDurable);
+static int flushMemory(BlockDevice* device, int isDurable);
+static long long getMemorySize(BlockDevice* device);
+static void closeMemory(BlockDevice* device);
+
+static long long readDirect(BlockDevice* device, long long offset,
+                            unsigned int numBytes, unsigned char* buffer);
+static long long writeDirect(BlockDevice* device, long long offset,
+                             unsigned int numBytes, unsigned char* buffer);
+static void closeDirect(BlockDevice* device);
+
+static long long readOverlayDevice(BlockDevice* device, long long offset,
+                                   unsigned int numBytes,
+                                   unsigned char* buffer);
+static long long writeOverlayDevice(BlockDevice* device, long long offset,
+                                    unsigned int numBytes,
+                                    unsigned char* buffer);
+static int flushOverlayDevice(BlockDevice* device, int isDurable);
+static long long getOverlayDeviceSize(BlockDevice* device);
+static void closeOverlayDevice(BlockDevice* device);
+
+static long long readCompressed(BlockDevice* device, long long offset,
+                                unsigned int numBytes, unsigned char* buffer);
+static long long writeCompressed(BlockDevice* device, long long offset,
+                                 unsigned int numBytes,
+                                 unsigned char* buffer);
+static int flushCompressed(BlockDevice* device, int isDurable);
+static long long getCompressedSize(BlockDevice* device);
+static void closeCompressed(BlockDevice* device);
+
+static int discardByWriting(BlockDevice* device, long long offset,
+                            long long numBytes);
+static long long getFileSize(BlockDevice* device);
+static void closeNothing(BlockDevice* device);
+
+/******************************************************************************
+ * punchHole - Punch a hole in a file, giving its space back to the host.
+ *
+ * fd - the file
+ * offset - where the hole starts
+ * numBytes - the size of the hole
+ *
+ * Return - 0 on success, -1 if the file's file system can't (or failure)
+ *****************************************************************************/
+static int punchHole(int fd, long long offset, long long numBytes);
+
+/******************************************************************************
+ * mapBlockDevice - Map a whole file into memory for a device.
+ *
+ * device - the device, whose size is set
+ * fd - the file
+ * isWritable - 1 to map it for writing too, 0 for reading only
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int mapBlockDevice(BlockDevice* device, int fd, int isWritable);
+
+
+//-----------------------------------------------------------------------------
+// Variables
+//-----------------------------------------------------------------------------
+
+static const BlockDeviceOps blockDeviceOps[NUM_BLOCK_DEVICE_TYPES] =
+{
+  { "stdio", readStdio, writeStdio, discardStdio, flushStdio, getFileSize,
+    closeStdio },
+  { "pread", readPread, writePread, discardFile, flushPread, getFileSize,
+    closeNothing },
+  { "mmap", readMemory, writeMemory, discardFile, flushMapping,
+    getMemorySize, closeMemory },
+  { "memory", readMemory, writeMemory, discardMemory, flushMemory,
+    getMemorySize, closeMemory },
+  { "direct", readDirect, writeDirect, discardByWriting, flushPread,
+    getFileSize, closeDirect },
+  { "overlay", readOverlayDevice, writeOverlayDevice, discardByWriting,
+    flushOverlayDevice, getOverlayDeviceSize, closeOverlayDevice },
+  { "compressed", readCompressed, writeCompressed, discardByWriting,
+    flushCompressed, getCompressedSize, closeCompressed },
+};
+
+
+//-----------------------------------------------------------------------------
+// Block Device interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * getBlockDeviceType
+ *****************************************************************************/
+int getBlockDeviceType(const char* name)
+{
+  int type;
+
+  for (type = 0; type < NUM_BLOCK_DEVICE_TYPES; type++)
+  {
+    if (strcmp(name, blockDeviceOps[type].name) == 0)
+      return type;
+  }
+  return -1;
+}
+
+/******************************************************************************
+ * getBlockDeviceName
+ *****************************************************************************/
+const char* getBlockDeviceName(int type)
+{
+  return blockDeviceOps[type].name;
+}
+
+/******************************************************************************
+ * createMemoryImage
+ *****************************************************************************/
+int createMemoryImage(FILE* stream, const char* memoryName)
+{
+  BlockDevice image;
+  struct stat imageStat;
+  long long offset = 0;
+  ssize_t numRead;
+  int fd;
+  int rc = 0;
+
+  if (fstat(fileno(stream), &imageStat) != 0)
+    return -1;
+  fd = shm_open(memoryName, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd == -1)
+    return -1;
+  if (ftruncate(fd, imageStat.st_size) != 0 ||
+      mapBlockDevice(&image, fd, 1) != 0)
+  {
+    close(fd);
+    shm_unlink(memoryName);
+    return -1;
+  }
+  close(fd);
+
+  // Copy the whole image in.
+  while (offset < image.size)
+  {
+    numRead = pread(fileno(stream), image.data + offset, image.size - offset,
+                    offset);
+    if (numRead < 0 && errno == EINTR)
+      continue;
+    if (numRead <= 0)
+    {
+      rc = -1;
+      break;
+    }
+    offset += numRead;
+  }
+
+  munmap(image.data, image.size);
+  if (rc != 0)
+    shm_unlink(memoryName);
+  return rc;
+}
+
+/******************************************************************************
+ * destroyMemoryImage
+ *****************************************************************************/
+void destroyMemoryImage(const char* memoryName)
+{
+  shm_unlink(memoryName);
+}
+
+/******************************************************************************
+ * openBlockDevice
+ *****************************************************************************/
+BlockDevice* openBlockDevice(int type, FILE* stream, const char* fileName,
+                             const char* memoryName, int isWritable)
+{
+  BlockDevice* device = (BlockDevice*) calloc(1, sizeof(BlockDevice));
+  int rc = 0;
+  int fd;
+
+  // Writing to an image with a snapshot any other way would change the
+  // snapshot, and a compressed image can only be read through its chunks.
+  if (fileName != NULL && hasOverlay(fileName))
+    type = BLOCK_DEVICE_OVERLAY;
+  else if (stream != NULL && isCompressedImage(fileno(stream)))
+    type = BLOCK_DEVICE_COMPRESSED;
+
+  device->ops = &blockDeviceOps[type];
+  device->type = type;
+  device->stream = stream;
+  device->fd = -1;
+  pthread_mutex_init(&device->mutex, NULL);
+
+  switch (type)
+  {
+    case BLOCK_DEVICE_STDIO:
+    case BLOCK_DEVICE_PREAD:
+      device->fd = fileno(stream);
+      break;
+    case BLOCK_DEVICE_MMAP:
+      rc = mapBlockDevice(device, fileno(stream), isWritable);
+      break;
+    case BLOCK_DEVICE_MEMORY:
+      fd = shm_open(memoryName, (isWritable ? O_RDWR : O_RDONLY), 0);
+      rc = (fd == -1 ? -1 : mapBlockDevice(device, fd, isWritable));
+      if (fd != -1)
+        close(fd);
+      break;
+    case BLOCK_DEVICE_DIRECT:
+      rc = openDirectIo(fileName, isWritable);
+      break;
+    case BLOCK_DEVICE_OVERLAY:
+      device->overlay = openOverlay(fileName, fileno(stream), isWritable);
+      rc = (device->overlay == NULL ? -1 : 0);
+      break;
+    case BLOCK_DEVICE_COMPRESSED:
+      device->compressedImage = openCompressedImage(fileno(stream),
+                                                    isWritable);
+      rc = (device->compressedImage == NULL ? -1 : 0);
+      break;
+  }
+
+  if (rc != 0)
+  {
+    pthread_mutex_destroy(&device->mutex);
+    free(device);
+    return NULL;
+  }
+  device->size = device->ops->getSize(device);
+  return device;
+}
+
+/******************************************************************************
+ * closeBlockDevice
+ *****************************************************************************/
+void closeBlockDevice(BlockDevice* device)
+{
+  if (device == NULL)
+    return;
+  device->ops->close(device);
+  pthread_mutex_destroy(&device->mutex);
+  free(device);
+}
+
+/******************************************************************************
+ * readBlockDevice
+ *****************************************************************************/
+long long readBlockDevice(BlockDevice* device, long long offset,
+                          unsigned int numBytes, unsigned char* buffer)
+{
+  return device->ops->read(device, offset, numBytes, buffer);
+}
+
+/******************************************************************************
+ * writeBlockDevice
+ *****************************************************************************/
+long long writeBlockDevice(BlockDevice* device, long long offset,
+                           unsigned int numBytes, unsigned char* buffer)
+{
+  return device->ops->write(device, offset, numBytes, buffer);
+}
+
+/******************************************************************************
+ * discardBlockDevice
+ *****************************************************************************/
+int discardBlockDevice(BlockDevice* device, long long offset,
+                       long long numBytes)
+{
+  if (offset < 0 || numBytes < 0 || offset + numBytes > device->size)
+    return -1;
+  if (numBytes == 0)
+    return 0;
+  return device->ops->discard(device, offset, numBytes);
+}
+
+/******************************************************************************
+ * flushBlockDevice
+ *****************************************************************************/
+int flushBlockDevice(BlockDevice* device, int isDurable)
+{
+  return device->ops->flush(device, isDurable);
+}
+
+/******************************************************************************
+ * getBlockDeviceSize
+ *****************************************************************************/
+long long getBlockDeviceSize(BlockDevice* device)
+{
+  return device->ops->getSize(device);
+}
+
+
+//-----------------------------------------------------------------------------
+// Internal Functions
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * readStdio
+ *****************************************************************************/
+static long long readStdio(BlockDevice* device, long long offset,
+                           unsigned int numBytes, unsigned char* buffer)
+{
+  long long numRead;
+
+  // Seeking and reading must happen together, even when several threads
+  // share the device (such as in fsck).
+  pthread_mutex_lock(&device->mutex);
+  if (fseeko(device->stream, offset, SEEK_SET) != 0)
+    numRead = -1;
+  else
+    numRead = fread(buffer, sizeof(char), numBytes, device->stream);
+  pthread_mutex_unlock(&device->mutex);
+  return numRead;
+}
+
+/******************************************************************************
+ * writeStdio
+ *****************************************************************************/
+static long long writeStdio(BlockDevice* device, long long offset,
+                            unsigned int numBytes, unsigned char* buffer)
+{
+  long long numWritten;
+
+  pthread_mutex_lock(&device->mutex);
+  if (fseeko(device->stream, offset, SEEK_SET) != 0)
+    numWritten = -1;
+  else
+    numWritten = fwrite(buffer, sizeof(char), numBytes, device->stream);
+  pthread_mutex_unlock(&device->mutex);
+  return numWritten;
+}
+
+/******************************************************************************
+ * discardStdio
+ *****************************************************************************/
+static int discardStdio(BlockDevice* device, long long offset,
+                        long long numBytes)
+{
+  int rc;
+
+  // Write out the stream's buffer first, so it can't write the old bytes
+  // back over the hole, and forget what it read ahead.
+  pthread_mutex_lock(&device->mutex);
+  rc = fflush(device->stream);
+  pthread_mutex_unlock(&device->mutex);
+  if (rc != 0)
+    return -1;
+  return discardFile(device, offset, numBytes);
+}
+
+/******************************************************************************
+ * flushStdio
+ *****************************************************************************/
+static int flushStdio(BlockDevice* device, int isDurable)
+{
+  int rc;
+
+  pthread_mutex_lock(&device->mutex);
+  rc = fflush(device->stream);
+  pthread_mutex_unlock(&device->mutex);
+  if (rc == 0 && isDurable)
+    rc = fsync(fileno(device->stream));
+  return (rc == 0 ? 0 : -1);
+}
+
+/******************************************************************************
+ * closeStdio
+ *****************************************************************************/
+static void closeStdio(BlockDevice* device)
+{
+  fflush(device->stream);
+}
+
+/******************************************************************************
+ * readPread
+ *****************************************************************************/
+static long long readPread(BlockDevice* device, long long offset,
+                           unsigned int numBytes, unsigned char* buffer)
+{
+  unsigned int numRead = 0;
+  ssize_t numTransferred;
+
+  // Stop short only at the end of the image.
+  while (numRead < numBytes)
+  {
+    numTransferred = pread(device->fd, buffer + numRead, numBytes - numRead,
+                           offset + numRead);
+    if (numTransferred < 0 && errno == EINTR)
+      continue;
+    if (numTransferred < 0)
+      return -1;
+    if (numTransferred == 0)
+      break;
+    numRead += numTransferred;
+  }
+  return numRead;
+}
+
+/******************************************************************************
+ * writePread
+ *****************************************************************************/
+static long long writePread(BlockDevice* device, long long offset,
+                            unsigned int numBytes, unsigned char* buffer)
+{
+  unsigned int numWritten = 0;
+  ssize_t numTransferred;
+
+  while (numWritten < numBytes)
+  {
+    numTransferred = pwrite(device->fd, buffer + numWritten,
+                            numBytes - numWritten, offset + numWritten);
+    if (numTransferred < 0 && errno == EINTR)
+      continue;
+    if (numTransferred <= 0)
+      return -1;
+    numWritten += numTransferred;
+  }
+  return numWritten;
+}
+
+/******************************************************************************
+ * discardFile
+ *****************************************************************************/
+static int discardFile(BlockDevice* device, long long offset,
+                       long long numBytes)
+{
+  // A mapping of the image sees the hole as soon as it is punched.
+  if (punchHole(fileno(device->stream), offset, numBytes) == 0)
+    return 0;
+  return discardByWriting(device, offset, numBytes);
+}
+
+/******************************************************************************
+ * flushPread
+ *****************************************************************************/
+static int flushPread(BlockDevice* device, int isDurable)
+{
+  // Nothing is buffered, so there is only the kernel's copy to make durable.
+  if (isDurable && fsync(fileno(device->stream)) != 0)
+    return -1;
+  return 0;
+}
+
+/******************************************************************************
+ * readMemory
+ *****************************************************************************/
+static long long readMemory(BlockDevice* device, long long offset,
+                            unsigned int numBytes, unsigned char* buffer)
+{
+  if (offset < 0)
+    return -1;
+  if (offset >= device->size)
+    return 0;
+  if (offset + numBytes > device->size)
+    numBytes = device->size - offset;
+  memcpy(buffer, device->data + offset, numBytes);
+  return numBytes;
+}
+
+/******************************************************************************
+ * writeMemory
+ *****************************************************************************/
+static long long writeMemory(BlockDevice* device, long long offset,
+                             unsigned int numBytes, unsigned char* buffer)
+{
+  // The image can't grow.
+  if (offset < 0 || offset + numBytes > device->size)
+    return -1;
+  memcpy(device->data + offset, buffer, numBytes);
+  return numBytes;
+}
+
+/******************************************************************************
+ * discardMemory
+ *****************************************************************************/
+static int discardMemory(BlockDevice* device, long long offset,
+                         long long numBytes)
+{
+  memset(device->data + offset, 0, numBytes);
+  return 0;
+}
+
+/******************************************************************************
+ * flushMapping
+ *****************************************************************************/
+static int flushMapping(BlockDevice* device, int isDurable)
+{
+  // The mapping is the kernel's copy of the image, so it only needs writing
+  // out to be durable.
+  if (isDurable && msync(device->data, device->size, MS_SYNC) != 0)
+    return -1;
+  return 0;
+}
+
+/******************************************************************************
+ * flushMemory
+ *****************************************************************************/
+static int flushMemory(BlockDevice* device, int isDurable)
+{
+  // A copy in memory is never written back.
+  return 0;
+}
+
+/******************************************************************************
+ * getMemorySize
+ *****************************************************************************/
+static long long getMemorySize(BlockDevice* device)
+{
+  return device->size;
+}
+
+/******************************************************************************
+ * closeMemory
+ *****************************************************************************/
+static void closeMemory(BlockDevice* device)
+{
+  munmap(device->data, device->size);
+}
+
+/******************************************************************************
+ * readDirect
+ *****************************************************************************/
+static long long readDirect(BlockDevice* device, long long offset,
+                            unsigned int numBytes, unsigned char* buffer)
+{
+  return readDirectIo(offset, numBytes, buffer);
+}
+
+/******************************************************************************
+ * writeDirect
+ *****************************************************************************/
+static long long writeDirect(BlockDevice* device, long long offset,
+                             unsigned int numBytes, unsigned char* buffer)
+{
+  return writeDirectIo(offset, numBytes, buffer);
+}
+
+/******************************************************************************
+ * closeDirect
+ *****************************************************************************/
+static void closeDirect(BlockDevice* device)
+{
+  closeDirectIo();
+}
+
+/******************************************************************************
+ * readOverlayDevice
+ *****************************************************************************/
+static long long readOverlayDevice(BlockDevice* device, long long offset,
+                                   unsigned int numBytes,
+                                   unsigned char* buffer)
+{
+  return readOverlay(device->overlay, offset, numBytes, buffer);
+}
+
+/******************************************************************************
+ * writeOverlayDevice
+ *****************************************************************************/
+static long long writeOverlayDevice(BlockDevice* device, long long offset,
+                                    unsigned int numBytes,
+                                    unsigned char* buffer)
+{
+  return writeOverlay(device->overlay, offset, numBytes, buffer);
+}
+
+/******************************************************************************
+ * flushOverlayDevice
+ *****************************************************************************/
+static int flushOverlayDevice(BlockDevice* device, int isDurable)
+{
+  // Nothing is buffered, as for pread.
+  if (isDurable)
+    return flushOverlay(device->overlay);
+  return 0;
+}
+
+/******************************************************************************
+ * getOverlayDeviceSize
+ *****************************************************************************/
+static long long getOverlayDeviceSize(BlockDevice* device)
+{
+  return getOverlaySize(device->overlay);
+}
+
+/******************************************************************************
+ * closeOverlayDevice
+ *****************************************************************************/
+static void closeOverlayDevice(BlockDevice* device)
+{
+  closeOverlay(device->overlay);
+}
+
+/******************************************************************************
+ * readCompressed
+ *****************************************************************************/
+static long long readCompressed(BlockDevice* device, long long offset,
+                                unsigned int numBytes, unsigned char* buffer)
+{
+  return readCompressedImage(device->compressedImage, offset, numBytes,
+                             buffer);
+}
+
+/******************************************************************************
+ * writeCompressed
+ *****************************************************************************/
+static long long writeCompressed(BlockDevice* device, long long offset,
+                                 unsigned int numBytes,
+                                 unsigned char* buffer)
+{
+  return writeCompressedImage(device->compressedImage, offset, numBytes,
+                              buffer);
+}
+
+/******************************************************************************
+ * flushCompressed
+ *****************************************************************************/
+static int flushCompressed(BlockDevice* device, int isDurable)
+{
+  // Chunks are written as soon as they change, as for pread.
+  if (isDurable)
+    return flushCompressedImage(device->compressedImage);
+  return 0;
+}
+
+/******************************************************************************
+ * getCompressedSize
+ *****************************************************************************/
+static long long getCompressedSize(BlockDevice* device)
+{
+  return getCompressedImageSize(device->compressedImage);
+}
+
+/******************************************************************************
+ * closeCompressed
+ *****************************************************************************/
+static void closeCompressed(BlockDevice* device)
+{
+  closeCompressedImage(device->compressedImage);
+}
+
+/******************************************************************************
+ * discardByWriting
+ *****************************************************************************/
+static int discardByWriting(BlockDevice* device, long long offset,
+                            long long numBytes)
+{
+  static const unsigned int pieceSize = 64 * 1024;
+  unsigned char* zeros = (unsigned char*) calloc(1, pieceSize);
+  unsigned int numPieceBytes;
+  int rc = 0;
+
+  // Devices that can't punch holes still store zeros compactly: a
+  // compressed image keeps a chunk of zeros as nothing at all.
+  while (rc == 0 && numBytes > 0)
+  {
+    numPieceBytes = (numBytes < pieceSize ? numBytes : pieceSize);
+    if (device->ops->write(device, offset, numPieceBytes, zeros) !=
+        numPieceBytes)
+      rc = -1;
+    offset += numPieceBytes;
+    numBytes -= numPieceBytes;
+  }
+  free(zeros);
+  return rc;
+}
+
+/******************************************************************************
+ * getFileSize
+ *****************************************************************************/
+static long long getFileSize(BlockDevice* device)
+{
+  struct stat imageStat;
+
+  if (fstat(fileno(device->stream), &imageStat) != 0)
+    return -1;
+  return imageStat.st_size;
+}
+
+/******************************************************************************
+ * closeNothing
+ *****************************************************************************/
+static void closeNothing(BlockDevice* device)
+{
+}
+
+/******************************************************************************
+ * mapBlockDevice
+ *****************************************************************************/
+static int mapBlockDevice(BlockDevice* device, int fd, int isWritable)
+{
+  struct stat imageStat;
+  void* data;
+
+  if (fstat(fd, &imageStat) != 0 || imageStat.st_size == 0)
+    return -1;
+  data = mmap(NULL, imageStat.st_size,
+              PROT_READ | (isWritable ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED)
+    return -1;
+  device->data = (unsigned char*) data;
+  device->size = imageStat.st_size;
+  return 0;
+}
+
+/******************************************************************************
+ * punchHole
+ *****************************************************************************/
+static int punchHole(int fd, long long offset, long long numBytes)
+{
+  if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset,
+                numBytes) != 0)
+    return -1;
+  return 0;
+}
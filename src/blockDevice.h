@@ -0,0 +1,242 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function headers for block devices, through which all sector
+ *              I/O on a disk image goes. A block device is a table of
+ *              operations (read, write, discard, flush and getSize) plus the
+ *              state of one open image, so the same file system code can run
+ *              over any of these:
+ *
+ *                stdio  - fseek() and fread() or fwrite() on the image's
+ *                         stream (the default)
+ *                pread  - pread() and pwrite() on the image's descriptor,
+ *                         with no buffering of our own
+ *                mmap   - the whole image mapped into memory, so sectors are
+ *                         read and written with memcpy()
+ *                memory - a copy of the image in the session's memory,
+ *                         made when the session starts; changes are never
+ *                         written back to the image, so this is for
+ *                         benchmarks and experiments
+ *                direct - O_DIRECT, through a cache of aligned blocks (see
+ *                         directIo.h)
+ *                compressed - the image inside a compressed image (see
+ *                             compressedImage.h)
+ *
+ *              The device is picked for the whole session by the shell (see
+ *              the FAT12_BLOCK_DEVICE environment variable in Readme.txt),
+ *              or by bench with -d, and each command opens one when it
+ *              mounts the image. Images with a snapshot (see overlay.h) and
+ *              compressed images are always opened as overlay and
+ *              compressed devices.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#ifndef _BLOCK_DEVICE_H_
+#define _BLOCK_DEVICE_H_
+
+#include <pthread.h>
+#include <stdio.h>
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+
+// The environment variable naming the block device to use for a session.
+#define FAT12_BLOCK_DEVICE_ENV_VAR "FAT12_BLOCK_DEVICE"
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * BlockDeviceType - the kinds of block device.
+ *****************************************************************************/
+typedef enum
+{
+  BLOCK_DEVICE_STDIO = 0,
+  BLOCK_DEVICE_PREAD,
+  BLOCK_DEVICE_MMAP,
+  BLOCK_DEVICE_MEMORY,
+  BLOCK_DEVICE_DIRECT,
+  BLOCK_DEVICE_OVERLAY,
+  BLOCK_DEVICE_COMPRESSED,
+  NUM_BLOCK_DEVICE_TYPES
+} BlockDeviceType;
+
+typedef struct BlockDevice BlockDevice;
+
+/******************************************************************************
+ * BlockDeviceOps - the operations of one kind of block device. Offsets and
+ *                  sizes are in bytes, and needn't be whole sectors.
+ *****************************************************************************/
+typedef struct
+{
+  const char* name;
+  long long   (*read)(BlockDevice* device, long long offset,
+                      unsigned int numBytes, unsigned char* buffer);
+  long long   (*write)(BlockDevice* device, long long offset,
+                       unsigned int numBytes, unsigned char* buffer);
+  int         (*discard)(BlockDevice* device, long long offset,
+                         long long numBytes);
+  int         (*flush)(BlockDevice* device, int isDurable);
+  long long   (*getSize)(BlockDevice* device);
+  void        (*close)(BlockDevice* device);
+} BlockDeviceOps;
+
+/******************************************************************************
+ * BlockDevice - an open block device.
+ *****************************************************************************/
+struct BlockDevice
+{
+  const BlockDeviceOps*   ops;
+  BlockDeviceType         type;
+  FILE*                   stream; // the image's stream (not owned)
+  int                     fd; // a descriptor that reads and writes can go
+                              // straight to (as asyncIo.c does), or -1
+  unsigned char*          data; // the whole image, if it is in memory
+  struct Overlay*         overlay; // the image's delta, for an overlay
+  struct CompressedImage* compressedImage; // for a compressed image
+  long long               size; // in bytes
+  pthread_mutex_t         mutex; // guards the stream's position
+};
+
+
+//-----------------------------------------------------------------------------
+// Block Device interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * getBlockDeviceType - Look up a kind of block device by name.
+ *
+ * name - the name, such as "pread"
+ *
+ * Return - the type, or -1 if there is no such kind
+ *****************************************************************************/
+int getBlockDeviceType(const char* name);
+
+/******************************************************************************
+ * getBlockDeviceName - Get the name of a kind of block device.
+ *
+ * type - the type
+ *
+ * Return - the name, such as "pread"
+ *****************************************************************************/
+const char* getBlockDeviceName(int type);
+
+/******************************************************************************
+ * createMemoryImage - Copy a disk image into a shared memory segment, for
+ *                     memory block devices to use.
+ *
+ * stream - the image's stream
+ * memoryName - the name to give the segment
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+int createMemoryImage(FILE* stream, const char* memoryName);
+
+/******************************************************************************
+ * destroyMemoryImage - Remove a shared memory segment made by
+ *                      createMemoryImage().
+ *
+ * memoryName - the segment's name
+ *
+ * Return - none
+ *****************************************************************************/
+void destroyMemoryImage(const char* memoryName);
+
+/******************************************************************************
+ * openBlockDevice - Open a block device over a disk image.
+ *
+ * type - the kind of block device, ignored if the image has a snapshot or
+ *        is compressed
+ * stream - the image's stream, which must stay open until the device is
+ *          closed
+ * fileName - the image's host path name
+ * memoryName - the shared memory segment holding the image, for a memory
+ *              device
+ * isWritable - 1 to open it for writing too, 0 for reading only
+ *
+ * Return - the device, or NULL on failure
+ *****************************************************************************/
+BlockDevice* openBlockDevice(int type, FILE* stream, const char* fileName,
+                             const char* memoryName, int isWritable);
+
+/******************************************************************************
+ * closeBlockDevice - Close a block device, after writing out anything it
+ *                    buffered.
+ *
+ * device - the device, or NULL
+ *
+ * Return - none
+ *****************************************************************************/
+void closeBlockDevice(BlockDevice* device);
+
+/******************************************************************************
+ * readBlockDevice - Read consecutive bytes of a block device.
+ *
+ * device - the device
+ * offset - where to start reading
+ * numBytes - the number of bytes to read
+ * buffer - where to store them
+ *
+ * Return - the number of bytes read (fewer at the end of the device), or -1
+ *          on failure
+ *****************************************************************************/
+long long readBlockDevice(BlockDevice* device, long long offset,
+                          unsigned int numBytes, unsigned char* buffer);
+
+/******************************************************************************
+ * writeBlockDevice - Write consecutive bytes to a block device.
+ *
+ * device - the device
+ * offset - where to start writing
+ * numBytes - the number of bytes to write
+ * buffer - the bytes
+ *
+ * Return - the number of bytes written, or -1 on failure
+ *****************************************************************************/
+long long writeBlockDevice(BlockDevice* device, long long offset,
+                           unsigned int numBytes, unsigned char* buffer);
+
+/******************************************************************************
+ * discardBlockDevice - Throw away consecutive bytes of a block device, which
+ *                      read as zeros from then on. An image on the host gets
+ *                      a hole punched in it, so the space is given back;
+ *                      where that can't be done, zeros are written instead.
+ *
+ * device - the device
+ * offset - where to start
+ * numBytes - the number of bytes to discard
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+int discardBlockDevice(BlockDevice* device, long long offset,
+                       long long numBytes);
+
+/******************************************************************************
+ * flushBlockDevice - Write out anything a block device has buffered, and
+ *                    forget anything it read ahead, so the image can be read
+ *                    or written some other way.
+ *
+ * device - the device
+ * isDurable - 1 to also wait for the image to reach stable storage
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+int flushBlockDevice(BlockDevice* device, int isDurable);
+
+/******************************************************************************
+ * getBlockDeviceSize - Get the size of a block device.
+ *
+ * device - the device
+ *
+ * Return - the size in bytes
+ *****************************************************************************/
+long long getBlockDeviceSize(BlockDevice* device);
+
+
+#endif //_BLOCK_DEVICE_H_
@@ -19,11 +19,23 @@
 
 #include "fat.h"
 
+// How much of the file to read from the image at a time. The image is only
+// locked while reading a batch, not while writing it out, so that a command
+// reading from the other end of a pipe can lock the image too. The next
+// batch is read ahead while writing out the last one.
+#define CAT_BATCH_SIZE 65536
+
+static int openCatFile(const char* pathName, unsigned int offset,
+                       unsigned int* cluster, unsigned int* fileSize);
+static unsigned int startCatBatch(unsigned int* cluster, unsigned int offset,
+                                  unsigned int fileSize,
+                                  unsigned char* buffer, SectorRun* runs);
+static unsigned int readCatBatch(unsigned int* cluster, unsigned int offset,
+                                 unsigned int fileSize, unsigned char* buffer,
+                                 SectorRun* runs);
+
 int main(int argc, char* argv[])
 {
-  if (initializeFatFileSystem() != 0)
-    return -1;
-  
   // Validate the number of arguments.
   if (argc > 2)
   {
@@ -32,48 +44,192 @@ int main(int argc, char* argv[])
   }
   else if (argc == 1)
   {
-  	printf("Error: Too little arguments. cat requires 1 argument.\n");
-  	return -1;
+    printf("Error: Too little arguments. cat requires 1 argument.\n");
+    return -1;
   }
-  else if (argc == 2)
-  {  
-  	// Load the working directory.
-		FilePath dirPath;
-		getWorkingDirectory(&dirPath);	
-		
-		//Make a new path to the requested file
-  	FilePath newPath;
-  	char* path = argv[1];
-  	
-  	//If it's a relative path, add the user's input to the current path
-  	if (argv[1][0] != '/')
-  	{
-			path = (char*) malloc(sizeof(dirPath.pathName) + sizeof(argv[1]));
-			strcpy(path, dirPath.pathName);
-			if(dirPath.depthLevel != 1)
-			{				
-			  strcat(path, "/");
-			  
-			}
-			strcat(path, argv[1]);		
-		}
-		
-  	//Change to the new path
-  	changeFilePath(&newPath, path, PATH_TYPE_FILE);
-  		
-  	//Get the first logical cluster of this file
-  	unsigned short flc = newPath.dirLevels[newPath.depthLevel - 1].firstLogicalCluster;  
-  		
-  	//Print out the file contents if there are any
-		unsigned char* output;
-		unsigned int numBytes;
-		if (readFileContents(flc, &output, &numBytes) == 0)
-		{
-			printf("%s\n", output);
-			return 0;
-		}
-		
-  	printf("Error: File not found.\n");
-  	return -1;
-	}
+  
+  if (initializeFatFileSystem(FAT_LOCK_SHARED) != 0)
+    return -1;
+  
+  unsigned int cluster;
+  unsigned int fileSize;
+  if (openCatFile(argv[1], 0, &cluster, &fileSize) != 0)
+  {
+    terminateFatFileSystem();
+    return -1;
+  }
+  
+  // Two batches: the one being written out, and the one being read ahead.
+  // A batch holds whole clusters, which may be bigger than CAT_BATCH_SIZE.
+  unsigned int bytesPerCluster = fatFileSystem.geometry.bytesPerCluster;
+  unsigned int maxClusters = (CAT_BATCH_SIZE + bytesPerCluster - 1) /
+                             bytesPerCluster;
+  unsigned char* buffers[2];
+  buffers[0] = (unsigned char*) malloc(maxClusters * bytesPerCluster);
+  buffers[1] = (unsigned char*) malloc(maxClusters * bytesPerCluster);
+  SectorRun* runs = (SectorRun*) malloc(maxClusters * sizeof(SectorRun));
+  int current = 0;
+  unsigned int offset = 0;
+  unsigned int numBytes = 0;
+  unsigned int nextNumBytes;
+  unsigned int generation, flushedGeneration;
+  int isReadingAhead, isWritten;
+  int isNewLineNeeded = 0;
+  int rc = 0;
+  
+  if (fileSize > 0)
+    numBytes = readCatBatch(&cluster, offset, fileSize, buffers[current],
+                            runs);
+  
+  // Copy the file out a batch at a time.
+  while (offset < fileSize)
+  {
+    if (numBytes == 0)
+    {
+      rc = -1;
+      break;
+    }
+    unsigned char* buffer = buffers[current];
+    offset += numBytes;
+    
+    // Start reading the next batch into the other buffer. Sectors still in
+    // the journal are only looked up once the reads finish, and by then the
+    // journal could have been checkpointed, so there is no read ahead while
+    // it has anything in it.
+    nextNumBytes = 0;
+    isReadingAhead = (offset < fileSize &&
+                      fatFileSystem.session->journal.numTransactions == 0);
+    if (isReadingAhead)
+      nextNumBytes = startCatBatch(&cluster, offset, fileSize,
+                                   buffers[!current], runs);
+    
+    // Write the batch without holding the lock.
+    getFatSessionGenerations(&generation, &flushedGeneration);
+    unlockFatFileSystem();
+    isWritten = (fwrite(buffer, 1, numBytes, stdout) == numBytes &&
+                 fflush(stdout) == 0);
+    if (isReadingAhead && finishReadingSectorRuns() != 0)
+      nextNumBytes = 0;
+    if (!isWritten || lockFatFileSystem(FAT_LOCK_SHARED) != 0)
+    {
+      rc = -1;
+      break;
+    }
+    isNewLineNeeded = (buffer[numBytes - 1] != '\n');
+    
+    // If the image changed in the meantime, what was read ahead may be out
+    // of date, so find our place in the file again and read it over.
+    if (offset < fileSize)
+    {
+      unsigned int newGeneration;
+      getFatSessionGenerations(&newGeneration, &flushedGeneration);
+      if (newGeneration != generation)
+      {
+        if (openCatFile(argv[1], offset, &cluster, &fileSize) != 0)
+        {
+          rc = -1;
+          break;
+        }
+        isReadingAhead = 0;
+      }
+      if (!isReadingAhead && offset < fileSize)
+        nextNumBytes = readCatBatch(&cluster, offset, fileSize,
+                                    buffers[!current], runs);
+    }
+    numBytes = nextNumBytes;
+    current = !current;
+  }
+  
+  // Keep the prompt on its own line when printing text to the terminal.
+  if (isNewLineNeeded && isatty(STDOUT_FILENO))
+    printf("\n");
+  
+  free(runs);
+  free(buffers[0]);
+  free(buffers[1]);
+  terminateFatFileSystem();
+  return rc;
+}
+
+/******************************************************************************
+ * openCatFile - Locate a file, and the cluster holding the given offset in it
+ *****************************************************************************/
+static int openCatFile(const char* pathName, unsigned int offset,
+                       unsigned int* cluster, unsigned int* fileSize)
+{
+  FilePath filePath;
+  unsigned int entryValue;
+  int entryType;
+  unsigned int i;
+  
+  getWorkingDirectory(&filePath);
+  if (changeFilePath(&filePath, pathName, PATH_TYPE_FILE) != 0)
+    return -1;
+  
+  // Get the file's size from its entry in the parent directory.
+  DirectoryLevel* fileLevel = &filePath.dirLevels[filePath.depthLevel - 1];
+  DirectoryEntry* parentDir = openDirectory(
+    filePath.dirLevels[filePath.depthLevel - 2].firstLogicalCluster);
+  if (parentDir == NULL)
+    return -1;
+  *fileSize = parentDir[fileLevel->indexInParentDirectory].fileSize;
+  closeDirectory(parentDir);
+  
+  // Follow the chain to the cluster holding the offset.
+  *cluster = fileLevel->firstLogicalCluster;
+  for (i = 0; i < offset / fatFileSystem.geometry.bytesPerCluster; i++)
+  {
+    getFatEntry(*cluster, &entryValue, &entryType);
+    if (entryType != FAT_ENTRY_TYPE_NEXT_SECTOR)
+    {
+      *fileSize = offset;
+      break;
+    }
+    *cluster = entryValue;
+  }
+  return 0;
+}
+
+/******************************************************************************
+ * startCatBatch - Start reading the next batch of a file, from the given
+ *                 offset and cluster, with every run of consecutive clusters
+ *                 in flight at once, and advance cluster past them. Returns
+ *                 the number of bytes being read, which is less than a whole
+ *                 batch at the end of the file or if the chain ends early.
+ *                 The reads must be finished with finishReadingSectorRuns().
+ *****************************************************************************/
+static unsigned int startCatBatch(unsigned int* cluster, unsigned int offset,
+                                  unsigned int fileSize,
+                                  unsigned char* buffer, SectorRun* runs)
+{
+  unsigned int bytesPerCluster = fatFileSystem.geometry.bytesPerCluster;
+  unsigned int numBytes = fileSize - offset;
+  unsigned int numClusters;
+  unsigned int numRuns;
+  
+  if (numBytes > CAT_BATCH_SIZE)
+    numBytes = CAT_BATCH_SIZE;
+  numRuns = getClusterRuns(cluster, (numBytes + bytesPerCluster - 1) /
+                           bytesPerCluster, buffer, runs, &numClusters);
+  startReadingSectorRuns(runs, numRuns);
+  
+  if (numClusters * bytesPerCluster < numBytes)
+    numBytes = numClusters * bytesPerCluster;
+  return numBytes;
+}
+
+/******************************************************************************
+ * readCatBatch - Read the next batch of a file, like startCatBatch(), but
+ *                waiting for it. Returns 0 if it couldn't be read.
+ *****************************************************************************/
+static unsigned int readCatBatch(unsigned int* cluster, unsigned int offset,
+                                 unsigned int fileSize, unsigned char* buffer,
+                                 SectorRun* runs)
+{
+  unsigned int numBytes = startCatBatch(cluster, offset, fileSize, buffer,
+                                        runs);
+  
+  if (finishReadingSectorRuns() != 0)
+    return 0;
+  return numBytes;
 }
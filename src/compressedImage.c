@@ -0,0 +1,733 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function definitions for compressed images.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "compressedImage.h"
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+
+// Space is set aside for chunks in whole sectors, so a chunk that grows a
+// little when it is written again usually still fits.
+#define COMPRESSED_IMAGE_SECTOR_SIZE 512
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * CachedChunk - a chunk kept decompressed.
+ *****************************************************************************/
+typedef struct
+{
+  unsigned long long chunk;
+  unsigned int       generation; // of the chunk when it was decompressed
+  unsigned long long lastUsed;
+  unsigned char*     data; // or NULL if the entry is empty
+} CachedChunk;
+
+/******************************************************************************
+ * CompressedImage - an open compressed image.
+ *****************************************************************************/
+struct CompressedImage
+{
+  int                    fd; // not owned
+  int                    isWritable;
+  unsigned char*         mapping; // the header and index, shared with the file
+  CompressedImageHeader* header; // within mapping
+  CompressedChunk*       index; // within mapping
+  pthread_rwlock_t       lock; // held to read chunks, and alone to write them
+  pthread_mutex_t        cacheMutex;
+  CachedChunk*           cache;
+  unsigned int           numCachedChunks;
+  unsigned long long     clock; // counts uses of the cache, for lastUsed
+  unsigned char*         compressedData; // for writing a chunk
+};
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * getChunkLength - Get the number of bytes of the image in a chunk, which is
+ *                  the chunk size for all but the last one.
+ *
+ * image - the container
+ * chunk - the chunk number
+ *
+ * Return - the number of bytes
+ *****************************************************************************/
+static unsigned int getChunkLength(CompressedImage* image,
+                                   unsigned long long chunk);
+
+/******************************************************************************
+ * loadChunk - Read and decompress a chunk from the container. The lock must
+ *             be held.
+ *
+ * image - the container
+ * chunk - the chunk number
+ * data - where to store the chunk (the chunk size long)
+ * generation - where to store the generation of the chunk read
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int loadChunk(CompressedImage* image, unsigned long long chunk,
+                     unsigned char* data, unsigned int* generation);
+
+/******************************************************************************
+ * storeChunk - Compress a chunk and write it to the container, then point the
+ *              index at it. The lock must be held alone.
+ *
+ * image - the container
+ * chunk - the chunk number
+ * data - the chunk (the chunk size long)
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int storeChunk(CompressedImage* image, unsigned long long chunk,
+                      unsigned char* data);
+
+/******************************************************************************
+ * readChunkBytes - Read bytes of one chunk, from the cache if it is there.
+ *                  The lock must be held.
+ *
+ * image - the container
+ * chunk - the chunk number
+ * offset - where in the chunk to start reading
+ * numBytes - the number of bytes to read, all within the chunk
+ * buffer - where to store them
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int readChunkBytes(CompressedImage* image, unsigned long long chunk,
+                          unsigned int offset, unsigned int numBytes,
+                          unsigned char* buffer);
+
+/******************************************************************************
+ * writeChunkBytes - Write bytes of one chunk, first filling in the rest of
+ *                   it if they don't cover it all. The lock must be held
+ *                   alone.
+ *
+ * image - the container
+ * chunk - the chunk number
+ * offset - where in the chunk to start writing
+ * numBytes - the number of bytes to write, all within the chunk
+ * buffer - the bytes
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int writeChunkBytes(CompressedImage* image, unsigned long long chunk,
+                           unsigned int offset, unsigned int numBytes,
+                           unsigned char* buffer);
+
+/******************************************************************************
+ * findCachedChunk - Copy bytes of a chunk out of the cache, if it is there
+ *                   and no one has written the chunk since.
+ *
+ * image - the container
+ * chunk - the chunk number
+ * offset - where in the chunk to start copying
+ * numBytes - the number of bytes to copy
+ * buffer - where to copy them
+ *
+ * Return - 1 if the chunk was in the cache, 0 if not
+ *****************************************************************************/
+static int findCachedChunk(CompressedImage* image, unsigned long long chunk,
+                           unsigned int offset, unsigned int numBytes,
+                           unsigned char* buffer);
+
+/******************************************************************************
+ * cacheChunk - Add a decompressed chunk to the cache, in place of the one
+ *              used longest ago.
+ *
+ * image - the container
+ * chunk - the chunk number
+ * generation - the generation of the chunk
+ * data - the chunk, which the cache takes ownership of
+ *
+ * Return - none
+ *****************************************************************************/
+static void cacheChunk(CompressedImage* image, unsigned long long chunk,
+                       unsigned int generation, unsigned char* data);
+
+/******************************************************************************
+ * isZero - Check if bytes are all zeros.
+ *
+ * data - the bytes
+ * numBytes - the number of bytes
+ *
+ * Return - 1 if they are, 0 if not
+ *****************************************************************************/
+static int isZero(const unsigned char* data, unsigned int numBytes);
+
+/******************************************************************************
+ * readFully - pread() until every byte asked for is read.
+ *
+ * fd - the file
+ * buffer - where to store the bytes
+ * numBytes - the number of bytes to read
+ * offset - where in the file to start reading
+ *
+ * Return - 0 on success, -1 on failure (including the file ending early)
+ *****************************************************************************/
+static int readFully(int fd, unsigned char* buffer, size_t numBytes,
+                     long long offset);
+
+/******************************************************************************
+ * writeFully - pwrite() until every byte is written.
+ *
+ * fd - the file
+ * buffer - the bytes
+ * numBytes - the number of bytes to write
+ * offset - where in the file to start writing
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int writeFully(int fd, const unsigned char* buffer, size_t numBytes,
+                      long long offset);
+
+
+//-----------------------------------------------------------------------------
+// Compressed Image interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * isCompressedImage
+ *****************************************************************************/
+int isCompressedImage(int fd)
+{
+  unsigned int magic;
+
+  return (readFully(fd, (unsigned char*) &magic, sizeof(magic), 0) == 0 &&
+          magic == FAT12_COMPRESSED_IMAGE_MAGIC);
+}
+
+/******************************************************************************
+ * createCompressedImage
+ *****************************************************************************/
+CompressedImage* createCompressedImage(int fd, unsigned long long imageSize,
+                                       unsigned int chunkSize, int level)
+{
+  CompressedImageHeader header;
+  unsigned long long indexSize;
+
+  if (chunkSize < COMPRESSED_IMAGE_MIN_CHUNK_SIZE ||
+      chunkSize > COMPRESSED_IMAGE_MAX_CHUNK_SIZE ||
+      (chunkSize & (chunkSize - 1)) != 0 ||
+      level < Z_BEST_SPEED || level > Z_BEST_COMPRESSION)
+    return NULL;
+
+  memset(&header, 0, sizeof(header));
+  header.magic = FAT12_COMPRESSED_IMAGE_MAGIC;
+  header.version = FAT12_COMPRESSED_IMAGE_VERSION;
+  header.imageSize = imageSize;
+  header.chunkSize = chunkSize;
+  header.level = level;
+  header.numChunks = (imageSize + chunkSize - 1) / chunkSize;
+  indexSize = header.numChunks * sizeof(CompressedChunk);
+  header.indexOffset = COMPRESSED_IMAGE_ALIGNMENT;
+  header.dataOffset = header.indexOffset +
+                      (indexSize + COMPRESSED_IMAGE_ALIGNMENT - 1) /
+                      COMPRESSED_IMAGE_ALIGNMENT * COMPRESSED_IMAGE_ALIGNMENT;
+  header.dataEnd = header.dataOffset;
+
+  // An index of zeros is every chunk stored as a zero chunk.
+  if (ftruncate(fd, 0) != 0 ||
+      writeFully(fd, (unsigned char*) &header, sizeof(header), 0) != 0 ||
+      ftruncate(fd, header.dataOffset) != 0)
+    return NULL;
+  return openCompressedImage(fd, 1);
+}
+
+/******************************************************************************
+ * openCompressedImage
+ *****************************************************************************/
+CompressedImage* openCompressedImage(int fd, int isWritable)
+{
+  CompressedImage* image;
+  CompressedImageHeader header;
+  struct stat containerStat;
+  void* mapping;
+
+  if (readFully(fd, (unsigned char*) &header, sizeof(header), 0) != 0 ||
+      fstat(fd, &containerStat) != 0 ||
+      header.magic != FAT12_COMPRESSED_IMAGE_MAGIC ||
+      header.version != FAT12_COMPRESSED_IMAGE_VERSION ||
+      header.chunkSize < COMPRESSED_IMAGE_MIN_CHUNK_SIZE ||
+      header.chunkSize > COMPRESSED_IMAGE_MAX_CHUNK_SIZE ||
+      (header.chunkSize & (header.chunkSize - 1)) != 0 ||
+      header.numChunks != (header.imageSize + header.chunkSize - 1) /
+                          header.chunkSize ||
+      header.indexOffset < sizeof(header) ||
+      header.dataOffset < header.indexOffset +
+                          header.numChunks * sizeof(CompressedChunk) ||
+      (unsigned long long) containerStat.st_size < header.dataOffset)
+    return NULL;
+
+  mapping = mmap(NULL, header.dataOffset,
+                 PROT_READ | (isWritable ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED)
+    return NULL;
+
+  image = (CompressedImage*) calloc(1, sizeof(CompressedImage));
+  image->fd = fd;
+  image->isWritable = isWritable;
+  image->mapping = (unsigned char*) mapping;
+  image->header = (CompressedImageHeader*) image->mapping;
+  image->index = (CompressedChunk*) (image->mapping + header.indexOffset);
+  pthread_rwlock_init(&image->lock, NULL);
+  pthread_mutex_init(&image->cacheMutex, NULL);
+  image->numCachedChunks = COMPRESSED_IMAGE_CACHE_SIZE / header.chunkSize;
+  if (image->numCachedChunks < 4)
+    image->numCachedChunks = 4;
+  image->cache = (CachedChunk*) calloc(image->numCachedChunks,
+                                       sizeof(CachedChunk));
+  if (isWritable)
+    image->compressedData = (unsigned char*) malloc(
+      compressBound(header.chunkSize));
+  return image;
+}
+
+/******************************************************************************
+ * closeCompressedImage
+ *****************************************************************************/
+void closeCompressedImage(CompressedImage* image)
+{
+  unsigned int i;
+
+  for (i = 0; i < image->numCachedChunks; i++)
+    free(image->cache[i].data);
+  free(image->cache);
+  free(image->compressedData);
+  munmap(image->mapping, image->header->dataOffset);
+  pthread_mutex_destroy(&image->cacheMutex);
+  pthread_rwlock_destroy(&image->lock);
+  free(image);
+}
+
+/******************************************************************************
+ * readCompressedImage
+ *****************************************************************************/
+long long readCompressedImage(CompressedImage* image, long long offset,
+                              unsigned int numBytes, unsigned char* buffer)
+{
+  unsigned int chunkSize = image->header->chunkSize;
+  unsigned long long chunk;
+  unsigned int chunkOffset;
+  unsigned int length;
+  unsigned int numDone = 0;
+  int rc = 0;
+
+  if (offset < 0)
+    return -1;
+  if (offset >= (long long) image->header->imageSize)
+    return 0;
+  if (offset + numBytes > image->header->imageSize)
+    numBytes = image->header->imageSize - offset;
+
+  pthread_rwlock_rdlock(&image->lock);
+  while (rc == 0 && numDone < numBytes)
+  {
+    chunk = (offset + numDone) / chunkSize;
+    chunkOffset = (offset + numDone) % chunkSize;
+    length = chunkSize - chunkOffset;
+    if (length > numBytes - numDone)
+      length = numBytes - numDone;
+    rc = readChunkBytes(image, chunk, chunkOffset, length, buffer + numDone);
+    numDone += length;
+  }
+  pthread_rwlock_unlock(&image->lock);
+  return (rc == 0 ? numBytes : -1);
+}
+
+/******************************************************************************
+ * writeCompressedImage
+ *****************************************************************************/
+long long writeCompressedImage(CompressedImage* image, long long offset,
+                               unsigned int numBytes, unsigned char* buffer)
+{
+  unsigned int chunkSize = image->header->chunkSize;
+  unsigned long long chunk;
+  unsigned int chunkOffset;
+  unsigned int length;
+  unsigned int numDone = 0;
+  int rc = 0;
+
+  // The image can't grow.
+  if (!image->isWritable || offset < 0 ||
+      offset + numBytes > image->header->imageSize)
+    return -1;
+
+  pthread_rwlock_wrlock(&image->lock);
+  while (rc == 0 && numDone < numBytes)
+  {
+    chunk = (offset + numDone) / chunkSize;
+    chunkOffset = (offset + numDone) % chunkSize;
+    length = chunkSize - chunkOffset;
+    if (length > numBytes - numDone)
+      length = numBytes - numDone;
+    rc = writeChunkBytes(image, chunk, chunkOffset, length,
+                         buffer + numDone);
+    numDone += length;
+  }
+  pthread_rwlock_unlock(&image->lock);
+  return (rc == 0 ? numBytes : -1);
+}
+
+/******************************************************************************
+ * flushCompressedImage
+ *****************************************************************************/
+int flushCompressedImage(CompressedImage* image)
+{
+  // The index is part of the same file, so this writes it out too.
+  return (fdatasync(image->fd) == 0 ? 0 : -1);
+}
+
+/******************************************************************************
+ * getCompressedImageSize
+ *****************************************************************************/
+long long getCompressedImageSize(CompressedImage* image)
+{
+  return image->header->imageSize;
+}
+
+/******************************************************************************
+ * getCompressedImageUsage
+ *****************************************************************************/
+void getCompressedImageUsage(CompressedImage* image,
+                             CompressedImageUsage* usage)
+{
+  struct stat containerStat;
+  unsigned long long i;
+
+  memset(usage, 0, sizeof(*usage));
+  pthread_rwlock_rdlock(&image->lock);
+  usage->imageSize = image->header->imageSize;
+  usage->chunkSize = image->header->chunkSize;
+  usage->numChunks = image->header->numChunks;
+  usage->numUnusedBytes = image->header->numUnusedBytes;
+  for (i = 0; i < image->header->numChunks; i++)
+  {
+    if (image->index[i].type == COMPRESSED_CHUNK_ZERO)
+      usage->numZeroChunks++;
+    else if (image->index[i].type == COMPRESSED_CHUNK_RAW)
+      usage->numRawChunks++;
+    usage->numBytesStored += image->index[i].size;
+  }
+  pthread_rwlock_unlock(&image->lock);
+  if (fstat(image->fd, &containerStat) == 0)
+    usage->containerSize = containerStat.st_size;
+}
+
+
+//-----------------------------------------------------------------------------
+// Internal Functions
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * getChunkLength
+ *****************************************************************************/
+static unsigned int getChunkLength(CompressedImage* image,
+                                   unsigned long long chunk)
+{
+  unsigned long long start = chunk * image->header->chunkSize;
+
+  if (image->header->imageSize - start < image->header->chunkSize)
+    return image->header->imageSize - start;
+  return image->header->chunkSize;
+}
+
+/******************************************************************************
+ * loadChunk
+ *****************************************************************************/
+static int loadChunk(CompressedImage* image, unsigned long long chunk,
+                     unsigned char* data, unsigned int* generation)
+{
+  CompressedChunk entry = image->index[chunk];
+  unsigned int length = getChunkLength(image, chunk);
+  unsigned char* compressedData;
+  uLongf numBytes = image->header->chunkSize;
+  int rc = 0;
+
+  *generation = entry.generation;
+  memset(data + length, 0, image->header->chunkSize - length);
+  switch (entry.type)
+  {
+    case COMPRESSED_CHUNK_ZERO:
+      memset(data, 0, length);
+      break;
+    case COMPRESSED_CHUNK_RAW:
+      if (entry.size != length ||
+          readFully(image->fd, data, length, entry.offset) != 0)
+        rc = -1;
+      break;
+    case COMPRESSED_CHUNK_DEFLATE:
+      if (entry.size > compressBound(image->header->chunkSize))
+        return -1;
+      compressedData = (unsigned char*) malloc(entry.size);
+      if (readFully(image->fd, compressedData, entry.size,
+                    entry.offset) != 0 ||
+          uncompress(data, &numBytes, compressedData, entry.size) != Z_OK ||
+          numBytes != length)
+        rc = -1;
+      free(compressedData);
+      break;
+    default:
+      rc = -1;
+      break;
+  }
+  return rc;
+}
+
+/******************************************************************************
+ * storeChunk
+ *****************************************************************************/
+static int storeChunk(CompressedImage* image, unsigned long long chunk,
+                      unsigned char* data)
+{
+  CompressedChunk* entry = &image->index[chunk];
+  CompressedImageHeader* header = image->header;
+  unsigned int length = getChunkLength(image, chunk);
+  const unsigned char* stored = data;
+  uLongf size = compressBound(header->chunkSize);
+  unsigned int type;
+
+  // Zeros (such as free clusters) take no space, and a chunk that doesn't
+  // get any smaller is kept as it is.
+  if (isZero(data, length))
+  {
+    type = COMPRESSED_CHUNK_ZERO;
+    size = 0;
+  }
+  else if (compress2(image->compressedData, &size, data, length,
+                     header->level) == Z_OK && size < length)
+  {
+    type = COMPRESSED_CHUNK_DEFLATE;
+    stored = image->compressedData;
+  }
+  else
+  {
+    type = COMPRESSED_CHUNK_RAW;
+    size = length;
+  }
+
+  // Move it to the end of the container if it has outgrown its space.
+  if (size > entry->capacity)
+  {
+    header->numUnusedBytes += entry->capacity;
+    entry->offset = header->dataEnd;
+    entry->capacity = (size + COMPRESSED_IMAGE_SECTOR_SIZE - 1) /
+                      COMPRESSED_IMAGE_SECTOR_SIZE *
+                      COMPRESSED_IMAGE_SECTOR_SIZE;
+    header->dataEnd += entry->capacity;
+  }
+  if (size > 0 && writeFully(image->fd, stored, size, entry->offset) != 0)
+    return -1;
+
+  // Only point the index at it once it is there.
+  entry->size = size;
+  entry->type = type;
+  entry->generation++;
+  return 0;
+}
+
+/******************************************************************************
+ * readChunkBytes
+ *****************************************************************************/
+static int readChunkBytes(CompressedImage* image, unsigned long long chunk,
+                          unsigned int offset, unsigned int numBytes,
+                          unsigned char* buffer)
+{
+  unsigned char* data;
+  unsigned int generation;
+
+  // Zero chunks are quicker to make than to look up.
+  if (image->index[chunk].type == COMPRESSED_CHUNK_ZERO)
+  {
+    memset(buffer, 0, numBytes);
+    return 0;
+  }
+  if (findCachedChunk(image, chunk, offset, numBytes, buffer))
+    return 0;
+
+  // Several threads may decompress chunks at once.
+  data = (unsigned char*) malloc(image->header->chunkSize);
+  if (loadChunk(image, chunk, data, &generation) != 0)
+  {
+    free(data);
+    return -1;
+  }
+  memcpy(buffer, data + offset, numBytes);
+  cacheChunk(image, chunk, generation, data);
+  return 0;
+}
+
+/******************************************************************************
+ * writeChunkBytes
+ *****************************************************************************/
+static int writeChunkBytes(CompressedImage* image, unsigned long long chunk,
+                           unsigned int offset, unsigned int numBytes,
+                           unsigned char* buffer)
+{
+  unsigned int chunkSize = image->header->chunkSize;
+  unsigned char* data = (unsigned char*) malloc(chunkSize);
+  unsigned int generation;
+
+  // Only a chunk that is partly written has to be read first.
+  if (numBytes < getChunkLength(image, chunk) &&
+      !findCachedChunk(image, chunk, 0, chunkSize, data) &&
+      loadChunk(image, chunk, data, &generation) != 0)
+  {
+    free(data);
+    return -1;
+  }
+  else if (numBytes >= getChunkLength(image, chunk))
+    memset(data, 0, chunkSize);
+  memcpy(data + offset, buffer, numBytes);
+
+  if (storeChunk(image, chunk, data) != 0)
+  {
+    free(data);
+    return -1;
+  }
+
+  // The chunk is likely to be read or written again soon.
+  cacheChunk(image, chunk, image->index[chunk].generation, data);
+  return 0;
+}
+
+/******************************************************************************
+ * findCachedChunk
+ *****************************************************************************/
+static int findCachedChunk(CompressedImage* image, unsigned long long chunk,
+                           unsigned int offset, unsigned int numBytes,
+                           unsigned char* buffer)
+{
+  unsigned int generation = image->index[chunk].generation;
+  CachedChunk* entry;
+  unsigned int i;
+  int isFound = 0;
+
+  // A chunk written by another command since it was cached has a newer
+  // generation in the (shared) index.
+  pthread_mutex_lock(&image->cacheMutex);
+  for (i = 0; i < image->numCachedChunks; i++)
+  {
+    entry = &image->cache[i];
+    if (entry->data != NULL && entry->chunk == chunk &&
+        entry->generation == generation)
+    {
+      memcpy(buffer, entry->data + offset, numBytes);
+      entry->lastUsed = ++image->clock;
+      isFound = 1;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&image->cacheMutex);
+  return isFound;
+}
+
+/******************************************************************************
+ * cacheChunk
+ *****************************************************************************/
+static void cacheChunk(CompressedImage* image, unsigned long long chunk,
+                       unsigned int generation, unsigned char* data)
+{
+  CachedChunk* victim = &image->cache[0];
+  CachedChunk* entry;
+  unsigned int i;
+
+  // Replace an older copy of the same chunk, or else the one used longest
+  // ago.
+  pthread_mutex_lock(&image->cacheMutex);
+  for (i = 0; i < image->numCachedChunks; i++)
+  {
+    entry = &image->cache[i];
+    if (entry->data != NULL && entry->chunk == chunk)
+    {
+      victim = entry;
+      break;
+    }
+    if (entry->data == NULL ||
+        (victim->data != NULL && entry->lastUsed < victim->lastUsed))
+      victim = entry;
+  }
+  free(victim->data);
+  victim->chunk = chunk;
+  victim->generation = generation;
+  victim->data = data;
+  victim->lastUsed = ++image->clock;
+  pthread_mutex_unlock(&image->cacheMutex);
+}
+
+/******************************************************************************
+ * isZero
+ *****************************************************************************/
+static int isZero(const unsigned char* data, unsigned int numBytes)
+{
+  // Compare the bytes with themselves one on, once the first is known.
+  return (numBytes == 0 ||
+          (data[0] == 0 && memcmp(data, data + 1, numBytes - 1) == 0));
+}
+
+/******************************************************************************
+ * readFully
+ *****************************************************************************/
+static int readFully(int fd, unsigned char* buffer, size_t numBytes,
+                     long long offset)
+{
+  size_t numRead = 0;
+  ssize_t numTransferred;
+
+  while (numRead < numBytes)
+  {
+    numTransferred = pread(fd, buffer + numRead, numBytes - numRead,
+                           offset + numRead);
+    if (numTransferred < 0 && errno == EINTR)
+      continue;
+    if (numTransferred <= 0)
+      return -1;
+    numRead += numTransferred;
+  }
+  return 0;
+}
+
+/******************************************************************************
+ * writeFully
+ *****************************************************************************/
+static int writeFully(int fd, const unsigned char* buffer, size_t numBytes,
+                      long long offset)
+{
+  size_t numWritten = 0;
+  ssize_t numTransferred;
+
+  while (numWritten < numBytes)
+  {
+    numTransferred = pwrite(fd, buffer + numWritten, numBytes - numWritten,
+                            offset + numWritten);
+    if (numTransferred < 0 && errno == EINTR)
+      continue;
+    if (numTransferred <= 0)
+      return -1;
+    numWritten += numTransferred;
+  }
+  return 0;
+}
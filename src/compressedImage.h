@@ -0,0 +1,233 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function headers for compressed images, a container that
+ *              holds a disk image in compressed chunks and can still be
+ *              read and written anywhere, like the image itself.
+ *
+ *              The image is split into chunks of the same size (a power of
+ *              2 number of sectors), each compressed on its own with zlib,
+ *              so reading a sector only decompresses the chunk it is in. A
+ *              chunk of all zeros is stored as no bytes at all, and one that
+ *              doesn't compress is stored as it is. The container is laid
+ *              out as:
+ *
+ *                CompressedImageHeader, padded to COMPRESSED_IMAGE_ALIGNMENT
+ *                  bytes
+ *                an index of a CompressedChunk for each chunk, padded to a
+ *                  multiple of COMPRESSED_IMAGE_ALIGNMENT bytes
+ *                the chunks' data, in no particular order
+ *
+ *              A chunk that is written again goes back where it was if it
+ *              still fits, or else on the end of the container, leaving its
+ *              old space unused until the image is packed again (see the
+ *              imgpack program). The header and index are shared through a
+ *              mapping, so every command sees the others' writes as soon as
+ *              they are made, and each open container keeps a cache of the
+ *              chunks it used last, decompressed. A disk image that is a
+ *              container is always opened through it, whatever block device
+ *              was asked for (see blockDevice.h).
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#ifndef _COMPRESSED_IMAGE_H_
+#define _COMPRESSED_IMAGE_H_
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+
+// Magic number and version at the start of a compressed image.
+#define FAT12_COMPRESSED_IMAGE_MAGIC 0x504D4346 // "FCMP"
+#define FAT12_COMPRESSED_IMAGE_VERSION 1
+
+// The alignment of the index and data in the container (a page).
+#define COMPRESSED_IMAGE_ALIGNMENT 4096
+
+// The smallest and largest chunks, and the size imgpack uses by default.
+#define COMPRESSED_IMAGE_MIN_CHUNK_SIZE 4096
+#define COMPRESSED_IMAGE_MAX_CHUNK_SIZE (1024 * 1024)
+#define COMPRESSED_IMAGE_DEFAULT_CHUNK_SIZE (32 * 1024)
+
+// How much of the image each open container keeps decompressed.
+#define COMPRESSED_IMAGE_CACHE_SIZE (4 * 1024 * 1024)
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * CompressedChunkType - how a chunk is stored.
+ *****************************************************************************/
+typedef enum
+{
+  COMPRESSED_CHUNK_ZERO = 0, // all zeros, so nothing is stored
+  COMPRESSED_CHUNK_RAW, // as it is
+  COMPRESSED_CHUNK_DEFLATE // compressed with zlib
+} CompressedChunkType;
+
+/******************************************************************************
+ * CompressedImageHeader - the start of a compressed image.
+ *****************************************************************************/
+typedef struct
+{
+  unsigned int       magic;
+  unsigned int       version;
+  unsigned long long imageSize; // of the image inside, in bytes
+  unsigned int       chunkSize; // in bytes
+  int                level; // zlib's compression level, for writes
+  unsigned long long numChunks; // covering imageSize
+  unsigned long long indexOffset;
+  unsigned long long dataOffset;
+  unsigned long long dataEnd; // where the next chunk that doesn't fit goes
+  unsigned long long numUnusedBytes; // left behind by chunks that moved
+} CompressedImageHeader;
+
+/******************************************************************************
+ * CompressedChunk - where a chunk is in the container.
+ *****************************************************************************/
+typedef struct
+{
+  unsigned long long offset;
+  unsigned int       size; // the bytes stored (0 for a zero chunk)
+  unsigned int       capacity; // the bytes set aside at offset
+  unsigned int       type; // a CompressedChunkType
+  unsigned int       generation; // counts the times it was written
+} CompressedChunk;
+
+/******************************************************************************
+ * CompressedImageUsage - how well an image compressed.
+ *****************************************************************************/
+typedef struct
+{
+  unsigned long long imageSize;
+  unsigned long long containerSize; // of the container on the host
+  unsigned int       chunkSize;
+  unsigned long long numChunks;
+  unsigned long long numZeroChunks;
+  unsigned long long numRawChunks;
+  unsigned long long numBytesStored; // of chunk data
+  unsigned long long numUnusedBytes;
+} CompressedImageUsage;
+
+typedef struct CompressedImage CompressedImage;
+
+
+//-----------------------------------------------------------------------------
+// Compressed Image interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * isCompressedImage - Check if a file is a compressed image.
+ *
+ * fd - a descriptor of the file
+ *
+ * Return - 1 if it is, 0 if not
+ *****************************************************************************/
+int isCompressedImage(int fd);
+
+/******************************************************************************
+ * createCompressedImage - Make a file into an empty compressed image (one
+ *                         that reads as all zeros), open for writing.
+ *
+ * fd - a descriptor of the file, open for writing, which is truncated
+ * imageSize - the size of the image it will hold, in bytes
+ * chunkSize - the size of each chunk, a power of 2 from
+ *             COMPRESSED_IMAGE_MIN_CHUNK_SIZE to
+ *             COMPRESSED_IMAGE_MAX_CHUNK_SIZE
+ * level - zlib's compression level, from 1 (fastest) to 9 (smallest)
+ *
+ * Return - the container, or NULL on failure
+ *****************************************************************************/
+CompressedImage* createCompressedImage(int fd, unsigned long long imageSize,
+                                       unsigned int chunkSize, int level);
+
+/******************************************************************************
+ * openCompressedImage - Open a compressed image, to read and write the image
+ *                       inside it.
+ *
+ * fd - a descriptor of the container, which must stay open until it is
+ *      closed
+ * isWritable - 1 to open it for writing too, 0 for reading only
+ *
+ * Return - the container, or NULL on failure (such as if it isn't one)
+ *****************************************************************************/
+CompressedImage* openCompressedImage(int fd, int isWritable);
+
+/******************************************************************************
+ * closeCompressedImage - Close a compressed image.
+ *
+ * image - the container
+ *
+ * Return - none
+ *****************************************************************************/
+void closeCompressedImage(CompressedImage* image);
+
+/******************************************************************************
+ * readCompressedImage - Read consecutive bytes of the image inside a
+ *                       compressed image.
+ *
+ * image - the container
+ * offset - where in the image to start reading
+ * numBytes - the number of bytes to read
+ * buffer - where to store them
+ *
+ * Return - the number of bytes read (fewer at the end of the image), or -1
+ *          on failure
+ *****************************************************************************/
+long long readCompressedImage(CompressedImage* image, long long offset,
+                              unsigned int numBytes, unsigned char* buffer);
+
+/******************************************************************************
+ * writeCompressedImage - Write consecutive bytes of the image inside a
+ *                        compressed image, recompressing each chunk they
+ *                        fall in. The image can't grow.
+ *
+ * image - the container
+ * offset - where in the image to start writing
+ * numBytes - the number of bytes to write
+ * buffer - the bytes
+ *
+ * Return - the number of bytes written, or -1 on failure
+ *****************************************************************************/
+long long writeCompressedImage(CompressedImage* image, long long offset,
+                               unsigned int numBytes, unsigned char* buffer);
+
+/******************************************************************************
+ * flushCompressedImage - Make the chunks written to a compressed image, and
+ *                        its index, durable.
+ *
+ * image - the container
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+int flushCompressedImage(CompressedImage* image);
+
+/******************************************************************************
+ * getCompressedImageSize - Get the size of the image inside a compressed
+ *                          image.
+ *
+ * image - the container
+ *
+ * Return - the size in bytes
+ *****************************************************************************/
+long long getCompressedImageSize(CompressedImage* image);
+
+/******************************************************************************
+ * getCompressedImageUsage - Count how a compressed image's chunks are
+ *                           stored, and the space they take up.
+ *
+ * image - the container
+ * usage - where to store the counts
+ *
+ * Return - none
+ *****************************************************************************/
+void getCompressedImageUsage(CompressedImage* image,
+                             CompressedImageUsage* usage);
+
+
+#endif //_COMPRESSED_IMAGE_H_
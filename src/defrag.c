@@ -0,0 +1,844 @@
+/******************************************************************************
+ * defrag.c: Defragment
+ *
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Performs the defrag command, which rewrites the file system so
+ *              that every file and directory is stored in one contiguous run
+ *              of clusters. Directories are placed first, at the start of the
+ *              data region, followed by files in path order, so that walking
+ *              the tree and then reading its files moves steadily forward
+ *              through the disk image.
+ *
+ *              Clusters are moved in batches of DEFRAG_BATCH_CLUSTERS: every
+ *              cluster in a batch is read before any is written, so the
+ *              moves within a batch may freely swap clusters with each other.
+ *              After each file is in place, its FAT chain and directory entry
+ *              (and for a directory, its '.' entry and its subdirectories'
+ *              '..' entries) are updated and the image is unlocked, which
+ *              commits the file as one transaction when journaling is
+ *              enabled.
+ *
+ *              Usage: defrag [-n]
+ *                -n  only report how fragmented the file system is
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ *****************************************************************************/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "fat.h"
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+
+// The maximum number of clusters moved with each batch of reads and writes.
+#define DEFRAG_BATCH_CLUSTERS 64
+
+// The owner of a cluster that belongs to no entry.
+#define NO_OWNER -1
+
+// The owner of a cluster of the FAT32 root directory, which stays put.
+#define ROOT_OWNER -2
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * Chain - a file or directory, and the chain of clusters it is stored in.
+ *****************************************************************************/
+typedef struct
+{
+  char            path[FAT12_MAX_PATH_NAME_LENGTH];
+  int             parent; // index of the parent directory (-1 for the root)
+  int             indexInParent; // index of its entry in the parent
+  int             isDirectory;
+  unsigned int    flc; // first logical cluster in its directory entry
+  unsigned int    numClusters;
+  unsigned int*   clusters;
+  int             isChanged; // its chain has changed since the FAT was set
+} Chain;
+
+/******************************************************************************
+ * Move - a cluster to copy during a batch.
+ *****************************************************************************/
+typedef struct
+{
+  unsigned int   source;
+  unsigned int   destination;
+  unsigned int   slot; // where its data is kept in the read buffer
+} Move;
+
+
+//-----------------------------------------------------------------------------
+// Variables
+//-----------------------------------------------------------------------------
+
+static Chain*          chains = NULL;
+static int             numChains = 0;
+static int             maxChains = 0;
+
+static unsigned int    numClusters;
+static unsigned int    bytesPerCluster;
+
+// Room for a batch of clusters, for moving and timing reads.
+static unsigned char*  readBuffer = NULL;
+static unsigned char*  writeBuffer = NULL;
+
+// Which chain owns each cluster, and where in the chain it is.
+static int*            clusterOwners = NULL;
+static unsigned int*   clusterPositions = NULL;
+
+// For each cluster touched by the current batch, the cluster whose data
+// (as of the start of the batch) belongs there.
+static unsigned int*   clusterContents = NULL;
+static unsigned char*  isTouched = NULL;
+static unsigned int    touched[DEFRAG_BATCH_CLUSTERS];
+static unsigned int    numTouched = 0;
+
+// Clusters freed while placing the current chain.
+static unsigned int*   vacated = NULL;
+static unsigned int    numVacated = 0;
+
+static unsigned int    numClustersMoved = 0;
+static unsigned int    numBatches = 0;
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+static void usage();
+static int scanFileSystem();
+static int scanDirectory(int parent, unsigned int flc);
+static void freeChains();
+static int compareChains(const void* a, const void* b);
+static int placeChains(int* order);
+static int placeChain(int index, unsigned int* nextCluster);
+static void touchCluster(unsigned int cluster);
+static int flushBatch();
+static void undoBatch();
+static int compareMoveSources(const void* a, const void* b);
+static int compareMoveDestinations(const void* a, const void* b);
+static void updateChain(int index);
+static void setDotEntry(unsigned int directoryFlc, int dotIndex,
+                        unsigned int flc);
+static void reportFragmentation(const char* label, int* order);
+static double timeSequentialRead(int* order);
+static double getTime();
+
+
+/******************************************************************************
+ * main - runs the defrag command.
+ *****************************************************************************/
+int main(int argc, char* argv[])
+{
+  int reportOnly = 0;
+  int* order;
+  int i;
+  int rc;
+
+  if (argc == 2 && strcmp(argv[1], "-n") == 0)
+  {
+    reportOnly = 1;
+  }
+  else if (argc != 1)
+  {
+    usage();
+    return -1;
+  }
+
+  if (initializeFatFileSystem(reportOnly ? FAT_LOCK_SHARED :
+                              FAT_LOCK_EXCLUSIVE) != 0)
+    return -1;
+
+  bytesPerCluster = fatFileSystem.geometry.bytesPerCluster;
+  numClusters = fatFileSystem.session->numClusters;
+  readBuffer = (unsigned char*) malloc(DEFRAG_BATCH_CLUSTERS *
+                                       bytesPerCluster);
+  writeBuffer = (unsigned char*) malloc(DEFRAG_BATCH_CLUSTERS *
+                                        bytesPerCluster);
+  clusterOwners = (int*) malloc(numClusters * sizeof(int));
+  clusterPositions = (unsigned int*) malloc(numClusters *
+                                            sizeof(unsigned int));
+  clusterContents = (unsigned int*) malloc(numClusters *
+                                           sizeof(unsigned int));
+  isTouched = (unsigned char*) calloc(numClusters, 1);
+  vacated = (unsigned int*) malloc(numClusters * sizeof(unsigned int));
+  for (i = 0; i < numClusters; i++)
+    clusterContents[i] = i;
+
+  // If someone else changes the file system while we have it unlocked
+  // between files, start over with a fresh scan (chains that have already
+  // been placed stay where they are).
+  do
+  {
+    rc = scanFileSystem();
+    if (rc != 0)
+      break;
+
+    // Directories first, then files, each in path order.
+    order = (int*) malloc(numChains * sizeof(int));
+    for (i = 0; i < numChains; i++)
+      order[i] = i;
+    qsort(order, numChains, sizeof(int), compareChains);
+
+    if (numBatches == 0 && numClustersMoved == 0)
+    {
+      reportFragmentation("Before", order);
+      if (reportOnly)
+      {
+        free(order);
+        break;
+      }
+    }
+
+    rc = placeChains(order);
+    if (rc == 0)
+    {
+      printf("Moved %u clusters in %u batches\n", numClustersMoved,
+             numBatches);
+      reportFragmentation("After", order);
+    }
+    free(order);
+  } while (rc == 1);
+
+  // Cached paths to directories that moved are no longer valid.
+  if (numClustersMoved > 0)
+    invalidateWorkingDirectory();
+
+  freeChains();
+  free(clusterOwners);
+  free(clusterPositions);
+  free(clusterContents);
+  free(isTouched);
+  free(readBuffer);
+  free(writeBuffer);
+  free(vacated);
+  terminateFatFileSystem();
+  return (rc == 0 ? 0 : -1);
+}
+
+/******************************************************************************
+ * usage - prints the usage statement.
+ *****************************************************************************/
+static void usage()
+{
+  printf("Usage: defrag [-n]\n");
+  printf("Stores every file and directory contiguously (-n only reports).\n");
+}
+
+/******************************************************************************
+ * scanFileSystem - find the chain of every file and directory, starting from
+ *                  the root directory.
+ *
+ * Return - 0 on success, -1 if the file system is damaged
+ *****************************************************************************/
+static int scanFileSystem()
+{
+  unsigned int entryValue;
+  unsigned int numUsedClusters = 0;
+  unsigned int numOwnedClusters = 0;
+  int entryType;
+  int i;
+
+  freeChains();
+  for (i = 0; i < numClusters; i++)
+    clusterOwners[i] = NO_OWNER;
+
+  // The FAT32 root directory is a chain too, but it is left where it is.
+  if (fatFileSystem.geometry.fatType == FAT_TYPE_32)
+  {
+    unsigned int cluster = fatFileSystem.geometry.rootDirectoryCluster;
+    do
+    {
+      if (cluster < 2 || cluster >= numClusters ||
+          clusterOwners[cluster] != NO_OWNER)
+      {
+        printf("Error: the root directory has a damaged chain (run "
+               "'fsck -r' first)\n");
+        return -1;
+      }
+      getFatEntry(cluster, &entryValue, &entryType);
+      clusterOwners[cluster] = ROOT_OWNER;
+      numOwnedClusters++;
+      cluster = entryValue;
+    } while (entryType == FAT_ENTRY_TYPE_NEXT_SECTOR);
+  }
+
+  // Directories are appended as they are found, so this walks the whole
+  // tree breadth-first.
+  if (scanDirectory(-1, 0) != 0)
+    return -1;
+  for (i = 0; i < numChains; i++)
+  {
+    if (chains[i].isDirectory && scanDirectory(i, chains[i].flc) != 0)
+      return -1;
+    numOwnedClusters += chains[i].numClusters;
+  }
+
+  // Clusters that are in use but owned by nobody would be overwritten.
+  for (i = 2; i < numClusters; i++)
+  {
+    getFatEntry(i, &entryValue, &entryType);
+    if (entryType == FAT_ENTRY_TYPE_NEXT_SECTOR ||
+        entryType == FAT_ENTRY_TYPE_LAST_SECTOR)
+    {
+      numUsedClusters++;
+    }
+  }
+  if (numUsedClusters != numOwnedClusters)
+  {
+    printf("Error: the file system has lost clusters (run 'fsck -r' "
+           "first)\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+/******************************************************************************
+ * scanDirectory - add a chain for every file and subdirectory in a
+ *                 directory.
+ *
+ * parent - the index of the directory's chain (-1 for the root)
+ * flc - the first logical cluster of the directory
+ *
+ * Return - 0 on success, -1 if a chain is damaged
+ *****************************************************************************/
+static int scanDirectory(int parent, unsigned int flc)
+{
+  char name[FAT12_MAX_FILE_NAME_LENGTH];
+  unsigned int numBytes;
+  DirectoryEntry* directory = readDirectory(flc, &numBytes);
+  DirectoryEntry* entry;
+  unsigned int cluster;
+  unsigned int entryValue;
+  int entryType;
+  int index = 0;
+
+  for (entry = getFirstValidEntry(directory, &index); entry != NULL;
+       entry = getNextValidEntry(entry, &index))
+  {
+    getEntryName(entry, name);
+    if ((entry->attributes & DIR_ENTRY_ATTRIB_VOLUME_LABEL) ||
+        strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+        getEntryCluster(entry) == 0)
+    {
+      continue;
+    }
+
+    if (numChains == maxChains)
+    {
+      maxChains = (maxChains == 0 ? 64 : maxChains * 2);
+      chains = (Chain*) realloc(chains, maxChains * sizeof(Chain));
+    }
+
+    Chain* chain = &chains[numChains];
+    memset(chain, 0, sizeof(Chain));
+    snprintf(chain->path, sizeof(chain->path), "%s/%s",
+             (parent < 0 ? "" : chains[parent].path), name);
+    chain->parent = parent;
+    chain->indexInParent = index;
+    chain->isDirectory = isEntryADirectory(entry);
+    chain->flc = getEntryCluster(entry);
+    chain->clusters = (unsigned int*) malloc(
+      getFatEntryChainLength(chain->flc) * sizeof(unsigned int));
+
+    // Follow the chain, claiming each cluster for it.
+    cluster = chain->flc;
+    do
+    {
+      if (cluster < 2 || cluster >= numClusters ||
+          clusterOwners[cluster] != NO_OWNER)
+      {
+        printf("Error: %s has a damaged chain (run 'fsck -r' first)\n",
+               chain->path);
+        free(chain->clusters);
+        closeDirectory(directory);
+        return -1;
+      }
+      getFatEntry(cluster, &entryValue, &entryType);
+      clusterOwners[cluster] = numChains;
+      clusterPositions[cluster] = chain->numClusters;
+      chain->clusters[chain->numClusters++] = cluster;
+      cluster = entryValue;
+    } while (entryType == FAT_ENTRY_TYPE_NEXT_SECTOR);
+
+    numChains++;
+  }
+
+  closeDirectory(directory);
+  return 0;
+}
+
+/******************************************************************************
+ * freeChains - forget every chain.
+ *****************************************************************************/
+static void freeChains()
+{
+  int i;
+
+  for (i = 0; i < numChains; i++)
+    free(chains[i].clusters);
+  free(chains);
+  chains = NULL;
+  numChains = 0;
+  maxChains = 0;
+}
+
+/******************************************************************************
+ * compareChains - order chains with directories first, then by path name,
+ *                 for qsort(). A directory always comes before everything
+ *                 inside it.
+ *****************************************************************************/
+static int compareChains(const void* a, const void* b)
+{
+  Chain* chainA = &chains[*(const int*) a];
+  Chain* chainB = &chains[*(const int*) b];
+
+  if (chainA->isDirectory != chainB->isDirectory)
+    return chainB->isDirectory - chainA->isDirectory;
+  return strcmp(chainA->path, chainB->path);
+}
+
+/******************************************************************************
+ * placeChains - move every chain into place, in the given order.
+ *
+ * Return - 0 on success, 1 if the file system was changed by someone else
+ *          and must be scanned again, or -1 on failure
+ *****************************************************************************/
+static int placeChains(int* order)
+{
+  unsigned int nextCluster = 2;
+  unsigned int generation;
+  unsigned int newGeneration;
+  unsigned int flushedGeneration;
+  int i;
+
+  for (i = 0; i < numChains; i++)
+  {
+    if (placeChain(order[i], &nextCluster) != 0)
+      return -1;
+
+    // Commit the file and let other commands in before the next one.
+    unlockFatFileSystem();
+    getFatSessionGenerations(&generation, &flushedGeneration);
+    if (lockFatFileSystem(FAT_LOCK_EXCLUSIVE) != 0)
+      return -1;
+    getFatSessionGenerations(&newGeneration, &flushedGeneration);
+    if (newGeneration != generation)
+      return 1;
+  }
+
+  return 0;
+}
+
+/******************************************************************************
+ * placeChain - move a chain into the next run of usable clusters, then
+ *              update the FAT table and directory entries.
+ *
+ * index - the index of the chain to place
+ * nextCluster - the first cluster of the run, which is set to just past the
+ *               end of the run
+ *
+ * Return - 0 on success, or -1 if its clusters couldn't be copied (the
+ *          batch that failed is left where it was)
+ *****************************************************************************/
+static int placeChain(int index, unsigned int* nextCluster)
+{
+  Chain* chain = &chains[index];
+  unsigned int target;
+  unsigned int current;
+  unsigned int entryValue;
+  int entryType;
+  int owner;
+  unsigned int position;
+  unsigned int i;
+  int j;
+  int rc = 0;
+
+  numVacated = 0;
+
+  for (i = 0; i < chain->numClusters; i++)
+  {
+    // Skip over bad and reserved clusters, and the FAT32 root directory.
+    target = *nextCluster;
+    getFatEntry(target, &entryValue, &entryType);
+    while (entryType == FAT_ENTRY_TYPE_BAD ||
+           entryType == FAT_ENTRY_TYPE_RESERVED ||
+           clusterOwners[target] == ROOT_OWNER)
+    {
+      target++;
+      getFatEntry(target, &entryValue, &entryType);
+    }
+    *nextCluster = target + 1;
+
+    current = chain->clusters[i];
+    if (current == target)
+      continue;
+
+    // Leave room in the batch for both clusters.
+    if (numTouched + 2 > DEFRAG_BATCH_CLUSTERS && (rc = flushBatch()) != 0)
+      break;
+    touchCluster(target);
+    touchCluster(current);
+
+    owner = clusterOwners[target];
+    position = clusterPositions[target];
+    if (owner == NO_OWNER)
+    {
+      // Move our cluster into the free target.
+      clusterContents[target] = clusterContents[current];
+      clusterOwners[current] = NO_OWNER;
+      vacated[numVacated++] = current;
+    }
+    else
+    {
+      // Swap our cluster with the one in the way, which belongs to a chain
+      // that hasn't been placed yet (maybe even later in our own chain).
+      unsigned int contents = clusterContents[target];
+      clusterContents[target] = clusterContents[current];
+      clusterContents[current] = contents;
+      clusterOwners[current] = owner;
+      clusterPositions[current] = position;
+      chains[owner].clusters[position] = current;
+      chains[owner].isChanged = 1;
+    }
+
+    clusterOwners[target] = index;
+    clusterPositions[target] = i;
+    chain->clusters[i] = target;
+    chain->isChanged = 1;
+  }
+  if (rc == 0)
+    rc = flushBatch();
+  if (rc != 0)
+    printf("Error: could not move %s\n", chain->path);
+
+  // Free the clusters we left behind, unless someone was swapped into them
+  // (or a failed batch gave them back).
+  for (i = 0; i < numVacated; i++)
+  {
+    if (clusterOwners[vacated[i]] == NO_OWNER)
+      setFatEntry(vacated[i], 0x000);
+  }
+
+  // Rewrite the FAT chain of every chain that moved, and only then their
+  // directory entries, since finding an entry means reading its parent
+  // directory through the FAT table.
+  for (j = 0; j < numChains; j++)
+  {
+    if (!chains[j].isChanged)
+      continue;
+    for (i = 0; i < chains[j].numClusters; i++)
+    {
+      setFatEntry(chains[j].clusters[i], (i + 1 < chains[j].numClusters ?
+                  chains[j].clusters[i + 1] : FAT_END_OF_CHAIN));
+    }
+  }
+  for (j = 0; j < numChains; j++)
+  {
+    if (chains[j].isChanged)
+      updateChain(j);
+  }
+  return rc;
+}
+
+/******************************************************************************
+ * touchCluster - add a cluster to the current batch.
+ *****************************************************************************/
+static void touchCluster(unsigned int cluster)
+{
+  if (!isTouched[cluster])
+  {
+    isTouched[cluster] = 1;
+    touched[numTouched++] = cluster;
+  }
+}
+
+/******************************************************************************
+ * flushBatch - copy the data of every cluster touched by the current batch
+ *              to where it now belongs. Every source is read before anything
+ *              is written, and runs of consecutive clusters are read and
+ *              written with one call.
+ *
+ * Return - 0 on success, or -1 if the batch couldn't be read or written, in
+ *          which case its clusters are given back to the chains whose data
+ *          they still hold
+ *****************************************************************************/
+static int flushBatch()
+{
+  Move moves[DEFRAG_BATCH_CLUSTERS];
+  SectorRun runs[DEFRAG_BATCH_CLUSTERS];
+  unsigned int numMoves = 0;
+  unsigned int numRuns = 0;
+  unsigned int i;
+  unsigned int j;
+  int rc = 0;
+
+  // Only clusters that someone owns need their new contents.
+  for (i = 0; i < numTouched; i++)
+  {
+    unsigned int cluster = touched[i];
+    if (clusterContents[cluster] != cluster &&
+        clusterOwners[cluster] != NO_OWNER)
+    {
+      moves[numMoves].source = clusterContents[cluster];
+      moves[numMoves].destination = cluster;
+      numMoves++;
+    }
+  }
+
+  if (numMoves > 0)
+  {
+    // Read the sources in order, a run at a time, with every run in flight
+    // at once.
+    qsort(moves, numMoves, sizeof(Move), compareMoveSources);
+    for (i = 0; i < numMoves; i = j)
+    {
+      for (j = i + 1; j < numMoves &&
+           moves[j].source == moves[j - 1].source + 1; j++);
+      runs[numRuns].sector = logicalToPhysicalCluster(moves[i].source);
+      runs[numRuns].numBytes = (j - i) * bytesPerCluster;
+      runs[numRuns].buffer = readBuffer + (i * bytesPerCluster);
+      numRuns++;
+      for (; i < j; i++)
+        moves[i].slot = i;
+    }
+    rc = readSectorRuns(runs, numRuns);
+  }
+
+  if (numMoves > 0 && rc == 0)
+  {
+    // Then write the destinations in order, a run at a time.
+    qsort(moves, numMoves, sizeof(Move), compareMoveDestinations);
+    for (i = 0; i < numMoves; i++)
+    {
+      memcpy(writeBuffer + (i * bytesPerCluster),
+             readBuffer + (moves[i].slot * bytesPerCluster), bytesPerCluster);
+    }
+    numRuns = 0;
+    for (i = 0; i < numMoves; i = j)
+    {
+      for (j = i + 1; j < numMoves &&
+           moves[j].destination == moves[j - 1].destination + 1; j++);
+      runs[numRuns].sector = logicalToPhysicalCluster(moves[i].destination);
+      runs[numRuns].numBytes = (j - i) * bytesPerCluster;
+      runs[numRuns].buffer = writeBuffer + (i * bytesPerCluster);
+      numRuns++;
+    }
+    rc = writeSectorRuns(runs, numRuns);
+  }
+
+  if (rc == 0)
+  {
+    numClustersMoved += numMoves;
+    if (numMoves > 0)
+      numBatches++;
+  }
+  else
+  {
+    undoBatch();
+  }
+
+  for (i = 0; i < numTouched; i++)
+  {
+    clusterContents[touched[i]] = touched[i];
+    isTouched[touched[i]] = 0;
+  }
+  numTouched = 0;
+  return rc;
+}
+
+/******************************************************************************
+ * undoBatch - give each cluster touched by the current batch back to the
+ *             chain whose data it held at the start of the batch, so that
+ *             the chains match the data on disk again after the batch
+ *             couldn't be copied. The destinations that were free are free
+ *             again.
+ *****************************************************************************/
+static void undoBatch()
+{
+  int owners[DEFRAG_BATCH_CLUSTERS];
+  unsigned int positions[DEFRAG_BATCH_CLUSTERS];
+  unsigned int source;
+  unsigned int i;
+
+  // The data that belongs in each touched cluster is still in the one it
+  // was to be copied from, which was touched too.
+  for (i = 0; i < numTouched; i++)
+  {
+    owners[i] = clusterOwners[touched[i]];
+    positions[i] = clusterPositions[touched[i]];
+    clusterOwners[touched[i]] = NO_OWNER;
+  }
+  for (i = 0; i < numTouched; i++)
+  {
+    if (owners[i] == NO_OWNER)
+      continue;
+    source = clusterContents[touched[i]];
+    clusterOwners[source] = owners[i];
+    clusterPositions[source] = positions[i];
+    chains[owners[i]].clusters[positions[i]] = source;
+    chains[owners[i]].isChanged = 1;
+  }
+}
+
+/******************************************************************************
+ * compareMoveSources - order moves by source cluster, for qsort().
+ *****************************************************************************/
+static int compareMoveSources(const void* a, const void* b)
+{
+  return ((const Move*) a)->source - ((const Move*) b)->source;
+}
+
+/******************************************************************************
+ * compareMoveDestinations - order moves by destination cluster, for qsort().
+ *****************************************************************************/
+static int compareMoveDestinations(const void* a, const void* b)
+{
+  return ((const Move*) a)->destination - ((const Move*) b)->destination;
+}
+
+/******************************************************************************
+ * updateChain - point a moved chain's directory entry at its new first
+ *               cluster, and for a directory, its '.' entry and its
+ *               subdirectories' '..' entries too.
+ *****************************************************************************/
+static void updateChain(int index)
+{
+  Chain* chain = &chains[index];
+  unsigned int flc = chain->clusters[0];
+  unsigned int parentFlc;
+  unsigned int numBytes;
+  DirectoryEntry* directory;
+  int i;
+
+  chain->isChanged = 0;
+  if (chain->flc == flc)
+    return;
+  chain->flc = flc;
+
+  parentFlc = (chain->parent < 0 ? 0 : chains[chain->parent].clusters[0]);
+  directory = readDirectory(parentFlc, &numBytes);
+  setEntryCluster(&directory[chain->indexInParent], flc);
+  writeDirectory(parentFlc, directory, numBytes);
+  closeDirectory(directory);
+
+  if (chain->isDirectory)
+  {
+    setDotEntry(flc, 0, flc);
+    for (i = 0; i < numChains; i++)
+    {
+      if (chains[i].parent == index && chains[i].isDirectory)
+        setDotEntry(chains[i].clusters[0], 1, flc);
+    }
+  }
+}
+
+/******************************************************************************
+ * setDotEntry - set where a directory's '.' or '..' entry points.
+ *
+ * directoryFlc - the first logical cluster of the directory
+ * dotIndex - 0 for the '.' entry, 1 for the '..' entry
+ * flc - the first logical cluster for the entry to point to
+ *****************************************************************************/
+static void setDotEntry(unsigned int directoryFlc, int dotIndex,
+                        unsigned int flc)
+{
+  unsigned int numBytes;
+  DirectoryEntry* directory = readDirectory(directoryFlc, &numBytes);
+
+  if (directory[dotIndex].name[0] == '.')
+  {
+    setEntryCluster(&directory[dotIndex], flc);
+    writeDirectory(directoryFlc, directory, numBytes);
+  }
+  closeDirectory(directory);
+}
+
+/******************************************************************************
+ * reportFragmentation - print how fragmented the chains are, and how long it
+ *                       takes to read them all in order.
+ *****************************************************************************/
+static void reportFragmentation(const char* label, int* order)
+{
+  unsigned int numFragmented = 0;
+  unsigned int numFragments = 0;
+  unsigned int numClustersUsed = 0;
+  unsigned int fragments;
+  unsigned int i;
+  int j;
+
+  for (j = 0; j < numChains; j++)
+  {
+    fragments = 1;
+    for (i = 1; i < chains[j].numClusters; i++)
+    {
+      if (chains[j].clusters[i] != chains[j].clusters[i - 1] + 1)
+        fragments++;
+    }
+    if (fragments > 1)
+      numFragmented++;
+    numFragments += fragments;
+    numClustersUsed += chains[j].numClusters;
+  }
+
+  double elapsedTime = timeSequentialRead(order);
+  printf("%-6s: %d chains, %u fragmented, %u fragments (%.2f per chain); "
+         "read in %.3f ms (%.2f MB/s)\n", label, numChains, numFragmented,
+         numFragments, (numChains == 0 ? 0.0 : (double) numFragments /
+         numChains), elapsedTime * 1000.0, ((double) numClustersUsed *
+         bytesPerCluster / (1024.0 * 1024.0)) / elapsedTime);
+}
+
+/******************************************************************************
+ * timeSequentialRead - read every chain in order, a run of consecutive
+ *                      clusters at a time, after asking the OS to drop the
+ *                      image from its cache.
+ *
+ * Return - the time it took, in seconds
+ *****************************************************************************/
+static double timeSequentialRead(int* order)
+{
+  unsigned int i;
+  unsigned int j;
+  int k;
+
+  flushBlockDevice(fatFileSystem.blockDevice, 0);
+  posix_fadvise(fileno(fatFileSystem.fileSystemId), 0, 0,
+                POSIX_FADV_DONTNEED);
+
+  double startTime = getTime();
+  for (k = 0; k < numChains; k++)
+  {
+    Chain* chain = &chains[order[k]];
+    for (i = 0; i < chain->numClusters; i = j)
+    {
+      for (j = i + 1; j < chain->numClusters &&
+           j - i < DEFRAG_BATCH_CLUSTERS &&
+           chain->clusters[j] == chain->clusters[j - 1] + 1; j++);
+      readClusters(chain->clusters[i], j - i, readBuffer);
+    }
+  }
+  return getTime() - startTime;
+}
+
+/******************************************************************************
+ * getTime - get the current time, in seconds.
+ *****************************************************************************/
+static double getTime()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + (now.tv_nsec / 1.0e9);
+}
@@ -17,18 +17,28 @@
 
 int main(int argc, char* argv[])
 {
-  if (initializeFatFileSystem() != 0)
+  if (initializeFatFileSystem(FAT_LOCK_SHARED) != 0)
     return -1;
   
-  unsigned short totalBlocks;
-  unsigned short numUsedBlocks;
+  unsigned int totalBlocks;
+  unsigned int numUsedBlocks;
   
   getNumberOfUsedBlocks(&numUsedBlocks, &totalBlocks);
   
-  unsigned short numAvailableBlocks = totalBlocks - numUsedBlocks;
+  unsigned int numAvailableBlocks = totalBlocks - numUsedBlocks;
   float usePercent = ((float) numUsedBlocks / (float) totalBlocks) * 100.0f;
   
-  printf("%15s%10s%15s%11s\n", "512K-blocks", "Used", "Available", "Use %");
+  // The blocks are clusters, named as GNU df names its block sizes. A
+  // cluster is at least one 512-byte sector.
+  unsigned int bytesPerCluster = fatFileSystem.geometry.bytesPerCluster;
+  char blocksHeader[16];
+  if (bytesPerCluster % 1024 == 0)
+    snprintf(blocksHeader, sizeof(blocksHeader), "%uK-blocks",
+             bytesPerCluster / 1024);
+  else
+    snprintf(blocksHeader, sizeof(blocksHeader), "%uB-blocks",
+             bytesPerCluster);
+  printf("%15s%10s%15s%11s\n", blocksHeader, "Used", "Available", "Use %");
   printf("%15u%10u%15u%11.2f\n", totalBlocks, numUsedBlocks,
          numAvailableBlocks, usePercent);  
   
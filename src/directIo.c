@@ -0,0 +1,607 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function definitions for direct I/O mode.
+ *
+ *              The cache is a hash table of blocks numbered by their offset
+ *              in the image, kept in least recently used order, with their
+ *              aligned buffers allocated the first time each is used.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#define _GNU_SOURCE // for O_DIRECT
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "directIo.h"
+#include "fat.h"
+
+
+//-----------------------------------------------------------------------------
+// Definitions
+//-----------------------------------------------------------------------------
+
+// The number of hash table buckets (a power of 2).
+#define DIRECT_IO_HASH_SIZE 256
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * CacheBlock - a block of the image in the cache.
+ *****************************************************************************/
+typedef struct CacheBlock
+{
+  long long          number; // the block's offset in the image / blockSize
+  unsigned char*     data; // aligned, blockSize bytes long
+  int                isUsed;
+  struct CacheBlock* newer; // in least recently used order
+  struct CacheBlock* older;
+  struct CacheBlock* nextInBucket;
+} CacheBlock;
+
+
+//-----------------------------------------------------------------------------
+// Variables
+//-----------------------------------------------------------------------------
+
+static int             directFd = -1;
+static unsigned int    alignment;
+static unsigned int    blockSize;
+static long long       imageSize;
+
+// How the image was left when it was last unlocked.
+static unsigned int    numWriteUnlocks;
+static struct timespec modifiedTime;
+
+// The block after the last run read, where a sequential reader (such as cat)
+// will read next.
+static long long       readAheadBlock = -1;
+
+// Guards the cache, which threads (such as fsck's) share.
+static pthread_mutex_t cacheMutex = PTHREAD_MUTEX_INITIALIZER;
+static CacheBlock      blocks[DIRECT_IO_CACHE_BLOCKS];
+static CacheBlock*     buckets[DIRECT_IO_HASH_SIZE];
+static CacheBlock*     newestBlock;
+static CacheBlock*     oldestBlock;
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * getAlignment - Get the alignment O_DIRECT needs for an open file.
+ *
+ * fd - the file
+ *
+ * Return - the alignment in bytes, or 0 if the file doesn't support O_DIRECT
+ *****************************************************************************/
+static unsigned int getAlignment(int fd);
+
+/******************************************************************************
+ * findBlock - Look up a block in the cache, making it the most recently
+ *             used.
+ *
+ * number - the block's number
+ *
+ * Return - the block, or NULL if it isn't cached
+ *****************************************************************************/
+static CacheBlock* findBlock(long long number);
+
+/******************************************************************************
+ * takeBlock - Reuse the least recently used block for another block of the
+ *             image, without reading it.
+ *
+ * number - the block's number
+ *
+ * Return - the block, or NULL if its buffer couldn't be allocated
+ *****************************************************************************/
+static CacheBlock* takeBlock(long long number);
+
+/******************************************************************************
+ * dropBlock - Remove a block from the cache.
+ *
+ * block - the block
+ *
+ * Return - none
+ *****************************************************************************/
+static void dropBlock(CacheBlock* block);
+
+/******************************************************************************
+ * loadBlocks - Read a run of blocks that aren't cached into the cache, with
+ *              one read.
+ *
+ * number - the number of the first block
+ * numBlocks - the number of blocks, up to DIRECT_IO_MAX_RUN_BLOCKS
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int loadBlocks(long long number, unsigned int numBlocks);
+
+/******************************************************************************
+ * writeBlocks - Write the aligned units holding a range of bytes of a run of
+ *               cached blocks to the image, with one write.
+ *
+ * runBlocks - the blocks, one after another in the image
+ * numBlocks - the number of blocks
+ * start - the offset of the first byte in the first block
+ * end - the offset just past the last byte in the last block
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int writeBlocks(CacheBlock** runBlocks, unsigned int numBlocks,
+                       unsigned int start, unsigned int end);
+
+
+//-----------------------------------------------------------------------------
+// Direct I/O interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * openDirectIo
+ *****************************************************************************/
+int openDirectIo(const char* fileName, int isWritable)
+{
+  struct stat imageStat;
+  unsigned char byte;
+  int i;
+
+  if (directFd != -1)
+    return 0;
+
+  directFd = open(fileName, (isWritable ? O_RDWR : O_RDONLY) | O_DIRECT);
+  if (directFd == -1 || fstat(directFd, &imageStat) != 0 ||
+      (alignment = getAlignment(directFd)) == 0)
+  {
+    closeDirectIo();
+    return -1;
+  }
+  imageSize = imageStat.st_size;
+  blockSize = (alignment > DIRECT_IO_BLOCK_SIZE ? alignment :
+               DIRECT_IO_BLOCK_SIZE);
+
+  // Every block starts out unused, at the old end of the list.
+  memset(blocks, 0, sizeof(blocks));
+  memset(buckets, 0, sizeof(buckets));
+  for (i = 0; i < DIRECT_IO_CACHE_BLOCKS; i++)
+  {
+    blocks[i].newer = (i > 0 ? &blocks[i - 1] : NULL);
+    blocks[i].older = (i + 1 < DIRECT_IO_CACHE_BLOCKS ? &blocks[i + 1] :
+                       NULL);
+  }
+  newestBlock = &blocks[0];
+  oldestBlock = &blocks[DIRECT_IO_CACHE_BLOCKS - 1];
+  readAheadBlock = -1;
+
+  // Some file systems accept O_DIRECT but then fail every read.
+  if (readDirectIo(0, 1, &byte) == -1)
+  {
+    closeDirectIo();
+    return -1;
+  }
+  return 0;
+}
+
+/******************************************************************************
+ * closeDirectIo
+ *****************************************************************************/
+void closeDirectIo()
+{
+  int i;
+
+  if (directFd == -1)
+    return;
+  close(directFd);
+  directFd = -1;
+  for (i = 0; i < DIRECT_IO_CACHE_BLOCKS; i++)
+  {
+    free(blocks[i].data);
+    blocks[i].data = NULL;
+  }
+}
+
+/******************************************************************************
+ * readDirectIo
+ *****************************************************************************/
+long long readDirectIo(long long offset, unsigned int numBytes,
+                       unsigned char* buffer)
+{
+  long long number = offset / blockSize;
+  long long lastNumber = (offset + numBytes - 1) / blockSize;
+  unsigned int numCopied = 0;
+  unsigned int numMissing;
+  CacheBlock* block;
+
+  if (numBytes == 0)
+    return 0;
+
+  pthread_mutex_lock(&cacheMutex);
+  while (number <= lastNumber)
+  {
+    // Read the blocks that aren't cached a run at a time. When reading
+    // carries on from the last run, keep going past what was asked for (up
+    // to the end of the image), since the rest is likely to be read next.
+    block = findBlock(number);
+    if (block == NULL)
+    {
+      long long endNumber = lastNumber;
+      if (number == readAheadBlock)
+        endNumber = (imageSize - 1) / blockSize;
+      for (numMissing = 1; number + numMissing <= endNumber &&
+           numMissing < DIRECT_IO_MAX_RUN_BLOCKS &&
+           findBlock(number + numMissing) == NULL; numMissing++);
+      if (loadBlocks(number, numMissing) != 0)
+      {
+        pthread_mutex_unlock(&cacheMutex);
+        return -1;
+      }
+      readAheadBlock = number + numMissing;
+      block = findBlock(number);
+    }
+
+    // Copy out the part of the block asked for.
+    unsigned int start = (unsigned int) ((offset + numCopied) -
+                                         (number * blockSize));
+    unsigned int numToCopy = blockSize - start;
+    if (numToCopy > numBytes - numCopied)
+      numToCopy = numBytes - numCopied;
+    memcpy(buffer + numCopied, block->data + start, numToCopy);
+    numCopied += numToCopy;
+    number++;
+  }
+  pthread_mutex_unlock(&cacheMutex);
+
+  // Like read(), stop counting at the end of the image.
+  if (offset >= imageSize)
+    return 0;
+  if (offset + numBytes > imageSize)
+    return imageSize - offset;
+  return numBytes;
+}
+
+/******************************************************************************
+ * writeDirectIo
+ *****************************************************************************/
+long long writeDirectIo(long long offset, unsigned int numBytes,
+                        unsigned char* buffer)
+{
+  CacheBlock* runBlocks[DIRECT_IO_MAX_RUN_BLOCKS];
+  unsigned int numRunBlocks = 0;
+  unsigned int runStart = 0;
+  long long number = offset / blockSize;
+  long long lastNumber = (offset + numBytes - 1) / blockSize;
+  unsigned int numCopied = 0;
+  CacheBlock* block;
+
+  if (numBytes == 0)
+    return 0;
+
+  pthread_mutex_lock(&cacheMutex);
+  for (; number <= lastNumber; number++)
+  {
+    unsigned int start = (unsigned int) ((offset + numCopied) -
+                                         (number * blockSize));
+    unsigned int numToCopy = blockSize - start;
+    if (numToCopy > numBytes - numCopied)
+      numToCopy = numBytes - numCopied;
+
+    // A block being overwritten completely doesn't need to be read first.
+    block = findBlock(number);
+    if (block == NULL && start == 0 && numToCopy == blockSize)
+      block = takeBlock(number);
+    else if (block == NULL && loadBlocks(number, 1) == 0)
+      block = findBlock(number);
+    if (block == NULL)
+    {
+      pthread_mutex_unlock(&cacheMutex);
+      return -1;
+    }
+    memcpy(block->data + start, buffer + numCopied, numToCopy);
+    numCopied += numToCopy;
+
+    // Write the blocks changed so far once there are enough of them, or
+    // they're all changed.
+    if (numRunBlocks == 0)
+      runStart = start;
+    runBlocks[numRunBlocks++] = block;
+    if (numRunBlocks == DIRECT_IO_MAX_RUN_BLOCKS || number == lastNumber)
+    {
+      if (writeBlocks(runBlocks, numRunBlocks, runStart,
+                      start + numToCopy) != 0)
+      {
+        pthread_mutex_unlock(&cacheMutex);
+        return -1;
+      }
+      numRunBlocks = 0;
+    }
+  }
+  pthread_mutex_unlock(&cacheMutex);
+  return numBytes;
+}
+
+/******************************************************************************
+ * suspendDirectIoCache
+ *****************************************************************************/
+void suspendDirectIoCache()
+{
+  struct stat imageStat;
+
+  if (directFd == -1)
+    return;
+  numWriteUnlocks = fatFileSystem.session->numWriteUnlocks;
+  if (fstat(directFd, &imageStat) == 0)
+    modifiedTime = imageStat.st_mtim;
+  else
+    numWriteUnlocks--; // so it can't match
+}
+
+/******************************************************************************
+ * resumeDirectIoCache
+ *****************************************************************************/
+void resumeDirectIoCache()
+{
+  struct stat imageStat;
+  int i;
+
+  if (directFd == -1)
+    return;
+
+  // Other commands in the session count their exclusive locks, and anyone
+  // else writing to the image changes its modification time.
+  if (numWriteUnlocks == fatFileSystem.session->numWriteUnlocks &&
+      fstat(directFd, &imageStat) == 0 &&
+      imageStat.st_mtim.tv_sec == modifiedTime.tv_sec &&
+      imageStat.st_mtim.tv_nsec == modifiedTime.tv_nsec)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&cacheMutex);
+  for (i = 0; i < DIRECT_IO_CACHE_BLOCKS; i++)
+  {
+    if (blocks[i].isUsed)
+      dropBlock(&blocks[i]);
+  }
+  readAheadBlock = -1;
+  if (fstat(directFd, &imageStat) == 0)
+    imageSize = imageStat.st_size;
+  pthread_mutex_unlock(&cacheMutex);
+}
+
+
+//-----------------------------------------------------------------------------
+// Internal Functions
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * getAlignment
+ *****************************************************************************/
+static unsigned int getAlignment(int fd)
+{
+#ifdef STATX_DIOALIGN
+  struct statx fileStatx;
+
+  // The file system knows what it needs (0 if it can't do O_DIRECT at all).
+  if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &fileStatx) == 0 &&
+      (fileStatx.stx_mask & STATX_DIOALIGN))
+  {
+    if (fileStatx.stx_dio_offset_align == 0)
+      return 0;
+    return (fileStatx.stx_dio_mem_align > fileStatx.stx_dio_offset_align ?
+            fileStatx.stx_dio_mem_align : fileStatx.stx_dio_offset_align);
+  }
+#endif
+  return DIRECT_IO_DEFAULT_ALIGNMENT;
+}
+
+/******************************************************************************
+ * findBlock
+ *****************************************************************************/
+static CacheBlock* findBlock(long long number)
+{
+  CacheBlock* block = buckets[number & (DIRECT_IO_HASH_SIZE - 1)];
+
+  while (block != NULL && block->number != number)
+    block = block->nextInBucket;
+  if (block == NULL || block == newestBlock)
+    return block;
+
+  // Move it to the new end of the list.
+  block->newer->older = block->older;
+  if (block->older != NULL)
+    block->older->newer = block->newer;
+  else
+    oldestBlock = block->newer;
+  block->newer = NULL;
+  block->older = newestBlock;
+  newestBlock->newer = block;
+  newestBlock = block;
+  return block;
+}
+
+/******************************************************************************
+ * takeBlock
+ *****************************************************************************/
+static CacheBlock* takeBlock(long long number)
+{
+  CacheBlock* block = oldestBlock;
+  void* data;
+
+  if (block->data == NULL)
+  {
+    if (posix_memalign(&data, alignment, blockSize) != 0)
+      return NULL;
+    block->data = (unsigned char*) data;
+  }
+  if (block->isUsed)
+    dropBlock(block);
+
+  block->number = number;
+  block->isUsed = 1;
+  block->nextInBucket = buckets[number & (DIRECT_IO_HASH_SIZE - 1)];
+  buckets[number & (DIRECT_IO_HASH_SIZE - 1)] = block;
+  findBlock(number);
+  return block;
+}
+
+/******************************************************************************
+ * dropBlock
+ *****************************************************************************/
+static void dropBlock(CacheBlock* block)
+{
+  CacheBlock** link = &buckets[block->number & (DIRECT_IO_HASH_SIZE - 1)];
+
+  while (*link != block)
+    link = &(*link)->nextInBucket;
+  *link = block->nextInBucket;
+  block->nextInBucket = NULL;
+  block->isUsed = 0;
+}
+
+/******************************************************************************
+ * loadBlocks
+ *****************************************************************************/
+static int loadBlocks(long long number, unsigned int numBlocks)
+{
+  CacheBlock* runBlocks[DIRECT_IO_MAX_RUN_BLOCKS];
+  struct iovec vectors[DIRECT_IO_MAX_RUN_BLOCKS];
+  size_t numWanted = (size_t) numBlocks * blockSize;
+  size_t numRead = 0;
+  ssize_t numTransferred;
+  unsigned int i;
+
+  for (i = 0; i < numBlocks; i++)
+  {
+    runBlocks[i] = takeBlock(number + i);
+    if (runBlocks[i] == NULL)
+    {
+      while (i-- > 0)
+        dropBlock(runBlocks[i]);
+      return -1;
+    }
+  }
+
+  // Read until the run is full, or the image ends.
+  while (numRead < numWanted)
+  {
+    unsigned int first = numRead / blockSize;
+    for (i = first; i < numBlocks; i++)
+    {
+      vectors[i - first].iov_base = runBlocks[i]->data;
+      vectors[i - first].iov_len = blockSize;
+    }
+    numTransferred = preadv(directFd, vectors, numBlocks - first,
+                            (number * blockSize) + numRead);
+    if (numTransferred < 0 && errno == EINTR)
+      continue;
+    if (numTransferred < 0)
+    {
+      for (i = 0; i < numBlocks; i++)
+        dropBlock(runBlocks[i]);
+      return -1;
+    }
+    numRead += numTransferred;
+    if (numTransferred == 0 || numTransferred % blockSize != 0)
+      break;
+  }
+
+  // Past the end of the image, there is nothing but zeroes.
+  for (i = numRead / blockSize; i < numBlocks; i++)
+  {
+    unsigned int numValid = (i == numRead / blockSize ? numRead % blockSize :
+                             0);
+    memset(runBlocks[i]->data + numValid, 0, blockSize - numValid);
+  }
+
+  FAT_STAT_ADD(FAT_STAT_DIRECT_IO_READS, 1);
+  return 0;
+}
+
+/******************************************************************************
+ * writeBlocks
+ *****************************************************************************/
+static int writeBlocks(CacheBlock** runBlocks, unsigned int numBlocks,
+                       unsigned int start, unsigned int end)
+{
+  struct iovec vectors[DIRECT_IO_MAX_RUN_BLOCKS];
+  long long offset;
+  long long endOffset;
+  size_t numWanted = 0;
+  size_t numWritten = 0;
+  ssize_t numTransferred;
+  unsigned int i;
+
+  // Widen the range out to whole aligned units.
+  start -= start % alignment;
+  end = ((end + alignment - 1) / alignment) * alignment;
+  for (i = 0; i < numBlocks; i++)
+  {
+    vectors[i].iov_base = runBlocks[i]->data + (i == 0 ? start : 0);
+    vectors[i].iov_len = (i == numBlocks - 1 ? end : blockSize) -
+                         (i == 0 ? start : 0);
+    numWanted += vectors[i].iov_len;
+  }
+  offset = (runBlocks[0]->number * blockSize) + start;
+  endOffset = offset + numWanted;
+
+  // An image whose size isn't a whole number of aligned units can't have
+  // its last, partial unit written with O_DIRECT, or the image would grow.
+  // It's written through the image's stream's descriptor instead (the
+  // kernel keeps the two consistent).
+  if (endOffset > imageSize)
+  {
+    int fd = fileno(fatFileSystem.fileSystemId);
+    for (i = 0; i < numBlocks && offset < imageSize; i++)
+    {
+      size_t length = vectors[i].iov_len;
+      if (offset + (long long) length > imageSize)
+        length = imageSize - offset;
+      if (pwrite(fd, vectors[i].iov_base, length, offset) !=
+          (ssize_t) length)
+        return -1;
+      offset += vectors[i].iov_len;
+    }
+    FAT_STAT_ADD(FAT_STAT_DIRECT_IO_WRITES, 1);
+    return 0;
+  }
+
+  while (numWritten < numWanted)
+  {
+    numTransferred = pwritev(directFd, vectors, numBlocks, offset);
+    if (numTransferred < 0 && errno == EINTR)
+      continue;
+    if (numTransferred <= 0)
+      return -1;
+
+    // Carry on from where a short write left off.
+    numWritten += numTransferred;
+    offset += numTransferred;
+    while (numTransferred > 0 &&
+           (size_t) numTransferred >= vectors[0].iov_len)
+    {
+      numTransferred -= vectors[0].iov_len;
+      memmove(vectors, vectors + 1, (--numBlocks) * sizeof(struct iovec));
+    }
+    if (numTransferred > 0)
+    {
+      vectors[0].iov_base = (unsigned char*) vectors[0].iov_base +
+                            numTransferred;
+      vectors[0].iov_len -= numTransferred;
+    }
+  }
+
+  FAT_STAT_ADD(FAT_STAT_DIRECT_IO_WRITES, 1);
+  return 0;
+}
@@ -0,0 +1,119 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function headers for direct I/O mode, an optional way of
+ *              mounting the disk image for images far larger than memory.
+ *
+ *              Normally sectors are read through the image's stdio stream,
+ *              so every one is copied once into the kernel's page cache and
+ *              again into the stream's buffer, and a long streaming read
+ *              pushes everything else out of the page cache. In direct I/O
+ *              mode each command opens the image with O_DIRECT instead, and
+ *              serves all sector I/O from its own small cache of aligned
+ *              blocks, read and written straight between the device and
+ *              those blocks. Runs of blocks that aren't cached are read
+ *              with a single preadv(), and writes go straight through to the
+ *              image (whole aligned units at a time) with a single
+ *              pwritev(). Between one lock of the image and the next, the
+ *              cache is only kept if no one else could have written to it.
+ *
+ *              This is the "direct" block device (see blockDevice.h). Not
+ *              every file system supports O_DIRECT (tmpfs only does on
+ *              recent kernels), in which case the session stays buffered.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#ifndef _DIRECT_IO_H_
+#define _DIRECT_IO_H_
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+
+// The environment variable that turns on direct I/O mode for a session (the
+// same as setting FAT12_BLOCK_DEVICE to direct).
+#define FAT12_DIRECT_IO_ENV_VAR "FAT12_DIRECT_IO"
+
+// The size of each block in the cache, a multiple of the alignment O_DIRECT
+// needs, and how many blocks the cache holds (8 MB in all).
+#define DIRECT_IO_BLOCK_SIZE 65536
+#define DIRECT_IO_CACHE_BLOCKS 128
+
+// The most blocks read or written with one system call.
+#define DIRECT_IO_MAX_RUN_BLOCKS 16
+
+// The alignment to use when the file system can't say what it needs.
+#define DIRECT_IO_DEFAULT_ALIGNMENT 4096
+
+
+//-----------------------------------------------------------------------------
+// Direct I/O interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * openDirectIo - Open the disk image with O_DIRECT, and make sure it can be
+ *                read that way.
+ *
+ * fileName - the image's host path name
+ * isWritable - 1 to open it for writing too, 0 for reading only
+ *
+ * Return - 0 on success, -1 if the image can't be read with O_DIRECT
+ *****************************************************************************/
+int openDirectIo(const char* fileName, int isWritable);
+
+/******************************************************************************
+ * closeDirectIo - Close the O_DIRECT descriptor and free the cache, if they
+ *                 were opened.
+ *
+ * Return - none
+ *****************************************************************************/
+void closeDirectIo();
+
+/******************************************************************************
+ * readDirectIo - Read consecutive bytes of the image through the cache.
+ *
+ * offset - where in the image to start reading
+ * numBytes - the number of bytes to read
+ * buffer - where to store them
+ *
+ * Return - the number of bytes read, or -1 on failure
+ *****************************************************************************/
+long long readDirectIo(long long offset, unsigned int numBytes,
+                       unsigned char* buffer);
+
+/******************************************************************************
+ * writeDirectIo - Write consecutive bytes to the image through the cache.
+ *                 The cached blocks are updated, and the aligned units
+ *                 holding the bytes written straight to the image.
+ *
+ * offset - where in the image to start writing
+ * numBytes - the number of bytes to write
+ * buffer - the bytes
+ *
+ * Return - the number of bytes written, or -1 on failure
+ *****************************************************************************/
+long long writeDirectIo(long long offset, unsigned int numBytes,
+                        unsigned char* buffer);
+
+/******************************************************************************
+ * suspendDirectIoCache - Remember how the image was left as it is unlocked,
+ *                        so the cache can be kept if no one changes it before
+ *                        it is locked again.
+ *
+ * Return - none
+ *****************************************************************************/
+void suspendDirectIoCache();
+
+/******************************************************************************
+ * resumeDirectIoCache - Forget every cached block if the image may have been
+ *                       changed since suspendDirectIoCache(), as it is locked
+ *                       again.
+ *
+ * Return - none
+ *****************************************************************************/
+void resumeDirectIoCache();
+
+#endif //_DIRECT_IO_H_
@@ -0,0 +1,151 @@
+/******************************************************************************
+ * du.c: Disk usage
+ *
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Performs the du command, which prints the total size of each
+ *              directory under a path (defaulting to the current working
+ *              directory), next to the space actually allocated to it. The
+ *              allocated space is counted from the lengths of the chains, so
+ *              a file holding more clusters than its size needs shows up as
+ *              allocating more than it should.
+ *
+ *              Usage: du [-a] [-s] [-j THREADS] [PATH]
+ *                -a          list files too, not just directories
+ *                -s          only print the total for PATH itself
+ *                -j THREADS  the number of threads to use (default: one per
+ *                            CPU)
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fat.h"
+#include "treeWalk.h"
+
+
+//-----------------------------------------------------------------------------
+// Variables
+//-----------------------------------------------------------------------------
+
+static int isListingFiles = 0;
+static int isSummaryOnly = 0;
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+static void usage();
+static void printUsage(TreeNode* node, char* path, size_t pathLength);
+
+
+/******************************************************************************
+ * main - runs the du command.
+ *****************************************************************************/
+int main(int argc, char* argv[])
+{
+  const char* pathName = NULL;
+  int numThreads = 0;
+  int i;
+
+  // Parse the arguments.
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-a") == 0)
+      isListingFiles = 1;
+    else if (strcmp(argv[i], "-s") == 0)
+      isSummaryOnly = 1;
+    else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+    {
+      char* endptr;
+      numThreads = strtol(argv[++i], &endptr, 10);
+      if (*endptr != '\0' || numThreads < 1)
+      {
+        printf("THREADS must be a positive number\n");
+        usage();
+        return -1;
+      }
+    }
+    else if (argv[i][0] != '-' && pathName == NULL)
+      pathName = argv[i];
+    else
+    {
+      usage();
+      return -1;
+    }
+  }
+
+  if (initializeFatFileSystem(FAT_LOCK_SHARED) != 0)
+    return -1;
+
+  // Find the path to start at.
+  FilePath filePath;
+  getWorkingDirectory(&filePath);
+  if (pathName != NULL &&
+      changeFilePath(&filePath, pathName, PATH_TYPE_ANY) != 0)
+  {
+    terminateFatFileSystem();
+    return -1;
+  }
+
+  TreeNode* root = walkTree(&filePath, numThreads);
+  if (root == NULL)
+  {
+    terminateFatFileSystem();
+    return -1;
+  }
+
+  char path[FAT12_MAX_PATH_NAME_LENGTH * 2];
+  strcpy(path, filePath.pathName);
+  printf("%12s%12s  %s\n", "Size", "Allocated", "Path");
+  printUsage(root, path, strlen(path));
+
+  freeTree(root);
+  terminateFatFileSystem();
+  return 0;
+}
+
+/******************************************************************************
+ * usage - prints the usage statement.
+ *****************************************************************************/
+static void usage()
+{
+  printf("Usage: du [-a] [-s] [-j THREADS] [PATH]\n");
+  printf("Prints the size and allocated space of each directory.\n");
+}
+
+/******************************************************************************
+ * printUsage - print the totals of everything under a node, then of the node
+ *              itself.
+ *
+ * node - the node
+ * path - the node's path name, in a buffer long enough to add to
+ * pathLength - the length of the path name
+ *****************************************************************************/
+static void printUsage(TreeNode* node, char* path, size_t pathLength)
+{
+  unsigned int i;
+
+  if (!isSummaryOnly)
+  {
+    for (i = 0; i < node->numChildren; i++)
+    {
+      TreeNode* child = &node->children[i];
+      if (!child->isDirectory && !isListingFiles)
+        continue;
+
+      size_t childLength = pathLength;
+      if (path[childLength - 1] != '/')
+        path[childLength++] = '/';
+      strcpy(path + childLength, child->name);
+      printUsage(child, path, childLength + strlen(child->name));
+      path[pathLength] = '\0';
+    }
+  }
+
+  printf("%12llu%12llu  %s\n", node->totalSize, getAllocatedSize(node), path);
+}
@@ -7,15 +7,24 @@
  * I certify that this assignment is entirely my own work.
  ****************************************************************************/
 
+#define _GNU_SOURCE // for program_invocation_short_name
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/ipc.h>
-#include <sys/shm.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "fat.h"
+#include "overlay.h"
 
 
 //-----------------------------------------------------------------------------
@@ -41,10 +50,12 @@ static int loadBootSector();
  *
  * fatIndex - the index of the FAT table to load (because there are multiple
  *            FAT tables)  
+ * fatTable - the buffer to read the table into, which must be at least
+ *            sectorsPerFAT * bytesPerSector bytes long
  *
- * Return - a pointer to the FAT table's data. this must be freed with
+ * Return - 0 on success, -1 on failure
  *****************************************************************************/
-static unsigned char* readFatTable(int fatIndex);
+static int readFatTable(int fatIndex, unsigned char* fatTable);
 
 /******************************************************************************
  * writeFatTable - write a FAT table to disk.
@@ -52,29 +63,199 @@ static unsigned char* readFatTable(int fatIndex);
  * fatIndex - the index of the FAT table to write to
  * unsigned char* fatTable - the FAT table's data to write to disk
  *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int writeFatTable(int fatIndex, unsigned char* fatTable);
+
+/******************************************************************************
+ * loadSessionFatTable - read the first FAT table from disk into the session's
+ *                       shared copy and rebuild the free-cluster bitmap.
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int loadSessionFatTable();
+
+/******************************************************************************
+ * refreshSessionFatTable - make sure the session's shared FAT table matches
+ *                          the disk image, reloading it if another process
+ *                          outside of this session has changed the image.
+ *                          The image must be locked.
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int refreshSessionFatTable();
+
+/******************************************************************************
+ * getImageSignature - get the size, inode and modification time of the open
+ *                     disk image (and of its delta, if it has a snapshot),
+ *                     used to tell if it changed on disk.
+ *
+ * signature - the resulting signature
+ *
+ * Return - none
+ *****************************************************************************/
+static void getImageSignature(FatImageSignature* signature);
+
+/******************************************************************************
+ * lockSessionMutex - lock the session's process-shared mutex, which guards
+ *                    reloading and flushing of the shared FAT table.
+ *
+ * Return - none
+ *****************************************************************************/
+static void lockSessionMutex();
+
+/******************************************************************************
+ * unlockSessionMutex - unlock the session's process-shared mutex.
+ *
  * Return - none
  *****************************************************************************/
-static void writeFatTable(int fatIndex, unsigned char* fatTable);
+static void unlockSessionMutex();
+
+/******************************************************************************
+ * attachFatSession - map the shared memory segment of the session named in
+ *                    the FAT12_SESSION environment variable.
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int attachFatSession();
 
 /******************************************************************************
- * freeFatTable - free the allocated memory of a FAT table.
+ * detachFatSession - unmap the session's shared memory segment.
  *
- * fatTable - a pointer to the FAT table's data that was allocated with
- *           readFatTable()
+ * Return - none
+ *****************************************************************************/
+static void detachFatSession();
+
+/******************************************************************************
+ * removeStaleSessions - unlink the shared memory segments (the session's,
+ *                       and its memory image's) left behind by shells that
+ *                       exited without destroying their sessions, such as
+ *                       by crashing. A segment is stale once no process has
+ *                       the PID in its name.
  *
  * Return - none
  *****************************************************************************/
-static void freeFatTable(unsigned char* fatTable);
+static void removeStaleSessions();
 
 /******************************************************************************
- * logicalToPhysicalCluster - Translate a logical cluster number to a physical
- *                            cluster number.
+ * flushRootDirectory - write the sectors of the root directory region that
+ *                      this command changed.
  *
- * entryNumber - logicalCluster
- * 
- * Return - the corresponding physical cluster number
+ * Return - none
+ *****************************************************************************/
+static void flushRootDirectory();
+
+/******************************************************************************
+ * flushFatSectors - write the sectors of the FAT table that this command
+ *                   changed to every copy of the FAT, so that other sessions
+ *                   find them in the image once it is unlocked. A journaled
+ *                   session leaves them in its journal instead.
+ *
+ * Return - none
+ *****************************************************************************/
+static void flushFatSectors();
+
+/******************************************************************************
+ * getNumRootDirectorySectors - get the number of sectors in the root
+ *                              directory region.
+ *
+ * Return - the number of sectors
+ *****************************************************************************/
+static unsigned int getNumRootDirectorySectors();
+
+/******************************************************************************
+ * resolveRootCluster - get the start of the chain to follow for a first
+ *                      logical cluster, where 0 means the root directory. On
+ *                      FAT32 the root directory is an ordinary chain, so 0 is
+ *                      replaced with the cluster named in the boot sector.
+ *
+ * flc - the first logical cluster
+ *
+ * Return - the first logical cluster to use (still 0 for the fixed root
+ *          directory region of FAT12 and FAT16)
+ *****************************************************************************/
+static unsigned int resolveRootCluster(unsigned int flc);
+
+/******************************************************************************
+ * writeFsInfo - update the free-cluster hints in a FAT32 image's FSInfo
+ *               sector, if it has a valid one.
+ *
+ * Return - none
+ *****************************************************************************/
+static void writeFsInfo();
+
+/******************************************************************************
+ * finishLockingFatFileSystem - record that the image is now locked and, when
+ *                              re-locking in the middle of a command, catch
+ *                              up with changes made while it wasn't.
+ *
+ * lockMode - FAT_LOCK_SHARED or FAT_LOCK_EXCLUSIVE
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int finishLockingFatFileSystem(int lockMode);
+
+/******************************************************************************
+ * writeSessionFatTable - checkpoint the journal (which already holds every
+ *                        changed FAT sector), then write the session's FAT
+ *                        table to every FAT copy and make sure it reaches
+ *                        the disk. The image must be locked exclusively, and
+ *                        the session's mutex held.
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int writeSessionFatTable();
+
+/******************************************************************************
+ * advanceImageModifiedTime - make sure the image's modification time has
+ *                            moved on since it was locked exclusively, so
+ *                            that other sessions notice the change even when
+ *                            the host's clock hasn't ticked in between.
+ *
+ * Return - none
+ *****************************************************************************/
+static void advanceImageModifiedTime();
+
+/******************************************************************************
+ * rememberFreedCluster - add a cluster this command freed to the ones to
+ *                        discard when it unlocks.
+ *
+ * cluster - the cluster
+ *
+ * Return - none
+ *****************************************************************************/
+static void rememberFreedCluster(unsigned int cluster);
+
+/******************************************************************************
+ * compareClusters - order cluster numbers from lowest to highest, for
+ *                   qsort().
+ *****************************************************************************/
+static int compareClusters(const void* a, const void* b);
+
+/******************************************************************************
+ * discardFreedClusters - discard each run of the clusters this command freed
+ *                        that are still free.
+ *
+ * Return - none
  *****************************************************************************/
-unsigned short logicalToPhysicalCluster(unsigned short logicalCluster);
+static void discardFreedClusters();
+
+/******************************************************************************
+ * discardCheckpointedClusters - discard each run of the clusters in the
+ *                               session's discard map that are still free,
+ *                               once a checkpoint has made their freeing
+ *                               durable, and empty the map.
+ *
+ * Return - none
+ *****************************************************************************/
+static void discardCheckpointedClusters();
+
+/******************************************************************************
+ * closeDiskImage - close the disk image's block device and stream.
+ *
+ * Return - none
+ *****************************************************************************/
+static void closeDiskImage();
 
 
 //-----------------------------------------------------------------------------
@@ -82,47 +263,146 @@ unsigned short logicalToPhysicalCluster(unsigned short logicalCluster);
 //-----------------------------------------------------------------------------
 
 /******************************************************************************
- * initializeFatFileSystem
+ * createFatSession
  *****************************************************************************/
-int initializeFatFileSystem()
+int createFatSession(const char* diskImageFileName)
 {
-  // Setup the shared memory.
-  key_t key = FAT12_SHARED_MEMORY_KEY;
-  fatFileSystem.sharedMemoryId = shmget(key, 1024, 0666);
-  if (fatFileSystem.sharedMemoryId == -1)
+  char sessionName[64];
+  unsigned int fatTableSize;
+  unsigned int numClusters;
+  unsigned int freeMapSize;
+  unsigned int rootDirectorySize;
+  unsigned int size;
+  pthread_mutexattr_t mutexAttributes;
+  int fd;
+  
+  if (strlen(diskImageFileName) >= FAT12_MAX_IMAGE_PATH_LENGTH)
   {
-    perror("Error creating shared memory segment");
+    printf("Error: %s: disk image path name is too long\n", diskImageFileName);
     return -1;
   }
-  fatFileSystem.sharedMemoryPtr = shmat(fatFileSystem.sharedMemoryId, (void *) 0, 0);
-  if (fatFileSystem.sharedMemoryPtr == (void*) -1)
+  
+  // Read the boot sector to find out how large the FAT table is, so the
+  // segment can be sized to hold it. The image is opened for writing, if
+  // possible, in case a journal has to be replayed, and locked before
+  // anything is read from it, since the stream reads ahead into the FAT.
+  fatFileSystem.fileSystemId = fopen(diskImageFileName, "r+");
+  if (fatFileSystem.fileSystemId == NULL)
+    fatFileSystem.fileSystemId = fopen(diskImageFileName, "r");
+  if (fatFileSystem.fileSystemId == NULL)
   {
-    perror("Error attaching shared memory segment");
+    printf("Could not open the floppy drive or image.\n");
     return -1;
   }
-  fatFileSystem.diskImageFileName = fatFileSystem.sharedMemoryPtr;
-  fatFileSystem.workingDirectoryPathName = fatFileSystem.sharedMemoryPtr + 512;
-
-  // Open the disk image file.
-  fatFileSystem.fileSystemId = fopen(fatFileSystem.diskImageFileName, "r+");
-  if (fatFileSystem.fileSystemId == NULL)
+  if (lockFatFileSystem(FAT_LOCK_EXCLUSIVE) != 0)
   {
-    printf("Could not open the floppy drive or image.\n");
+    printf("Could not lock the floppy drive or image.\n");
+    fclose(fatFileSystem.fileSystemId);
     return -1;
   }
-
-  // Load the boot sector.
+  fatFileSystem.blockDevice = openBlockDevice(BLOCK_DEVICE_STDIO,
+    fatFileSystem.fileSystemId, diskImageFileName, NULL, 1);
   if (loadBootSector() != 0)
   {
     printf("Something has gone wrong -- could not read the boot table\n");
+    closeDiskImage();
     return -1;
   }
-
-  // Read the first FAT table.
-  fatFileSystem.fatTable = readFatTable(0);
-  if (fatFileSystem.fatTable == NULL)
+  
+  fatTableSize = fatFileSystem.bootSector.bytesPerSector *
+                 fatFileSystem.geometry.sectorsPerFAT;
+  numClusters = fatFileSystem.geometry.numClusters;
+  freeMapSize = (numClusters + 7) / 8;
+  rootDirectorySize = getNumRootDirectorySectors() *
+                      fatFileSystem.bootSector.bytesPerSector;
+  size = sizeof(FatSession) + fatTableSize + (2 * freeMapSize) +
+         rootDirectorySize;
+  
+  // Create the shared memory segment, named after this process, and clean
+  // up after shells that crashed while we're at it.
+  removeStaleSessions();
+  snprintf(sessionName, sizeof(sessionName), "%s%d",
+           FAT12_SESSION_NAME_PREFIX, (int) getpid());
+  fd = shm_open(sessionName, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd == -1)
+  {
+    perror("Error creating shared memory segment");
+    closeDiskImage();
+    return -1;
+  }
+  if (ftruncate(fd, size) == -1)
+  {
+    perror("Error sizing shared memory segment");
+    close(fd);
+    shm_unlink(sessionName);
+    closeDiskImage();
+    return -1;
+  }
+  fatFileSystem.session = (FatSession*) mmap(NULL, size,
+    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (fatFileSystem.session == MAP_FAILED)
+  {
+    perror("Error attaching shared memory segment");
+    shm_unlink(sessionName);
+    closeDiskImage();
+    return -1;
+  }
+  
+  // Initialize the disk image path and current working directory.
+  memset(fatFileSystem.session, 0, sizeof(FatSession));
+  fatFileSystem.session->size = size;
+  fatFileSystem.session->fatTableOffset = sizeof(FatSession);
+  fatFileSystem.session->fatTableSize = fatTableSize;
+  fatFileSystem.session->freeMapOffset = sizeof(FatSession) + fatTableSize;
+  fatFileSystem.session->rootDirectoryOffset =
+    fatFileSystem.session->freeMapOffset + freeMapSize;
+  fatFileSystem.session->rootDirectorySize = rootDirectorySize;
+  fatFileSystem.session->discardMapOffset =
+    fatFileSystem.session->rootDirectoryOffset + rootDirectorySize;
+  fatFileSystem.session->numClusters = numClusters;
+  strcpy(fatFileSystem.session->diskImageFileName, diskImageFileName);
+  initFilePath(&fatFileSystem.session->workingDirectory);
+  fatFileSystem.session->isWorkingDirectoryResolved = 1;
+  fatFileSystem.diskImageFileName = fatFileSystem.session->diskImageFileName;
+  fatFileSystem.workingDirectoryPathName =
+    fatFileSystem.session->workingDirectory.pathName;
+  
+  // The mutex is robust, so a command that dies while holding it can't
+  // hang the rest of the session.
+  pthread_mutexattr_init(&mutexAttributes);
+  pthread_mutexattr_setpshared(&mutexAttributes, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&mutexAttributes, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(&fatFileSystem.session->mutex, &mutexAttributes);
+  pthread_mutexattr_destroy(&mutexAttributes);
+  
+  // Finish any transactions left in the journal by a crash, then load the
+  // FAT table and root directory into the session once, for all commands to
+  // share.
+  fatFileSystem.fatTable = (unsigned char*) fatFileSystem.session +
+                           fatFileSystem.session->fatTableOffset;
+  fatFileSystem.freeClusterMap = (unsigned char*) fatFileSystem.session +
+                                 fatFileSystem.session->freeMapOffset;
+  fatFileSystem.rootDirectoryRegion = (unsigned char*) fatFileSystem.session +
+                                      fatFileSystem.session->rootDirectoryOffset;
+  fatFileSystem.discardMap = (unsigned char*) fatFileSystem.session +
+                             fatFileSystem.session->discardMapOffset;
+  if (replayFatJournal() < 0 ||
+      loadSessionFatTable() != 0)
   {
     printf("Something has gone wrong -- could not read the FAT table\n");
+    closeDiskImage();
+    destroyFatSession();
+    return -1;
+  }
+  unlockFatFileSystem();
+  closeDiskImage();
+  
+  // Let command processes find the session.
+  if (setenv(FAT12_SESSION_ENV_VAR, sessionName, 1) != 0)
+  {
+    perror("Error exporting the session name");
+    destroyFatSession();
     return -1;
   }
   
@@ -130,133 +410,519 @@ int initializeFatFileSystem()
 }
 
 /******************************************************************************
- * terminateFatFileSystem
+ * destroyFatSession
  *****************************************************************************/
-void terminateFatFileSystem()
+void destroyFatSession()
 {
-  writeFatTable(0, fatFileSystem.fatTable);
-  freeFatTable(fatFileSystem.fatTable);
-  fclose(fatFileSystem.fileSystemId);
-  shmdt(fatFileSystem.sharedMemoryPtr);
+  char sessionName[64];
+  
+  // The segment is always named after the shell that created it.
+  snprintf(sessionName, sizeof(sessionName), "%s%d",
+           FAT12_SESSION_NAME_PREFIX, (int) getpid());
+  
+  if (fatFileSystem.session != NULL &&
+      fatFileSystem.session->memoryImageName[0] != '\0')
+  {
+    destroyMemoryImage(fatFileSystem.session->memoryImageName);
+  }
+  detachFatSession();
+  shm_unlink(sessionName);
+  unsetenv(FAT12_SESSION_ENV_VAR);
 }
 
 /******************************************************************************
- * getFatBootSector
+ * syncFatSession
  *****************************************************************************/
-void getFatBootSector(FatBootSector* bootSector)
+int syncFatSession()
 {
-   memcpy(bootSector, &fatFileSystem.bootSector, sizeof(FatBootSector));
+  FatSession* session = fatFileSystem.session;
+  int rc = 0;
+  
+  if (session->flushedGeneration == session->generation &&
+      session->journal.numTransactions == 0)
+  {
+    return 0;
+  }
+  
+  fatFileSystem.fileSystemId = fopen(fatFileSystem.diskImageFileName, "r+");
+  if (fatFileSystem.fileSystemId == NULL)
+  {
+    printf("Could not open the floppy drive or image.\n");
+    return -1;
+  }
+  fatFileSystem.blockDevice = openBlockDevice(session->blockDeviceType,
+    fatFileSystem.fileSystemId, fatFileSystem.diskImageFileName,
+    session->memoryImageName, 1);
+  if (fatFileSystem.blockDevice == NULL ||
+      lockFatFileSystem(FAT_LOCK_EXCLUSIVE) != 0)
+  {
+    closeDiskImage();
+    return -1;
+  }
+  
+  // Another session may have changed the image since our last command.
+  // Pick up its changes rather than writing over them; ours are in the
+  // image already.
+  if (refreshSessionFatTable() != 0)
+  {
+    unlockFatFileSystem();
+    closeDiskImage();
+    return -1;
+  }
+  
+  lockSessionMutex();
+  rc = writeSessionFatTable();
+  getImageSignature(&session->imageSignature);
+  unlockSessionMutex();
+  
+  unlockFatFileSystem();
+  closeDiskImage();
+  return rc;
 }
 
 /******************************************************************************
- * getNumberOfUsedBlocks
+ * setFatBlockDevice
  *****************************************************************************/
-void getNumberOfUsedBlocks(unsigned short* numUsedBlocks,
-                           unsigned short* totalBlocks)
+int setFatBlockDevice(int type)
 {
-  unsigned short entryNumber;
-  unsigned short entryValue;
-  int entryType;
+  FatSession* session = fatFileSystem.session;
+  FILE* stream = fopen(fatFileSystem.diskImageFileName, "r");
+  BlockDevice* device = NULL;
+  unsigned char byte;
+  int rc = -1;
   
-  unsigned short totalEntries = (unsigned short)
-    (fatFileSystem.bootSector.totalSectorCount -
-    fatFileSystem.sectorOffsets.dataRegion + 2);
+  if (stream == NULL)
+  {
+    printf("Could not open the floppy drive or image.\n");
+    return -1;
+  }
   
-  *totalBlocks = totalEntries - 2;
-  *numUsedBlocks = 0;
+  // A memory device needs its copy of the image made first, named after
+  // the session.
+  if (type == BLOCK_DEVICE_MEMORY && session->memoryImageName[0] == '\0')
+  {
+    snprintf(session->memoryImageName, sizeof(session->memoryImageName),
+             "%s%d-image", FAT12_SESSION_NAME_PREFIX, (int) getpid());
+    if (createMemoryImage(stream, session->memoryImageName) != 0)
+      session->memoryImageName[0] = '\0';
+  }
   
-  for (entryNumber = 2; entryNumber < totalEntries; entryNumber++)
+  // Make sure the image can at least be read that way.
+  device = openBlockDevice(type, stream, fatFileSystem.diskImageFileName,
+                           session->memoryImageName, 0);
+  if (device != NULL && readBlockDevice(device, 0, 1, &byte) == 1)
   {
-    getFatEntry(entryNumber, &entryValue, &entryType);
-    if (entryType != FAT_ENTRY_TYPE_UNUSED)
-      (*numUsedBlocks)++;
+    session->blockDeviceType = type;
+    rc = 0;
+  }
+  else
+  {
+    printf("Warning: %s can't be opened as a %s device, using stdio\n",
+           fatFileSystem.diskImageFileName, getBlockDeviceName(type));
   }
+  closeBlockDevice(device);
+  fclose(stream);
+  return rc;
 }
 
-
-//-----------------------------------------------------------------------------
-// File Path interface
-//-----------------------------------------------------------------------------
-
 /******************************************************************************
- * initFilePath
+ * setFatFlushInterval
  *****************************************************************************/
-void initFilePath(FilePath* filePath)
+void setFatFlushInterval(unsigned int flushInterval)
 {
-  // Initialize to the root directory.
-  strcpy(filePath->pathName, "/");
-  filePath->isADirectory = 1;
-  filePath->depthLevel = 1;
-  filePath->dirLevels[0].indexInParentDirectory = 0; // irrelevant for root
-  filePath->dirLevels[0].firstLogicalCluster    = 0;
-  filePath->dirLevels[0].offsetInPathName       = 1;
+  fatFileSystem.session->flushInterval = flushInterval;
 }
 
 /******************************************************************************
- * getWorkingDirectory
+ * enableFatDiscard
  *****************************************************************************/
-void getWorkingDirectory(FilePath* filePath)
+void enableFatDiscard()
 {
-  // Always start at the root directory.
-  initFilePath(filePath);
-
-  // Change the file path using the current working directory's path name.
-  changeFilePath(filePath, fatFileSystem.workingDirectoryPathName,
-                 PATH_TYPE_DIRECTORY);
+  fatFileSystem.session->isDiscarding = 1;
 }
 
 /******************************************************************************
- * setWorkingDirectory
+ * getFatSessionGenerations
  *****************************************************************************/
-void setWorkingDirectory(FilePath* filePath)
+void getFatSessionGenerations(unsigned int* generation,
+                              unsigned int* flushedGeneration)
 {
-  strcpy(fatFileSystem.workingDirectoryPathName, filePath->pathName);
+  *generation = fatFileSystem.session->generation;
+  *flushedGeneration = fatFileSystem.session->flushedGeneration;
 }
 
 /******************************************************************************
- * changeFilePath
+ * initializeFatFileSystem
  *****************************************************************************/
-int changeFilePath(FilePath* filePath, const char* pathName, int pathType)
+int initializeFatFileSystem(int lockMode)
 {
-  DirectoryEntry* directory;
-  DirectoryEntry entry;
-  int index, i;
+  // Attach to the shell's session.
+  if (attachFatSession() != 0)
+    return -1;
+
+  // Open the disk image file (read-only commands don't need write access).
+  if (lockMode == FAT_LOCK_EXCLUSIVE)
+    fatFileSystem.fileSystemId = fopen(fatFileSystem.diskImageFileName, "r+");
+  else
+    fatFileSystem.fileSystemId = fopen(fatFileSystem.diskImageFileName, "r");
+  if (fatFileSystem.fileSystemId == NULL)
+  {
+    printf("Could not open the floppy drive or image.\n");
+    return -1;
+  }
   
-  // Store the new file path in another variable, in case the opeartion
-  // doesn't complete successfully.
-  FilePath newFilePath = *filePath;
-  char* path = newFilePath.pathName;
+  // Lock the disk image before reading anything from it, so that we never
+  // see another process's half-finished changes.
+  fatFileSystem.isLocked = 0;
+  fatFileSystem.isMounted = 0;
+  if (lockFatFileSystem(lockMode) != 0)
+  {
+    printf("Could not lock the floppy drive or image.\n");
+    fclose(fatFileSystem.fileSystemId);
+    return -1;
+  }
 
-  if (pathName[0] == '/')
+  // Load the boot sector, through the session's kind of block device.
+  fatFileSystem.blockDevice = openBlockDevice(
+    fatFileSystem.session->blockDeviceType, fatFileSystem.fileSystemId,
+    fatFileSystem.diskImageFileName, fatFileSystem.session->memoryImageName,
+    lockMode == FAT_LOCK_EXCLUSIVE);
+  if (fatFileSystem.blockDevice == NULL)
   {
-    // pathName is an absolute path (starts with a '/')
-    // Reset the starting file path to the root directory.
-    initFilePath(&newFilePath);
+    printf("Error: could not open %s as a %s device\n",
+           fatFileSystem.diskImageFileName,
+           getBlockDeviceName(fatFileSystem.session->blockDeviceType));
+    return -1;
   }
-  else if (newFilePath.depthLevel > 1)
+  if (loadBootSector() != 0)
   {
-    // pathName is a relative path.
-    path += strlen(newFilePath.pathName);
+    printf("Something has gone wrong -- could not read the boot table\n");
+    return -1;
   }
 
-  // Duplicate the pathName string (because strtok() will modify it).
-  char* tokenizedPath = (char*) malloc(strlen(pathName) + 1);
-  strcpy(tokenizedPath, pathName);
+  // Use the session's shared FAT table rather than reading it from disk,
+  // unless the image has been changed by someone outside of this session.
+  fatFileSystem.fatTable = (unsigned char*) fatFileSystem.session +
+                           fatFileSystem.session->fatTableOffset;
+  fatFileSystem.freeClusterMap = (unsigned char*) fatFileSystem.session +
+                                 fatFileSystem.session->freeMapOffset;
+  fatFileSystem.rootDirectoryRegion = (unsigned char*) fatFileSystem.session +
+                                      fatFileSystem.session->rootDirectoryOffset;
+  fatFileSystem.discardMap = (unsigned char*) fatFileSystem.session +
+                             fatFileSystem.session->discardMapOffset;
+  fatFileSystem.isFatTableDirty = 0;
+  fatFileSystem.dirtyFatSectors = (unsigned char*) calloc(
+    fatFileSystem.geometry.sectorsPerFAT, 1);
+  fatFileSystem.numDirtyFatSectors = 0;
+  fatFileSystem.dirtyRootSectors = (unsigned char*) calloc(
+    getNumRootDirectorySectors() + 1, 1);
+  if (openFatJournal() != 0)
+    return -1;
+  if (refreshSessionFatTable() != 0)
+  {
+    printf("Something has gone wrong -- could not read the FAT table\n");
+    return -1;
+  }
   
-  // Get the first token (directory name) from the path string.
-  char* token;
-  token = strtok(tokenizedPath, "/");
+  // Start collecting this command's changes into a transaction if it might
+  // make any.
+  fatFileSystem.isMounted = 1;
+  if (lockMode == FAT_LOCK_EXCLUSIVE)
+    beginFatTransaction();
+  return 0;
+}
+
+/******************************************************************************
+ * terminateFatFileSystem
+ *****************************************************************************/
+void terminateFatFileSystem()
+{
+  // Publishing changes to the shared FAT table, and writing them to the
+  // image, happens when unlocking.
+  unlockFatFileSystem();
+  fatFileSystem.isMounted = 0;
+  closeFatJournal();
+  closeAsyncIo();
   
-  DirectoryLevel *dirLevels = &newFilePath.dirLevels[newFilePath.depthLevel - 1];
+  // Count this command in the session's statistics.
+  addFatStats(&fatFileSystem.session->stats);
+  dumpFatStatsIfRequested(program_invocation_short_name);
+  
+  free(fatFileSystem.dirtyFatSectors);
+  fatFileSystem.dirtyFatSectors = NULL;
+  free(fatFileSystem.dirtyRootSectors);
+  fatFileSystem.dirtyRootSectors = NULL;
+  free(fatFileSystem.freedClusters);
+  fatFileSystem.freedClusters = NULL;
+  fatFileSystem.maxFreedClusters = 0;
+  closeDiskImage();
+  detachFatSession();
+}
 
-  // Handle one token (directory name) after another.
-  while (token != NULL)
+/******************************************************************************
+ * lockFatFileSystem
+ *****************************************************************************/
+int lockFatFileSystem(int lockMode)
+{
+  struct flock lock;
+  
+  // Lock the whole image file.
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type   = (lockMode == FAT_LOCK_EXCLUSIVE ? F_WRLCK : F_RDLCK);
+  lock.l_whence = SEEK_SET;
+  lock.l_start  = 0;
+  lock.l_len    = 0;
+  
+  // Wait for the lock, retrying if we get interrupted by a signal.
+  while (fcntl(fileno(fatFileSystem.fileSystemId), F_SETLKW, &lock) == -1)
   {
-    // Can't increase depth if we've reached a file instead of a directory.
-    if (!newFilePath.isADirectory)
+    if (errno != EINTR)
     {
-      printf("%s: Not a directory\n", pathName);
-      return -2;
+      perror("Error locking disk image");
+      return -1;
+    }
+  }
+  
+  return finishLockingFatFileSystem(lockMode);
+}
+
+/******************************************************************************
+ * tryLockFatFileSystem
+ *****************************************************************************/
+int tryLockFatFileSystem(int lockMode)
+{
+  struct flock lock;
+  
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type   = (lockMode == FAT_LOCK_EXCLUSIVE ? F_WRLCK : F_RDLCK);
+  lock.l_whence = SEEK_SET;
+  lock.l_start  = 0;
+  lock.l_len    = 0;
+  
+  // Give up straight away if another process holds a conflicting lock.
+  while (fcntl(fileno(fatFileSystem.fileSystemId), F_SETLK, &lock) == -1)
+  {
+    if (errno == EAGAIN || errno == EACCES)
+      return 1;
+    if (errno != EINTR)
+    {
+      perror("Error locking disk image");
+      return -1;
+    }
+  }
+  
+  return finishLockingFatFileSystem(lockMode);
+}
+
+/******************************************************************************
+ * finishLockingFatFileSystem
+ *****************************************************************************/
+static int finishLockingFatFileSystem(int lockMode)
+{
+  fatFileSystem.lockMode = lockMode;
+  fatFileSystem.isLocked = 1;
+  resumeDirectIoCache();
+  
+  // When re-locking in the middle of a command, someone else may have
+  // changed the image while we didn't hold the lock.
+  if (fatFileSystem.isMounted)
+  {
+    if (refreshSessionFatTable() != 0)
+      return -1;
+    if (lockMode == FAT_LOCK_EXCLUSIVE)
+      beginFatTransaction();
+  }
+  return 0;
+}
+
+/******************************************************************************
+ * unlockFatFileSystem
+ *****************************************************************************/
+void unlockFatFileSystem()
+{
+  struct flock lock;
+  unsigned int sequence = 0;
+  
+  if (!fatFileSystem.isLocked)
+    return;
+  
+  // Write out the root directory sectors we changed and commit our
+  // transaction, then make sure every write reaches the file before anyone
+  // else can read it, and before the image's signature is taken below.
+  if (fatFileSystem.isMounted && fatFileSystem.lockMode == FAT_LOCK_EXCLUSIVE)
+  {
+    sequence = fatFileSystem.session->journal.sequence;
+    flushRootDirectory();
+    commitFatTransaction();
+    flushFatSectors();
+    discardFreedClusters();
+  }
+  flushBlockDevice(fatFileSystem.blockDevice, 0);
+  
+  // Publish our changes to the shared FAT table with a new generation, make
+  // them durable if enough have built up since the last time, and remember
+  // the image as we left it so that our own writes aren't mistaken for
+  // changes made outside of the session.
+  if (fatFileSystem.isMounted && fatFileSystem.lockMode == FAT_LOCK_EXCLUSIVE)
+  {
+    lockSessionMutex();
+    if (fatFileSystem.isFatTableDirty ||
+        sequence != fatFileSystem.session->journal.sequence)
+    {
+      fatFileSystem.session->generation++;
+      fatFileSystem.isFatTableDirty = 0;
+    }
+    if (fatFileSystem.session->flushInterval > 0 &&
+        fatFileSystem.session->generation -
+        fatFileSystem.session->flushedGeneration >=
+        fatFileSystem.session->flushInterval)
+    {
+      writeSessionFatTable();
+    }
+    advanceImageModifiedTime();
+    getImageSignature(&fatFileSystem.session->imageSignature);
+    unlockSessionMutex();
+  }
+  if (fatFileSystem.lockMode == FAT_LOCK_EXCLUSIVE)
+    fatFileSystem.session->numWriteUnlocks++;
+  suspendDirectIoCache();
+  
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type   = F_UNLCK;
+  lock.l_whence = SEEK_SET;
+  lock.l_start  = 0;
+  lock.l_len    = 0;
+  fcntl(fileno(fatFileSystem.fileSystemId), F_SETLK, &lock);
+  
+  fatFileSystem.isLocked = 0;
+}
+
+/******************************************************************************
+ * getFatBootSector
+ *****************************************************************************/
+void getFatBootSector(FatBootSector* bootSector)
+{
+   memcpy(bootSector, &fatFileSystem.bootSector, sizeof(FatBootSector));
+}
+
+/******************************************************************************
+ * getNumberOfUsedBlocks
+ *****************************************************************************/
+void getNumberOfUsedBlocks(unsigned int* numUsedBlocks,
+                           unsigned int* totalBlocks)
+{
+  // The session keeps count of the free clusters as FAT entries change.
+  *totalBlocks = fatFileSystem.session->numClusters - 2;
+  *numUsedBlocks = *totalBlocks - fatFileSystem.session->numFreeClusters;
+}
+
+
+//-----------------------------------------------------------------------------
+// File Path interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * initFilePath
+ *****************************************************************************/
+void initFilePath(FilePath* filePath)
+{
+  // Initialize to the root directory.
+  strcpy(filePath->pathName, "/");
+  filePath->isADirectory = 1;
+  filePath->depthLevel = 1;
+  filePath->dirLevels[0].indexInParentDirectory = 0; // irrelevant for root
+  filePath->dirLevels[0].firstLogicalCluster    = 0;
+  filePath->dirLevels[0].offsetInPathName       = 1;
+}
+
+/******************************************************************************
+ * getWorkingDirectory
+ *****************************************************************************/
+void getWorkingDirectory(FilePath* filePath)
+{
+  FatSession* session = fatFileSystem.session;
+  
+  // Use the session's resolved working directory if we have it, so we don't
+  // have to walk the path on disk.
+  if (session->isWorkingDirectoryResolved)
+  {
+    *filePath = session->workingDirectory;
+    return;
+  }
+  
+  // Always start at the root directory.
+  initFilePath(filePath);
+
+  // Change the file path using the current working directory's path name.
+  changeFilePath(filePath, fatFileSystem.workingDirectoryPathName,
+                 PATH_TYPE_DIRECTORY);
+  setWorkingDirectory(filePath);
+}
+
+/******************************************************************************
+ * setWorkingDirectory
+ *****************************************************************************/
+void setWorkingDirectory(FilePath* filePath)
+{
+  fatFileSystem.session->workingDirectory = *filePath;
+  fatFileSystem.session->isWorkingDirectoryResolved = 1;
+}
+
+/******************************************************************************
+ * invalidateWorkingDirectory
+ *****************************************************************************/
+void invalidateWorkingDirectory()
+{
+  fatFileSystem.session->isWorkingDirectoryResolved = 0;
+}
+
+/******************************************************************************
+ * changeFilePath
+ *****************************************************************************/
+int changeFilePath(FilePath* filePath, const char* pathName, int pathType)
+{
+  DirectoryEntry* directory;
+  DirectoryEntry entry;
+  int index, i;
+  
+  // Store the new file path in another variable, in case the opeartion
+  // doesn't complete successfully.
+  FilePath newFilePath = *filePath;
+  char* path = newFilePath.pathName;
+  
+  FAT_STAT_ADD(FAT_STAT_PATH_RESOLUTIONS, 1);
+
+  if (pathName[0] == '/')
+  {
+    // pathName is an absolute path (starts with a '/')
+    // Reset the starting file path to the root directory.
+    initFilePath(&newFilePath);
+  }
+  else if (newFilePath.depthLevel > 1)
+  {
+    // pathName is a relative path.
+    path += strlen(newFilePath.pathName);
+  }
+
+  // Duplicate the pathName string (because strtok() will modify it).
+  char* tokenizedPath = (char*) malloc(strlen(pathName) + 1);
+  strcpy(tokenizedPath, pathName);
+  
+  // Get the first token (directory name) from the path string.
+  char* token;
+  token = strtok(tokenizedPath, "/");
+  
+  DirectoryLevel *dirLevels = &newFilePath.dirLevels[newFilePath.depthLevel - 1];
+
+  // Handle one token (directory name) after another.
+  while (token != NULL)
+  {
+    // Can't increase depth if we've reached a file instead of a directory.
+    if (!newFilePath.isADirectory)
+    {
+      printf("%s: Not a directory\n", pathName);
+      free(tokenizedPath);
+      return -2;
     }
   
     // Find the entry by token name in the top-most directory.
@@ -269,13 +935,14 @@ int changeFilePath(FilePath* filePath, const char* pathName, int pathType)
     if (index < 0)
     {
       printf("%s: No such file or directory\n", pathName);
+      free(tokenizedPath);
       return -1;
     }
     else
     {
       // We found the next entry.
       dirLevels++;
-      dirLevels->firstLogicalCluster = entry.firstLogicalCluster;
+      dirLevels->firstLogicalCluster = getEntryCluster(&entry);
       dirLevels->indexInParentDirectory = index;
       if (newFilePath.depthLevel == 1)
         dirLevels->offsetInPathName = 1;
@@ -295,7 +962,7 @@ int changeFilePath(FilePath* filePath, const char* pathName, int pathType)
       {
         for (i = 0; i < newFilePath.depthLevel - 1; i++)
         {
-          if (entry.firstLogicalCluster ==
+          if (getEntryCluster(&entry) ==
               newFilePath.dirLevels[i].firstLogicalCluster)
           {
             newFilePath.depthLevel = i + 1;
@@ -322,6 +989,7 @@ int changeFilePath(FilePath* filePath, const char* pathName, int pathType)
     // Move onto the next token (directory name) in the given path name.
     token = strtok(NULL, "/");
   }
+  free(tokenizedPath);
   
   // Validate the file type.
   if (newFilePath.isADirectory && pathType == PATH_TYPE_FILE)
@@ -353,13 +1021,17 @@ int changeFilePath(FilePath* filePath, const char* pathName, int pathType)
 /******************************************************************************
  * openDirectory
  *****************************************************************************/
-DirectoryEntry* openDirectory(unsigned short flc)
+DirectoryEntry* openDirectory(unsigned int flc)
 {
   unsigned char* data;
   unsigned int numBytes;
   
+  FAT_STAT_ADD(FAT_STAT_DIRECTORY_READS, 1);
   if (readFileContents(flc, &data, &numBytes) == 0)
   {
+    // End with an empty entry, so that searching a full directory stops.
+    data = (unsigned char*) realloc(data, numBytes + sizeof(DirectoryEntry));
+    memset(data + numBytes, 0, sizeof(DirectoryEntry));
     return (DirectoryEntry*) data;
   }
   else
@@ -379,11 +1051,37 @@ void closeDirectory(DirectoryEntry* directory)
 /******************************************************************************
  * saveDirectory
  *****************************************************************************/
-int saveDirectory(unsigned short flc, DirectoryEntry* directory)
+int saveDirectory(unsigned int flc, DirectoryEntry* directory)
 {
-  unsigned short numSectors = getFatEntryChainLength(flc);
-  unsigned int numBytes = numSectors * fatFileSystem.bootSector.bytesPerSector;
+  unsigned int numBytes = getFatEntryChainSize(flc);
   
+  return writeFileContents(flc, (unsigned char*) directory, numBytes);
+}
+
+/******************************************************************************
+ * readDirectory
+ *****************************************************************************/
+DirectoryEntry* readDirectory(unsigned int flc, unsigned int* numBytes)
+{
+  unsigned char* data;
+
+  FAT_STAT_ADD(FAT_STAT_DIRECTORY_READS, 1);
+  if (readFileContents(flc, &data, numBytes) != 0)
+  {
+    *numBytes = 0;
+    data = NULL;
+  }
+  data = (unsigned char*) realloc(data, *numBytes + sizeof(DirectoryEntry));
+  memset(data + *numBytes, 0, sizeof(DirectoryEntry));
+  return (DirectoryEntry*) data;
+}
+
+/******************************************************************************
+ * writeDirectory
+ *****************************************************************************/
+void writeDirectory(unsigned int flc, DirectoryEntry* directory,
+                    unsigned int numBytes)
+{
   writeFileContents(flc, (unsigned char*) directory, numBytes);
 }
 
@@ -427,7 +1125,7 @@ void removeEntry(DirectoryEntry* directory, int index)
   DirectoryEntry* entryToRemove = directory + index;
   
   entryToRemove->name[0] = DIR_ENTRY_FREE;
-  freeFileContents(entryToRemove->firstLogicalCluster);
+  freeFileContents(getEntryCluster(entryToRemove));
 }
 
 /******************************************************************************
@@ -462,6 +1160,8 @@ DirectoryEntry* getFirstValidEntry(DirectoryEntry* entry, int* indexCounter)
 {
   while (1)
   {
+    FAT_STAT_ADD(FAT_STAT_DIRECTORY_ENTRIES, 1);
+    
     if ((unsigned char) entry->name[0] == DIR_ENTRY_FREE)
     {
       // The directory entry is free (i.e., currently unused).
@@ -530,16 +1230,15 @@ int isDirectoryEmpty(DirectoryEntry* directory)
 /******************************************************************************
  * createNewEntry
  *****************************************************************************/
-int createNewEntry(unsigned short flc, DirectoryEntry** directory,
+int createNewEntry(unsigned int flc, DirectoryEntry** directory,
                    const char* name, int* newEntryIndex)
 {
   int index = 0;
   DirectoryEntry* entry = *directory;
 
-  unsigned short bytesPerSector = fatFileSystem.bootSector.bytesPerSector;
-  unsigned short numSectorsForDir = getFatEntryChainLength(flc);
-  int maxNumEntries = ((numSectorsForDir * bytesPerSector) /
-                      sizeof(DirectoryEntry)) - 1;
+  unsigned int bytesPerCluster = fatFileSystem.geometry.bytesPerCluster;
+  unsigned int numBytesForDir = getFatEntryChainSize(flc);
+  int maxNumEntries = (numBytesForDir / sizeof(DirectoryEntry)) - 1;
   
   // Find an unused entry in the given directory.
   while (index < maxNumEntries)
@@ -561,19 +1260,18 @@ int createNewEntry(unsigned short flc, DirectoryEntry** directory,
     index++;
   }
   
-  // Increase the size of the directory if it is full.
+  // Increase the size of the directory by a cluster if it is full.
   if (index == maxNumEntries)
   {
-    numSectorsForDir++;
-    *directory = (DirectoryEntry*) realloc(*directory, numSectorsForDir * bytesPerSector);
+    *directory = (DirectoryEntry*) realloc(*directory, numBytesForDir +
+                                           bytesPerCluster);
+    memset((unsigned char*) *directory + numBytesForDir, 0, bytesPerCluster);
+    numBytesForDir += bytesPerCluster;
     int rc = writeFileContents(flc, (unsigned char*) *directory,
-                               numSectorsForDir * bytesPerSector);
+                               numBytesForDir);
     if (rc != 0)
       return rc;
     
-    // TODO: remove this debug print.
-    printf("Increased directory size to %u\n", numSectorsForDir);
-    
     entry = (*directory) + index;
     (entry + 1)->name[0] = DIR_ENTRY_END_OF_ENTRIES;
   }
@@ -584,9 +1282,10 @@ int createNewEntry(unsigned short flc, DirectoryEntry** directory,
   entry->fileSize = 0;
   
   // Allocate a data sector for the entry.
-  entry->firstLogicalCluster = 0;
-  findUnusedFatEntry(&entry->firstLogicalCluster);
-  setFatEntry(entry->firstLogicalCluster, 0xFFF);
+  unsigned int cluster = 0;
+  findUnusedFatEntry(&cluster);
+  setFatEntry(cluster, FAT_END_OF_CHAIN);
+  setEntryCluster(entry, cluster);
 
   *newEntryIndex = index;
   return 0;
@@ -643,363 +1342,1223 @@ void getEntryName(DirectoryEntry* entry, char* nameString)
 }
 
 /******************************************************************************
- * setEntryName
+ * getEntryCluster
+ *****************************************************************************/
+unsigned int getEntryCluster(DirectoryEntry* entry)
+{
+  unsigned int cluster = entry->firstLogicalCluster;
+  
+  // FAT12 and FAT16 use the high half for other things.
+  if (fatFileSystem.geometry.fatType == FAT_TYPE_32)
+    cluster |= (unsigned int) entry->firstLogicalClusterHigh << 16;
+  return cluster;
+}
+
+/******************************************************************************
+ * setEntryCluster
+ *****************************************************************************/
+void setEntryCluster(DirectoryEntry* entry, unsigned int cluster)
+{
+  entry->firstLogicalCluster = (unsigned short) cluster;
+  if (fatFileSystem.geometry.fatType == FAT_TYPE_32)
+    entry->firstLogicalClusterHigh = (unsigned short) (cluster >> 16);
+}
+
+/******************************************************************************
+ * setEntryName
+ *****************************************************************************/
+void setEntryName(DirectoryEntry* entry, const char* nameString)
+{
+  // Fill the entry's name & extension with spaces.
+  memset(entry->name, ' ', sizeof(entry->name));
+  memset(entry->extension, ' ', sizeof(entry->extension));
+  
+  // Split the name and extension by the first dot in the given string.
+  const char* startOfName = nameString;
+  const char* endOfName   = nameString + sizeof(entry->name);
+  const char* startOfExt  = nameString;
+  const char* endOfExt    = nameString;
+  const char* dot         = strchr(nameString, '.');
+  
+  if (dot != NULL)
+  {
+    startOfExt = dot + 1;
+    endOfExt = dot + 1 + sizeof(entry->extension);
+    if (dot < endOfName)
+      endOfName = dot;
+  }
+  
+  // Write the characters into the entry's name.
+  const char* c;
+  int i;
+  for (i = 0, c = startOfName; c != endOfName && *c != '\0'; c++)
+    entry->name[i++] = toupper(*c);
+  for (i = 0, c = startOfExt; c != endOfExt && *c != '\0'; c++)
+    entry->extension[i++] = toupper(*c);
+}
+
+
+//-----------------------------------------------------------------------------
+// File Data interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * readFileContents
+ *****************************************************************************/
+int readFileContents(unsigned int flc, unsigned char** data,
+                     unsigned int* numBytes)
+{
+  unsigned int numClusters;
+  unsigned int numRuns;
+  SectorRun* runs;
+  
+  flc = resolveRootCluster(flc);
+  
+  // Count the number of bytes used by the given FLC.
+  *numBytes = getFatEntryChainSize(flc);
+  *data = (unsigned char*) malloc(*numBytes);
+  
+  // The root directory is a fixed region, not a chain, and the session
+  // always has a copy of it.
+  if (flc == 0)
+  {
+    memcpy(*data, fatFileSystem.rootDirectoryRegion, *numBytes);
+    return 0;
+  }
+  
+  // Read every run of consecutive clusters in the chain at once.
+  numClusters = *numBytes / fatFileSystem.geometry.bytesPerCluster;
+  runs = (SectorRun*) malloc(numClusters * sizeof(SectorRun));
+  numRuns = getClusterRuns(&flc, numClusters, *data, runs, &numClusters);
+  readSectorRuns(runs, numRuns);
+  free(runs);
+  
+  // A damaged chain may end early.
+  memset(*data + (numClusters * fatFileSystem.geometry.bytesPerCluster), 0,
+         *numBytes - (numClusters * fatFileSystem.geometry.bytesPerCluster));
+
+  return 0;
+}
+
+/******************************************************************************
+ * writeFileContents
+ *****************************************************************************/
+int writeFileContents(unsigned int flc, unsigned char* data,
+                      unsigned int numBytes)
+{
+  unsigned int clusterIndex;
+  unsigned int entryNumber;
+  unsigned int entryValue;
+  int entryType;
+  unsigned int numNeededClusters;
+  unsigned int numUsedClusters;
+  unsigned int temp;
+  int rc;
+  
+  unsigned int bytesPerSector = fatFileSystem.bootSector.bytesPerSector;
+  unsigned int bytesPerCluster = fatFileSystem.geometry.bytesPerCluster;
+  
+  flc = resolveRootCluster(flc);
+  
+  // The root directory is a fixed region, which can't grow. Only the
+  // session's copy changes now; the sectors that actually differ are
+  // written when unlocking.
+  if (flc == 0)
+  {
+    unsigned char* region = fatFileSystem.rootDirectoryRegion;
+    unsigned int sectorIndex;
+    if (numBytes > getFatEntryChainSize(flc))
+    {
+      printf("Error: the root directory is full\n");
+      return -1;
+    }
+    for (sectorIndex = 0; numBytes > 0; sectorIndex++)
+    {
+      unsigned int numToCopy = (numBytes < bytesPerSector ? numBytes :
+                                bytesPerSector);
+      unsigned char* sector = region + (sectorIndex * bytesPerSector);
+      if (memcmp(sector, data, numToCopy) != 0)
+      {
+        memcpy(sector, data, numToCopy);
+        fatFileSystem.dirtyRootSectors[sectorIndex] = 1;
+      }
+      data += numToCopy;
+      numBytes -= numToCopy;
+    }
+    return 0;
+  }
+
+  // Count the number of needed clusters to write numBytes.
+  numNeededClusters = (numBytes + bytesPerCluster - 1) / bytesPerCluster;
+  if (numNeededClusters == 0)
+    numNeededClusters = 1;
+  
+  // Count the current number of clusters used by the existing FLC.
+  numUsedClusters = getFatEntryChainLength(flc);
+  
+  // Check if there isn't enough available clusters to write all the data.
+  if (numNeededClusters > numUsedClusters)
+  {
+    unsigned int totalClusters;
+    unsigned int numUsedBlocks;
+    
+    getNumberOfUsedBlocks(&numUsedBlocks, &totalClusters);
+    
+    unsigned int numAvailableClusters = totalClusters - numUsedBlocks + 
+                                        numUsedClusters;
+    
+    if (numAvailableClusters < numNeededClusters)
+    {
+      printf("Error: not enough available blocks to write %u bytes\n", numBytes);
+      return -1;
+    }
+  }
+  
+  // The data is written in runs of consecutive clusters, all at once after
+  // the chain is laid out.
+  SectorRun* runs = (SectorRun*) malloc(numNeededClusters * sizeof(SectorRun));
+  unsigned int numRuns = 0;
+  
+  entryNumber = flc;
+  unsigned int maxNeededUsedClusters = numNeededClusters;
+  if (numUsedClusters > numNeededClusters)
+    maxNeededUsedClusters = numUsedClusters; 
+    
+  // Write the data to the needed clusters, and free any uneeded 
+  // but previously-used clusters.
+  for (clusterIndex = 0; clusterIndex < maxNeededUsedClusters; clusterIndex++)
+  {
+    getFatEntry(entryNumber, &entryValue, &entryType);
+    
+    // Write the data into this cluster.
+    if (clusterIndex < numNeededClusters)
+    {
+      if (numBytes > 0)
+      {
+        unsigned int numToWrite = (numBytes < bytesPerCluster ? numBytes :
+                                   bytesPerCluster);
+        unsigned int sector = logicalToPhysicalCluster(entryNumber);
+        SectorRun* run = (numRuns > 0 ? &runs[numRuns - 1] : NULL);
+        if (run != NULL && run->sector + (run->numBytes / bytesPerSector) ==
+            sector && run->numBytes % bytesPerCluster == 0)
+        {
+          run->numBytes += numToWrite;
+        }
+        else
+        {
+          run = &runs[numRuns++];
+          run->sector = sector;
+          run->numBytes = numToWrite;
+          run->buffer = data;
+        }
+        data += numToWrite;
+        numBytes -= numToWrite;
+      }
+    }
+    else
+    {
+      setFatEntry(entryNumber, 0x000);
+    }
+    
+    if (clusterIndex == numNeededClusters - 1)
+    {
+      // Mark the end of the chain of FAT entries.
+      setFatEntry(entryNumber, FAT_END_OF_CHAIN);
+    }
+    
+    if (entryType == FAT_ENTRY_TYPE_NEXT_SECTOR)
+    {
+      // Reuse this and the next FAT entry.
+      entryNumber = entryValue;
+    }
+    else if (clusterIndex < numNeededClusters - 1)
+    {
+      // Allocate a new FAT entry, ending the chain there until it grows
+      // again, so the next allocation doesn't find the same one.
+      findUnusedFatEntry(&temp);
+      setFatEntry(temp, FAT_END_OF_CHAIN);
+      setFatEntry(entryNumber, temp);
+      entryNumber = temp;
+    }
+  }
+  
+  rc = writeSectorRuns(runs, numRuns);
+  free(runs);
+  return rc;
+}
+
+/******************************************************************************
+ * freeFileContents
+ *****************************************************************************/
+int freeFileContents(unsigned int flc)
+{
+  unsigned int numClusters = fatFileSystem.session->numClusters;
+  unsigned int numLeft = numClusters; // so a looped chain still ends
+  unsigned int entryValue;
+  int entryType;
+  
+  // Free every cluster in the chain, not just the first, stopping at
+  // anything that isn't part of a chain (an empty file has none).
+  while (flc >= 2 && flc < numClusters && numLeft-- > 0)
+  {
+    getFatEntry(flc, &entryValue, &entryType);
+    if (entryType == FAT_ENTRY_TYPE_UNUSED ||
+        entryType == FAT_ENTRY_TYPE_RESERVED ||
+        entryType == FAT_ENTRY_TYPE_BAD)
+      break;
+    setFatEntry(flc, FAT_ENTRY_TYPE_UNUSED);
+    if (entryType != FAT_ENTRY_TYPE_NEXT_SECTOR)
+      break;
+    flc = entryValue;
+  }
+  return 0;
+}
+
+/******************************************************************************
+ * readClusters
+ *****************************************************************************/
+int readClusters(unsigned int cluster, unsigned int numClusters,
+                 unsigned char* buffer)
+{
+  if (read_sectors(logicalToPhysicalCluster(cluster), numClusters *
+                   fatFileSystem.geometry.sectorsPerCluster, buffer) == -1)
+  {
+    return -1;
+  }
+  return 0;
+}
+
+/******************************************************************************
+ * writeClusters
+ *****************************************************************************/
+int writeClusters(unsigned int cluster, unsigned char* data,
+                  unsigned int numBytes)
+{
+  unsigned int bytesPerSector = fatFileSystem.bootSector.bytesPerSector;
+  unsigned int sector = logicalToPhysicalCluster(cluster);
+  unsigned int numWholeSectors = numBytes / bytesPerSector;
+  
+  // The whole sectors go in one write, and any partial last one in another.
+  if (numWholeSectors > 0 &&
+      write_sectors(sector, numWholeSectors, data) == -1)
+  {
+    return -1;
+  }
+  if (numBytes % bytesPerSector != 0 &&
+      write_sector(sector + numWholeSectors, data + (numWholeSectors *
+                   bytesPerSector), numBytes % bytesPerSector) == -1)
+  {
+    return -1;
+  }
+  return 0;
+}
+
+/******************************************************************************
+ * getClusterRuns
+ *****************************************************************************/
+unsigned int getClusterRuns(unsigned int* cluster, unsigned int maxClusters,
+                            unsigned char* buffer, SectorRun* runs,
+                            unsigned int* numClusters)
+{
+  unsigned int bytesPerCluster = fatFileSystem.geometry.bytesPerCluster;
+  unsigned int numRuns = 0;
+  unsigned int runStart;
+  unsigned int runLength;
+  unsigned int entryValue;
+  int entryType = FAT_ENTRY_TYPE_NEXT_SECTOR;
+  
+  *numClusters = 0;
+  while (*numClusters < maxClusters && *cluster >= 2 &&
+         entryType == FAT_ENTRY_TYPE_NEXT_SECTOR)
+  {
+    // Find how many of the next clusters follow each other on disk.
+    runStart = *cluster;
+    runLength = 0;
+    do
+    {
+      getFatEntry(*cluster, &entryValue, &entryType);
+      runLength++;
+      *cluster = (entryType == FAT_ENTRY_TYPE_NEXT_SECTOR ? entryValue : 0);
+    } while (*numClusters + runLength < maxClusters &&
+             *cluster == runStart + runLength);
+    
+    runs[numRuns].sector = logicalToPhysicalCluster(runStart);
+    runs[numRuns].numBytes = runLength * bytesPerCluster;
+    runs[numRuns].buffer = (buffer != NULL ? buffer + (*numClusters *
+                            bytesPerCluster) : NULL);
+    numRuns++;
+    *numClusters += runLength;
+  }
+  return numRuns;
+}
+
+
+//-----------------------------------------------------------------------------
+// FAT Table Interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * getFatEntry
+ *****************************************************************************/
+void getFatEntry(unsigned int entryNumber, unsigned int* entryValue,
+                int* entryType)
+{
+  const FatEntryCodec* codec = fatFileSystem.fatCodec;
+  
+  // Entries past the end of the table can only be reached through a
+  // damaged chain, so treat them as bad rather than reading past the table.
+  if (fatFileSystem.session != NULL &&
+      entryNumber >= fatFileSystem.session->numClusters)
+  {
+    *entryValue = codec->badCluster;
+    *entryType = FAT_ENTRY_TYPE_BAD;
+    return;
+  }
+  
+  *entryValue = codec->getEntry(entryNumber, fatFileSystem.fatTable);
+  FAT_STAT_ADD(FAT_STAT_FAT_LOOKUPS, 1);
+  
+  // The special values are at the top of the entries' range (0xFF0 and up
+  // for FAT12), just below and above the bad cluster marker.
+  if (*entryValue == 0x00)
+    *entryType = FAT_ENTRY_TYPE_UNUSED;
+  else if (*entryValue >= codec->badCluster - 7 &&
+           *entryValue < codec->badCluster)
+    *entryType = FAT_ENTRY_TYPE_RESERVED;
+  else if (*entryValue == codec->badCluster)
+    *entryType = FAT_ENTRY_TYPE_BAD;
+  else if (*entryValue > codec->badCluster)
+    *entryType = FAT_ENTRY_TYPE_LAST_SECTOR;
+  else
+  {
+    *entryType = FAT_ENTRY_TYPE_NEXT_SECTOR;
+    FAT_STAT_ADD(FAT_STAT_CHAIN_HOPS, 1);
+  }
+}
+
+/******************************************************************************
+ * setFatEntry
+ *****************************************************************************/
+void setFatEntry(unsigned int entryNumber, unsigned int entryValue)
+{
+  FatSession* session = fatFileSystem.session;
+  const FatEntryCodec* codec = fatFileSystem.fatCodec;
+  unsigned int oldValue;
+  
+  // Remember which sectors of the FAT table change, for the journal, making
+  // room for them first in case the transaction is full.
+  if (fatFileSystem.dirtyFatSectors != NULL)
+  {
+    unsigned long long firstBit = (unsigned long long) entryNumber *
+                                  codec->bitsPerEntry;
+    unsigned int bytesPerSector = fatFileSystem.bootSector.bytesPerSector;
+    unsigned int firstSector = (firstBit / 8) / bytesPerSector;
+    unsigned int lastSector = ((firstBit + codec->bitsPerEntry - 1) / 8) /
+                              bytesPerSector;
+    unsigned int numNewSectors = !fatFileSystem.dirtyFatSectors[firstSector] +
+      (lastSector != firstSector && !fatFileSystem.dirtyFatSectors[lastSector]);
+    
+    if (numNewSectors > 0)
+    {
+      journalReserveFatSectors(numNewSectors);
+      fatFileSystem.numDirtyFatSectors +=
+        !fatFileSystem.dirtyFatSectors[firstSector];
+      fatFileSystem.dirtyFatSectors[firstSector] = 1;
+      fatFileSystem.numDirtyFatSectors +=
+        !fatFileSystem.dirtyFatSectors[lastSector];
+      fatFileSystem.dirtyFatSectors[lastSector] = 1;
+    }
+  }
+  
+  oldValue = codec->getEntry(entryNumber, fatFileSystem.fatTable);
+  codec->setEntry(entryNumber, entryValue, fatFileSystem.fatTable);
+  entryValue = codec->getEntry(entryNumber, fatFileSystem.fatTable);
+  fatFileSystem.isFatTableDirty = 1;
+  FAT_STAT_ADD(FAT_STAT_FAT_UPDATES, 1);
+  
+  // Keep the free-cluster bitmap, count and search hint up to date.
+  if (entryNumber >= 2 && entryNumber < session->numClusters)
+  {
+    if (oldValue != 0 && entryValue == 0)
+    {
+      fatFileSystem.freeClusterMap[entryNumber / 8] |= 1 << (entryNumber % 8);
+      session->numFreeClusters++;
+      if (entryNumber < session->nextFreeCluster)
+        session->nextFreeCluster = entryNumber;
+      if (session->isDiscarding)
+        rememberFreedCluster(entryNumber);
+    }
+    else if (oldValue == 0 && entryValue != 0)
+    {
+      fatFileSystem.freeClusterMap[entryNumber / 8] &= ~(1 << (entryNumber % 8));
+      session->numFreeClusters--;
+    }
+  }
+}
+
+/******************************************************************************
+ * findUnusedFatEntry
+ *****************************************************************************/
+int findUnusedFatEntry(unsigned int* entryNumber)
+{
+  FatSession* session = fatFileSystem.session;
+  unsigned int numClusters = session->numClusters;
+  unsigned int numBytes = (numClusters + 7) / 8;
+  unsigned int byteIndex;
+  unsigned int cluster;
+  unsigned char bits;
+  
+  // Look through the free-cluster bitmap a byte at a time, rather than
+  // decoding every FAT entry, starting where the last search left off (the
+  // clusters before that are all in use, which matters on large images).
+  for (byteIndex = session->nextFreeCluster / 8; byteIndex < numBytes;
+       byteIndex++)
+  {
+    bits = fatFileSystem.freeClusterMap[byteIndex];
+    if (bits == 0)
+      continue;
+    
+    cluster = (byteIndex * 8) + __builtin_ctz(bits);
+    if (cluster < numClusters)
+    {
+      session->nextFreeCluster = cluster;
+      *entryNumber = cluster;
+      return 0;
+    }
+  }
+  
+  session->nextFreeCluster = numClusters;
+  return -1;
+}
+
+/******************************************************************************
+ * getFatEntryChainLength
+ *****************************************************************************/
+unsigned int getFatEntryChainLength(unsigned int firstEntryNumber)
+{
+  unsigned int entryValue;
+  unsigned int length;
+  int entryType;
+  
+  // The FAT12 and FAT16 root directory isn't in the FAT table; it fills its
+  // whole region.
+  firstEntryNumber = resolveRootCluster(firstEntryNumber);
+  if (firstEntryNumber == 0)
+  {
+    return (getNumRootDirectorySectors() +
+            fatFileSystem.geometry.sectorsPerCluster - 1) /
+           fatFileSystem.geometry.sectorsPerCluster;
+  }
+  
+  // Get the first entry.
+  getFatEntry(firstEntryNumber, &entryValue, &entryType);
+  
+  if (entryType != FAT_ENTRY_TYPE_NEXT_SECTOR &&
+      entryType != FAT_ENTRY_TYPE_LAST_SECTOR)
+  {
+    return 0;
+  }
+  
+  // Count the current number of entries in a chain. A chain can't be longer
+  // than the number of clusters, unless it's damaged and loops back on
+  // itself.
+  for (length = 1; entryType == FAT_ENTRY_TYPE_NEXT_SECTOR; length++)
+  {
+    if (fatFileSystem.session != NULL &&
+        length >= fatFileSystem.session->numClusters)
+    {
+      break;
+    }
+    getFatEntry(entryValue, &entryValue, &entryType);
+  }
+  
+  return length;
+}
+
+/******************************************************************************
+ * getFatEntryChainSize
+ *****************************************************************************/
+unsigned int getFatEntryChainSize(unsigned int firstEntryNumber)
+{
+  // The FAT12 and FAT16 root directory region needn't be whole clusters.
+  if (resolveRootCluster(firstEntryNumber) == 0)
+  {
+    return getNumRootDirectorySectors() *
+           fatFileSystem.bootSector.bytesPerSector;
+  }
+  return getFatEntryChainLength(firstEntryNumber) *
+         fatFileSystem.geometry.bytesPerCluster;
+}
+
+
+/******************************************************************************
+ * readFatTableCopy
+ *****************************************************************************/
+int readFatTableCopy(int fatIndex, unsigned char* fatTable)
+{
+  if (fatIndex < 0 || fatIndex >= fatFileSystem.bootSector.numFATs)
+    return -1;
+  return readFatTable(fatIndex, fatTable);
+}
+
+/******************************************************************************
+ * writeFatTableCopies
+ *****************************************************************************/
+int writeFatTableCopies()
+{
+  int rc;
+  
+  lockSessionMutex();
+  rc = writeSessionFatTable();
+  unlockSessionMutex();
+  return rc;
+}
+
+
+//-----------------------------------------------------------------------------
+// Internal Functions
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * writeSessionFatTable
+ *****************************************************************************/
+static int writeSessionFatTable()
+{
+  int i;
+  
+  if (checkpointFatJournal() != 0)
+    return -1;
+  for (i = 0; i < fatFileSystem.bootSector.numFATs; i++)
+  {
+    if (writeFatTable(i, fatFileSystem.fatTable) != 0)
+      return -1;
+  }
+  writeFsInfo();
+  if (flushBlockDevice(fatFileSystem.blockDevice, 1) != 0)
+    return -1;
+  fatFileSystem.session->flushedGeneration = fatFileSystem.session->generation;
+  discardCheckpointedClusters();
+  return 0;
+}
+
+/******************************************************************************
+ * advanceImageModifiedTime
  *****************************************************************************/
-void setEntryName(DirectoryEntry* entry, const char* nameString)
+static void advanceImageModifiedTime()
 {
-  // Fill the entry's name & extension with spaces.
-  memset(entry->name, ' ', sizeof(entry->name));
-  memset(entry->extension, ' ', sizeof(entry->extension));
-  
-  // Split the name and extension by the first dot in the given string.
-  const char* startOfName = nameString;
-  const char* endOfName   = nameString + sizeof(entry->name);
-  const char* startOfExt  = nameString;
-  const char* endOfExt    = nameString;
-  const char* dot         = strchr(nameString, '.');
+  FatImageSignature* locked = &fatFileSystem.lockedSignature;
+  FatImageSignature signature;
+  struct timespec times[2];
   
-  if (dot != NULL)
+  // Every session took its signature of the image at or before our lock, so
+  // a time later than the one we locked at is one none of them has seen.
+  // The clock may be too coarse to have moved on by itself, though, and a
+  // write can even set the time back to the current tick.
+  getImageSignature(&signature);
+  if (signature.modifiedTimeSeconds > locked->modifiedTimeSeconds ||
+      (signature.modifiedTimeSeconds == locked->modifiedTimeSeconds &&
+       signature.modifiedTimeNanoseconds > locked->modifiedTimeNanoseconds))
   {
-    startOfExt = dot + 1;
-    endOfExt = dot + 1 + sizeof(entry->extension);
-    if (dot < endOfName)
-      endOfName = dot;
+    return;
   }
   
-  // Write the characters into the entry's name.
-  const char* c;
-  int i;
-  for (i = 0, c = startOfName; c != endOfName && *c != '\0'; c++)
-    entry->name[i++] = toupper(*c);
-  for (i = 0, c = startOfExt; c != endOfExt && *c != '\0'; c++)
-    entry->extension[i++] = toupper(*c);
+  times[0].tv_sec  = 0;
+  times[0].tv_nsec = UTIME_OMIT;
+  times[1].tv_sec  = locked->modifiedTimeSeconds;
+  times[1].tv_nsec = locked->modifiedTimeNanoseconds + 1;
+  if (times[1].tv_nsec >= 1000000000)
+  {
+    times[1].tv_sec++;
+    times[1].tv_nsec = 0;
+  }
+  futimens(fileno(fatFileSystem.fileSystemId), times);
 }
 
-
-//-----------------------------------------------------------------------------
-// File Data interface
-//-----------------------------------------------------------------------------
-
 /******************************************************************************
- * readFileContents
+ * rememberFreedCluster
  *****************************************************************************/
-int readFileContents(unsigned short flc, unsigned char** data,
-                     unsigned int* numBytes)
+static void rememberFreedCluster(unsigned int cluster)
 {
-  unsigned short entryValue;
-  int entryType;
-  unsigned short numSectors;
-  unsigned short sectorIndex;
-  unsigned char* sectorData;
-  
-  // Count the number of sectors used by the given FLC.
-  numSectors = getFatEntryChainLength(flc);
+  unsigned int* freedClusters;
   
-  *numBytes = numSectors * fatFileSystem.bootSector.bytesPerSector;
-  *data = (unsigned char*) malloc(*numBytes);
+  // When group committing, the transaction that frees the cluster isn't
+  // durable until the next checkpoint, so its data must last until then.
+  if (fatFileSystem.session->journal.isEnabled &&
+      fatFileSystem.session->journal.isGroupCommit)
+  {
+    fatFileSystem.discardMap[cluster / 8] |= 1 << (cluster % 8);
+    return;
+  }
   
-  // Read the data from each sector.
-  entryValue = flc;
-  sectorData = *data;
-    
-  for (sectorIndex = 0; sectorIndex < numSectors; sectorIndex++)
+  if (fatFileSystem.numFreedClusters == fatFileSystem.maxFreedClusters)
   {
-    read_sector(logicalToPhysicalCluster(entryValue), sectorData);
-    getFatEntry(entryValue, &entryValue, &entryType);
-    sectorData += fatFileSystem.bootSector.bytesPerSector;
+    freedClusters = (unsigned int*) realloc(fatFileSystem.freedClusters,
+      sizeof(unsigned int) * (fatFileSystem.maxFreedClusters * 2 + 256));
+    if (freedClusters == NULL)
+      return; // the cluster just keeps its data
+    fatFileSystem.freedClusters = freedClusters;
+    fatFileSystem.maxFreedClusters = fatFileSystem.maxFreedClusters * 2 + 256;
   }
-
-  return 0;
+  fatFileSystem.freedClusters[fatFileSystem.numFreedClusters++] = cluster;
 }
 
 /******************************************************************************
- * writeFileContents
+ * compareClusters
  *****************************************************************************/
-int writeFileContents(unsigned short flc, unsigned char* data,
-                      unsigned int numBytes)
+static int compareClusters(const void* a, const void* b)
 {
-  unsigned short sectorIndex;
-  unsigned short entryNumber;
-  unsigned short entryValue;
-  int entryType;
-  unsigned short numNeededSectors;
-  unsigned short numUsedSectors;
-  unsigned short temp;
+  unsigned int clusterA = *(const unsigned int*) a;
+  unsigned int clusterB = *(const unsigned int*) b;
   
-  unsigned short bytesPerSector = fatFileSystem.bootSector.bytesPerSector;
+  return (clusterA > clusterB) - (clusterA < clusterB);
+}
+
+/******************************************************************************
+ * discardFreedClusters
+ *****************************************************************************/
+static void discardFreedClusters()
+{
+  unsigned int* clusters = fatFileSystem.freedClusters;
+  unsigned int numClusters = fatFileSystem.numFreedClusters;
+  unsigned int bytesPerSector = fatFileSystem.bootSector.bytesPerSector;
+  unsigned int bytesPerCluster = fatFileSystem.geometry.bytesPerCluster;
+  unsigned int first;
+  unsigned int last;
+  unsigned int i = 0;
   
-  // Count the number of needed sectors to write numBytes.
-  numNeededSectors = (numBytes + bytesPerSector - 1) / bytesPerSector;
-  if (numNeededSectors == 0)
-    numNeededSectors = 1;
+  if (numClusters == 0)
+    return;
   
-  // Count the current number of sectors used by the existing FLC.
-  numUsedSectors = getFatEntryChainLength(flc);
-
-  // Check if there isn't enough available sectors for to write all the data.
-  if (numNeededSectors > numUsedSectors)
+  // A cluster freed and then allocated again (such as when a file is
+  // rewritten) now holds new data, so only those still free are discarded,
+  // and the freeing has been committed to the journal first.
+  qsort(clusters, numClusters, sizeof(unsigned int), compareClusters);
+  while (i < numClusters)
   {
-    unsigned short totalSectors;
-    unsigned short numUsedBlocks;
-    
-    getNumberOfUsedBlocks(&numUsedBlocks, &totalSectors);
-    
-    unsigned short numAvailableSectors = totalSectors - numUsedBlocks + 
-                                         numUsedSectors;
-    
-    if (numAvailableSectors < numNeededSectors)
+    first = clusters[i++];
+    last = first;
+    if (!(fatFileSystem.freeClusterMap[first / 8] & (1 << (first % 8))))
+      continue;
+    while (i < numClusters && clusters[i] <= last + 1)
     {
-      printf("Error: not enough available blocks to write %u bytes\n", numBytes);
-      return -1;
+      if (clusters[i] == last + 1 &&
+          !(fatFileSystem.freeClusterMap[clusters[i] / 8] &
+            (1 << (clusters[i] % 8))))
+        break;
+      last = clusters[i++];
     }
+    discardBlockDevice(fatFileSystem.blockDevice,
+                       (long long) logicalToPhysicalCluster(first) *
+                       bytesPerSector,
+                       (long long) (last - first + 1) * bytesPerCluster);
   }
+  fatFileSystem.numFreedClusters = 0;
+}
+
+/******************************************************************************
+ * discardCheckpointedClusters
+ *****************************************************************************/
+static void discardCheckpointedClusters()
+{
+  unsigned char* discardMap = fatFileSystem.discardMap;
+  unsigned int numClusters = fatFileSystem.session->numClusters;
+  unsigned int bytesPerSector = fatFileSystem.bootSector.bytesPerSector;
+  unsigned int bytesPerCluster = fatFileSystem.geometry.bytesPerCluster;
+  unsigned int first;
+  unsigned int cluster = 0;
   
-  entryNumber = flc;
-  unsigned short maxNeededUsedSectors = numNeededSectors;
-  if (numUsedSectors > numNeededSectors)
-    maxNeededUsedSectors = numUsedSectors; 
-    
-  // Write the data to the needed sectors, and free any uneeded 
-  // but previously-used sectors.
-  for (sectorIndex = 0; sectorIndex < maxNeededUsedSectors; sectorIndex++)
+  // Only the clusters that are still free are discarded, as with
+  // discardFreedClusters(), skipping a byte of the map at a time where it's
+  // empty.
+  while (cluster < numClusters)
   {
-    getFatEntry(entryNumber, &entryValue, &entryType);
-    
-    // Write the data into this sector.
-    if (sectorIndex < numNeededSectors)
-    {
-      if (numBytes > 0)
-      {
-        write_sector(logicalToPhysicalCluster(entryNumber), data, numBytes);
-        data += bytesPerSector;
-        numBytes -= bytesPerSector;
-      }
-    }
-    else
+    if (cluster % 8 == 0 && discardMap[cluster / 8] == 0)
     {
-      setFatEntry(entryNumber, 0x000);
+      cluster += 8;
+      continue;
     }
-    
-    if (sectorIndex == numNeededSectors - 1)
+    first = cluster;
+    while (cluster < numClusters &&
+           (discardMap[cluster / 8] & (1 << (cluster % 8))) &&
+           (fatFileSystem.freeClusterMap[cluster / 8] & (1 << (cluster % 8))))
     {
-      // Mark the end of the chain of FAT entries.
-      setFatEntry(entryNumber, 0xFFF);
+      cluster++;
     }
-    
-    if (entryType == FAT_ENTRY_TYPE_NEXT_SECTOR)
+    if (cluster > first)
     {
-      // Reuse this and the next FAT entry.
-      entryNumber = entryValue;
+      discardBlockDevice(fatFileSystem.blockDevice,
+                         (long long) logicalToPhysicalCluster(first) *
+                         bytesPerSector,
+                         (long long) (cluster - first) * bytesPerCluster);
     }
-    else if (sectorIndex < numNeededSectors - 1)
+    else
     {
-      // Allocate a new FAT entry.
-      findUnusedFatEntry(&temp);
-      setFatEntry(entryNumber, temp);
-      entryNumber = temp;
+      cluster++;
     }
   }
-  
-  return 0;
+  memset(discardMap, 0, (numClusters + 7) / 8);
 }
 
 /******************************************************************************
- * freeFileContents
+ * closeDiskImage
  *****************************************************************************/
-int freeFileContents(unsigned short flc)
+static void closeDiskImage()
 {
-  unsigned int numSectors = getFatEntryChainLength(flc);
-  unsigned int numBytes = numSectors * fatFileSystem.bootSector.bytesPerSector; 
-  setFatEntry(flc, FAT_ENTRY_TYPE_UNUSED);
+  closeBlockDevice(fatFileSystem.blockDevice);
+  fatFileSystem.blockDevice = NULL;
+  fclose(fatFileSystem.fileSystemId);
+  fatFileSystem.fileSystemId = NULL;
 }
 
+/******************************************************************************
+ * loadBootSector
+ *****************************************************************************/
+static int loadBootSector()
+{
+  // Read the boot sector from the start of the disk image.
+  long long bytesRead = readBlockDevice(fatFileSystem.blockDevice, 0,
+    sizeof(FatBootSector), (unsigned char*) &fatFileSystem.bootSector);
+  if (bytesRead != sizeof(FatBootSector))
+  {
+    return -1;
+  }
+
+  // The 16-bit counts are 0 when the values don't fit, and FAT32 keeps its
+  // own count of sectors per FAT.
+  FatBootSector* bootSector = &fatFileSystem.bootSector;
+  fatFileSystem.geometry.totalSectors = (bootSector->totalSectorCount != 0 ?
+    bootSector->totalSectorCount : bootSector->totalSectorCountForFAT32);
+  fatFileSystem.geometry.sectorsPerFAT = (bootSector->sectorsPerFAT != 0 ?
+    bootSector->sectorsPerFAT : bootSector->sectorsPerFAT32);
+  if (bootSector->bytesPerSector == 0 || bootSector->numFATs == 0 ||
+      fatFileSystem.geometry.sectorsPerFAT == 0 ||
+      bootSector->sectorsPerCluster == 0 ||
+      (bootSector->sectorsPerCluster & (bootSector->sectorsPerCluster - 1)))
+  {
+    return -1;
+  }
+  fatFileSystem.geometry.sectorsPerCluster = bootSector->sectorsPerCluster;
+  fatFileSystem.geometry.bytesPerCluster = bootSector->sectorsPerCluster *
+                                           bootSector->bytesPerSector;
+  
+  // Calculate some sector offsets (FAT32 has no root directory region).
+  fatFileSystem.sectorOffsets.fatTables = bootSector->numReservedSectors;
+  fatFileSystem.sectorOffsets.rootDirectory =
+    fatFileSystem.sectorOffsets.fatTables +
+    (fatFileSystem.geometry.sectorsPerFAT * bootSector->numFATs);
+  fatFileSystem.sectorOffsets.dataRegion =
+    fatFileSystem.sectorOffsets.rootDirectory + getNumRootDirectorySectors();
+  if (fatFileSystem.sectorOffsets.dataRegion >=
+      fatFileSystem.geometry.totalSectors)
+  {
+    return -1;
+  }
+  
+  // The type of FAT follows from the number of data clusters alone.
+  unsigned int numDataClusters = (fatFileSystem.geometry.totalSectors -
+    fatFileSystem.sectorOffsets.dataRegion) / bootSector->sectorsPerCluster;
+  if (numDataClusters <= FAT12_MAX_DATA_CLUSTERS)
+  {
+    fatFileSystem.geometry.fatType = FAT_TYPE_12;
+    fatFileSystem.fatCodec = &fat12EntryCodec;
+  }
+  else if (numDataClusters <= FAT16_MAX_DATA_CLUSTERS)
+  {
+    fatFileSystem.geometry.fatType = FAT_TYPE_16;
+    fatFileSystem.fatCodec = &fat16EntryCodec;
+  }
+  else
+  {
+    fatFileSystem.geometry.fatType = FAT_TYPE_32;
+    fatFileSystem.fatCodec = &fat32EntryCodec;
+  }
+  fatFileSystem.geometry.rootDirectoryCluster =
+    (fatFileSystem.geometry.fatType == FAT_TYPE_32 ?
+     bootSector->rootDirectoryCluster : 0);
+  
+  // Don't trust the FAT table to have room for all of the clusters.
+  unsigned long long maxNumClusters = (unsigned long long)
+    fatFileSystem.geometry.sectorsPerFAT * bootSector->bytesPerSector * 8 /
+    fatFileSystem.fatCodec->bitsPerEntry;
+  fatFileSystem.geometry.numClusters = numDataClusters + 2;
+  if (fatFileSystem.geometry.numClusters > maxNumClusters)
+    fatFileSystem.geometry.numClusters = maxNumClusters;
 
-//-----------------------------------------------------------------------------
-// FAT Table Interface
-//-----------------------------------------------------------------------------
+  return 0;
+}
 
 /******************************************************************************
- * getFatEntry
+ * readFatTable
  *****************************************************************************/
-void getFatEntry(unsigned short entryNumber, unsigned short* entryValue,
-                int* entryType)
+static int readFatTable(int fatIndex, unsigned char* fatTable)
 {
-  *entryValue = get_fat_entry(entryNumber, fatFileSystem.fatTable);
+  unsigned int sectorsPerFAT = fatFileSystem.geometry.sectorsPerFAT;
   
-  if (*entryValue == 0x00)
-    *entryType = FAT_ENTRY_TYPE_UNUSED;
-  else if (*entryValue >= 0xFF0 && *entryValue <= 0xFF6)
-    *entryType = FAT_ENTRY_TYPE_RESERVED;
-  else if (*entryValue == 0xFF7)
-    *entryType = FAT_ENTRY_TYPE_BAD;
-  else if (*entryValue >= 0xFF8 && *entryValue <= 0xFFF)
-    *entryType = FAT_ENTRY_TYPE_LAST_SECTOR;
-  else  
-    *entryType = FAT_ENTRY_TYPE_NEXT_SECTOR;
+  // Calculate the table's sector number.
+  unsigned int sector = fatFileSystem.sectorOffsets.fatTables +
+                        (fatIndex * sectorsPerFAT);
+  
+  // Read the whole table at once. All of it must be read, because
+  // writeFatTable() writes every sector back.
+  if (read_sectors(sector, sectorsPerFAT, fatTable) == -1)
+    return -1;
+
+  return 0;
 }
 
 /******************************************************************************
- * setFatEntry
+ * writeFatTable
  *****************************************************************************/
-void setFatEntry(unsigned short entryNumber, unsigned short entryValue)
+static int writeFatTable(int fatIndex, unsigned char* fatTable)
 {
-  set_fat_entry((unsigned int) entryNumber,
-                (unsigned int) entryValue,
-                fatFileSystem.fatTable);
+  unsigned int sectorsPerFAT = fatFileSystem.geometry.sectorsPerFAT;
+  
+  // Calculate the table's sector number.
+  unsigned int sector = fatFileSystem.sectorOffsets.fatTables +
+                        (fatIndex * sectorsPerFAT);
+  
+  // Write the whole table to disk at once.
+  if (write_sectors(sector, sectorsPerFAT, fatTable) == -1)
+    return -1;
+
+  return 0;
 }
 
 /******************************************************************************
- * findUnusedFatEntry
+ * loadSessionFatTable
  *****************************************************************************/
-int findUnusedFatEntry(unsigned short* entryNumber)
+static int loadSessionFatTable()
 {
-  unsigned short tempEntryNumber;
-  unsigned short entryValue;
-  int entryType;
+  FatSession* session = fatFileSystem.session;
+  unsigned int entryNumber;
+  
+  if (readFatTable(0, fatFileSystem.fatTable) != 0)
+    return -1;
   
-  unsigned short totalEntries = fatFileSystem.bootSector.totalSectorCount -
-                                fatFileSystem.sectorOffsets.dataRegion + 2;
+  // Read the whole root directory region at once.
+  if (session->rootDirectorySize > 0 &&
+      read_sectors(fatFileSystem.sectorOffsets.rootDirectory,
+                   session->rootDirectorySize /
+                   fatFileSystem.bootSector.bytesPerSector,
+                   fatFileSystem.rootDirectoryRegion) == -1)
+  {
+    return -1;
+  }
   
-  for (tempEntryNumber = 0; tempEntryNumber < totalEntries; tempEntryNumber++)
+  // Rebuild the free-cluster bitmap (a set bit means the cluster is free).
+  memset(fatFileSystem.freeClusterMap, 0, (session->numClusters + 7) / 8);
+  session->numFreeClusters = 0;
+  session->nextFreeCluster = session->numClusters;
+  for (entryNumber = session->numClusters - 1; entryNumber >= 2; entryNumber--)
   {
-    getFatEntry(tempEntryNumber, &entryValue, &entryType);
-    if (entryType == FAT_ENTRY_TYPE_UNUSED)
+    if (fatFileSystem.fatCodec->getEntry(entryNumber,
+                                         fatFileSystem.fatTable) == 0)
     {
-      *entryNumber = tempEntryNumber;
-      return 0;
+      fatFileSystem.freeClusterMap[entryNumber / 8] |= 1 << (entryNumber % 8);
+      session->numFreeClusters++;
+      session->nextFreeCluster = entryNumber;
     }
   }
   
-  return -1;
+  getImageSignature(&session->imageSignature);
+  session->generation++;
+  session->flushedGeneration = session->generation;
+  FAT_STAT_ADD(FAT_STAT_FAT_RELOADS, 1);
+  return 0;
 }
 
 /******************************************************************************
- * getFatEntryChainLength
+ * refreshSessionFatTable
  *****************************************************************************/
-unsigned short getFatEntryChainLength(unsigned short firstEntryNumber)
+static int refreshSessionFatTable()
 {
-  unsigned short entryValue;
-  unsigned short length;
-  int entryType;
-  
-  // Get the first entry.
-  getFatEntry(firstEntryNumber, &entryValue, &entryType);
+  FatSession* session = fatFileSystem.session;
+  FatImageSignature signature;
+  unsigned int numUnflushed;
+  int rc = 0;
   
-  if (entryType != FAT_ENTRY_TYPE_NEXT_SECTOR &&
-      entryType != FAT_ENTRY_TYPE_LAST_SECTOR)
+  lockSessionMutex();
+  getImageSignature(&signature);
+  fatFileSystem.lockedSignature = signature;
+  if (memcmp(&signature, &session->imageSignature, sizeof(signature)) != 0)
   {
-    return 0;
+    if (session->journal.numIndexEntries > 0)
+    {
+      // Our journal holds sectors that aren't in the image yet, and that
+      // would be written over whatever the other session changed.
+      printf("Error: %s was changed outside of this session while its "
+             "journal holds unsaved changes\n",
+             fatFileSystem.diskImageFileName);
+      rc = -1;
+    }
+    else
+    {
+      // Every change we made is in the image already, even the ones that
+      // haven't been made durable yet, so the image is up to date.
+      numUnflushed = session->generation - session->flushedGeneration;
+      rc = loadSessionFatTable();
+      session->flushedGeneration -= numUnflushed;
+    }
   }
+  unlockSessionMutex();
   
-  // Count the current number of entries in a chain.
-  for (length = 1; entryType == FAT_ENTRY_TYPE_NEXT_SECTOR; length++)
+  return rc;
+}
+
+/******************************************************************************
+ * getImageSignature
+ *****************************************************************************/
+static void getImageSignature(FatImageSignature* signature)
+{
+  char deltaFileName[FAT12_MAX_IMAGE_PATH_LENGTH +
+                     sizeof(FAT12_OVERLAY_SUFFIX)];
+  struct stat imageStat;
+  
+  memset(signature, 0, sizeof(FatImageSignature));
+  if (fstat(fileno(fatFileSystem.fileSystemId), &imageStat) == 0)
   {
-    getFatEntry(entryValue, &entryValue, &entryType);
+    signature->inode                   = imageStat.st_ino;
+    signature->size                    = imageStat.st_size;
+    signature->modifiedTimeSeconds     = imageStat.st_mtim.tv_sec;
+    signature->modifiedTimeNanoseconds = imageStat.st_mtim.tv_nsec;
   }
   
-  return length;
+  // With a snapshot, changes go to the delta instead, and taking or rolling
+  // back a snapshot changes the image too.
+  getOverlayFileName(fatFileSystem.diskImageFileName, deltaFileName);
+  if (stat(deltaFileName, &imageStat) == 0)
+  {
+    signature->overlayInode                   = imageStat.st_ino;
+    signature->overlayModifiedTimeSeconds     = imageStat.st_mtim.tv_sec;
+    signature->overlayModifiedTimeNanoseconds = imageStat.st_mtim.tv_nsec;
+  }
 }
 
+/******************************************************************************
+ * lockSessionMutex
+ *****************************************************************************/
+static void lockSessionMutex()
+{
+  // If the previous owner died while holding the mutex, the FAT table it
+  // was reloading may be half-written, so force the next check to reload.
+  if (pthread_mutex_lock(&fatFileSystem.session->mutex) == EOWNERDEAD)
+  {
+    memset(&fatFileSystem.session->imageSignature, 0,
+           sizeof(FatImageSignature));
+    pthread_mutex_consistent(&fatFileSystem.session->mutex);
+  }
+}
 
-//-----------------------------------------------------------------------------
-// Internal Functions
-//-----------------------------------------------------------------------------
+/******************************************************************************
+ * unlockSessionMutex
+ *****************************************************************************/
+static void unlockSessionMutex()
+{
+  pthread_mutex_unlock(&fatFileSystem.session->mutex);
+}
 
 /******************************************************************************
- * loadBootSector
+ * attachFatSession
  *****************************************************************************/
-static int loadBootSector()
+static int attachFatSession()
 {
-  // Make sure we're at the beginning of the disk image file.
-  if (fseek(fatFileSystem.fileSystemId, 0, SEEK_SET) != 0)
+  const char* sessionName;
+  struct stat sessionStat;
+  int fd;
+  
+  sessionName = getenv(FAT12_SESSION_ENV_VAR);
+  if (sessionName == NULL)
   {
+    printf("Error: no FAT12 session (commands must be run from the shell)\n");
     return -1;
   }
-
-  // Read the boot sector from the disk image file.
-  int bytesRead = fread(&fatFileSystem.bootSector, sizeof(char),
-                        sizeof(FatBootSector), fatFileSystem.fileSystemId);
-  if (bytesRead != sizeof(FatBootSector))
+  
+  fd = shm_open(sessionName, O_RDWR, 0);
+  if (fd == -1)
   {
+    perror("Error opening shared memory segment");
+    return -1;
+  }
+  if (fstat(fd, &sessionStat) == -1 || sessionStat.st_size < sizeof(FatSession))
+  {
+    printf("Error: %s: invalid session\n", sessionName);
+    close(fd);
+    return -1;
+  }
+  fatFileSystem.session = (FatSession*) mmap(NULL, sessionStat.st_size,
+    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (fatFileSystem.session == MAP_FAILED)
+  {
+    perror("Error attaching shared memory segment");
     return -1;
   }
-
-  // Calculate some sector offsets.
-  fatFileSystem.sectorOffsets.fatTables =
-    fatFileSystem.bootSector.numReservedSectors;
   
-  fatFileSystem.sectorOffsets.rootDirectory =
-    fatFileSystem.sectorOffsets.fatTables +
-    (fatFileSystem.bootSector.sectorsPerFAT *
-    fatFileSystem.bootSector.numFATs);
-    
-  fatFileSystem.sectorOffsets.dataRegion = 
-    fatFileSystem.sectorOffsets.rootDirectory +
-    ((fatFileSystem.bootSector.maxNumRootDirEntries * sizeof(DirectoryEntry)) /
-    fatFileSystem.bootSector.bytesPerSector);
-
+  fatFileSystem.diskImageFileName = fatFileSystem.session->diskImageFileName;
+  fatFileSystem.workingDirectoryPathName =
+    fatFileSystem.session->workingDirectory.pathName;
   return 0;
 }
 
 /******************************************************************************
- * readFatTable
+ * detachFatSession
  *****************************************************************************/
-static unsigned char* readFatTable(int fatIndex)
+static void detachFatSession()
 {
-  // Allocate the FAT buffer.
-  unsigned char* buffer = (unsigned char*) malloc(fatFileSystem.bootSector
-    .bytesPerSector * fatFileSystem.bootSector.sectorsPerFAT);
-  
-  // Calculate the table's sector number.
-  unsigned int sector = fatFileSystem.sectorOffsets.fatTables +
-                        (fatIndex * fatFileSystem.bootSector.sectorsPerFAT);
+  if (fatFileSystem.session != NULL)
+    munmap(fatFileSystem.session, fatFileSystem.session->size);
+  fatFileSystem.session = NULL;
+}
+
+/******************************************************************************
+ * removeStaleSessions
+ *****************************************************************************/
+static void removeStaleSessions()
+{
+  // Shared memory segments are the files in /dev/shm, named without the
+  // leading '/'.
+  const char* prefix = FAT12_SESSION_NAME_PREFIX + 1;
+  char name[NAME_MAX + 2];
+  struct dirent* entry;
+  DIR* directory = opendir("/dev/shm");
+  char* end;
+  long pid;
   
-  // Read the FAT table from the file.
-  if (read_sector(sector, buffer) == -1)
+  if (directory == NULL)
+    return;
+  while ((entry = readdir(directory)) != NULL)
   {
-    free(buffer);
-    return NULL;
+    if (strncmp(entry->d_name, prefix, strlen(prefix)) != 0)
+      continue;
+    pid = strtol(entry->d_name + strlen(prefix), &end, 10);
+    if (pid <= 0 || (*end != '\0' && strcmp(end, "-image") != 0))
+      continue;
+    if (kill((pid_t) pid, 0) == -1 && errno == ESRCH)
+    {
+      snprintf(name, sizeof(name), "/%s", entry->d_name);
+      shm_unlink(name);
+    }
   }
+  closedir(directory);
+}
 
-  return buffer;
+/******************************************************************************
+ * flushRootDirectory
+ *****************************************************************************/
+static void flushRootDirectory()
+{
+  unsigned int bytesPerSector = fatFileSystem.bootSector.bytesPerSector;
+  unsigned int numSectors = fatFileSystem.session->rootDirectorySize /
+                            bytesPerSector;
+  unsigned int i;
+  
+  for (i = 0; i < numSectors; i++)
+  {
+    if (fatFileSystem.dirtyRootSectors[i])
+    {
+      write_sector(fatFileSystem.sectorOffsets.rootDirectory + i,
+                   fatFileSystem.rootDirectoryRegion + (i * bytesPerSector),
+                   bytesPerSector);
+      fatFileSystem.dirtyRootSectors[i] = 0;
+    }
+  }
 }
 
 /******************************************************************************
- * writeFatTable
+ * flushFatSectors
  *****************************************************************************/
-static void writeFatTable(int fatIndex, unsigned char* fatTable)
+static void flushFatSectors()
 {
+  unsigned int bytesPerSector = fatFileSystem.bootSector.bytesPerSector;
+  unsigned int sectorsPerFAT = fatFileSystem.geometry.sectorsPerFAT;
   unsigned int i;
+  int j;
   
-  // Calculate the table's sector number.
-  unsigned int sector = fatFileSystem.sectorOffsets.fatTables +
-                        (fatIndex * fatFileSystem.bootSector.sectorsPerFAT);
+  if (fatFileSystem.session->journal.isEnabled)
+    return;
   
-  // Write each sector of the table to disk.
-  for (i = 0; i < fatFileSystem.bootSector.sectorsPerFAT; i++)
+  for (i = 0; i < sectorsPerFAT; i++)
   {
-    write_sector(sector + i, fatTable, fatFileSystem.bootSector.bytesPerSector);
-    fatTable += fatFileSystem.bootSector.bytesPerSector;
+    if (fatFileSystem.dirtyFatSectors[i])
+    {
+      for (j = 0; j < fatFileSystem.bootSector.numFATs; j++)
+      {
+        write_sector(fatFileSystem.sectorOffsets.fatTables +
+                     (j * sectorsPerFAT) + i,
+                     fatFileSystem.fatTable + (i * bytesPerSector),
+                     bytesPerSector);
+      }
+      fatFileSystem.dirtyFatSectors[i] = 0;
+    }
   }
+  fatFileSystem.numDirtyFatSectors = 0;
+}
+
+/******************************************************************************
+ * getNumRootDirectorySectors
+ *****************************************************************************/
+static unsigned int getNumRootDirectorySectors()
+{
+  unsigned int bytesPerSector = fatFileSystem.bootSector.bytesPerSector;
+  
+  return (fatFileSystem.bootSector.maxNumRootDirEntries *
+          sizeof(DirectoryEntry) + bytesPerSector - 1) / bytesPerSector;
+}
+
+/******************************************************************************
+ * resolveRootCluster
+ *****************************************************************************/
+static unsigned int resolveRootCluster(unsigned int flc)
+{
+  if (flc == 0 && fatFileSystem.geometry.fatType == FAT_TYPE_32)
+    return fatFileSystem.geometry.rootDirectoryCluster;
+  return flc;
 }
 
 /******************************************************************************
- * freeFatTable
+ * writeFsInfo
  *****************************************************************************/
-static void freeFatTable(unsigned char* fatTable)
+static void writeFsInfo()
 {
-  free(fatTable);
+  unsigned int sector = fatFileSystem.bootSector.fsInfoSector;
+  unsigned char* buffer;
+  FatFsInfo* fsInfo;
+  
+  if (fatFileSystem.geometry.fatType != FAT_TYPE_32 || sector == 0 ||
+      sector >= fatFileSystem.bootSector.numReservedSectors)
+  {
+    return;
+  }
+  
+  // The FSInfo structure is the first 512 bytes of its sector. Only fill in
+  // the hints if the sector really is an FSInfo sector.
+  buffer = (unsigned char*) malloc(fatFileSystem.bootSector.bytesPerSector);
+  fsInfo = (FatFsInfo*) buffer;
+  if (read_sector(sector, buffer) != -1 &&
+      fsInfo->leadSignature == FAT_FSINFO_LEAD_SIGNATURE &&
+      fsInfo->structSignature == FAT_FSINFO_STRUCT_SIGNATURE &&
+      fsInfo->trailSignature == FAT_FSINFO_TRAIL_SIGNATURE)
+  {
+    fsInfo->numFreeClusters = fatFileSystem.session->numFreeClusters;
+    fsInfo->nextFreeCluster = fatFileSystem.session->nextFreeCluster;
+    if (fsInfo->nextFreeCluster >= fatFileSystem.session->numClusters)
+      fsInfo->nextFreeCluster = FAT_FSINFO_UNKNOWN;
+    write_sector(sector, buffer, sizeof(FatFsInfo));
+  }
+  free(buffer);
 }
 
 /******************************************************************************
  * logicalToPhysicalCluster
  *****************************************************************************/
-unsigned short logicalToPhysicalCluster(unsigned short logicalCluster)
+unsigned int logicalToPhysicalCluster(unsigned int logicalCluster)
 {
+  logicalCluster = resolveRootCluster(logicalCluster);
   if (logicalCluster == 0)
     return fatFileSystem.sectorOffsets.rootDirectory;
   else
-    return fatFileSystem.sectorOffsets.dataRegion + logicalCluster - 2;
+    return fatFileSystem.sectorOffsets.dataRegion + ((logicalCluster - 2) *
+           fatFileSystem.geometry.sectorsPerCluster);
 }
 
 
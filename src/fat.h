@@ -12,6 +12,12 @@
 #define _FAT_H_
 
 #include "fatSupport.h"
+#include "journal.h"
+#include "fatStats.h"
+#include "asyncIo.h"
+#include "directIo.h"
+#include "blockDevice.h"
+#include <pthread.h>
 #include <stdio.h>
 
 
@@ -42,8 +48,31 @@
 // file name and can be ignored for purposes of this assignment. 
 #define DIR_ENTRY_ATTRIB_LONG_FILE_NAME  0x0F
 
-// A key to share memory between command processes.
-#define FAT12_SHARED_MEMORY_KEY 899862
+// The FAT type follows from the number of data clusters: FAT12 has at most
+// 4084, FAT16 at most 65524, and FAT32 anything more.
+#define FAT12_MAX_DATA_CLUSTERS 4084
+#define FAT16_MAX_DATA_CLUSTERS 65524
+
+// The value that ends a chain of clusters (cut down to the size of the FAT
+// table's entries when it is set).
+#define FAT_END_OF_CHAIN 0x0FFFFFFF
+
+// The signatures of a FAT32 FSInfo sector.
+#define FAT_FSINFO_LEAD_SIGNATURE   0x41615252
+#define FAT_FSINFO_STRUCT_SIGNATURE 0x61417272
+#define FAT_FSINFO_TRAIL_SIGNATURE  0xAA550000
+#define FAT_FSINFO_UNKNOWN          0xFFFFFFFF
+
+// The maximum number of characters for the host path name of a disk image.
+#define FAT12_MAX_IMAGE_PATH_LENGTH 512
+
+// The environment variable through which the shell tells its command
+// processes the name of the session's shared memory segment.
+#define FAT12_SESSION_ENV_VAR "FAT12_SESSION"
+
+// The prefix of a session's shared memory segment name (followed by the PID
+// of the shell that owns the session).
+#define FAT12_SESSION_NAME_PREFIX "/fat12-session-"
 
 
 //-----------------------------------------------------------------------------
@@ -87,10 +116,35 @@ typedef enum
   FAT_ENTRY_TYPE_NEXT_SECTOR = 4,
 } FatEntryType;
 
+/******************************************************************************
+ * FatType - the types of FAT file system, named for the bits in a FAT entry.
+ *****************************************************************************/
+typedef enum
+{
+  FAT_TYPE_12 = 12,
+  FAT_TYPE_16 = 16,
+  FAT_TYPE_32 = 32,
+} FatType;
+
+/******************************************************************************
+ * FatLockMode - the kind of lock a command process holds on the disk image
+ *               while it is working with the file system.
+ *****************************************************************************/
+typedef enum
+{
+  FAT_LOCK_SHARED    = 0, // read-only commands, which may run in parallel
+  FAT_LOCK_EXCLUSIVE = 1, // mutating commands, which must run alone
+} FatLockMode;
+
 #pragma pack(1)
 
 /******************************************************************************
  * FatBootSector - struct containing the data elements in the FAT boot sector.
+ *                 FAT32 moves the FAT12/FAT16 extended fields further along to
+ *                 make room for its own, so they share a union. The 16-bit
+ *                 totalSectorCount and sectorsPerFAT are 0 when the value
+ *                 doesn't fit, in which case the 32-bit field is used (see
+ *                 FatFileSystem's geometry for the values that apply).
  *****************************************************************************/
 typedef struct
 {
@@ -107,13 +161,48 @@ typedef struct
   unsigned short  numHeads;
   char            ignore3[4];
   unsigned int    totalSectorCountForFAT32;
-  char            ignore4[2];
-  unsigned char   bootSignature;
-  unsigned int    volumeID;
-  char            volumeLabel[11];
-  char            fileSystemType[8];
+  union
+  {
+    struct // FAT12 and FAT16
+    {
+      char            ignore4[2];
+      unsigned char   bootSignature;
+      unsigned int    volumeID;
+      char            volumeLabel[11];
+      char            fileSystemType[8];
+    };
+    struct // FAT32
+    {
+      unsigned int    sectorsPerFAT32;
+      unsigned short  extendedFlags;
+      unsigned short  fileSystemVersion;
+      unsigned int    rootDirectoryCluster;
+      unsigned short  fsInfoSector;
+      unsigned short  backupBootSector;
+      char            ignore5[14];
+      unsigned char   bootSignature32;
+      unsigned int    volumeID32;
+      char            volumeLabel32[11];
+      char            fileSystemType32[8];
+    };
+  };
 } FatBootSector;
 
+/******************************************************************************
+ * FatFsInfo - struct containing the FAT32 FSInfo sector, which holds hints
+ *             about the free clusters so they needn't be counted.
+ *****************************************************************************/
+typedef struct
+{
+  unsigned int    leadSignature;
+  char            ignore1[480];
+  unsigned int    structSignature;
+  unsigned int    numFreeClusters; // or FAT_FSINFO_UNKNOWN
+  unsigned int    nextFreeCluster; // where to start looking, or unknown
+  char            ignore2[12];
+  unsigned int    trailSignature;
+} FatFsInfo;
+
 /******************************************************************************
  * DirectoryEntry - struct for an entry in a directory, representing a file or
  *                  subdirectory in the file system.
@@ -127,13 +216,15 @@ typedef struct
   unsigned short creationTime;
   unsigned short creationDate;
   unsigned short lastAccessDate;
-  unsigned char  ignored[2];
+  unsigned short firstLogicalClusterHigh; // FAT32 only
   unsigned short lastWriteTime;
   unsigned short lastWriteDate;
   unsigned short firstLogicalCluster;
   unsigned int   fileSize;
 } DirectoryEntry;
 
+#pragma pack()
+
 /******************************************************************************
  * DirectoryLevel - a single level in an absolute file path. A FilePath with
  *                  a depth greater than 1 will have multiple DirectoryLevels,
@@ -142,7 +233,7 @@ typedef struct
 typedef struct
 {
   unsigned int   indexInParentDirectory; // negligable for root directory
-  unsigned short firstLogicalCluster;
+  unsigned int   firstLogicalCluster;
   unsigned int   offsetInPathName;
 } DirectoryLevel;
 
@@ -160,6 +251,79 @@ typedef struct
                                // 0 if it points to a file
 } FilePath;
 
+/******************************************************************************
+ * FatImageSignature - identifies the state of a disk image file on the host,
+ *                     used to detect changes made outside of a session.
+ *****************************************************************************/
+typedef struct
+{
+  unsigned long long inode;
+  long long          size;
+  long long          modifiedTimeSeconds;
+  long long          modifiedTimeNanoseconds;
+  unsigned long long overlayInode; // of its delta, or 0 if it has none
+  long long          overlayModifiedTimeSeconds;
+  long long          overlayModifiedTimeNanoseconds;
+} FatImageSignature;
+
+/******************************************************************************
+ * FatSession - the mounted state shared between a shell and its command
+ *              processes, kept in a per-session shared memory segment. The
+ *              segment also holds the session's decoded FAT table (starting
+ *              fatTableOffset bytes from the start of the segment), a
+ *              free-cluster bitmap (starting freeMapOffset bytes in, with a
+ *              set bit for each free cluster), for FAT12 and FAT16, the
+ *              whole root directory region (starting rootDirectoryOffset
+ *              bytes in), and a bitmap of freed clusters waiting for the
+ *              next checkpoint to be discarded (starting discardMapOffset
+ *              bytes in).
+ *
+ *              Commands change the shared FAT table in place while holding
+ *              the image's exclusive lock, bump the generation when they
+ *              do, and write the FAT sectors they changed to the image
+ *              before unlocking (unless journaling), so other sessions
+ *              never find a stale FAT table there. The command whose change
+ *              is the flushInterval'th since the FAT table was last made
+ *              durable checkpoints the journal and fsyncs the image before
+ *              unlocking, as does syncFatSession(), after which
+ *              flushedGeneration equals generation. The root directory is
+ *              only ever read from the segment; the sectors of it that a
+ *              command changes are written to disk when it unlocks.
+ *
+ *              Every command reads and writes the image through the kind of
+ *              block device in blockDeviceType. For a memory device, the
+ *              image is in the shared memory segment named memoryImageName.
+ *****************************************************************************/
+typedef struct
+{
+  unsigned int      size; // total size of the segment in bytes
+  char              diskImageFileName[FAT12_MAX_IMAGE_PATH_LENGTH];
+  FilePath          workingDirectory; // resolved working directory
+  int               isWorkingDirectoryResolved;
+  pthread_mutex_t   mutex; // process-shared, guards reloads and flushes
+  unsigned int      generation;
+  unsigned int      flushedGeneration;
+  unsigned int      numWriteUnlocks; // times the image's exclusive lock was
+                                     // released
+  FatImageSignature imageSignature; // the image as of the last load/change
+  unsigned int      fatTableOffset;
+  unsigned int      fatTableSize;
+  unsigned int      freeMapOffset;
+  unsigned int      rootDirectoryOffset;
+  unsigned int      rootDirectorySize; // in bytes (0 for FAT32)
+  unsigned int      discardMapOffset;
+  unsigned int      numClusters; // number of FAT entries, including 0 and 1
+  unsigned int      numFreeClusters;
+  unsigned int      nextFreeCluster; // no free cluster comes before this one
+  JournalState      journal;
+  int               isDiscarding; // discard clusters when they are freed
+  unsigned int      flushInterval; // changes a command lets build up before
+                                   // making the FAT durable (0 = never)
+  BlockDeviceType   blockDeviceType;
+  char              memoryImageName[64];
+  FatStats          stats; // totals of every command in the session
+} FatSession;
+
 /******************************************************************************
  * FatFileSystem - struct containing information needed to work with a FAT12
  *                 file system.
@@ -167,46 +331,198 @@ typedef struct
 typedef struct
 {
   FILE*            fileSystemId;
+  BlockDevice*     blockDevice; // all sector I/O goes through this
   FatBootSector    bootSector;
   unsigned char*   fatTable;
   char*            diskImageFileName;  
   char*            workingDirectoryPathName;
-  char*            sharedMemoryPtr;
-  int              sharedMemoryId;
+  FatSession*      session;
+  unsigned char*   freeClusterMap;
+  unsigned char*   dirtyFatSectors; // one flag per sector of the FAT table
+  unsigned int     numDirtyFatSectors;
+  unsigned char*   rootDirectoryRegion; // the session's copy of it
+  unsigned char*   dirtyRootSectors; // one flag per sector of the region
+  unsigned int*    freedClusters; // freed while locked, to discard
+  unsigned int     numFreedClusters;
+  unsigned int     maxFreedClusters; // room in freedClusters
+  unsigned char*   discardMap; // the session's, for group commit
+  int              isFatTableDirty;
+  int              isMounted;
+  int              lockMode;
+  int              isLocked;
+  FatImageSignature lockedSignature; // the image as of when it was locked
   
   struct
   {
-    unsigned short fatTables;
-    unsigned short rootDirectory;
-    unsigned short dataRegion;
+    unsigned int fatTables;
+    unsigned int rootDirectory; // FAT12 and FAT16 only
+    unsigned int dataRegion;
   } sectorOffsets;
   
+  // The layout of the file system, worked out from the boot sector.
+  struct
+  {
+    int          fatType; // FAT_TYPE_12, FAT_TYPE_16 or FAT_TYPE_32
+    unsigned int sectorsPerFAT;
+    unsigned int sectorsPerCluster;
+    unsigned int bytesPerCluster;
+    unsigned int totalSectors;
+    unsigned int numClusters; // number of FAT entries, including 0 and 1
+    unsigned int rootDirectoryCluster; // FAT32 only
+  } geometry;
+  
+  // How the FAT table's entries are packed, for the FAT type.
+  const FatEntryCodec* fatCodec;
+  
 } FatFileSystem;
 
-#pragma pack()
-
 
 //-----------------------------------------------------------------------------
 // FAT12 interface
 //-----------------------------------------------------------------------------
 
 /******************************************************************************
- * initializeFatFileSystem - Initialize the FAT file system by loading the
- *                           boot sector, reading the first FAT table, and
- *                           loading the working directory
+ * createFatSession - Create a new session for a shell, in a shared memory
+ *                    segment named after the calling process's PID. The
+ *                    segment's name is exported in the FAT12_SESSION
+ *                    environment variable so that command processes started
+ *                    by the shell attach to the same session. Segments left
+ *                    behind by shells that are no longer running are
+ *                    removed first.
+ *
+ * diskImageFileName - the host path name of the disk image to use
  *
  * Return - 0 on success, -1 on failure
  *****************************************************************************/
-int initializeFatFileSystem();
+int createFatSession(const char* diskImageFileName);
 
 /******************************************************************************
- * terminateFatFileSystem - Terminate the FAT file sysem, deallocating any of
- *                          its used memory
+ * destroyFatSession - Unmap and remove the shared memory segment of a session
+ *                     created with createFatSession()
+ *
+ * Return - none
+ *****************************************************************************/
+void destroyFatSession();
+
+/******************************************************************************
+ * syncFatSession - Write the session's shared FAT table to every FAT copy on
+ *                  disk, if it has changed since it was last written, first
+ *                  checkpointing the journal if journaling is enabled. This
+ *                  is done by the shell, not by command processes.
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+int syncFatSession();
+
+/******************************************************************************
+ * setFatBlockDevice - Pick the kind of block device that every command in the
+ *                     session reads and writes the disk image with, after
+ *                     making sure the image can be opened that way. This is
+ *                     done by the shell, after creating the session.
+ *
+ * type - the kind of block device
+ *
+ * Return - 0 on success, -1 on failure (the session keeps its stdio device)
+ *****************************************************************************/
+int setFatBlockDevice(int type);
+
+/******************************************************************************
+ * setFatFlushInterval - Set how many changes to the session's shared FAT
+ *                       table may build up before the command that makes
+ *                       the last of them checkpoints the journal and fsyncs
+ *                       the image. Every command writes the FAT sectors it
+ *                       changed before unlocking regardless, so the interval
+ *                       only trades durability for speed. This is done by
+ *                       the shell, after creating the session.
+ *
+ * flushInterval - the number of changes, or 0 to only make it durable with
+ *                 syncFatSession()
+ *
+ * Return - none
+ *****************************************************************************/
+void setFatFlushInterval(unsigned int flushInterval);
+
+/******************************************************************************
+ * enableFatDiscard - Have every command in the session discard the clusters
+ *                    it frees (see discardBlockDevice()) before it unlocks
+ *                    the image, so a sparse image on the host stays sparse
+ *                    as files are removed. Their data is gone at once, even
+ *                    before the FAT table is made durable.
+ *                    This is done by the shell, after creating the session.
+ *
+ * Return - none
+ *****************************************************************************/
+void enableFatDiscard();
+
+/******************************************************************************
+ * getFatSessionGenerations - Get the current generation of the session's
+ *                            shared FAT table, and the generation that was
+ *                            last written to disk
+ *
+ * generation - the current generation
+ * flushedGeneration - the generation last written to disk
+ *
+ * Return - none
+ *****************************************************************************/
+void getFatSessionGenerations(unsigned int* generation,
+                              unsigned int* flushedGeneration);
+
+/******************************************************************************
+ * initializeFatFileSystem - Initialize the FAT file system by attaching to
+ *                           the shell's session, locking the disk image, loading the boot sector, reading the first
+ *                           FAT table, and loading the working directory
+ *
+ * lockMode - how to lock the disk image. Possible values:
+ *             FAT_LOCK_SHARED    - for commands that only read the image
+ *             FAT_LOCK_EXCLUSIVE - for commands that modify the image
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+int initializeFatFileSystem(int lockMode);
+
+/******************************************************************************
+ * terminateFatFileSystem - Terminate the FAT file sysem, publishing any
+ *                          changes to the session's shared FAT table,
+ *                          unlocking the image, and detaching from the
+ *                          session
  *
  * Return - none
  *****************************************************************************/
 void terminateFatFileSystem();
 
+/******************************************************************************
+ * lockFatFileSystem - Lock the disk image, waiting until any conflicting
+ *                     locks held by other processes are released. Shared
+ *                     locks may be held by many processes at once, while an
+ *                     exclusive lock can only be held by one.
+ *
+ * lockMode - FAT_LOCK_SHARED or FAT_LOCK_EXCLUSIVE
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+int lockFatFileSystem(int lockMode);
+
+/******************************************************************************
+ * tryLockFatFileSystem - Lock the disk image like lockFatFileSystem(), but
+ *                        without waiting if another process holds a
+ *                        conflicting lock.
+ *
+ * lockMode - FAT_LOCK_SHARED or FAT_LOCK_EXCLUSIVE
+ *
+ * Return - 0 if the image is now locked, 1 if it is busy, -1 on failure
+ *****************************************************************************/
+int tryLockFatFileSystem(int lockMode);
+
+/******************************************************************************
+ * unlockFatFileSystem - Release the lock on the disk image, first flushing
+ *                       any buffered writes and publishing any changes to
+ *                       the shared FAT table so the next lock holder sees
+ *                       them.
+ *
+ * Return - none
+ *****************************************************************************/
+void unlockFatFileSystem();
+
 /******************************************************************************
  * getFatBootSector - Retreive the information from the FAT file system's
  *                    boot sector
@@ -227,8 +543,8 @@ void getFatBootSector(FatBootSector* bootSector);
  *
  * Return - none
  *****************************************************************************/
-void getNumberOfUsedBlocks(unsigned short* numUsedBlocks,
-                           unsigned short* totalBlocks);
+void getNumberOfUsedBlocks(unsigned int* numUsedBlocks,
+                           unsigned int* totalBlocks);
 
 
 //-----------------------------------------------------------------------------
@@ -255,7 +571,7 @@ void getWorkingDirectory(FilePath* filePath);
 
 /******************************************************************************
  * setWorkingDirectory - Set the current working directory to the given file
- *                       path
+ *                       path, caching the resolved path in the session
  *
  * filePath - the file path to set the working directory as
  *
@@ -263,6 +579,17 @@ void getWorkingDirectory(FilePath* filePath);
  *****************************************************************************/
 void setWorkingDirectory(FilePath* filePath);
 
+/******************************************************************************
+ * invalidateWorkingDirectory - Discard the session's resolved working
+ *                              directory, so that the next call to
+ *                              getWorkingDirectory() resolves it again from
+ *                              its path name. This must be called by any
+ *                              command that moves directories on disk.
+ *
+ * Return - none
+ *****************************************************************************/
+void invalidateWorkingDirectory();
+
 /******************************************************************************
  * changeFilePath - Change the path of a file path, either replacing it if
  *                  given a absolute path, or concatenating it if given a
@@ -293,7 +620,7 @@ int changeFilePath(FilePath* filePath, const char* pathName, int pathType);
  *  
  * Return - a list of directory entries on success, or NULL on failure
  *****************************************************************************/
-DirectoryEntry* openDirectory(unsigned short flc);
+DirectoryEntry* openDirectory(unsigned int flc);
 
 /******************************************************************************
  * closeDirectory - Close an opened directory
@@ -315,7 +642,33 @@ void closeDirectory(DirectoryEntry* directory);
  * Return - 0 on success, -1 if there wasn't enough space to save the entire
  *          directory.
  *****************************************************************************/
-int saveDirectory(unsigned short flc, DirectoryEntry* directory);
+int saveDirectory(unsigned int flc, DirectoryEntry* directory);
+
+/******************************************************************************
+ * readDirectory - Read every entry of a directory, including the whole root
+ *                 directory region (FLC 0), which has no chain in the FAT
+ *                 table. An extra end-of-entries marker is added after the
+ *                 last entry, so the list ends properly even if the directory
+ *                 is completely full.
+ * 
+ * flc - the first logical cluster of the directory to read
+ * numBytes - set to the size of the directory, not counting the marker
+ *  
+ * Return - a list of directory entries, to be closed with closeDirectory()
+ *****************************************************************************/
+DirectoryEntry* readDirectory(unsigned int flc, unsigned int* numBytes);
+
+/******************************************************************************
+ * writeDirectory - Write back a directory read with readDirectory()
+ * 
+ * flc - the first logical cluster of the directory
+ * directory - the directory's list of entries
+ * numBytes - the size of the directory, as given by readDirectory()
+ *  
+ * Return - none
+ *****************************************************************************/
+void writeDirectory(unsigned int flc, DirectoryEntry* directory,
+                    unsigned int numBytes);
 
 /******************************************************************************
  * organizeDirectory - Organizing a directory's list of entries by removing
@@ -395,7 +748,7 @@ int isDirectoryEmpty(DirectoryEntry* directory);
  * Return - 0 on success, -1 if there was not enough room on the file system
  *          for one more entry.
  *****************************************************************************/
-int createNewEntry(unsigned short flc, DirectoryEntry** directory,
+int createNewEntry(unsigned int flc, DirectoryEntry** directory,
                    const char* name, int* newEntryIndex);
 
 
@@ -425,6 +778,26 @@ int isEntryADirectory(DirectoryEntry* entry);
  *****************************************************************************/
 void getEntryName(DirectoryEntry* entry, char* nameString);
 
+/******************************************************************************
+ * getEntryCluster - Get the first logical cluster of a directory entry, which
+ *                   on FAT32 is split into a low and a high half
+ *
+ * entry - The directory entry
+ * 
+ * Return - the first logical cluster
+ *****************************************************************************/
+unsigned int getEntryCluster(DirectoryEntry* entry);
+
+/******************************************************************************
+ * setEntryCluster - Set the first logical cluster of a directory entry
+ *
+ * entry - The directory entry
+ * cluster - the first logical cluster
+ * 
+ * Return - none
+ *****************************************************************************/
+void setEntryCluster(DirectoryEntry* entry, unsigned int cluster);
+
 /******************************************************************************
  * setEntryName - Set the name of a directory entry.
  *
@@ -449,7 +822,7 @@ void setEntryName(DirectoryEntry* entry, const char* nameString);
  * 
  * Return - 0 on success, -1 on failure
  *****************************************************************************/
-int readFileContents(unsigned short flc, unsigned char** data,
+int readFileContents(unsigned int flc, unsigned char** data,
                      unsigned int* numBytes);
 
 /******************************************************************************
@@ -463,7 +836,7 @@ int readFileContents(unsigned short flc, unsigned char** data,
  * Return - 0 on success, -1 on failure (if there wasn't enough space on the
  *          file system
  *****************************************************************************/
-int writeFileContents(unsigned short flc, unsigned char* data,
+int writeFileContents(unsigned int flc, unsigned char* data,
                       unsigned int numBytes);
 
 /******************************************************************************
@@ -474,7 +847,7 @@ int writeFileContents(unsigned short flc, unsigned char* data,
  * 
  * Return - 0 on success, -1 on failure
  *****************************************************************************/
-int freeFileContents(unsigned short flc);
+int freeFileContents(unsigned int flc);
 
 
 //-----------------------------------------------------------------------------
@@ -495,7 +868,7 @@ int freeFileContents(unsigned short flc);
  * 
  * Return - none
  *****************************************************************************/
-void getFatEntry(unsigned short entryNumber, unsigned short* entryValue,
+void getFatEntry(unsigned int entryNumber, unsigned int* entryValue,
                 int* entryType);
 
 /******************************************************************************
@@ -506,7 +879,7 @@ void getFatEntry(unsigned short entryNumber, unsigned short* entryValue,
  * 
  * Return - none
  *****************************************************************************/
-void setFatEntry(unsigned short entryNumber, unsigned short entryValue);
+void setFatEntry(unsigned int entryNumber, unsigned int entryValue);
 
 /******************************************************************************
  * findUnusedFatEntry - Find an unused FAT entry, getting its entry number.
@@ -515,17 +888,111 @@ void setFatEntry(unsigned short entryNumber, unsigned short entryValue);
  * 
  * Return - 0 if an unused entry was found, -1 if not.
  *****************************************************************************/
-int findUnusedFatEntry(unsigned short* entryNumber);
+int findUnusedFatEntry(unsigned int* entryNumber);
 
 /******************************************************************************
- * getFatEntryChainLength - Count the number of sectors in a chain of FAT
- *                          entries, starting at the given FLC.
+ * getFatEntryChainLength - Count the number of clusters in a chain of FAT
+ *                          entries, starting at the given FLC. The FAT12 and
+ *                          FAT16 root directory counts as the number of
+ *                          clusters its region would fill.
  *
  * firstEntryNumber - The FAT entry number to start at
  * 
  * Return - the length of the entry chain starting at firstEntryNumber
  *****************************************************************************/
-unsigned short getFatEntryChainLength(unsigned short firstEntryNumber);
+unsigned int getFatEntryChainLength(unsigned int firstEntryNumber);
+
+/******************************************************************************
+ * getFatEntryChainSize - Get the number of bytes that a chain of FAT entries,
+ *                        starting at the given FLC, has room for.
+ *
+ * firstEntryNumber - The FAT entry number to start at
+ * 
+ * Return - the length of the chain in bytes (or the size of the root
+ *          directory region, for the FAT12 and FAT16 root directory)
+ *****************************************************************************/
+unsigned int getFatEntryChainSize(unsigned int firstEntryNumber);
+
+/******************************************************************************
+ * logicalToPhysicalCluster - Translate a logical cluster number to a physical
+ *                            cluster number.
+ *
+ * entryNumber - logicalCluster
+ * 
+ * Return - the corresponding physical cluster number (the sector number of
+ *          the cluster's data)
+ *****************************************************************************/
+unsigned int logicalToPhysicalCluster(unsigned int logicalCluster);
+
+/******************************************************************************
+ * readClusters - Read a run of consecutive clusters with a single read.
+ *
+ * cluster - the first cluster of the run
+ * numClusters - the number of clusters in the run
+ * buffer - where to store the data, numClusters * bytesPerCluster bytes long
+ * 
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+int readClusters(unsigned int cluster, unsigned int numClusters,
+                 unsigned char* buffer);
+
+/******************************************************************************
+ * writeClusters - Write data to a run of consecutive clusters, with a single
+ *                 write for all of the whole sectors. When the data ends
+ *                 partway through a sector, the rest of that sector is left
+ *                 as it was.
+ *
+ * cluster - the first cluster of the run
+ * data - the data to write
+ * numBytes - the number of bytes of data, which sets the length of the run
+ * 
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+int writeClusters(unsigned int cluster, unsigned char* data,
+                  unsigned int numBytes);
+
+/******************************************************************************
+ * getClusterRuns - Split the next clusters of a chain into runs of
+ *                  consecutive clusters, to read them all at once with
+ *                  readSectorRuns() (the FAT table is already in memory, so
+ *                  the whole chain is known before reading any of it).
+ *
+ * cluster - the cluster to start at, which is advanced past the clusters
+ *           added (to 0 if the chain ends)
+ * maxClusters - the most clusters to add
+ * buffer - where the clusters' data goes, one after another (or NULL to
+ *          only find the runs)
+ * runs - the runs to fill in, with room for maxClusters of them
+ * numClusters - set to the number of clusters added
+ * 
+ * Return - the number of runs
+ *****************************************************************************/
+unsigned int getClusterRuns(unsigned int* cluster, unsigned int maxClusters,
+                            unsigned char* buffer, SectorRun* runs,
+                            unsigned int* numClusters);
+
+/******************************************************************************
+ * readFatTableCopy - Read one of the copies of the FAT table from disk (not
+ *                    the session's shared FAT table), such as to check that
+ *                    the copies agree.
+ *
+ * fatIndex - the index of the FAT table copy to read (0 to numFATs - 1)
+ * fatTable - the buffer to read the table into, which must be at least
+ *            sectorsPerFAT * bytesPerSector bytes long
+ * 
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+int readFatTableCopy(int fatIndex, unsigned char* fatTable);
+
+/******************************************************************************
+ * writeFatTableCopies - Write the session's shared FAT table to every copy
+ *                       of the FAT table on disk and make sure it reaches
+ *                       the disk, such as to repair copies that don't agree.
+ *                       The image must be locked exclusively.
+ * 
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+int writeFatTableCopies();
 
 
 //-----------------------------------------------------------------------------
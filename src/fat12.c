@@ -0,0 +1,145 @@
+/******************************************************************************
+ * fat12.c: Multi-call binary
+ *
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Runs the shell or one of the commands, all of which are built
+ *              into this one executable (see fat12.h).
+ *
+ *              Usage: fat12 COMMAND [ARGS...]
+ *                 or: COMMAND [ARGS...] (through a link named COMMAND)
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "fat12.h"
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * Fat12Command - a command built into the multi-call binary.
+ *****************************************************************************/
+typedef struct
+{
+  const char*      name;
+  Fat12CommandMain main;
+} Fat12Command;
+
+
+//-----------------------------------------------------------------------------
+// Variables
+//-----------------------------------------------------------------------------
+
+// Each command's main function is renamed to <name>Main when it is compiled
+// for the multi-call binary (see Makefile.fat12).
+int catMain(int argc, char* argv[]);
+int cdMain(int argc, char* argv[]);
+int defragMain(int argc, char* argv[]);
+int dfMain(int argc, char* argv[]);
+int duMain(int argc, char* argv[]);
+int findMain(int argc, char* argv[]);
+int fsckMain(int argc, char* argv[]);
+int imgcloneMain(int argc, char* argv[]);
+int imgdiffMain(int argc, char* argv[]);
+int imgpackMain(int argc, char* argv[]);
+int imgpatchMain(int argc, char* argv[]);
+int lsMain(int argc, char* argv[]);
+int mkdirMain(int argc, char* argv[]);
+int mkfsMain(int argc, char* argv[]);
+int pbsMain(int argc, char* argv[]);
+int pfeMain(int argc, char* argv[]);
+int pwdMain(int argc, char* argv[]);
+int rmMain(int argc, char* argv[]);
+int rmdirMain(int argc, char* argv[]);
+int shellMain(int argc, char* argv[]);
+int snapshotMain(int argc, char* argv[]);
+int statsMain(int argc, char* argv[]);
+int touchMain(int argc, char* argv[]);
+int treeMain(int argc, char* argv[]);
+int writeMain(int argc, char* argv[]);
+
+static const Fat12Command commands[] =
+{
+  { "cat",      catMain      },
+  { "cd",       cdMain       },
+  { "defrag",   defragMain   },
+  { "df",       dfMain       },
+  { "du",       duMain       },
+  { "find",     findMain     },
+  { "fsck",     fsckMain     },
+  { "imgclone", imgcloneMain },
+  { "imgdiff",  imgdiffMain  },
+  { "imgpack",  imgpackMain  },
+  { "imgpatch", imgpatchMain },
+  { "ls",       lsMain       },
+  { "mkdir",    mkdirMain    },
+  { "mkfs",     mkfsMain     },
+  { "pbs",      pbsMain      },
+  { "pfe",      pfeMain      },
+  { "pwd",      pwdMain      },
+  { "rm",       rmMain       },
+  { "rmdir",    rmdirMain    },
+  { "shell",    shellMain    },
+  { "snapshot", snapshotMain },
+  { "stats",    statsMain    },
+  { "touch",    touchMain    },
+  { "tree",     treeMain     },
+  { "write",    writeMain    },
+};
+
+#define NUM_COMMANDS (sizeof(commands) / sizeof(commands[0]))
+
+
+/******************************************************************************
+ * main - runs the command named by argv[0], or else by argv[1].
+ *****************************************************************************/
+int main(int argc, char* argv[])
+{
+  Fat12CommandMain commandMain;
+  const char* name;
+  unsigned int i;
+
+  // Run the command we were run as, if there is one.
+  name = strrchr(argv[0], '/');
+  name = (name != NULL ? name + 1 : argv[0]);
+  commandMain = findFat12Command(name);
+  if (commandMain != NULL)
+    return commandMain(argc, argv);
+
+  // Otherwise, the command is the first argument.
+  if (argc >= 2)
+  {
+    commandMain = findFat12Command(argv[1]);
+    if (commandMain != NULL)
+      return commandMain(argc - 1, argv + 1);
+    printf("Error: Unknown command '%s'\n", argv[1]);
+  }
+
+  printf("Usage: fat12 COMMAND [ARGS...]\n");
+  printf("Commands:");
+  for (i = 0; i < NUM_COMMANDS; i++)
+    printf(" %s", commands[i].name);
+  printf("\n");
+  return -1;
+}
+
+/******************************************************************************
+ * findFat12Command
+ *****************************************************************************/
+Fat12CommandMain findFat12Command(const char* name)
+{
+  unsigned int i;
+
+  for (i = 0; i < NUM_COMMANDS; i++)
+  {
+    if (strcmp(commands[i].name, name) == 0)
+      return commands[i].main;
+  }
+  return NULL;
+}
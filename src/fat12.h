@@ -0,0 +1,49 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function headers for the fat12 multi-call binary, which holds
+ *              the shell and every command in one executable. The command to
+ *              run is picked by the name it was run as (argv[0], such as
+ *              through a symlink named after the command), or else by its
+ *              first argument:
+ *
+ *                $ bin/fat12 shell disks/floppy1
+ *
+ *              The shell in the multi-call binary runs each command by
+ *              exec'ing the same binary with argv[0] set to the command's
+ *              name, so only one executable has to be loaded and kept in the
+ *              page cache.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#ifndef _FAT12_H_
+#define _FAT12_H_
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * Fat12CommandMain - the main function of a command.
+ *****************************************************************************/
+typedef int (*Fat12CommandMain)(int argc, char* argv[]);
+
+
+//-----------------------------------------------------------------------------
+// Multi-call interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * findFat12Command - Find a command in the multi-call binary by name
+ *
+ * name - the name of the command (such as "ls")
+ *
+ * Return - the command's main function, or NULL if there is no such command
+ *****************************************************************************/
+Fat12CommandMain findFat12Command(const char* name);
+
+
+#endif //_FAT12_H_
@@ -0,0 +1,151 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function definitions for the I/O and FAT operation
+ *              statistics.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fatStats.h"
+
+
+//-----------------------------------------------------------------------------
+// Variables
+//-----------------------------------------------------------------------------
+
+unsigned long long fatStatCounters[NUM_FAT_STATS];
+
+// The name of each counter, as a JSON key and as a description.
+static const char* statKeys[NUM_FAT_STATS] =
+{
+  "read_calls",
+  "sectors_read",
+  "bytes_read",
+  "write_calls",
+  "sectors_written",
+  "bytes_written",
+  "journal_reads",
+  "journal_writes",
+  "journal_commits",
+  "fat_lookups",
+  "fat_updates",
+  "chain_hops",
+  "fat_reloads",
+  "directory_reads",
+  "directory_entries",
+  "path_resolutions",
+  "io_submissions",
+  "direct_io_reads",
+  "direct_io_writes",
+};
+static const char* statDescriptions[NUM_FAT_STATS] =
+{
+  "Read calls",
+  "Sectors read",
+  "Bytes read",
+  "Write calls",
+  "Sectors written",
+  "Bytes written",
+  "Sectors read from journal",
+  "Sectors written to journal",
+  "Journal commits",
+  "FAT lookups",
+  "FAT updates",
+  "Chain hops",
+  "FAT table reloads",
+  "Directory reads",
+  "Directory entries scanned",
+  "Path resolutions",
+  "I/O engine submissions",
+  "Direct I/O reads",
+  "Direct I/O writes",
+};
+
+
+//-----------------------------------------------------------------------------
+// Statistics interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * addFatStats
+ *****************************************************************************/
+void addFatStats(FatStats* stats)
+{
+  int i;
+
+  __atomic_add_fetch(&stats->numCommands, 1, __ATOMIC_RELAXED);
+  for (i = 0; i < NUM_FAT_STATS; i++)
+  {
+    __atomic_add_fetch(&stats->counters[i], __atomic_load_n(
+      &fatStatCounters[i], __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+  }
+}
+
+/******************************************************************************
+ * resetFatStats
+ *****************************************************************************/
+void resetFatStats(FatStats* stats)
+{
+  int i;
+
+  __atomic_store_n(&stats->numCommands, 0, __ATOMIC_RELAXED);
+  for (i = 0; i < NUM_FAT_STATS; i++)
+    __atomic_store_n(&stats->counters[i], 0, __ATOMIC_RELAXED);
+}
+
+/******************************************************************************
+ * printFatStats
+ *****************************************************************************/
+void printFatStats(FILE* stream, const char* name, const FatStats* stats,
+                   int format)
+{
+  unsigned long long counters[NUM_FAT_STATS];
+  unsigned long long numCommands = 1;
+  int i;
+
+  for (i = 0; i < NUM_FAT_STATS; i++)
+  {
+    counters[i] = __atomic_load_n((stats != NULL ? &stats->counters[i] :
+                                   &fatStatCounters[i]), __ATOMIC_RELAXED);
+  }
+  if (stats != NULL)
+    numCommands = __atomic_load_n(&stats->numCommands, __ATOMIC_RELAXED);
+
+  if (format == FAT_STATS_FORMAT_JSON)
+  {
+    fprintf(stream, "{\"name\": \"%s\", \"enabled\": %s, \"commands\": %llu",
+            name, (FAT12_STATS_ENABLED ? "true" : "false"), numCommands);
+    for (i = 0; i < NUM_FAT_STATS; i++)
+      fprintf(stream, ", \"%s\": %llu", statKeys[i], counters[i]);
+    fprintf(stream, "}\n");
+  }
+  else
+  {
+    fprintf(stream, "Statistics for %s (%llu command%s)%s:\n", name,
+            numCommands, (numCommands == 1 ? "" : "s"),
+            (FAT12_STATS_ENABLED ? "" : " [compiled out]"));
+    for (i = 0; i < NUM_FAT_STATS; i++)
+      fprintf(stream, "  %-28s%12llu\n", statDescriptions[i], counters[i]);
+  }
+}
+
+/******************************************************************************
+ * dumpFatStatsIfRequested
+ *****************************************************************************/
+void dumpFatStatsIfRequested(const char* name)
+{
+  const char* format = getenv(FAT12_STATS_ENV_VAR);
+
+  if (format == NULL)
+    return;
+  if (strcmp(format, "json") == 0)
+    printFatStats(stderr, name, NULL, FAT_STATS_FORMAT_JSON);
+  else if (strcmp(format, "human") == 0)
+    printFatStats(stderr, name, NULL, FAT_STATS_FORMAT_HUMAN);
+}
@@ -0,0 +1,156 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function headers and counters for the I/O and FAT operation
+ *              statistics.
+ *
+ *              Each process counts its own sector I/O, FAT table lookups,
+ *              chain hops and directory scans with FAT_STAT_ADD(). The
+ *              counters are atomic, so threads (such as fsck's) can share
+ *              them. When a command terminates, its counters are added to the
+ *              session's totals, which the stats command prints. Setting the
+ *              FAT12_STATS environment variable to "human" or "json" also
+ *              makes each command print its own counters to stderr when it
+ *              terminates.
+ *
+ *              Compiling with -DFAT12_NO_STATS (make DEFINES=-DFAT12_NO_STATS)
+ *              removes the counting altogether.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#ifndef _FAT_STATS_H_
+#define _FAT_STATS_H_
+
+#include <stdio.h>
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+
+// The environment variable that makes commands print their counters when
+// they terminate ("human" or "json").
+#define FAT12_STATS_ENV_VAR "FAT12_STATS"
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * FatStat - the things that are counted.
+ *****************************************************************************/
+typedef enum
+{
+  FAT_STAT_READ_CALLS = 0,       // calls to read sectors from the image
+  FAT_STAT_SECTORS_READ,         // sectors read from the image
+  FAT_STAT_BYTES_READ,           // bytes read from the image
+  FAT_STAT_WRITE_CALLS,          // calls to write sectors to the image
+  FAT_STAT_SECTORS_WRITTEN,      // sectors written to the image
+  FAT_STAT_BYTES_WRITTEN,        // bytes written to the image
+  FAT_STAT_JOURNAL_READS,        // sectors read from the journal instead
+  FAT_STAT_JOURNAL_WRITES,       // sectors written into a transaction instead
+  FAT_STAT_JOURNAL_COMMITS,      // transactions appended to the journal
+  FAT_STAT_FAT_LOOKUPS,          // FAT entries read
+  FAT_STAT_FAT_UPDATES,          // FAT entries changed
+  FAT_STAT_CHAIN_HOPS,           // FAT entries read that link to another
+  FAT_STAT_FAT_RELOADS,          // times the shared FAT was reloaded from disk
+  FAT_STAT_DIRECTORY_READS,      // directories read
+  FAT_STAT_DIRECTORY_ENTRIES,    // directory entries scanned
+  FAT_STAT_PATH_RESOLUTIONS,     // path names resolved
+  FAT_STAT_IO_SUBMISSIONS,       // batches of runs handed to the I/O engine
+  FAT_STAT_DIRECT_IO_READS,      // reads of the image with O_DIRECT
+  FAT_STAT_DIRECT_IO_WRITES,     // writes of the image with O_DIRECT
+  NUM_FAT_STATS
+} FatStat;
+
+/******************************************************************************
+ * FatStats - a set of counters.
+ *****************************************************************************/
+typedef struct
+{
+  unsigned long long numCommands; // number of commands counted
+  unsigned long long counters[NUM_FAT_STATS];
+} FatStats;
+
+/******************************************************************************
+ * FatStatsFormat - the formats the counters can be printed in.
+ *****************************************************************************/
+typedef enum
+{
+  FAT_STATS_FORMAT_HUMAN = 0,
+  FAT_STATS_FORMAT_JSON  = 1,
+} FatStatsFormat;
+
+
+//-----------------------------------------------------------------------------
+// Counters
+//-----------------------------------------------------------------------------
+
+// This process's counters.
+extern unsigned long long fatStatCounters[NUM_FAT_STATS];
+
+/******************************************************************************
+ * FAT_STAT_ADD - Add to one of this process's counters.
+ *****************************************************************************/
+#ifdef FAT12_NO_STATS
+  #define FAT12_STATS_ENABLED 0
+  #define FAT_STAT_ADD(stat, amount) ((void) 0)
+#else
+  #define FAT12_STATS_ENABLED 1
+  #define FAT_STAT_ADD(stat, amount) \
+    __atomic_add_fetch(&fatStatCounters[stat], (amount), __ATOMIC_RELAXED)
+#endif
+
+
+//-----------------------------------------------------------------------------
+// Statistics interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * addFatStats - Add this process's counters to a set of counters, such as
+ *               the session's totals. Other processes may be adding to the
+ *               same set at the same time.
+ *
+ * stats - the set of counters to add to
+ *
+ * Return - none
+ *****************************************************************************/
+void addFatStats(FatStats* stats);
+
+/******************************************************************************
+ * resetFatStats - Set a set of counters back to zero.
+ *
+ * stats - the set of counters to reset
+ *
+ * Return - none
+ *****************************************************************************/
+void resetFatStats(FatStats* stats);
+
+/******************************************************************************
+ * printFatStats - Print a set of counters.
+ *
+ * stream - the stream to print to
+ * name - what the counters are for (such as the command's name)
+ * stats - the counters to print, or NULL for this process's counters
+ * format - FAT_STATS_FORMAT_HUMAN or FAT_STATS_FORMAT_JSON
+ *
+ * Return - none
+ *****************************************************************************/
+void printFatStats(FILE* stream, const char* name, const FatStats* stats,
+                   int format);
+
+/******************************************************************************
+ * dumpFatStatsIfRequested - Print this process's counters to stderr, if the
+ *                           FAT12_STATS environment variable asks for them.
+ *
+ * name - the name of the command
+ *
+ * Return - none
+ *****************************************************************************/
+void dumpFatStatsIfRequested(const char* name);
+
+
+#endif //_FAT_STATS_H_
@@ -3,9 +3,16 @@
  *
  *  read_sector
  *  write_sector
+ *  read_sectors
+ *  write_sectors
+ *  flush_sectors
  *
  *  get_fat_entry
  *  set_fat_entry
+ *  get_fat16_entry
+ *  set_fat16_entry
+ *  get_fat32_entry
+ *  set_fat32_entry
  *  
  * Authors: Andy Kinley, Archana Chidanandan, David Mutchler and others.
  *          March, 2004.
@@ -15,6 +22,48 @@
 #include "fat.h"
 
 
+/******************************************************************************
+ * read_bytes
+ *
+ * Read bytes from the file system, through its block device
+ *
+ * sector_number:  The number of the sector to start reading at
+ * num_bytes:  The number of bytes to read
+ * buffer:  The array into which to store the bytes
+ *
+ * Return: the number of bytes read, or -1 if the sector can't be reached.
+ *****************************************************************************/
+
+static long long read_bytes(unsigned int sector_number, size_t num_bytes,
+                            unsigned char* buffer)
+{
+   return readBlockDevice(fatFileSystem.blockDevice, (long long)
+                          sector_number * fatFileSystem.bootSector
+                          .bytesPerSector, num_bytes, buffer);
+}
+
+
+/******************************************************************************
+ * write_bytes
+ *
+ * Write bytes to the file system, through its block device
+ *
+ * sector_number:  The number of the sector to start writing at
+ * num_bytes:  The number of bytes to write
+ * buffer:  The array whose contents are to be written
+ *
+ * Return: the number of bytes written, or -1 if the sector can't be reached.
+ *****************************************************************************/
+
+static long long write_bytes(unsigned int sector_number, size_t num_bytes,
+                             unsigned char* buffer)
+{
+   return writeBlockDevice(fatFileSystem.blockDevice, (long long)
+                           sector_number * fatFileSystem.bootSector
+                           .bytesPerSector, num_bytes, buffer);
+}
+
+
 /******************************************************************************
  * read_sector
  *
@@ -32,22 +81,30 @@ int read_sector(unsigned int sector_number, unsigned char* buffer)
 {
    int bytes_read;
 
-   if (fseek(fatFileSystem.fileSystemId, (long) sector_number *
-             (long) fatFileSystem.bootSector.bytesPerSector, SEEK_SET) != 0)
+   // Sectors written by a journaled transaction are read from the journal.
+   if (journalReadSector(sector_number, buffer))
+   {
+      FAT_STAT_ADD(FAT_STAT_JOURNAL_READS, 1);
+      return fatFileSystem.bootSector.bytesPerSector;
+   }
+
+   bytes_read = read_bytes(sector_number, fatFileSystem.bootSector
+                           .bytesPerSector, buffer);
+   if (bytes_read == -1)
    {
 	   printf("Error accessing sector %d\n", sector_number);
       return -1;
    }
 
-   bytes_read = fread(buffer, sizeof(char), fatFileSystem.bootSector
-                      .bytesPerSector, fatFileSystem.fileSystemId);
-
    if (bytes_read != fatFileSystem.bootSector.bytesPerSector)
    {
       printf("Error reading sector %d\n", sector_number);
       return -1;
    }
 
+   FAT_STAT_ADD(FAT_STAT_READ_CALLS, 1);
+   FAT_STAT_ADD(FAT_STAT_SECTORS_READ, 1);
+   FAT_STAT_ADD(FAT_STAT_BYTES_READ, bytes_read);
    return bytes_read;
 }
 
@@ -68,19 +125,24 @@ int write_sector(unsigned int sector_number, unsigned char* buffer, unsigned int
 {
    int bytes_written;
 
-   if (fseek(fatFileSystem.fileSystemId, (long) sector_number *
-             (long) fatFileSystem.bootSector.bytesPerSector, SEEK_SET) != 0) 
+   // While a journaled transaction is open, writes go into the transaction.
+   if (journalWriteSector(sector_number, buffer, bufferSize))
    {
-      printf("Error accessing sector %d\n", sector_number);
-      return -1;
+      FAT_STAT_ADD(FAT_STAT_JOURNAL_WRITES, 1);
+      return (bufferSize < fatFileSystem.bootSector.bytesPerSector ?
+              bufferSize : fatFileSystem.bootSector.bytesPerSector);
    }
-   
+
    int numBytesToWrite = fatFileSystem.bootSector.bytesPerSector;
    if (bufferSize < numBytesToWrite)
      numBytesToWrite = bufferSize;
 
-   bytes_written = fwrite(buffer, sizeof(char), numBytesToWrite,
-                          fatFileSystem.fileSystemId);
+   bytes_written = write_bytes(sector_number, numBytesToWrite, buffer);
+   if (bytes_written == -1) 
+   {
+      printf("Error accessing sector %d\n", sector_number);
+      return -1;
+   }
 
    if (bytes_written != numBytesToWrite) 
    {
@@ -88,10 +150,128 @@ int write_sector(unsigned int sector_number, unsigned char* buffer, unsigned int
       return -1;
    }
 
+   FAT_STAT_ADD(FAT_STAT_WRITE_CALLS, 1);
+   FAT_STAT_ADD(FAT_STAT_SECTORS_WRITTEN, 1);
+   FAT_STAT_ADD(FAT_STAT_BYTES_WRITTEN, bytes_written);
    return bytes_written;
 }
 
 
+/*****************************************************************************
+ * read_sectors
+ *
+ * Read a run of consecutive sectors from the file system with a single read
+ *
+ * sector_number:  The number of the first sector to read
+ * num_sectors:  The number of sectors to read
+ * buffer:  The array into which to store the contents of the sectors
+ *
+ * Return: the number of bytes read, or -1 if the read fails.
+ ****************************************************************************/
+
+int read_sectors(unsigned int sector_number, unsigned int num_sectors,
+                 unsigned char* buffer)
+{
+   unsigned int bytes_per_sector = fatFileSystem.bootSector.bytesPerSector;
+   size_t num_bytes = (size_t) num_sectors * bytes_per_sector;
+   long long bytes_read;
+   unsigned int i;
+
+   bytes_read = read_bytes(sector_number, num_bytes, buffer);
+   if (bytes_read == -1)
+   {
+      printf("Error accessing sector %d\n", sector_number);
+      return -1;
+   }
+
+   if (bytes_read != (long long) num_bytes)
+   {
+      printf("Error reading sectors %d to %d\n", sector_number,
+             sector_number + num_sectors - 1);
+      return -1;
+   }
+
+   FAT_STAT_ADD(FAT_STAT_READ_CALLS, 1);
+   FAT_STAT_ADD(FAT_STAT_SECTORS_READ, num_sectors);
+   FAT_STAT_ADD(FAT_STAT_BYTES_READ, bytes_read);
+
+   // Sectors written by a journaled transaction replace what's on disk.
+   for (i = 0; i < num_sectors; i++)
+   {
+      if (journalReadSector(sector_number + i, buffer +
+                            (i * bytes_per_sector)))
+         FAT_STAT_ADD(FAT_STAT_JOURNAL_READS, 1);
+   }
+
+   return (int) bytes_read;
+}
+
+
+/*****************************************************************************
+ * write_sectors
+ *
+ * Write a run of consecutive sectors to the file system with a single write
+ *
+ * sector_number:  The number of the first sector to write
+ * num_sectors:  The number of sectors to write
+ * buffer:  The array whose contents are to be written
+ *
+ * Return: the number of bytes written, or -1 if the write fails.
+ ****************************************************************************/
+
+int write_sectors(unsigned int sector_number, unsigned int num_sectors,
+                  unsigned char* buffer)
+{
+   unsigned int bytes_per_sector = fatFileSystem.bootSector.bytesPerSector;
+   size_t num_bytes = (size_t) num_sectors * bytes_per_sector;
+   long long bytes_written;
+   unsigned int i;
+
+   // While a journaled transaction is open, each sector goes into it.
+   if (journalWriteSector(sector_number, buffer, bytes_per_sector))
+   {
+      for (i = 1; i < num_sectors; i++)
+         journalWriteSector(sector_number + i, buffer +
+                            (i * bytes_per_sector), bytes_per_sector);
+      FAT_STAT_ADD(FAT_STAT_JOURNAL_WRITES, num_sectors);
+      return (int) num_bytes;
+   }
+
+   bytes_written = write_bytes(sector_number, num_bytes, buffer);
+   if (bytes_written == -1)
+   {
+      printf("Error accessing sector %d\n", sector_number);
+      return -1;
+   }
+
+   if (bytes_written != (long long) num_bytes)
+   {
+      printf("Error writing sectors %d to %d\n", sector_number,
+             sector_number + num_sectors - 1);
+      return -1;
+   }
+
+   FAT_STAT_ADD(FAT_STAT_WRITE_CALLS, 1);
+   FAT_STAT_ADD(FAT_STAT_SECTORS_WRITTEN, num_sectors);
+   FAT_STAT_ADD(FAT_STAT_BYTES_WRITTEN, bytes_written);
+   return (int) bytes_written;
+}
+
+
+/*****************************************************************************
+ * flush_sectors
+ *
+ * Write out anything buffered for the file system, and forget anything read
+ * ahead from it, so the file system can be read or written without going
+ * through its block device (such as by asyncIo.c)
+ ****************************************************************************/
+
+void flush_sectors()
+{
+   flushBlockDevice(fatFileSystem.blockDevice, 0);
+}
+
+
 /*****************************************************************************
  * get_fat_entry
  *
@@ -175,3 +355,97 @@ void set_fat_entry(unsigned int fat_entry_number, unsigned int value, unsigned c
                                           0x00f0)  |  (a >> 8));
    }
 }
+
+
+/*****************************************************************************
+ * get_fat16_entry
+ *
+ * Get the specified entry from the given FAT16 FAT, where each entry is two
+ * little-endian bytes
+ *
+ * fat_entry_number:  The number of the FAT entry to get (0, 1, 2, ...)
+ * fat:  The fat table from which to get the specified entry
+ *
+ * Return: the value at the specified entry of the given FAT
+ ****************************************************************************/
+
+unsigned int get_fat16_entry(unsigned int fat_entry_number, unsigned char* fat)
+{
+   unsigned char* entry = fat + (2 * fat_entry_number);
+
+   return entry[0] | (entry[1] << 8);
+}
+
+
+/******************************************************************************
+ * set_fat16_entry
+ *
+ * Set the specified entry in the given FAT16 FAT to the given value
+ *
+ * fat_entry_number:  The number of the FAT entry to set (0, 1, 2, ...)
+ * value:  The given value to place in the FAT entry
+ * fat:  The fat table in which to set the given value at the specified entry
+ *****************************************************************************/
+
+void set_fat16_entry(unsigned int fat_entry_number, unsigned int value, unsigned char* fat)
+{
+   unsigned char* entry = fat + (2 * fat_entry_number);
+
+   entry[0] = (unsigned char) value;
+   entry[1] = (unsigned char) (value >> 8);
+}
+
+
+/*****************************************************************************
+ * get_fat32_entry
+ *
+ * Get the specified entry from the given FAT32 FAT, where each entry is four
+ * little-endian bytes, of which only the low 28 bits are used
+ *
+ * fat_entry_number:  The number of the FAT entry to get (0, 1, 2, ...)
+ * fat:  The fat table from which to get the specified entry
+ *
+ * Return: the value at the specified entry of the given FAT
+ ****************************************************************************/
+
+unsigned int get_fat32_entry(unsigned int fat_entry_number, unsigned char* fat)
+{
+   unsigned char* entry = fat + (4 * fat_entry_number);
+
+   return (entry[0] | (entry[1] << 8) | (entry[2] << 16) |
+           ((unsigned int) entry[3] << 24)) & 0x0FFFFFFF;
+}
+
+
+/******************************************************************************
+ * set_fat32_entry
+ *
+ * Set the specified entry in the given FAT32 FAT to the given value, keeping
+ * the top 4 bits of the entry as they were
+ *
+ * fat_entry_number:  The number of the FAT entry to set (0, 1, 2, ...)
+ * value:  The given value to place in the FAT entry
+ * fat:  The fat table in which to set the given value at the specified entry
+ *****************************************************************************/
+
+void set_fat32_entry(unsigned int fat_entry_number, unsigned int value, unsigned char* fat)
+{
+   unsigned char* entry = fat + (4 * fat_entry_number);
+
+   entry[0] = (unsigned char) value;
+   entry[1] = (unsigned char) (value >> 8);
+   entry[2] = (unsigned char) (value >> 16);
+   entry[3] = (unsigned char) ((entry[3] & 0xF0) | ((value >> 24) & 0x0F));
+}
+
+
+/******************************************************************************
+ * The entry codecs for each type of FAT
+ *****************************************************************************/
+
+const FatEntryCodec fat12EntryCodec = { 12, 0xFF7, get_fat_entry,
+                                        set_fat_entry };
+const FatEntryCodec fat16EntryCodec = { 16, 0xFFF7, get_fat16_entry,
+                                        set_fat16_entry };
+const FatEntryCodec fat32EntryCodec = { 32, 0x0FFFFFF7, get_fat32_entry,
+                                        set_fat32_entry };
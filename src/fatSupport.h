@@ -5,9 +5,34 @@
 
 int read_sector(unsigned int sector_number, unsigned char* buffer);
 int write_sector(unsigned int sector_number, unsigned char* buffer, unsigned int bufferSize);
+int read_sectors(unsigned int sector_number, unsigned int num_sectors, unsigned char* buffer);
+int write_sectors(unsigned int sector_number, unsigned int num_sectors, unsigned char* buffer);
+void flush_sectors();
 
 unsigned int get_fat_entry(unsigned int fat_entry_number, unsigned char* fat);
 void set_fat_entry(unsigned int fat_entry_number, unsigned int value, unsigned char* fat);
 
+unsigned int get_fat16_entry(unsigned int fat_entry_number, unsigned char* fat);
+void set_fat16_entry(unsigned int fat_entry_number, unsigned int value, unsigned char* fat);
+unsigned int get_fat32_entry(unsigned int fat_entry_number, unsigned char* fat);
+void set_fat32_entry(unsigned int fat_entry_number, unsigned int value, unsigned char* fat);
+
+// How the entries of one type of FAT table (12, 16 or 32 bits) are packed.
+// Values are bitsPerEntry wide (28 bits for FAT32); badCluster marks a bad
+// cluster, the 7 values below it are reserved, and those above it end a
+// chain.
+typedef struct
+{
+   int          bitsPerEntry;
+   unsigned int badCluster;
+   unsigned int (*getEntry)(unsigned int fat_entry_number, unsigned char* fat);
+   void (*setEntry)(unsigned int fat_entry_number, unsigned int value,
+                    unsigned char* fat);
+} FatEntryCodec;
+
+extern const FatEntryCodec fat12EntryCodec;
+extern const FatEntryCodec fat16EntryCodec;
+extern const FatEntryCodec fat32EntryCodec;
+
 
 #endif
@@ -0,0 +1,306 @@
+/******************************************************************************
+ * find.c: Find files
+ *
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Performs the find command, which prints the path of every
+ *              file and directory under a path (defaulting to the current
+ *              working directory) that matches all of the given tests.
+ *
+ *              Usage: find [PATH] [-name GLOB] [-type f|d] [-size [+|-]N]
+ *                          [-attr FLAGS] [-overallocated] [-j THREADS]
+ *                -name GLOB     the name matches a wildcard pattern (in any
+ *                               case, such as '*.TXT')
+ *                -type f|d      it is a file (f) or a directory (d)
+ *                -size [+|-]N   its size is more than (+), less than (-) or
+ *                               exactly N bytes (N may end in k or M)
+ *                -attr FLAGS    it has all of the given attributes: r (read
+ *                               only), h (hidden), s (system) and a (archive)
+ *                -overallocated its chain has more clusters than its size
+ *                               needs
+ *                -j THREADS     the number of threads to use (default: one
+ *                               per CPU)
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ *****************************************************************************/
+
+#define _GNU_SOURCE // for FNM_CASEFOLD
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fat.h"
+#include "treeWalk.h"
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * FindTests - what an entry has to match to be printed.
+ *****************************************************************************/
+typedef struct
+{
+  const char*        namePattern; // NULL to match any name
+  char               type; // 'f', 'd', or 0 for either
+  int                sizeComparison; // -1, 0 or 1, for less, equal or more
+  unsigned long long size;
+  int                isSizeTested;
+  unsigned char      attributes; // that must all be set
+  int                isOverallocated;
+} FindTests;
+
+
+//-----------------------------------------------------------------------------
+// Variables
+//-----------------------------------------------------------------------------
+
+static FindTests tests;
+static unsigned int numMatches = 0;
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+static void usage();
+static int parseSize(const char* string);
+static int parseAttributes(const char* string);
+static int isMatch(TreeNode* node);
+static void findMatches(TreeNode* node, char* path, size_t pathLength);
+
+
+/******************************************************************************
+ * main - runs the find command.
+ *****************************************************************************/
+int main(int argc, char* argv[])
+{
+  const char* pathName = NULL;
+  int numThreads = 0;
+  int i;
+
+  // Parse the arguments.
+  memset(&tests, 0, sizeof(tests));
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-overallocated") == 0)
+      tests.isOverallocated = 1;
+    else if (argv[i][0] == '-' && i + 1 == argc)
+    {
+      usage();
+      return -1;
+    }
+    else if (strcmp(argv[i], "-name") == 0)
+      tests.namePattern = argv[++i];
+    else if (strcmp(argv[i], "-type") == 0)
+    {
+      i++;
+      if (strcmp(argv[i], "f") != 0 && strcmp(argv[i], "d") != 0)
+      {
+        printf("The type must be f (file) or d (directory)\n");
+        return -1;
+      }
+      tests.type = argv[i][0];
+    }
+    else if (strcmp(argv[i], "-size") == 0)
+    {
+      if (parseSize(argv[++i]) != 0)
+        return -1;
+    }
+    else if (strcmp(argv[i], "-attr") == 0)
+    {
+      if (parseAttributes(argv[++i]) != 0)
+        return -1;
+    }
+    else if (strcmp(argv[i], "-j") == 0)
+    {
+      char* endptr;
+      numThreads = strtol(argv[++i], &endptr, 10);
+      if (*endptr != '\0' || numThreads < 1)
+      {
+        printf("THREADS must be a positive number\n");
+        usage();
+        return -1;
+      }
+    }
+    else if (argv[i][0] != '-' && pathName == NULL && i == 1)
+      pathName = argv[i];
+    else
+    {
+      usage();
+      return -1;
+    }
+  }
+
+  if (initializeFatFileSystem(FAT_LOCK_SHARED) != 0)
+    return -1;
+
+  // Find the path to start at.
+  FilePath filePath;
+  getWorkingDirectory(&filePath);
+  if (pathName != NULL &&
+      changeFilePath(&filePath, pathName, PATH_TYPE_ANY) != 0)
+  {
+    terminateFatFileSystem();
+    return -1;
+  }
+
+  TreeNode* root = walkTree(&filePath, numThreads);
+  if (root == NULL)
+  {
+    terminateFatFileSystem();
+    return -1;
+  }
+
+  char path[FAT12_MAX_PATH_NAME_LENGTH * 2];
+  strcpy(path, filePath.pathName);
+  findMatches(root, path, strlen(path));
+
+  freeTree(root);
+  terminateFatFileSystem();
+  return (numMatches > 0 ? 0 : 1);
+}
+
+/******************************************************************************
+ * usage - prints the usage statement.
+ *****************************************************************************/
+static void usage()
+{
+  printf("Usage: find [PATH] [-name GLOB] [-type f|d] [-size [+|-]N] "
+         "[-attr FLAGS]\n");
+  printf("            [-overallocated] [-j THREADS]\n");
+  printf("Prints the path of everything under PATH that passes the tests.\n");
+}
+
+/******************************************************************************
+ * parseSize - parse the argument of -size into the tests.
+ *
+ * string - the argument, such as '+4k'
+ *
+ * Return - 0 on success, -1 if it isn't a valid size
+ *****************************************************************************/
+static int parseSize(const char* string)
+{
+  char* endptr;
+
+  tests.isSizeTested = 1;
+  tests.sizeComparison = 0;
+  if (string[0] == '+' || string[0] == '-')
+    tests.sizeComparison = (*string++ == '+' ? 1 : -1);
+
+  tests.size = strtoull(string, &endptr, 10);
+  if (endptr != string && *endptr == 'k')
+  {
+    tests.size *= 1024;
+    endptr++;
+  }
+  else if (endptr != string && *endptr == 'M')
+  {
+    tests.size *= 1024 * 1024;
+    endptr++;
+  }
+
+  if (endptr == string || *endptr != '\0')
+  {
+    printf("The size must be a number of bytes, optionally starting with + "
+           "or - and ending with k or M\n");
+    return -1;
+  }
+  return 0;
+}
+
+/******************************************************************************
+ * parseAttributes - parse the argument of -attr into the tests.
+ *
+ * string - the argument, such as 'rh'
+ *
+ * Return - 0 on success, -1 if it has an unknown attribute
+ *****************************************************************************/
+static int parseAttributes(const char* string)
+{
+  for (; *string != '\0'; string++)
+  {
+    if (*string == 'r')
+      tests.attributes |= DIR_ENTRY_ATTRIB_READ_ONLY;
+    else if (*string == 'h')
+      tests.attributes |= DIR_ENTRY_ATTRIB_HIDDEN;
+    else if (*string == 's')
+      tests.attributes |= DIR_ENTRY_ATTRIB_SYSTEM;
+    else if (*string == 'a')
+      tests.attributes |= DIR_ENTRY_ATTRIB_ARCHIVE;
+    else
+    {
+      printf("Unknown attribute '%c' (use r, h, s and a)\n", *string);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/******************************************************************************
+ * isMatch - check if a node passes all of the tests.
+ *
+ * node - the node
+ *
+ * Return - 1 if it does, 0 if not
+ *****************************************************************************/
+static int isMatch(TreeNode* node)
+{
+  unsigned int bytesPerCluster = fatFileSystem.geometry.bytesPerCluster;
+
+  if (tests.namePattern != NULL &&
+      fnmatch(tests.namePattern, node->name, FNM_CASEFOLD) != 0)
+    return 0;
+  if (tests.type != 0 && (tests.type == 'd') != node->isDirectory)
+    return 0;
+  if (tests.isSizeTested &&
+      (node->entry.fileSize > tests.size) - (node->entry.fileSize < tests.size)
+      != tests.sizeComparison)
+    return 0;
+  if ((node->entry.attributes & tests.attributes) != tests.attributes)
+    return 0;
+
+  // Empty files created by touch still get one cluster, and directories
+  // have no size of their own.
+  if (tests.isOverallocated)
+  {
+    unsigned int neededClusters = (node->entry.fileSize + bytesPerCluster -
+                                   1) / bytesPerCluster;
+    if (node->isDirectory || node->numClusters <= neededClusters ||
+        (neededClusters == 0 && node->numClusters == 1))
+      return 0;
+  }
+  return 1;
+}
+
+/******************************************************************************
+ * findMatches - print the path of a node and everything under it that
+ *               passes the tests.
+ *
+ * node - the node
+ * path - the node's path name, in a buffer long enough to add to
+ * pathLength - the length of the path name
+ *****************************************************************************/
+static void findMatches(TreeNode* node, char* path, size_t pathLength)
+{
+  unsigned int i;
+
+  if (isMatch(node))
+  {
+    printf("%s\n", path);
+    numMatches++;
+  }
+
+  for (i = 0; i < node->numChildren; i++)
+  {
+    TreeNode* child = &node->children[i];
+    size_t childLength = pathLength;
+    if (path[childLength - 1] != '/')
+      path[childLength++] = '/';
+    strcpy(path + childLength, child->name);
+    findMatches(child, path, childLength + strlen(child->name));
+    path[pathLength] = '\0';
+  }
+}
@@ -0,0 +1,706 @@
+/******************************************************************************
+ * fsck.c: File system consistency check
+ *
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Performs the fsck command, which checks the file system for
+ *              damage and optionally repairs it. The directory tree is walked
+ *              from the root, with subdirectories checked in parallel on a
+ *              thread pool. Every cluster reached from a directory entry is
+ *              claimed in a cluster ownership map, which finds:
+ *
+ *               - cross-linked chains (a cluster claimed by two entries)
+ *               - damaged chains (pointing at a free, reserved or bad
+ *                 cluster, or out of range)
+ *               - files whose chain length doesn't match their file size
+ *               - bad '.' and '..' entries
+ *               - lost clusters (in use in the FAT, but claimed by nobody)
+ *               - copies of the FAT table on disk that disagree
+ *
+ *              Usage: fsck [-r] [-j THREADS]
+ *                -r          repair the problems that were found
+ *                -j THREADS  the number of threads to use (default: one per
+ *                            CPU)
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ *****************************************************************************/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "fat.h"
+#include "threadPool.h"
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * ProblemType - the kinds of problems fsck can find with an entry.
+ *****************************************************************************/
+typedef enum
+{
+  PROBLEM_NONE           = -1,
+  PROBLEM_CROSS_LINKED   = 0, // its chain runs into another entry's chain
+  PROBLEM_BAD_CHAIN      = 1, // its chain is damaged
+  PROBLEM_SIZE_MISMATCH  = 2, // its chain length doesn't match its size
+  PROBLEM_BAD_DOT_ENTRY  = 3, // a '.' or '..' entry points the wrong way
+} ProblemType;
+
+/******************************************************************************
+ * Problem - a problem found with a directory entry.
+ *****************************************************************************/
+typedef struct
+{
+  int            type;
+  char           path[FAT12_MAX_PATH_NAME_LENGTH];
+  unsigned int   parentFlc; // the directory containing the entry
+  int            indexInParent;
+  unsigned int   otherOwner; // for cross-links, the entry we ran into
+  unsigned int   cluster; // where the chain goes wrong
+  unsigned int   previousCluster; // the cluster before it (0 if none)
+  unsigned int   chainLength; // number of good clusters in the chain
+  unsigned int   expectedLength;
+  unsigned int   expectedFlc; // for '.' and '..' entries
+} Problem;
+
+/******************************************************************************
+ * DirectoryTask - a directory for a worker thread to check.
+ *****************************************************************************/
+typedef struct
+{
+  char           path[FAT12_MAX_PATH_NAME_LENGTH];
+  unsigned int   flc;
+  unsigned int   parentFlc;
+  unsigned int   depth;
+} DirectoryTask;
+
+
+//-----------------------------------------------------------------------------
+// Variables
+//-----------------------------------------------------------------------------
+
+static ThreadPool*     threadPool;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER; // guards the below
+static Problem*        problems = NULL;
+static unsigned int    numProblems = 0;
+static unsigned int    maxProblems = 0;
+static char**          ownerPaths = NULL; // indexed by owner ID - 1
+static unsigned int    numOwners = 0;
+static unsigned int    maxOwners = 0;
+
+// The entry that owns each cluster (an owner ID, or 0 if unowned).
+static unsigned int*   clusterOwners;
+static unsigned int    numClusters;
+static unsigned int    bytesPerCluster;
+static unsigned int    numUnrepaired = 0; // problems 'fsck -r' couldn't fix
+
+// Counters, updated atomically.
+static unsigned int    numDirectories = 0;
+static unsigned int    numFiles = 0;
+static unsigned int    numClustersOwned = 0;
+static unsigned long long numBytesRead = 0;
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+static void usage();
+static void checkDirectory(void* argument);
+static unsigned int claimChain(unsigned int owner, unsigned int flc,
+                               Problem* problem);
+static unsigned int addOwner(const char* path);
+static void addProblem(Problem* problem);
+static int compareProblems(const void* a, const void* b);
+static void printProblem(Problem* problem);
+static void repairProblem(Problem* problem);
+static void truncateChain(unsigned int cluster, unsigned int length);
+static unsigned int checkLostClusters(int repair);
+static unsigned int checkFatCopies(int repair);
+static double getTime();
+
+
+/******************************************************************************
+ * main - runs the fsck command.
+ *****************************************************************************/
+int main(int argc, char* argv[])
+{
+  int repair = 0;
+  int numThreads = 0;
+  int i;
+
+  // Parse the arguments.
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-r") == 0)
+    {
+      repair = 1;
+    }
+    else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+    {
+      char* endptr;
+      numThreads = strtol(argv[++i], &endptr, 10);
+      if (*endptr != '\0' || numThreads < 1)
+      {
+        printf("THREADS must be a positive number\n");
+        usage();
+        return -1;
+      }
+    }
+    else
+    {
+      usage();
+      return -1;
+    }
+  }
+
+  if (initializeFatFileSystem(repair ? FAT_LOCK_EXCLUSIVE :
+                              FAT_LOCK_SHARED) != 0)
+    return -1;
+
+  numClusters = fatFileSystem.session->numClusters;
+  bytesPerCluster = fatFileSystem.geometry.bytesPerCluster;
+  clusterOwners = (unsigned int*) calloc(numClusters, sizeof(unsigned int));
+
+  // The FAT32 root directory is a chain of its own, which nothing else can
+  // be allowed to claim. It can't be repaired here if it is damaged.
+  double startTime = getTime();
+  unsigned int numRootErrors = 0;
+  if (fatFileSystem.geometry.fatType == FAT_TYPE_32)
+  {
+    Problem problem;
+    memset(&problem, 0, sizeof(problem));
+    strcpy(problem.path, "/");
+    problem.chainLength = claimChain(addOwner("/"),
+      fatFileSystem.geometry.rootDirectoryCluster, &problem);
+    if (problem.type != PROBLEM_NONE)
+    {
+      printProblem(&problem);
+      numRootErrors++;
+    }
+  }
+
+  // Walk the directory tree from the root.
+  threadPool = createThreadPool(numThreads);
+  if (threadPool == NULL)
+  {
+    printf("Error: could not start threads\n");
+    terminateFatFileSystem();
+    return -1;
+  }
+  DirectoryTask* root = (DirectoryTask*) calloc(1, sizeof(DirectoryTask));
+  strcpy(root->path, "/");
+  submitTask(threadPool, checkDirectory, root);
+  waitForTasks(threadPool);
+  numThreads = getThreadPoolSize(threadPool);
+  destroyThreadPool(threadPool);
+
+  // Report the problems with entries in path order, so the output doesn't
+  // depend on which thread got where first.
+  if (numProblems > 0)
+    qsort(problems, numProblems, sizeof(Problem), compareProblems);
+  for (i = 0; i < numProblems; i++)
+  {
+    printProblem(&problems[i]);
+    if (repair)
+      repairProblem(&problems[i]);
+  }
+
+  // Then check for problems in the FAT table itself.
+  unsigned int numLostClusters = checkLostClusters(repair);
+  unsigned int numFatCopyErrors = checkFatCopies(repair);
+  double elapsedTime = getTime() - startTime;
+
+  // Print a summary.
+  unsigned int numErrors = numRootErrors + numProblems + numLostClusters +
+                           numFatCopyErrors;
+  printf("%u directories, %u files, %u clusters in use\n",
+         numDirectories, numFiles, numClustersOwned);
+  if (numErrors == 0)
+    printf("No problems found\n");
+  else if (repair && numUnrepaired == 0)
+    printf("%u problems found and repaired\n", numErrors);
+  else if (repair)
+    printf("%u problems found, %u of them not repaired\n", numErrors,
+           numUnrepaired);
+  else
+    printf("%u problems found (run 'fsck -r' to repair)\n", numErrors);
+  printf("Checked in %.3f ms with %d threads (%.0f entries/s, "
+         "%.2f MB/s of metadata)\n", elapsedTime * 1000.0, numThreads,
+         (numDirectories + numFiles) / elapsedTime,
+         (numBytesRead / (1024.0 * 1024.0)) / elapsedTime);
+
+  for (i = 0; i < numOwners; i++)
+    free(ownerPaths[i]);
+  free(ownerPaths);
+  free(problems);
+  free(clusterOwners);
+  terminateFatFileSystem();
+  return (numErrors == 0 ? 0 : 1);
+}
+
+/******************************************************************************
+ * usage - prints the usage statement.
+ *****************************************************************************/
+static void usage()
+{
+  printf("Usage: fsck [-r] [-j THREADS]\n");
+  printf("Checks the file system for damage (and repairs it with -r).\n");
+}
+
+/******************************************************************************
+ * checkDirectory - check every entry in a directory, submitting a new task
+ *                  for each of its subdirectories. This runs on a worker
+ *                  thread.
+ *****************************************************************************/
+static void checkDirectory(void* argument)
+{
+  DirectoryTask* task = (DirectoryTask*) argument;
+  char name[FAT12_MAX_FILE_NAME_LENGTH];
+  unsigned int numBytes;
+  DirectoryEntry* directory;
+  DirectoryEntry* entry;
+  int index = 0;
+
+  __atomic_add_fetch(&numDirectories, 1, __ATOMIC_RELAXED);
+
+  // Read the directory, making sure it ends with an end-of-entries marker
+  // even if the directory is completely full.
+  directory = readDirectory(task->flc, &numBytes);
+  __atomic_add_fetch(&numBytesRead, numBytes, __ATOMIC_RELAXED);
+
+  for (entry = getFirstValidEntry(directory, &index); entry != NULL;
+       entry = getNextValidEntry(entry, &index))
+  {
+    Problem problem;
+
+    if (entry->attributes & DIR_ENTRY_ATTRIB_VOLUME_LABEL)
+      continue;
+
+    getEntryName(entry, name);
+    memset(&problem, 0, sizeof(problem));
+    problem.parentFlc = task->flc;
+    problem.indexInParent = index;
+    snprintf(problem.path, sizeof(problem.path), "%s%s%s", task->path,
+             (task->depth == 0 ? "" : "/"), name);
+
+    // Check that '.' and '..' point to this directory and its parent.
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+    {
+      problem.expectedFlc = (name[1] == '\0' ? task->flc : task->parentFlc);
+      if (getEntryCluster(entry) != problem.expectedFlc)
+      {
+        problem.cluster = getEntryCluster(entry);
+        problem.type = PROBLEM_BAD_DOT_ENTRY;
+        addProblem(&problem);
+      }
+      continue;
+    }
+
+    int isDirectory = isEntryADirectory(entry);
+    if (!isDirectory)
+      __atomic_add_fetch(&numFiles, 1, __ATOMIC_RELAXED);
+
+    // Empty files don't need a chain at all.
+    if (getEntryCluster(entry) == 0 && !isDirectory &&
+        entry->fileSize == 0)
+    {
+      continue;
+    }
+
+    // Claim the entry's chain of clusters.
+    unsigned int owner = addOwner(problem.path);
+    problem.chainLength = claimChain(owner, getEntryCluster(entry),
+                                     &problem);
+    if (problem.type != PROBLEM_NONE)
+    {
+      addProblem(&problem);
+      continue;
+    }
+
+    if (isDirectory)
+    {
+      // Check the subdirectory on another task.
+      if (task->depth + 1 < FAT12_MAX_DIRECTORY_DEPTH)
+      {
+        DirectoryTask* subtask = (DirectoryTask*) malloc(
+          sizeof(DirectoryTask));
+        strcpy(subtask->path, problem.path);
+        subtask->flc = getEntryCluster(entry);
+        subtask->parentFlc = task->flc;
+        subtask->depth = task->depth + 1;
+        submitTask(threadPool, checkDirectory, subtask);
+      }
+    }
+    else
+    {
+      // Check the file's size against its chain. Empty files created by
+      // touch still get one cluster.
+      problem.expectedLength = (entry->fileSize + bytesPerCluster - 1) /
+                               bytesPerCluster;
+      if (problem.expectedLength == 0 ? problem.chainLength > 1 :
+          problem.chainLength != problem.expectedLength)
+      {
+        problem.type = PROBLEM_SIZE_MISMATCH;
+        addProblem(&problem);
+      }
+    }
+  }
+
+  closeDirectory(directory);
+  free(task);
+}
+
+/******************************************************************************
+ * claimChain - claim each cluster in a chain for an owner, stopping at the
+ *              end of the chain or at the first problem.
+ *
+ * owner - the owner ID to claim the clusters for
+ * flc - the first logical cluster of the chain
+ * problem - the problem to fill in if something is wrong with the chain
+ *           (its type is set to PROBLEM_NONE if not)
+ *
+ * Return - the number of good clusters in the chain
+ *****************************************************************************/
+static unsigned int claimChain(unsigned int owner, unsigned int flc,
+                               Problem* problem)
+{
+  unsigned int cluster = flc;
+  unsigned int previousCluster = 0;
+  unsigned int entryValue;
+  unsigned int length = 0;
+  unsigned int expected;
+  int entryType;
+
+  problem->type = PROBLEM_NONE;
+
+  while (1)
+  {
+    problem->cluster = cluster;
+    problem->previousCluster = previousCluster;
+
+    if (cluster < 2 || cluster >= numClusters)
+    {
+      problem->type = PROBLEM_BAD_CHAIN;
+      break;
+    }
+
+    getFatEntry(cluster, &entryValue, &entryType);
+    if (entryType != FAT_ENTRY_TYPE_NEXT_SECTOR &&
+        entryType != FAT_ENTRY_TYPE_LAST_SECTOR)
+    {
+      problem->type = PROBLEM_BAD_CHAIN;
+      break;
+    }
+
+    // Claim the cluster, unless someone (maybe even us, if the chain loops)
+    // already has.
+    expected = 0;
+    if (!__atomic_compare_exchange_n(&clusterOwners[cluster], &expected,
+                                     owner, 0, __ATOMIC_RELAXED,
+                                     __ATOMIC_RELAXED))
+    {
+      problem->type = (expected == owner ? PROBLEM_BAD_CHAIN :
+                       PROBLEM_CROSS_LINKED);
+      problem->otherOwner = expected;
+      break;
+    }
+
+    length++;
+    __atomic_add_fetch(&numClustersOwned, 1, __ATOMIC_RELAXED);
+    if (entryType == FAT_ENTRY_TYPE_LAST_SECTOR)
+      break;
+
+    previousCluster = cluster;
+    cluster = entryValue;
+  }
+
+  return length;
+}
+
+/******************************************************************************
+ * addOwner - register an entry that can own clusters.
+ *
+ * path - the entry's path name
+ *
+ * Return - the entry's owner ID
+ *****************************************************************************/
+static unsigned int addOwner(const char* path)
+{
+  unsigned int owner;
+
+  pthread_mutex_lock(&mutex);
+  if (numOwners == maxOwners)
+  {
+    maxOwners = (maxOwners == 0 ? 256 : maxOwners * 2);
+    ownerPaths = (char**) realloc(ownerPaths, maxOwners * sizeof(char*));
+  }
+  ownerPaths[numOwners] = strdup(path);
+  owner = ++numOwners;
+  pthread_mutex_unlock(&mutex);
+
+  return owner;
+}
+
+/******************************************************************************
+ * addProblem - record a problem that was found.
+ *****************************************************************************/
+static void addProblem(Problem* problem)
+{
+  pthread_mutex_lock(&mutex);
+  if (numProblems == maxProblems)
+  {
+    maxProblems = (maxProblems == 0 ? 16 : maxProblems * 2);
+    problems = (Problem*) realloc(problems, maxProblems * sizeof(Problem));
+  }
+  problems[numProblems++] = *problem;
+  pthread_mutex_unlock(&mutex);
+}
+
+/******************************************************************************
+ * compareProblems - order problems by path name, for qsort().
+ *****************************************************************************/
+static int compareProblems(const void* a, const void* b)
+{
+  return strcmp(((const Problem*) a)->path, ((const Problem*) b)->path);
+}
+
+/******************************************************************************
+ * printProblem - print a description of a problem.
+ *****************************************************************************/
+static void printProblem(Problem* problem)
+{
+  switch (problem->type)
+  {
+    case PROBLEM_CROSS_LINKED:
+      printf("%s: cross-linked with %s at cluster %u\n", problem->path,
+             ownerPaths[problem->otherOwner - 1], problem->cluster);
+      break;
+    case PROBLEM_BAD_CHAIN:
+      printf("%s: damaged chain at cluster %u (after %u good clusters)\n",
+             problem->path, problem->cluster, problem->chainLength);
+      break;
+    case PROBLEM_SIZE_MISMATCH:
+      printf("%s: file size needs %u clusters, but chain has %u\n",
+             problem->path, problem->expectedLength, problem->chainLength);
+      break;
+    case PROBLEM_BAD_DOT_ENTRY:
+      printf("%s: points to cluster %u instead of %u\n", problem->path,
+             problem->cluster, problem->expectedFlc);
+      break;
+  }
+}
+
+/******************************************************************************
+ * repairProblem - repair a problem with an entry.
+ *****************************************************************************/
+static void repairProblem(Problem* problem)
+{
+  unsigned int numBytes;
+  DirectoryEntry* directory = readDirectory(problem->parentFlc, &numBytes);
+  DirectoryEntry* entry = &directory[problem->indexInParent];
+  unsigned int maxSize;
+
+  switch (problem->type)
+  {
+    case PROBLEM_CROSS_LINKED:
+    case PROBLEM_BAD_CHAIN:
+      if (problem->previousCluster == 0)
+      {
+        // Nothing in the chain is good, so remove the entry (without
+        // freeing clusters that belong to someone else).
+        entry->name[0] = DIR_ENTRY_FREE;
+      }
+      else
+      {
+        // Cut the chain off before the bad cluster.
+        setFatEntry(problem->previousCluster, FAT_END_OF_CHAIN);
+        maxSize = problem->chainLength * bytesPerCluster;
+        if (!isEntryADirectory(entry) && entry->fileSize > maxSize)
+          entry->fileSize = maxSize;
+      }
+      break;
+
+    case PROBLEM_SIZE_MISMATCH:
+      if (problem->chainLength > problem->expectedLength)
+      {
+        // Free the clusters past the end of the file (keeping one for an
+        // empty file).
+        truncateChain(getEntryCluster(entry), (problem->expectedLength == 0 ?
+                      1 : problem->expectedLength));
+      }
+      else
+      {
+        // The file is shorter than its size says.
+        entry->fileSize = problem->chainLength * bytesPerCluster;
+      }
+      break;
+
+    case PROBLEM_BAD_DOT_ENTRY:
+      setEntryCluster(entry, problem->expectedFlc);
+      break;
+  }
+
+  writeDirectory(problem->parentFlc, directory, numBytes);
+  closeDirectory(directory);
+}
+
+/******************************************************************************
+ * truncateChain - cut a chain down to the given length, freeing the rest.
+ *****************************************************************************/
+static void truncateChain(unsigned int cluster, unsigned int length)
+{
+  unsigned int entryValue;
+  int entryType;
+  unsigned int i;
+
+  for (i = 1; i < length; i++)
+  {
+    getFatEntry(cluster, &entryValue, &entryType);
+    cluster = entryValue;
+  }
+
+  getFatEntry(cluster, &entryValue, &entryType);
+  setFatEntry(cluster, FAT_END_OF_CHAIN);
+  while (entryType == FAT_ENTRY_TYPE_NEXT_SECTOR)
+  {
+    cluster = entryValue;
+    getFatEntry(cluster, &entryValue, &entryType);
+    setFatEntry(cluster, 0x000);
+  }
+}
+
+/******************************************************************************
+ * checkLostClusters - find clusters that are in use in the FAT table, but
+ *                     that no entry owns, and free them if repairing.
+ *
+ * Return - the number of lost chains
+ *****************************************************************************/
+static unsigned int checkLostClusters(int repair)
+{
+  unsigned char* isPointedTo = (unsigned char*) calloc(numClusters, 1);
+  unsigned int entryValue;
+  unsigned int numLostClusters = 0;
+  unsigned int numLostChains = 0;
+  unsigned int cluster;
+  int entryType;
+
+  // Find which lost clusters are pointed to by other lost clusters, so the
+  // rest can be counted as the start of a lost chain.
+  for (cluster = 2; cluster < numClusters; cluster++)
+  {
+    getFatEntry(cluster, &entryValue, &entryType);
+    if (clusterOwners[cluster] == 0 &&
+        entryType == FAT_ENTRY_TYPE_NEXT_SECTOR && entryValue < numClusters)
+    {
+      isPointedTo[entryValue] = 1;
+    }
+  }
+
+  for (cluster = 2; cluster < numClusters; cluster++)
+  {
+    getFatEntry(cluster, &entryValue, &entryType);
+    if (clusterOwners[cluster] != 0 ||
+        (entryType != FAT_ENTRY_TYPE_NEXT_SECTOR &&
+         entryType != FAT_ENTRY_TYPE_LAST_SECTOR))
+    {
+      continue;
+    }
+
+    numLostClusters++;
+    if (!isPointedTo[cluster])
+      numLostChains++;
+  }
+
+  if (numLostClusters > 0)
+  {
+    printf("%u lost clusters in %u chains\n", numLostClusters, numLostChains);
+
+    // Free them (after counting, since freeing changes the FAT table).
+    for (cluster = 2; repair && cluster < numClusters; cluster++)
+    {
+      getFatEntry(cluster, &entryValue, &entryType);
+      if (clusterOwners[cluster] == 0 &&
+          (entryType == FAT_ENTRY_TYPE_NEXT_SECTOR ||
+           entryType == FAT_ENTRY_TYPE_LAST_SECTOR))
+      {
+        setFatEntry(cluster, 0x000);
+      }
+    }
+  }
+
+  free(isPointedTo);
+  return numLostChains;
+}
+
+/******************************************************************************
+ * checkFatCopies - check that every copy of the FAT table on disk matches
+ *                  the first one. If repairing, the session's FAT table is
+ *                  written to every copy.
+ *
+ * Return - the number of copies that don't match the first
+ *****************************************************************************/
+static unsigned int checkFatCopies(int repair)
+{
+  unsigned int fatSize = fatFileSystem.session->fatTableSize;
+  unsigned char* firstCopy = (unsigned char*) malloc(fatSize);
+  unsigned char* copy = (unsigned char*) malloc(fatSize);
+  unsigned int numBadCopies = 0;
+  unsigned int entryNumber;
+  unsigned int numDifferences;
+  int i;
+
+  if (readFatTableCopy(0, firstCopy) != 0)
+  {
+    free(firstCopy);
+    free(copy);
+    return 0;
+  }
+
+  for (i = 1; i < fatFileSystem.bootSector.numFATs; i++)
+  {
+    if (readFatTableCopy(i, copy) != 0 || memcmp(firstCopy, copy,
+                                                 fatSize) == 0)
+    {
+      continue;
+    }
+
+    numDifferences = 0;
+    for (entryNumber = 0; entryNumber < numClusters; entryNumber++)
+    {
+      if (fatFileSystem.fatCodec->getEntry(entryNumber, firstCopy) !=
+          fatFileSystem.fatCodec->getEntry(entryNumber, copy))
+      {
+        numDifferences++;
+      }
+    }
+    printf("FAT copy %d differs from FAT copy 0 in %u entries\n", i,
+           numDifferences);
+    numBadCopies++;
+  }
+
+  if (numBadCopies > 0 && repair && writeFatTableCopies() != 0)
+  {
+    printf("Error: could not write the copies of the FAT table\n");
+    numUnrepaired += numBadCopies;
+  }
+
+  free(firstCopy);
+  free(copy);
+  return numBadCopies;
+}
+
+/******************************************************************************
+ * getTime - get the current time, in seconds.
+ *****************************************************************************/
+static double getTime()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + (now.tv_nsec / 1.0e9);
+}
@@ -0,0 +1,142 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function definitions for the latency histogram.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#include <string.h>
+
+#include "histogram.h"
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * getCountIndex - get the index of the count for a value.
+ *****************************************************************************/
+static unsigned int getCountIndex(unsigned long long value);
+
+/******************************************************************************
+ * getHighestEquivalentValue - get the largest value counted at an index.
+ *****************************************************************************/
+static unsigned long long getHighestEquivalentValue(unsigned int index);
+
+
+//-----------------------------------------------------------------------------
+// Histogram interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * initHistogram
+ *****************************************************************************/
+void initHistogram(Histogram* histogram)
+{
+  memset(histogram, 0, sizeof(Histogram));
+}
+
+/******************************************************************************
+ * recordHistogramValue
+ *****************************************************************************/
+void recordHistogramValue(Histogram* histogram, unsigned long long value)
+{
+  if (histogram->totalCount == 0 || value < histogram->minValue)
+    histogram->minValue = value;
+  if (value > histogram->maxValue)
+    histogram->maxValue = value;
+  histogram->totalCount++;
+  histogram->sum += (double) value;
+  histogram->counts[getCountIndex(value)]++;
+}
+
+/******************************************************************************
+ * getHistogramPercentile
+ *****************************************************************************/
+unsigned long long getHistogramPercentile(const Histogram* histogram,
+                                          double percentile)
+{
+  unsigned long long countToIndex;
+  unsigned long long runningCount = 0;
+  unsigned long long value;
+  unsigned int index;
+
+  if (histogram->totalCount == 0)
+    return 0;
+
+  // Find the count that the percentile lands on (at least the first).
+  countToIndex = (unsigned long long) ((percentile / 100.0) *
+                                       histogram->totalCount + 0.5);
+  if (countToIndex < 1)
+    countToIndex = 1;
+
+  for (index = 0; index < HISTOGRAM_NUM_COUNTS; index++)
+  {
+    runningCount += histogram->counts[index];
+    if (runningCount >= countToIndex)
+    {
+      // Don't claim more than was actually seen.
+      value = getHighestEquivalentValue(index);
+      return (value > histogram->maxValue ? histogram->maxValue : value);
+    }
+  }
+
+  return histogram->maxValue;
+}
+
+/******************************************************************************
+ * getHistogramMean
+ *****************************************************************************/
+double getHistogramMean(const Histogram* histogram)
+{
+  if (histogram->totalCount == 0)
+    return 0.0;
+  return histogram->sum / (double) histogram->totalCount;
+}
+
+
+//-----------------------------------------------------------------------------
+// Internal Functions
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * getCountIndex
+ *****************************************************************************/
+static unsigned int getCountIndex(unsigned long long value)
+{
+  unsigned int bucket = 0;
+  unsigned int index;
+
+  // Values below 2 * HISTOGRAM_SUB_BUCKETS are counted exactly. Each bucket
+  // after that is twice as wide, with its values shifted down into the top
+  // half of the sub-buckets.
+  if (value >= 2 * HISTOGRAM_SUB_BUCKETS)
+  {
+    bucket = (63 - __builtin_clzll(value)) -
+             __builtin_ctz(HISTOGRAM_SUB_BUCKETS);
+  }
+
+  index = (bucket * HISTOGRAM_SUB_BUCKETS) + (unsigned int) (value >> bucket);
+  if (index >= HISTOGRAM_NUM_COUNTS)
+    index = HISTOGRAM_NUM_COUNTS - 1;
+  return index;
+}
+
+/******************************************************************************
+ * getHighestEquivalentValue
+ *****************************************************************************/
+static unsigned long long getHighestEquivalentValue(unsigned int index)
+{
+  unsigned int bucket;
+  unsigned long long subBucket;
+
+  if (index < 2 * HISTOGRAM_SUB_BUCKETS)
+    return index;
+
+  bucket = (index / HISTOGRAM_SUB_BUCKETS) - 1;
+  subBucket = (index % HISTOGRAM_SUB_BUCKETS) + HISTOGRAM_SUB_BUCKETS;
+  return ((subBucket + 1) << bucket) - 1;
+}
@@ -0,0 +1,95 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function headers for a latency histogram in the style of an
+ *              HDR histogram. Values are counted in buckets that double in
+ *              width, each split into HISTOGRAM_SUB_BUCKETS linear
+ *              sub-buckets, so any value is recorded to within about 3% with
+ *              a fixed amount of memory, however large it is.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+
+// The number of sub-buckets in each bucket (half of them in the first one),
+// which must be a power of 2. Values are precise to 1 part in this many.
+#define HISTOGRAM_SUB_BUCKETS 32
+
+// The number of buckets, enough for values up to 2^40.
+#define HISTOGRAM_BUCKETS 36
+
+// The total number of counts in a histogram.
+#define HISTOGRAM_NUM_COUNTS ((HISTOGRAM_BUCKETS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * Histogram - counts of recorded values.
+ *****************************************************************************/
+typedef struct
+{
+  unsigned long long totalCount;
+  unsigned long long minValue;
+  unsigned long long maxValue;
+  double             sum; // of every recorded value, for the mean
+  unsigned int       counts[HISTOGRAM_NUM_COUNTS];
+} Histogram;
+
+
+//-----------------------------------------------------------------------------
+// Histogram interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * initHistogram - Empty a histogram
+ *
+ * histogram - the histogram to empty
+ *
+ * Return - none
+ *****************************************************************************/
+void initHistogram(Histogram* histogram);
+
+/******************************************************************************
+ * recordHistogramValue - Count a value in a histogram
+ *
+ * histogram - the histogram to count the value in
+ * value - the value (such as a latency in microseconds)
+ *
+ * Return - none
+ *****************************************************************************/
+void recordHistogramValue(Histogram* histogram, unsigned long long value);
+
+/******************************************************************************
+ * getHistogramPercentile - Get the value at a percentile of a histogram
+ *
+ * histogram - the histogram
+ * percentile - the percentile, from 0 to 100
+ *
+ * Return - the largest value that counts the same as the value at the
+ *          percentile (0 if the histogram is empty)
+ *****************************************************************************/
+unsigned long long getHistogramPercentile(const Histogram* histogram,
+                                          double percentile);
+
+/******************************************************************************
+ * getHistogramMean - Get the mean of the values counted in a histogram
+ *
+ * histogram - the histogram
+ *
+ * Return - the mean value (0 if the histogram is empty)
+ *****************************************************************************/
+double getHistogramMean(const Histogram* histogram);
+
+
+#endif //_HISTOGRAM_H_
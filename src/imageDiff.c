@@ -0,0 +1,403 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function definitions for comparing disk images.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "imageDiff.h"
+#include "threadPool.h"
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+
+// The primes XXH64 mixes with.
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * ChunkBuffers - buffers to read chunks into, kept for the next task rather
+ *                than freed, so each one is only faulted in once.
+ *****************************************************************************/
+typedef struct
+{
+  pthread_mutex_t mutex;
+  unsigned char** buffers;
+  unsigned int    numFree;
+} ChunkBuffers;
+
+/******************************************************************************
+ * HashTask - a chunk of an image for one task to hash.
+ *****************************************************************************/
+typedef struct
+{
+  ChunkBuffers*       chunkBuffers;
+  BlockDevice*        device;
+  unsigned long long  imageSize;
+  unsigned long long  firstSector;
+  unsigned long long  numSectors;
+  unsigned long long* hashes; // for the chunk's sectors
+  int                 rc;
+} HashTask;
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * hashChunk - Read a chunk of an image and hash each of its sectors, as a
+ *             thread pool task.
+ *
+ * argument - the HashTask
+ *
+ * Return - none
+ *****************************************************************************/
+static void hashChunk(void* argument);
+
+/******************************************************************************
+ * The steps of XXH64.
+ *****************************************************************************/
+static unsigned long long rotateLeft(unsigned long long value, int bits);
+static unsigned long long hashRound(unsigned long long accumulator,
+                                    unsigned long long input);
+static unsigned long long mergeRound(unsigned long long accumulator,
+                                     unsigned long long value);
+static unsigned long long read64(const unsigned char* bytes);
+static unsigned int read32(const unsigned char* bytes);
+
+
+//-----------------------------------------------------------------------------
+// Image Diff interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * hashBytes
+ *****************************************************************************/
+unsigned long long hashBytes(const void* data, size_t numBytes,
+                             unsigned long long seed)
+{
+  const unsigned char* bytes = (const unsigned char*) data;
+  const unsigned char* end = bytes + numBytes;
+  unsigned long long hash;
+
+  if (numBytes >= 32)
+  {
+    unsigned long long v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+    unsigned long long v2 = seed + XXH_PRIME64_2;
+    unsigned long long v3 = seed;
+    unsigned long long v4 = seed - XXH_PRIME64_1;
+
+    // Four lanes of 8 bytes at a time.
+    do
+    {
+      v1 = hashRound(v1, read64(bytes));
+      v2 = hashRound(v2, read64(bytes + 8));
+      v3 = hashRound(v3, read64(bytes + 16));
+      v4 = hashRound(v4, read64(bytes + 24));
+      bytes += 32;
+    } while (bytes + 32 <= end);
+
+    hash = rotateLeft(v1, 1) + rotateLeft(v2, 7) + rotateLeft(v3, 12) +
+           rotateLeft(v4, 18);
+    hash = mergeRound(hash, v1);
+    hash = mergeRound(hash, v2);
+    hash = mergeRound(hash, v3);
+    hash = mergeRound(hash, v4);
+  }
+  else
+  {
+    hash = seed + XXH_PRIME64_5;
+  }
+  hash += numBytes;
+
+  // Then whatever is left.
+  while (bytes + 8 <= end)
+  {
+    hash ^= hashRound(0, read64(bytes));
+    hash = rotateLeft(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    bytes += 8;
+  }
+  if (bytes + 4 <= end)
+  {
+    hash ^= (unsigned long long) read32(bytes) * XXH_PRIME64_1;
+    hash = rotateLeft(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+    bytes += 4;
+  }
+  while (bytes < end)
+  {
+    hash ^= *bytes * XXH_PRIME64_5;
+    hash = rotateLeft(hash, 11) * XXH_PRIME64_1;
+    bytes++;
+  }
+
+  hash ^= hash >> 33;
+  hash *= XXH_PRIME64_2;
+  hash ^= hash >> 29;
+  hash *= XXH_PRIME64_3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+/******************************************************************************
+ * computeImageSignature
+ *****************************************************************************/
+int computeImageSignature(BlockDevice* device, int numThreads,
+                          ImageSignature* signature)
+{
+  ThreadPool* threadPool;
+  ChunkBuffers chunkBuffers;
+  HashTask* tasks;
+  unsigned long long numTasks;
+  unsigned long long i;
+  long long imageSize = getBlockDeviceSize(device);
+  int rc = 0;
+
+  if (imageSize < 0)
+    return -1;
+  signature->imageSize = imageSize;
+  signature->numSectors = (imageSize + IMAGE_DIFF_SECTOR_SIZE - 1) /
+                          IMAGE_DIFF_SECTOR_SIZE;
+  signature->hashes = (unsigned long long*) malloc(
+    (signature->numSectors + 1) * sizeof(unsigned long long));
+
+  numTasks = (signature->numSectors + IMAGE_DIFF_CHUNK_SECTORS - 1) /
+             IMAGE_DIFF_CHUNK_SECTORS;
+  tasks = (HashTask*) calloc(numTasks + 1, sizeof(HashTask));
+  threadPool = createThreadPool(numThreads);
+  if (threadPool == NULL)
+  {
+    free(tasks);
+    freeImageSignature(signature);
+    return -1;
+  }
+
+  // Each chunk is read and hashed on its own, in whatever order. There are
+  // never more buffers than threads.
+  pthread_mutex_init(&chunkBuffers.mutex, NULL);
+  chunkBuffers.buffers = (unsigned char**) malloc(
+    getThreadPoolSize(threadPool) * sizeof(unsigned char*));
+  chunkBuffers.numFree = 0;
+  for (i = 0; i < numTasks; i++)
+  {
+    tasks[i].chunkBuffers = &chunkBuffers;
+    tasks[i].device = device;
+    tasks[i].imageSize = signature->imageSize;
+    tasks[i].firstSector = i * IMAGE_DIFF_CHUNK_SECTORS;
+    tasks[i].numSectors = signature->numSectors - tasks[i].firstSector;
+    if (tasks[i].numSectors > IMAGE_DIFF_CHUNK_SECTORS)
+      tasks[i].numSectors = IMAGE_DIFF_CHUNK_SECTORS;
+    tasks[i].hashes = signature->hashes + tasks[i].firstSector;
+    submitTask(threadPool, hashChunk, &tasks[i]);
+  }
+  waitForTasks(threadPool);
+  destroyThreadPool(threadPool);
+  while (chunkBuffers.numFree > 0)
+    free(chunkBuffers.buffers[--chunkBuffers.numFree]);
+  free(chunkBuffers.buffers);
+  pthread_mutex_destroy(&chunkBuffers.mutex);
+
+  for (i = 0; i < numTasks; i++)
+  {
+    if (tasks[i].rc != 0)
+      rc = -1;
+  }
+  free(tasks);
+  if (rc != 0)
+    freeImageSignature(signature);
+  return rc;
+}
+
+/******************************************************************************
+ * loadImageSignature
+ *****************************************************************************/
+int loadImageSignature(const char* fileName, ImageSignature* signature)
+{
+  ImageSignatureHeader header;
+  FILE* file = fopen(fileName, "r");
+
+  if (file == NULL)
+    return -1;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      header.magic != FAT12_IMAGE_SIGNATURE_MAGIC ||
+      header.version != FAT12_IMAGE_DIFF_VERSION ||
+      header.numSectors != (header.imageSize + IMAGE_DIFF_SECTOR_SIZE - 1) /
+                           IMAGE_DIFF_SECTOR_SIZE)
+  {
+    fclose(file);
+    return -1;
+  }
+
+  signature->imageSize = header.imageSize;
+  signature->numSectors = header.numSectors;
+  signature->hashes = (unsigned long long*) malloc(
+    (header.numSectors + 1) * sizeof(unsigned long long));
+  if (fread(signature->hashes, sizeof(unsigned long long), header.numSectors,
+            file) != header.numSectors)
+  {
+    freeImageSignature(signature);
+    fclose(file);
+    return -1;
+  }
+  fclose(file);
+  return 0;
+}
+
+/******************************************************************************
+ * saveImageSignature
+ *****************************************************************************/
+int saveImageSignature(const char* fileName, ImageSignature* signature)
+{
+  ImageSignatureHeader header;
+  FILE* file = fopen(fileName, "w");
+  int rc = 0;
+
+  if (file == NULL)
+    return -1;
+  memset(&header, 0, sizeof(header));
+  header.magic = FAT12_IMAGE_SIGNATURE_MAGIC;
+  header.version = FAT12_IMAGE_DIFF_VERSION;
+  header.imageSize = signature->imageSize;
+  header.numSectors = signature->numSectors;
+  if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+      fwrite(signature->hashes, sizeof(unsigned long long),
+             signature->numSectors, file) != signature->numSectors)
+    rc = -1;
+  if (fclose(file) != 0)
+    rc = -1;
+  return rc;
+}
+
+/******************************************************************************
+ * getImageSignatureHash
+ *****************************************************************************/
+unsigned long long getImageSignatureHash(ImageSignature* signature)
+{
+  return hashBytes(signature->hashes,
+                   signature->numSectors * sizeof(unsigned long long),
+                   signature->imageSize);
+}
+
+/******************************************************************************
+ * freeImageSignature
+ *****************************************************************************/
+void freeImageSignature(ImageSignature* signature)
+{
+  free(signature->hashes);
+  signature->hashes = NULL;
+}
+
+
+//-----------------------------------------------------------------------------
+// Internal Functions
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * hashChunk
+ *****************************************************************************/
+static void hashChunk(void* argument)
+{
+  HashTask* task = (HashTask*) argument;
+  ChunkBuffers* chunkBuffers = task->chunkBuffers;
+  unsigned char* buffer = NULL;
+  long long offset = task->firstSector * IMAGE_DIFF_SECTOR_SIZE;
+  long long numBytes = task->numSectors * IMAGE_DIFF_SECTOR_SIZE;
+  long long sectorSize;
+  unsigned long long i;
+
+  // The last sector may be cut short by the end of the image.
+  if (offset + numBytes > (long long) task->imageSize)
+    numBytes = task->imageSize - offset;
+  pthread_mutex_lock(&chunkBuffers->mutex);
+  if (chunkBuffers->numFree > 0)
+    buffer = chunkBuffers->buffers[--chunkBuffers->numFree];
+  pthread_mutex_unlock(&chunkBuffers->mutex);
+  if (buffer == NULL)
+    buffer = (unsigned char*) malloc(IMAGE_DIFF_CHUNK_SECTORS *
+                                     IMAGE_DIFF_SECTOR_SIZE);
+
+  task->rc = 0;
+  if (readBlockDevice(task->device, offset, numBytes, buffer) != numBytes)
+    task->rc = -1;
+  for (i = 0; task->rc == 0 && i < task->numSectors; i++)
+  {
+    sectorSize = numBytes - (long long) i * IMAGE_DIFF_SECTOR_SIZE;
+    if (sectorSize > IMAGE_DIFF_SECTOR_SIZE)
+      sectorSize = IMAGE_DIFF_SECTOR_SIZE;
+    task->hashes[i] = hashBytes(buffer + i * IMAGE_DIFF_SECTOR_SIZE,
+                                sectorSize, 0);
+  }
+
+  pthread_mutex_lock(&chunkBuffers->mutex);
+  chunkBuffers->buffers[chunkBuffers->numFree++] = buffer;
+  pthread_mutex_unlock(&chunkBuffers->mutex);
+}
+
+/******************************************************************************
+ * rotateLeft
+ *****************************************************************************/
+static unsigned long long rotateLeft(unsigned long long value, int bits)
+{
+  return (value << bits) | (value >> (64 - bits));
+}
+
+/******************************************************************************
+ * hashRound
+ *****************************************************************************/
+static unsigned long long hashRound(unsigned long long accumulator,
+                                    unsigned long long input)
+{
+  accumulator += input * XXH_PRIME64_2;
+  accumulator = rotateLeft(accumulator, 31);
+  return accumulator * XXH_PRIME64_1;
+}
+
+/******************************************************************************
+ * mergeRound
+ *****************************************************************************/
+static unsigned long long mergeRound(unsigned long long accumulator,
+                                     unsigned long long value)
+{
+  accumulator ^= hashRound(0, value);
+  return accumulator * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+/******************************************************************************
+ * read64
+ *****************************************************************************/
+static unsigned long long read64(const unsigned char* bytes)
+{
+  unsigned long long value;
+
+  // (Little-endian, as everything on the disk image is.)
+  memcpy(&value, bytes, sizeof(value));
+  return value;
+}
+
+/******************************************************************************
+ * read32
+ *****************************************************************************/
+static unsigned int read32(const unsigned char* bytes)
+{
+  unsigned int value;
+
+  memcpy(&value, bytes, sizeof(value));
+  return value;
+}
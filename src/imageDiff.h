@@ -0,0 +1,179 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function headers for comparing disk images sector by sector,
+ *              used by the imgdiff and imgpatch programs.
+ *
+ *              An image's signature is a 64-bit hash (XXH64) of each of its
+ *              512-byte sectors, worked out a large chunk at a time on a
+ *              thread pool. Two images differ exactly where their signatures
+ *              do (barring a collision), so an image can be compared with a
+ *              signature saved from an earlier one, without keeping the
+ *              earlier image around: an incremental backup only needs the
+ *              signature of the last backup. A signature file is:
+ *
+ *                ImageSignatureHeader
+ *                unsigned long long hashes[numSectors]
+ *
+ *              A patch holds the sectors that changed between two images, to
+ *              turn a copy of the first into the second:
+ *
+ *                ImagePatchHeader
+ *                for each run of changed sectors (split into runs of at
+ *                most IMAGE_DIFF_CHUNK_SECTORS):
+ *                  ImagePatchRun
+ *                  unsigned char data[] (numSectors sectors, cut short at the
+ *                                        end of the new image)
+ *
+ *              The header records a hash of both images' signatures, so a
+ *              patch is only applied to the image it was made from.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#ifndef _IMAGE_DIFF_H_
+#define _IMAGE_DIFF_H_
+
+#include <stddef.h>
+#include "blockDevice.h"
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+
+// The size of the sectors compared. This is the smallest sector a FAT file
+// system can have, so it works for any of them.
+#define IMAGE_DIFF_SECTOR_SIZE 512
+
+// How much of an image each task hashes (1 MB), and the longest run of
+// sectors in a patch.
+#define IMAGE_DIFF_CHUNK_SECTORS 2048
+
+// Magic numbers and version at the start of signature and patch files.
+#define FAT12_IMAGE_SIGNATURE_MAGIC 0x47495346 // "FSIG"
+#define FAT12_IMAGE_PATCH_MAGIC 0x54415046 // "FPAT"
+#define FAT12_IMAGE_DIFF_VERSION 1
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * ImageSignature - the hash of every sector of an image.
+ *****************************************************************************/
+typedef struct
+{
+  unsigned long long  imageSize; // in bytes
+  unsigned long long  numSectors; // covering imageSize
+  unsigned long long* hashes;
+} ImageSignature;
+
+/******************************************************************************
+ * ImageSignatureHeader - the start of a signature file.
+ *****************************************************************************/
+typedef struct
+{
+  unsigned int       magic;
+  unsigned int       version;
+  unsigned long long imageSize;
+  unsigned long long numSectors;
+} ImageSignatureHeader;
+
+/******************************************************************************
+ * ImagePatchHeader - the start of a patch.
+ *****************************************************************************/
+typedef struct
+{
+  unsigned int       magic;
+  unsigned int       version;
+  unsigned long long oldImageSize;
+  unsigned long long oldImageHash; // see getImageSignatureHash()
+  unsigned long long newImageSize;
+  unsigned long long newImageHash;
+  unsigned long long numRuns;
+  unsigned long long numSectors; // in all the runs
+} ImagePatchHeader;
+
+/******************************************************************************
+ * ImagePatchRun - the start of a run of changed sectors in a patch.
+ *****************************************************************************/
+typedef struct
+{
+  unsigned long long firstSector;
+  unsigned long long numSectors;
+} ImagePatchRun;
+
+
+//-----------------------------------------------------------------------------
+// Image Diff interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * hashBytes - Hash bytes with XXH64.
+ *
+ * data - the bytes
+ * numBytes - the number of bytes
+ * seed - the seed
+ *
+ * Return - the hash
+ *****************************************************************************/
+unsigned long long hashBytes(const void* data, size_t numBytes,
+                             unsigned long long seed);
+
+/******************************************************************************
+ * computeImageSignature - Hash every sector of a disk image, in parallel.
+ *
+ * device - the image, opened with a block device that can be read from
+ *          several threads at once (not stdio)
+ * numThreads - the number of threads to use, or 0 to use one per CPU
+ * signature - where to store the signature
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+int computeImageSignature(BlockDevice* device, int numThreads,
+                          ImageSignature* signature);
+
+/******************************************************************************
+ * loadImageSignature - Read a signature file.
+ *
+ * fileName - the signature file's host path name
+ * signature - where to store the signature
+ *
+ * Return - 0 on success, -1 if it can't be read or isn't a signature file
+ *****************************************************************************/
+int loadImageSignature(const char* fileName, ImageSignature* signature);
+
+/******************************************************************************
+ * saveImageSignature - Write a signature file.
+ *
+ * fileName - the signature file's host path name
+ * signature - the signature
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+int saveImageSignature(const char* fileName, ImageSignature* signature);
+
+/******************************************************************************
+ * getImageSignatureHash - Hash a whole signature, to identify the contents of
+ *                         an image.
+ *
+ * signature - the signature
+ *
+ * Return - the hash
+ *****************************************************************************/
+unsigned long long getImageSignatureHash(ImageSignature* signature);
+
+/******************************************************************************
+ * freeImageSignature - Free the hashes of a signature.
+ *
+ * signature - the signature
+ *
+ * Return - none
+ *****************************************************************************/
+void freeImageSignature(ImageSignature* signature);
+
+
+#endif //_IMAGE_DIFF_H_
@@ -0,0 +1,506 @@
+/******************************************************************************
+ * imgclone.c: Image clone
+ *
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Copies a disk image to a new sparse file, reading only the
+ *              clusters the FAT table says are in use, or makes an image
+ *              sparse where it is. This runs on its own, outside of the
+ *              shell:
+ *
+ *              Usage: imgclone SOURCE CLONE
+ *                 or: imgclone -p IMAGE
+ *
+ *                -p  punch holes in IMAGE over its free clusters, rather
+ *                    than cloning it
+ *
+ *              A clone holds the reserved sectors, FAT tables and root
+ *              directory, and every cluster in use, each in the same place
+ *              as in SOURCE. The rest of it is left as holes, so cloning
+ *              takes time (and space on the host) for the space in use
+ *              rather than for the size of the image, and holes in SOURCE
+ *              are skipped too. SOURCE may have a snapshot or be packed; the
+ *              clone is a plain image of what it reads as.
+ *
+ *              Both lock the image the way commands do, and a clone is
+ *              written to a temporary file which is then renamed, so
+ *              nothing sees it half-written. A shell that has the image open
+ *              should 'sync' first, or clusters it has allocated since may
+ *              be left out (or, with -p, thrown away).
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ *****************************************************************************/
+
+#define _GNU_SOURCE // for SEEK_DATA and SEEK_HOLE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "fat.h"
+#include "journal.h"
+#include "overlay.h"
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+
+// Appended to the clone's path name to name the temporary file.
+#define TEMPORARY_SUFFIX ".tmp"
+
+// The most bytes copied at once.
+#define CLONE_COPY_SIZE (1024 * 1024)
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+static void usage();
+
+/******************************************************************************
+ * cloneImage - copies the parts of an image in use to a new sparse image.
+ *
+ * sourceFileName - the image's host path name
+ * cloneFileName - the clone's host path name
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int cloneImage(const char* sourceFileName, const char* cloneFileName);
+
+/******************************************************************************
+ * punchImage - punches holes in an image over its free clusters.
+ *
+ * imageFileName - the image's host path name
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int punchImage(const char* imageFileName);
+
+/******************************************************************************
+ * mountImage - mounts an image in a session of our own, read with pread so
+ *              that seeking its descriptor can't confuse a stream.
+ *
+ * imageFileName - the image's host path name
+ * lockMode - FAT_LOCK_SHARED or FAT_LOCK_EXCLUSIVE
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int mountImage(const char* imageFileName, int lockMode);
+
+/******************************************************************************
+ * unmountImage - unmounts an image mounted with mountImage().
+ *
+ * Return - none
+ *****************************************************************************/
+static void unmountImage();
+
+/******************************************************************************
+ * isClusterFree - checks the mounted image's free-cluster map for a cluster.
+ *
+ * cluster - the cluster
+ *
+ * Return - 1 if the cluster is free, 0 if it is in use
+ *****************************************************************************/
+static int isClusterFree(unsigned int cluster);
+
+/******************************************************************************
+ * findClusterRun - finds the next run of consecutive clusters that are all
+ *                  free, or all in use.
+ *
+ * cluster - the cluster to start looking from
+ * isFree - 1 to find free clusters, 0 for clusters in use
+ * numClusters - where to store the number of clusters in the run (0 if
+ *               there are no more)
+ *
+ * Return - the first cluster of the run
+ *****************************************************************************/
+static unsigned int findClusterRun(unsigned int cluster, int isFree,
+                                   unsigned int* numClusters);
+
+/******************************************************************************
+ * getClusterOffset - gets where a cluster is in the image.
+ *
+ * cluster - the cluster (numClusters for the end of the last one)
+ *
+ * Return - the offset in bytes
+ *****************************************************************************/
+static long long getClusterOffset(unsigned int cluster);
+
+/******************************************************************************
+ * copyRange - copies part of the mounted image to the clone, at the same
+ *             offset, skipping holes in the image and not writing anything
+ *             that is all zeros.
+ *
+ * fd - the clone's descriptor
+ * offset - where the part starts
+ * numBytes - the size of the part
+ * buffer - a buffer of CLONE_COPY_SIZE bytes
+ * numBytesCopied - the number of bytes written to the clone, which is added
+ *                  to
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int copyRange(int fd, long long offset, long long numBytes,
+                     unsigned char* buffer,
+                     unsigned long long* numBytesCopied);
+
+/******************************************************************************
+ * createTemporaryFile - creates the temporary file that is renamed to an
+ *                       output once it is written.
+ *
+ * fileName - the output's host path name, which must be a regular file if
+ *            it exists (so it is never a device)
+ * temporaryFileName - where to store the temporary file's path name (of at
+ *                     least strlen(fileName) + sizeof(TEMPORARY_SUFFIX))
+ *
+ * Return - the temporary file's descriptor, or -1 on failure
+ *****************************************************************************/
+static int createTemporaryFile(const char* fileName, char* temporaryFileName);
+
+
+/******************************************************************************
+ * main - runs the imgclone program.
+ *****************************************************************************/
+int main(int argc, char* argv[])
+{
+  int isPunching = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "p")) != -1)
+  {
+    switch (opt)
+    {
+      case 'p': isPunching = 1; break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+  argc -= optind;
+  argv += optind;
+
+  if (isPunching && argc == 1)
+    return punchImage(argv[0]);
+  if (!isPunching && argc == 2)
+    return cloneImage(argv[0], argv[1]);
+  usage();
+  return -1;
+}
+
+/******************************************************************************
+ * usage - prints how to run the program.
+ *****************************************************************************/
+static void usage()
+{
+  printf("Usage: imgclone SOURCE CLONE\n"
+         "   or: imgclone -p IMAGE\n");
+}
+
+/******************************************************************************
+ * cloneImage
+ *****************************************************************************/
+static int cloneImage(const char* sourceFileName, const char* cloneFileName)
+{
+  char temporaryFileName[strlen(cloneFileName) + sizeof(TEMPORARY_SUFFIX)];
+  unsigned long long numBytesCopied = 0;
+  unsigned long long numBytesInUse = 0;
+  unsigned char* buffer;
+  unsigned int numClusters;
+  unsigned int runLength;
+  unsigned int cluster;
+  long long imageSize;
+  long long dataEnd;
+  int fd;
+  int rc = 0;
+
+  if (mountImage(sourceFileName, FAT_LOCK_SHARED) != 0)
+    return -1;
+  imageSize = getBlockDeviceSize(fatFileSystem.blockDevice);
+  numClusters = fatFileSystem.geometry.numClusters;
+  dataEnd = getClusterOffset(numClusters);
+
+  // The clone starts out as one big hole.
+  fd = createTemporaryFile(cloneFileName, temporaryFileName);
+  if (fd == -1)
+  {
+    rc = -1;
+  }
+  else if (ftruncate(fd, imageSize) != 0)
+  {
+    perror(temporaryFileName);
+    rc = -1;
+  }
+  buffer = (unsigned char*) malloc(CLONE_COPY_SIZE);
+
+  // Copy everything before the data region, then each run of clusters in
+  // use, then any sectors after the last cluster.
+  if (rc == 0)
+    rc = copyRange(fd, 0, getClusterOffset(2), buffer, &numBytesCopied);
+  cluster = 2;
+  while (rc == 0)
+  {
+    cluster = findClusterRun(cluster, 0, &runLength);
+    if (runLength == 0)
+      break;
+    rc = copyRange(fd, getClusterOffset(cluster),
+                   (long long) runLength *
+                   fatFileSystem.geometry.bytesPerCluster,
+                   buffer, &numBytesCopied);
+    numBytesInUse += (unsigned long long) runLength *
+                     fatFileSystem.geometry.bytesPerCluster;
+    cluster += runLength;
+  }
+  if (rc == 0 && dataEnd < imageSize)
+    rc = copyRange(fd, dataEnd, imageSize - dataEnd, buffer, &numBytesCopied);
+  free(buffer);
+
+  if (rc == 0 && fsync(fd) != 0)
+  {
+    perror(temporaryFileName);
+    rc = -1;
+  }
+  if (fd != -1)
+    close(fd);
+
+  // Only replace the clone once it is all there, which also makes cloning
+  // an image onto itself safe.
+  if (rc == 0 && rename(temporaryFileName, cloneFileName) != 0)
+  {
+    perror(cloneFileName);
+    rc = -1;
+  }
+  if (rc != 0)
+    unlink(temporaryFileName);
+  unmountImage();
+
+  if (rc == 0)
+  {
+    printf("Cloned %s (%llu KB, %llu KB of clusters in use) into %s, "
+           "writing %llu KB\n", sourceFileName,
+           (unsigned long long) imageSize / 1024, numBytesInUse / 1024,
+           cloneFileName, numBytesCopied / 1024);
+  }
+  return rc;
+}
+
+/******************************************************************************
+ * punchImage
+ *****************************************************************************/
+static int punchImage(const char* imageFileName)
+{
+  unsigned long long numBytesFree = 0;
+  unsigned int runLength;
+  unsigned int cluster;
+  long long numBytes;
+  struct stat imageStat;
+  int rc = 0;
+
+  // Every write to an image with a snapshot goes to its delta, so zeros
+  // would only take up more space there.
+  if (hasOverlay(imageFileName))
+  {
+    printf("Error: %s has a snapshot; commit or roll it back first\n",
+           imageFileName);
+    return -1;
+  }
+  if (mountImage(imageFileName, FAT_LOCK_EXCLUSIVE) != 0)
+    return -1;
+
+  cluster = 2;
+  while (rc == 0)
+  {
+    cluster = findClusterRun(cluster, 1, &runLength);
+    if (runLength == 0)
+      break;
+    numBytes = (long long) runLength * fatFileSystem.geometry.bytesPerCluster;
+    rc = discardBlockDevice(fatFileSystem.blockDevice,
+                            getClusterOffset(cluster), numBytes);
+    numBytesFree += numBytes;
+    cluster += runLength;
+  }
+  if (rc != 0)
+    printf("Error: %s: unable to write disk image file\n", imageFileName);
+  else if (flushBlockDevice(fatFileSystem.blockDevice, 1) != 0)
+    rc = -1;
+
+  if (rc == 0 && fstat(fileno(fatFileSystem.fileSystemId), &imageStat) == 0)
+  {
+    printf("Punched holes over %llu KB of free clusters in %s, which now "
+           "takes up %llu KB\n", numBytesFree / 1024, imageFileName,
+           (unsigned long long) imageStat.st_blocks * 512 / 1024);
+  }
+  unmountImage();
+  return rc;
+}
+
+/******************************************************************************
+ * mountImage
+ *****************************************************************************/
+static int mountImage(const char* imageFileName, int lockMode)
+{
+  if (isFatJournalPending(imageFileName))
+  {
+    printf("Error: %s has a journal waiting to be checkpointed; exit the "
+           "shell first\n", imageFileName);
+    return -1;
+  }
+  if (createFatSession(imageFileName) != 0)
+    return -1;
+  if (setFatBlockDevice(BLOCK_DEVICE_PREAD) != 0 ||
+      initializeFatFileSystem(lockMode) != 0)
+  {
+    destroyFatSession();
+    return -1;
+  }
+  return 0;
+}
+
+/******************************************************************************
+ * unmountImage
+ *****************************************************************************/
+static void unmountImage()
+{
+  terminateFatFileSystem();
+  destroyFatSession();
+}
+
+/******************************************************************************
+ * isClusterFree
+ *****************************************************************************/
+static int isClusterFree(unsigned int cluster)
+{
+  return (fatFileSystem.freeClusterMap[cluster / 8] >> (cluster % 8)) & 1;
+}
+
+/******************************************************************************
+ * findClusterRun
+ *****************************************************************************/
+static unsigned int findClusterRun(unsigned int cluster, int isFree,
+                                   unsigned int* numClusters)
+{
+  unsigned char* freeClusterMap = fatFileSystem.freeClusterMap;
+  unsigned int lastCluster = fatFileSystem.geometry.numClusters;
+  unsigned char otherByte = (isFree ? 0x00 : 0xFF);
+  unsigned int first;
+
+  // Skip whole bytes of the map at a time where they can't hold the start
+  // (or end) of a run.
+  while (cluster < lastCluster && isClusterFree(cluster) != isFree)
+  {
+    if (cluster % 8 == 0 && cluster + 8 <= lastCluster &&
+        freeClusterMap[cluster / 8] == otherByte)
+      cluster += 8;
+    else
+      cluster++;
+  }
+  first = cluster;
+  while (cluster < lastCluster && isClusterFree(cluster) == isFree)
+  {
+    if (cluster % 8 == 0 && cluster + 8 <= lastCluster &&
+        freeClusterMap[cluster / 8] == (unsigned char) ~otherByte)
+      cluster += 8;
+    else
+      cluster++;
+  }
+  *numClusters = cluster - first;
+  return first;
+}
+
+/******************************************************************************
+ * getClusterOffset
+ *****************************************************************************/
+static long long getClusterOffset(unsigned int cluster)
+{
+  return ((long long) fatFileSystem.sectorOffsets.dataRegion *
+          fatFileSystem.bootSector.bytesPerSector) +
+         (long long) (cluster - 2) * fatFileSystem.geometry.bytesPerCluster;
+}
+
+/******************************************************************************
+ * copyRange
+ *****************************************************************************/
+static int copyRange(int fd, long long offset, long long numBytes,
+                     unsigned char* buffer,
+                     unsigned long long* numBytesCopied)
+{
+  BlockDevice* device = fatFileSystem.blockDevice;
+  long long end = offset + numBytes;
+  long long dataStart;
+  long long dataEnd;
+  long long numPieceBytes;
+
+  while (offset < end)
+  {
+    // An image on the host can say where its holes are, so they aren't
+    // read at all. Through a snapshot or a packed image, everything is
+    // read and zeros are skipped instead.
+    dataEnd = end;
+    if (device->fd != -1)
+    {
+      dataStart = lseek(device->fd, offset, SEEK_DATA);
+      if (dataStart == -1 && errno == ENXIO)
+        return 0; // nothing but a hole to the end of the image
+      if (dataStart != -1)
+      {
+        if (dataStart >= end)
+          return 0;
+        offset = dataStart;
+        dataEnd = lseek(device->fd, offset, SEEK_HOLE);
+        if (dataEnd == -1 || dataEnd > end)
+          dataEnd = end;
+      }
+    }
+
+    for (; offset < dataEnd; offset += numPieceBytes)
+    {
+      numPieceBytes = dataEnd - offset;
+      if (numPieceBytes > CLONE_COPY_SIZE)
+        numPieceBytes = CLONE_COPY_SIZE;
+      if (readBlockDevice(device, offset, numPieceBytes, buffer) !=
+          numPieceBytes)
+      {
+        printf("Error: %s: unable to read disk image file\n",
+               fatFileSystem.diskImageFileName);
+        return -1;
+      }
+      if (buffer[0] == 0 &&
+          memcmp(buffer, buffer + 1, numPieceBytes - 1) == 0)
+        continue;
+      if (pwrite(fd, buffer, numPieceBytes, offset) != numPieceBytes)
+      {
+        perror("Error writing the clone");
+        return -1;
+      }
+      *numBytesCopied += numPieceBytes;
+    }
+  }
+  return 0;
+}
+
+/******************************************************************************
+ * createTemporaryFile
+ *****************************************************************************/
+static int createTemporaryFile(const char* fileName, char* temporaryFileName)
+{
+  struct stat fileStat;
+  int fd;
+
+  if (stat(fileName, &fileStat) == 0 && !S_ISREG(fileStat.st_mode))
+  {
+    printf("Error: %s is not a regular file\n", fileName);
+    return -1;
+  }
+
+  strcpy(temporaryFileName, fileName);
+  strcat(temporaryFileName, TEMPORARY_SUFFIX);
+  fd = open(temporaryFileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
+    perror(temporaryFileName);
+  return fd;
+}
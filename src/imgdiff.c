@@ -0,0 +1,650 @@
+/******************************************************************************
+ * imgdiff.c: Image diff
+ *
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Finds the sectors that changed between two disk images, and
+ *              which files they belong to, optionally writing a patch that
+ *              imgpatch applies to a copy of the first image to turn it into
+ *              the second (see imageDiff.h). This runs on its own, outside of
+ *              the shell:
+ *
+ *              Usage: imgdiff [-j THREADS] [-o PATCH] [-s SIGNATURE] [-q]
+ *                             OLD NEW
+ *
+ *                -j THREADS    number of threads to hash with (default: one
+ *                              per CPU)
+ *                -o PATCH      write a patch of the changed sectors
+ *                -s SIGNATURE  save NEW's signature, to diff against next
+ *                              time instead of keeping a copy of NEW
+ *                -q            only print the totals, without mapping the
+ *                              changed sectors to files
+ *
+ *              OLD is either an image or a signature saved with -s. Both
+ *              images are hashed a sector at a time in parallel. Each changed
+ *              sector is then mapped to the region of the file system it is
+ *              in, or to the file or directory whose cluster it is, by
+ *              reading NEW's FAT table and directory tree (and OLD's, when it
+ *              is an image, for clusters that were freed).
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ *****************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fat.h"
+#include "imageDiff.h"
+#include "treeWalk.h"
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+
+// The owners every image has, before those of its files.
+enum
+{
+  OWNER_FREE_SPACE = 0,
+  OWNER_RESERVED,
+  OWNER_FAT_TABLES,
+  OWNER_ROOT_DIRECTORY,
+  OWNER_PAST_END,
+  NUM_FIXED_OWNERS
+};
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * Owner - a region or file that changed sectors are counted against.
+ *****************************************************************************/
+typedef struct
+{
+  char*              name;
+  unsigned long long firstSector; // the first changed one
+  unsigned long long numSectors; // changed
+} Owner;
+
+/******************************************************************************
+ * ImageLayout - where an image's regions are, and which owner each of its
+ *               clusters belongs to.
+ *****************************************************************************/
+typedef struct
+{
+  int           isMapped;
+  unsigned int  bytesPerSector;
+  unsigned int  sectorsPerCluster;
+  unsigned int  fatTables; // the first sector of each region
+  unsigned int  rootDirectory;
+  unsigned int  dataRegion;
+  unsigned int  totalSectors;
+  unsigned int  numClusters;
+  unsigned int* clusterOwners; // index into owners, or OWNER_FREE_SPACE
+} ImageLayout;
+
+
+//-----------------------------------------------------------------------------
+// Variables
+//-----------------------------------------------------------------------------
+
+static Owner*       owners = NULL;
+static unsigned int numOwners = 0;
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+static void usage();
+
+/******************************************************************************
+ * openImage - opens a disk image to read, through the block device the
+ *             commands would use, and locks it for reading.
+ *
+ * imageFileName - the image's host path name
+ * stream - where to store the image's stream
+ *
+ * Return - the block device, or NULL on failure
+ *****************************************************************************/
+static BlockDevice* openImage(const char* imageFileName, FILE** stream);
+
+/******************************************************************************
+ * closeImage - closes a disk image opened by openImage().
+ *
+ * device - the block device
+ * stream - the image's stream
+ *
+ * Return - none
+ *****************************************************************************/
+static void closeImage(BlockDevice* device, FILE* stream);
+
+/******************************************************************************
+ * writePatch - writes a patch of the sectors whose hashes differ.
+ *
+ * patchFileName - the patch's host path name
+ * device - the new image
+ * oldSignature - the old image's signature
+ * newSignature - the new image's signature
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int writePatch(const char* patchFileName, BlockDevice* device,
+                      ImageSignature* oldSignature,
+                      ImageSignature* newSignature);
+
+/******************************************************************************
+ * isSectorChanged - checks if a sector differs between two images.
+ *
+ * oldSignature - the old image's signature
+ * newSignature - the new image's signature
+ * sector - the sector number, in IMAGE_DIFF_SECTOR_SIZE sectors
+ *
+ * Return - 1 if it does, 0 if not
+ *****************************************************************************/
+static int isSectorChanged(ImageSignature* oldSignature,
+                           ImageSignature* newSignature,
+                           unsigned long long sector);
+
+/******************************************************************************
+ * mapImage - mounts a disk image to find its layout, and which file or
+ *            directory owns each cluster.
+ *
+ * imageFileName - the image's host path name
+ * prefix - put before the name of each owner found
+ * numThreads - the number of threads to walk the tree with
+ * layout - where to store the layout
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int mapImage(const char* imageFileName, const char* prefix,
+                    int numThreads, ImageLayout* layout);
+
+/******************************************************************************
+ * addOwners - adds a node of a walked tree, and everything under it, as the
+ *             owners of their clusters.
+ *
+ * node - the node
+ * path - the node's path name, in a buffer long enough to add to
+ * pathLength - the length of the path name
+ * prefix - put before the name of each owner
+ * layout - the layout to add the clusters' owners to
+ *
+ * Return - none
+ *****************************************************************************/
+static void addOwners(TreeNode* node, char* path, size_t pathLength,
+                      const char* prefix, ImageLayout* layout);
+
+/******************************************************************************
+ * addOwner - adds an owner.
+ *
+ * name - its name, which is copied
+ *
+ * Return - its index
+ *****************************************************************************/
+static unsigned int addOwner(const char* name);
+
+/******************************************************************************
+ * getSectorOwner - finds the owner of a sector in an image.
+ *
+ * layout - the image's layout
+ * sector - the sector number, in IMAGE_DIFF_SECTOR_SIZE sectors
+ *
+ * Return - the owner's index, or OWNER_FREE_SPACE
+ *****************************************************************************/
+static unsigned int getSectorOwner(ImageLayout* layout,
+                                   unsigned long long sector);
+
+/******************************************************************************
+ * compareOwners - orders owners by their first changed sector, for qsort().
+ *****************************************************************************/
+static int compareOwners(const void* a, const void* b);
+
+
+/******************************************************************************
+ * main - runs the imgdiff program.
+ *****************************************************************************/
+int main(int argc, char* argv[])
+{
+  const char* patchFileName = NULL;
+  const char* signatureFileName = NULL;
+  const char* oldFileName;
+  const char* newFileName;
+  int numThreads = 0;
+  int isMappingFiles = 1;
+  ImageSignature oldSignature;
+  ImageSignature newSignature;
+  ImageLayout oldLayout;
+  ImageLayout newLayout;
+  BlockDevice* device;
+  FILE* stream;
+  unsigned long long numChanged = 0;
+  unsigned long long numRuns = 0;
+  unsigned long long sector;
+  unsigned long long numSectors;
+  unsigned int owner;
+  unsigned int i;
+  int rc = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "j:o:s:q")) != -1)
+  {
+    switch (opt)
+    {
+      case 'j': numThreads = strtol(optarg, NULL, 10); break;
+      case 'o': patchFileName = optarg; break;
+      case 's': signatureFileName = optarg; break;
+      case 'q': isMappingFiles = 0; break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+  if (optind != argc - 2 || numThreads < 0)
+  {
+    usage();
+    return -1;
+  }
+  oldFileName = argv[optind];
+  newFileName = argv[optind + 1];
+  memset(&oldLayout, 0, sizeof(oldLayout));
+  memset(&newLayout, 0, sizeof(newLayout));
+
+  // Map the images first, since mounting one finishes anything left in its
+  // journal.
+  for (i = 0; i < NUM_FIXED_OWNERS; i++)
+  {
+    static const char* fixedOwners[NUM_FIXED_OWNERS] =
+    {
+      "free space", "reserved sectors", "FAT tables", "root directory",
+      "past the end of the file system"
+    };
+    addOwner(fixedOwners[i]);
+  }
+  if (isMappingFiles)
+  {
+    if (mapImage(newFileName, "", numThreads, &newLayout) != 0)
+      printf("Warning: %s: could not read its files\n", newFileName);
+  }
+
+  // Hash both images, unless OLD is a signature already.
+  if (loadImageSignature(oldFileName, &oldSignature) != 0)
+  {
+    if (isMappingFiles)
+      mapImage(oldFileName, "freed from ", numThreads, &oldLayout);
+    device = openImage(oldFileName, &stream);
+    if (device == NULL)
+      return -1;
+    rc = computeImageSignature(device, numThreads, &oldSignature);
+    closeImage(device, stream);
+    if (rc != 0)
+    {
+      printf("Error: %s: unable to read disk image file\n", oldFileName);
+      return -1;
+    }
+  }
+  device = openImage(newFileName, &stream);
+  if (device == NULL)
+  {
+    freeImageSignature(&oldSignature);
+    return -1;
+  }
+  if (computeImageSignature(device, numThreads, &newSignature) != 0)
+  {
+    printf("Error: %s: unable to read disk image file\n", newFileName);
+    closeImage(device, stream);
+    freeImageSignature(&oldSignature);
+    return -1;
+  }
+
+  // Count the changed sectors against their owners.
+  numSectors = newSignature.numSectors;
+  for (sector = 0; sector < numSectors; sector++)
+  {
+    if (!isSectorChanged(&oldSignature, &newSignature, sector))
+      continue;
+    if (sector == 0 || !isSectorChanged(&oldSignature, &newSignature,
+                                        sector - 1))
+      numRuns++;
+    numChanged++;
+
+    owner = getSectorOwner(&newLayout, sector);
+    if (owner == OWNER_FREE_SPACE && newLayout.isMapped)
+      owner = getSectorOwner(&oldLayout, sector);
+    if (owners[owner].numSectors++ == 0)
+      owners[owner].firstSector = sector;
+  }
+
+  if (patchFileName != NULL &&
+      writePatch(patchFileName, device, &oldSignature, &newSignature) != 0)
+  {
+    perror(patchFileName);
+    rc = -1;
+  }
+  closeImage(device, stream);
+  if (signatureFileName != NULL &&
+      saveImageSignature(signatureFileName, &newSignature) != 0)
+  {
+    perror(signatureFileName);
+    rc = -1;
+  }
+
+  printf("%llu of %llu sectors changed (%llu KB) in %llu runs",
+         numChanged, numSectors,
+         numChanged * IMAGE_DIFF_SECTOR_SIZE / 1024, numRuns);
+  if (oldSignature.imageSize != newSignature.imageSize)
+    printf(", and the size changed from %llu to %llu bytes",
+           oldSignature.imageSize, newSignature.imageSize);
+  printf("\n");
+  if (isMappingFiles && numChanged > 0)
+  {
+    qsort(owners, numOwners, sizeof(Owner), compareOwners);
+    printf("%10s  %s\n", "Sectors", "Where");
+    for (i = 0; i < numOwners; i++)
+    {
+      if (owners[i].numSectors > 0)
+        printf("%10llu  %s\n", owners[i].numSectors, owners[i].name);
+    }
+  }
+
+  for (i = 0; i < numOwners; i++)
+    free(owners[i].name);
+  free(owners);
+  free(oldLayout.clusterOwners);
+  free(newLayout.clusterOwners);
+  freeImageSignature(&oldSignature);
+  freeImageSignature(&newSignature);
+  return rc;
+}
+
+/******************************************************************************
+ * usage - prints how to run the program.
+ *****************************************************************************/
+static void usage()
+{
+  printf("Usage: imgdiff [-j THREADS] [-o PATCH] [-s SIGNATURE] [-q] "
+         "OLD NEW\n");
+  printf("OLD is a disk image, or a signature saved with -s.\n");
+}
+
+/******************************************************************************
+ * openImage
+ *****************************************************************************/
+static BlockDevice* openImage(const char* imageFileName, FILE** stream)
+{
+  BlockDevice* device;
+  struct flock lock;
+
+  *stream = fopen(imageFileName, "r");
+  if (*stream == NULL)
+  {
+    perror(imageFileName);
+    return NULL;
+  }
+
+  // Wait for any command writing to it to finish.
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type   = F_RDLCK;
+  lock.l_whence = SEEK_SET;
+  while (fcntl(fileno(*stream), F_SETLKW, &lock) == -1 && errno == EINTR)
+    ;
+
+  // pread can be shared by the hashing threads (or an overlay, if the image
+  // has a snapshot).
+  device = openBlockDevice(BLOCK_DEVICE_PREAD, *stream, imageFileName, NULL,
+                           0);
+  if (device == NULL)
+  {
+    printf("Error: %s: unable to open disk image file\n", imageFileName);
+    fclose(*stream);
+  }
+  return device;
+}
+
+/******************************************************************************
+ * closeImage
+ *****************************************************************************/
+static void closeImage(BlockDevice* device, FILE* stream)
+{
+  closeBlockDevice(device);
+  fclose(stream); // which unlocks it
+}
+
+/******************************************************************************
+ * writePatch
+ *****************************************************************************/
+static int writePatch(const char* patchFileName, BlockDevice* device,
+                      ImageSignature* oldSignature,
+                      ImageSignature* newSignature)
+{
+  ImagePatchHeader header;
+  ImagePatchRun run;
+  unsigned char* buffer;
+  unsigned long long sector = 0;
+  unsigned long long numSectors;
+  long long offset;
+  long long numBytes;
+  FILE* file = fopen(patchFileName, "w");
+  int rc = 0;
+
+  if (file == NULL)
+    return -1;
+  memset(&header, 0, sizeof(header));
+  header.magic = FAT12_IMAGE_PATCH_MAGIC;
+  header.version = FAT12_IMAGE_DIFF_VERSION;
+  header.oldImageSize = oldSignature->imageSize;
+  header.oldImageHash = getImageSignatureHash(oldSignature);
+  header.newImageSize = newSignature->imageSize;
+  header.newImageHash = getImageSignatureHash(newSignature);
+
+  // The header is written again at the end, once the runs are counted.
+  buffer = (unsigned char*) malloc(IMAGE_DIFF_CHUNK_SECTORS *
+                                   IMAGE_DIFF_SECTOR_SIZE);
+  if (fwrite(&header, sizeof(header), 1, file) != 1)
+    rc = -1;
+  while (rc == 0 && sector < newSignature->numSectors)
+  {
+    if (!isSectorChanged(oldSignature, newSignature, sector))
+    {
+      sector++;
+      continue;
+    }
+    numSectors = 1;
+    while (numSectors < IMAGE_DIFF_CHUNK_SECTORS &&
+           sector + numSectors < newSignature->numSectors &&
+           isSectorChanged(oldSignature, newSignature, sector + numSectors))
+      numSectors++;
+
+    offset = sector * IMAGE_DIFF_SECTOR_SIZE;
+    numBytes = numSectors * IMAGE_DIFF_SECTOR_SIZE;
+    if (offset + numBytes > (long long) newSignature->imageSize)
+      numBytes = newSignature->imageSize - offset;
+    run.firstSector = sector;
+    run.numSectors = numSectors;
+    if (readBlockDevice(device, offset, numBytes, buffer) != numBytes ||
+        fwrite(&run, sizeof(run), 1, file) != 1 ||
+        fwrite(buffer, 1, numBytes, file) != (size_t) numBytes)
+      rc = -1;
+    header.numRuns++;
+    header.numSectors += numSectors;
+    sector += numSectors;
+  }
+  free(buffer);
+
+  if (rc == 0 && (fseeko(file, 0, SEEK_SET) != 0 ||
+                  fwrite(&header, sizeof(header), 1, file) != 1))
+    rc = -1;
+  if (fclose(file) != 0)
+    rc = -1;
+  return rc;
+}
+
+/******************************************************************************
+ * isSectorChanged
+ *****************************************************************************/
+static int isSectorChanged(ImageSignature* oldSignature,
+                           ImageSignature* newSignature,
+                           unsigned long long sector)
+{
+  return (sector >= oldSignature->numSectors ||
+          oldSignature->hashes[sector] != newSignature->hashes[sector]);
+}
+
+/******************************************************************************
+ * mapImage
+ *****************************************************************************/
+static int mapImage(const char* imageFileName, const char* prefix,
+                    int numThreads, ImageLayout* layout)
+{
+  char path[FAT12_MAX_PATH_NAME_LENGTH * 2];
+  FilePath filePath;
+  TreeNode* root;
+
+  if (createFatSession(imageFileName) != 0)
+    return -1;
+  if (initializeFatFileSystem(FAT_LOCK_SHARED) != 0)
+  {
+    destroyFatSession();
+    return -1;
+  }
+
+  layout->bytesPerSector = fatFileSystem.bootSector.bytesPerSector;
+  layout->sectorsPerCluster = fatFileSystem.geometry.sectorsPerCluster;
+  layout->fatTables = fatFileSystem.sectorOffsets.fatTables;
+  layout->rootDirectory = fatFileSystem.sectorOffsets.rootDirectory;
+  layout->dataRegion = fatFileSystem.sectorOffsets.dataRegion;
+  layout->totalSectors = fatFileSystem.geometry.totalSectors;
+  layout->numClusters = fatFileSystem.geometry.numClusters;
+  layout->clusterOwners = (unsigned int*) calloc(layout->numClusters,
+                                                 sizeof(unsigned int));
+
+  getWorkingDirectory(&filePath);
+  root = walkTree(&filePath, numThreads);
+  if (root != NULL)
+  {
+    strcpy(path, filePath.pathName);
+    addOwners(root, path, strlen(path), prefix, layout);
+    freeTree(root);
+    layout->isMapped = 1;
+  }
+
+  terminateFatFileSystem();
+  destroyFatSession();
+  return (layout->isMapped ? 0 : -1);
+}
+
+/******************************************************************************
+ * addOwners
+ *****************************************************************************/
+static void addOwners(TreeNode* node, char* path, size_t pathLength,
+                      const char* prefix, ImageLayout* layout)
+{
+  char name[FAT12_MAX_PATH_NAME_LENGTH * 2 + 32];
+  unsigned int cluster = getEntryCluster(&node->entry);
+  unsigned int owner;
+  unsigned int entryValue;
+  int entryType;
+  unsigned int numClusters = 0;
+  unsigned int i;
+
+  // The FAT32 root directory is a chain like any other, found through the
+  // boot sector.
+  if (node->isDirectory && pathLength == 1 && path[0] == '/')
+  {
+    cluster = (fatFileSystem.geometry.fatType == FAT_TYPE_32 ?
+               fatFileSystem.geometry.rootDirectoryCluster : 0);
+  }
+
+  // Give each cluster of the chain to this node, stopping at any cluster
+  // already claimed, in case the chains are crossed.
+  if (cluster >= 2 && cluster < layout->numClusters)
+  {
+    snprintf(name, sizeof(name), "%s%s%s", prefix, path,
+             (node->isDirectory && pathLength > 1 ? "/" : ""));
+    owner = addOwner(name);
+    while (cluster >= 2 && cluster < layout->numClusters &&
+           layout->clusterOwners[cluster] == OWNER_FREE_SPACE &&
+           numClusters++ < layout->numClusters)
+    {
+      layout->clusterOwners[cluster] = owner;
+      getFatEntry(cluster, &entryValue, &entryType);
+      if (entryType != FAT_ENTRY_TYPE_NEXT_SECTOR)
+        break;
+      cluster = entryValue;
+    }
+  }
+
+  for (i = 0; i < node->numChildren; i++)
+  {
+    TreeNode* child = &node->children[i];
+    size_t childLength = pathLength;
+
+    if (path[childLength - 1] != '/')
+      path[childLength++] = '/';
+    strcpy(path + childLength, child->name);
+    addOwners(child, path, childLength + strlen(child->name), prefix,
+              layout);
+    path[pathLength] = '\0';
+  }
+}
+
+/******************************************************************************
+ * addOwner
+ *****************************************************************************/
+static unsigned int addOwner(const char* name)
+{
+  if ((numOwners & (numOwners - 1)) == 0)
+    owners = (Owner*) realloc(owners, (numOwners == 0 ? 1 : numOwners * 2) *
+                                      sizeof(Owner));
+  owners[numOwners].name = strdup(name);
+  owners[numOwners].firstSector = 0;
+  owners[numOwners].numSectors = 0;
+  return numOwners++;
+}
+
+/******************************************************************************
+ * getSectorOwner
+ *****************************************************************************/
+static unsigned int getSectorOwner(ImageLayout* layout,
+                                   unsigned long long sector)
+{
+  unsigned long long fsSector;
+  unsigned long long cluster;
+
+  if (!layout->isMapped)
+    return OWNER_FREE_SPACE;
+
+  // Which of the file system's (possibly larger) sectors it is in.
+  fsSector = sector * IMAGE_DIFF_SECTOR_SIZE / layout->bytesPerSector;
+  if (fsSector < layout->fatTables)
+    return OWNER_RESERVED;
+  if (fsSector >= layout->totalSectors)
+    return OWNER_PAST_END;
+  if (fsSector < layout->rootDirectory)
+    return OWNER_FAT_TABLES;
+  if (fsSector < layout->dataRegion) // (FAT12 and FAT16 only)
+    return OWNER_ROOT_DIRECTORY;
+
+  cluster = (fsSector - layout->dataRegion) / layout->sectorsPerCluster + 2;
+  if (cluster >= layout->numClusters)
+    return OWNER_PAST_END;
+  return layout->clusterOwners[cluster];
+}
+
+/******************************************************************************
+ * compareOwners
+ *****************************************************************************/
+static int compareOwners(const void* a, const void* b)
+{
+  const Owner* ownerA = (const Owner*) a;
+  const Owner* ownerB = (const Owner*) b;
+
+  if (ownerA->firstSector != ownerB->firstSector)
+    return (ownerA->firstSector < ownerB->firstSector ? -1 : 1);
+  return 0;
+}
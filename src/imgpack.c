@@ -0,0 +1,575 @@
+/******************************************************************************
+ * imgpack.c: Image pack
+ *
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Packs disk images into compressed images, and unpacks them
+ *              again (see compressedImage.h). This runs on its own, outside
+ *              of the shell:
+ *
+ *              Usage: imgpack pack [-c KB] [-l LEVEL] [-k] IMAGE PACKED
+ *                 or: imgpack unpack PACKED IMAGE
+ *                 or: imgpack status PACKED
+ *
+ *                -c KB     the size of each chunk, a power of 2 from 4 to
+ *                          1024 (default 32)
+ *                -l LEVEL  zlib's compression level, from 1 (fastest) to 9
+ *                          (smallest) (default 6)
+ *                -k        keep what is in free clusters, rather than
+ *                          storing them as zeros
+ *
+ *              pack compresses IMAGE into PACKED, which every command can
+ *              then use just like IMAGE. Free clusters (found from the FAT
+ *              table) are stored as zeros, so a chunk of nothing but free
+ *              clusters takes no space at all. IMAGE may itself be packed,
+ *              and packing an image into itself reclaims the space left
+ *              behind by chunks that were written since it was packed.
+ *              unpack writes the image inside PACKED back out (as a sparse
+ *              file), and status prints how well it compressed.
+ *
+ *              The image is locked while it is read, and the output is
+ *              written to a temporary file which is then renamed, so
+ *              nothing sees it half-written.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ *****************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "compressedImage.h"
+#include "fat.h"
+#include "journal.h"
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+
+// The default compression level.
+#define DEFAULT_LEVEL 6
+
+// Appended to the output's path name to name the temporary file.
+#define TEMPORARY_SUFFIX ".tmp"
+
+// The most bytes copied at once when unpacking.
+#define UNPACK_COPY_SIZE (1024 * 1024)
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * FreeSpace - where an image's free clusters are.
+ *****************************************************************************/
+typedef struct
+{
+  unsigned long long dataRegion; // in bytes
+  unsigned int       bytesPerCluster;
+  unsigned int       numClusters; // number of FAT entries, including 0 and 1
+  unsigned char*     freeClusterMap; // a set bit for each free cluster
+} FreeSpace;
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+static void usage();
+
+/******************************************************************************
+ * pack - compresses an image into a new compressed image.
+ *
+ * imageFileName - the image's host path name
+ * packedFileName - the compressed image's host path name
+ * chunkSize - the size of each chunk, in bytes
+ * level - the compression level
+ * isFreeSpaceKept - 1 to keep what is in free clusters
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int pack(const char* imageFileName, const char* packedFileName,
+                unsigned int chunkSize, int level, int isFreeSpaceKept);
+
+/******************************************************************************
+ * unpack - writes the image inside a compressed image out to a new file.
+ *
+ * packedFileName - the compressed image's host path name
+ * imageFileName - the image's host path name
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int unpack(const char* packedFileName, const char* imageFileName);
+
+/******************************************************************************
+ * printStatus - prints how well a compressed image compressed.
+ *
+ * packedFileName - the compressed image's host path name
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int printStatus(const char* packedFileName);
+
+/******************************************************************************
+ * findFreeSpace - finds an image's free clusters from its FAT table.
+ *
+ * imageFileName - the image's host path name
+ * freeSpace - where to store where they are
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int findFreeSpace(const char* imageFileName, FreeSpace* freeSpace);
+
+/******************************************************************************
+ * clearFreeSpace - zeros the free clusters in part of an image.
+ *
+ * freeSpace - where the free clusters are
+ * offset - where in the image the part starts
+ * numBytes - the size of the part
+ * data - the part
+ *
+ * Return - none
+ *****************************************************************************/
+static void clearFreeSpace(FreeSpace* freeSpace, long long offset,
+                           unsigned int numBytes, unsigned char* data);
+
+/******************************************************************************
+ * createTemporaryFile - creates the temporary file that is renamed to an
+ *                       output once it is written.
+ *
+ * fileName - the output's host path name, which must be a regular file if
+ *            it exists (so it is never a device)
+ * temporaryFileName - where to store the temporary file's path name (of at
+ *                     least strlen(fileName) + sizeof(TEMPORARY_SUFFIX))
+ * flags - the flags to open it with, besides O_CREAT and O_TRUNC
+ *
+ * Return - the temporary file's descriptor, or -1 on failure
+ *****************************************************************************/
+static int createTemporaryFile(const char* fileName, char* temporaryFileName,
+                               int flags);
+
+/******************************************************************************
+ * openImage - opens a disk image to read, locked against commands writing
+ *             to it.
+ *
+ * imageFileName - the image's host path name
+ * stream - where to store the image's stream
+ *
+ * Return - the image's block device, or NULL on failure
+ *****************************************************************************/
+static BlockDevice* openImage(const char* imageFileName, FILE** stream);
+
+
+/******************************************************************************
+ * main - runs the imgpack program.
+ *****************************************************************************/
+int main(int argc, char* argv[])
+{
+  const char* action;
+  unsigned int chunkSize = COMPRESSED_IMAGE_DEFAULT_CHUNK_SIZE;
+  int level = DEFAULT_LEVEL;
+  int isFreeSpaceKept = 0;
+  int opt;
+
+  if (argc < 2)
+  {
+    usage();
+    return -1;
+  }
+  action = argv[1];
+
+  // The options come after the action.
+  while ((opt = getopt(argc - 1, argv + 1, "c:l:k")) != -1)
+  {
+    switch (opt)
+    {
+      case 'c': chunkSize = strtoul(optarg, NULL, 10) * 1024; break;
+      case 'l': level = strtol(optarg, NULL, 10); break;
+      case 'k': isFreeSpaceKept = 1; break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+  argc -= optind + 1;
+  argv += optind + 1;
+
+  if (strcmp(action, "pack") == 0 && argc == 2)
+  {
+    if (chunkSize < COMPRESSED_IMAGE_MIN_CHUNK_SIZE ||
+        chunkSize > COMPRESSED_IMAGE_MAX_CHUNK_SIZE ||
+        (chunkSize & (chunkSize - 1)) != 0 || level < 1 || level > 9)
+    {
+      usage();
+      return -1;
+    }
+    return pack(argv[0], argv[1], chunkSize, level, isFreeSpaceKept);
+  }
+  if (strcmp(action, "unpack") == 0 && argc == 2)
+    return unpack(argv[0], argv[1]);
+  if (strcmp(action, "status") == 0 && argc == 1)
+    return printStatus(argv[0]);
+  usage();
+  return -1;
+}
+
+/******************************************************************************
+ * usage - prints how to run the program.
+ *****************************************************************************/
+static void usage()
+{
+  printf("Usage: imgpack pack [-c KB] [-l LEVEL] [-k] IMAGE PACKED\n"
+         "   or: imgpack unpack PACKED IMAGE\n"
+         "   or: imgpack status PACKED\n");
+}
+
+/******************************************************************************
+ * pack
+ *****************************************************************************/
+static int pack(const char* imageFileName, const char* packedFileName,
+                unsigned int chunkSize, int level, int isFreeSpaceKept)
+{
+  char temporaryFileName[strlen(packedFileName) + sizeof(TEMPORARY_SUFFIX)];
+  FreeSpace freeSpace;
+  CompressedImage* packed = NULL;
+  CompressedImageUsage usage;
+  BlockDevice* device;
+  FILE* stream;
+  unsigned char* chunk;
+  long long imageSize;
+  long long offset;
+  long long numBytes;
+  int fd;
+  int rc = 0;
+
+  memset(&freeSpace, 0, sizeof(freeSpace));
+  if (!isFreeSpaceKept && findFreeSpace(imageFileName, &freeSpace) != 0)
+  {
+    printf("Error: could not read the FAT table of %s (use -k to pack it "
+           "anyway)\n", imageFileName);
+    return -1;
+  }
+  device = openImage(imageFileName, &stream);
+  if (device == NULL)
+  {
+    free(freeSpace.freeClusterMap);
+    return -1;
+  }
+  imageSize = getBlockDeviceSize(device);
+
+  fd = createTemporaryFile(packedFileName, temporaryFileName, O_RDWR);
+  if (fd != -1)
+  {
+    packed = createCompressedImage(fd, imageSize, chunkSize, level);
+    if (packed == NULL)
+      perror(temporaryFileName);
+  }
+  if (packed == NULL)
+    rc = -1;
+
+  // Copy the image in a chunk at a time.
+  chunk = (unsigned char*) malloc(chunkSize);
+  for (offset = 0; rc == 0 && offset < imageSize; offset += chunkSize)
+  {
+    numBytes = imageSize - offset;
+    if (numBytes > chunkSize)
+      numBytes = chunkSize;
+    if (readBlockDevice(device, offset, numBytes, chunk) != numBytes)
+    {
+      printf("Error: %s: unable to read disk image file\n", imageFileName);
+      rc = -1;
+      break;
+    }
+    if (freeSpace.freeClusterMap != NULL)
+      clearFreeSpace(&freeSpace, offset, numBytes, chunk);
+    if (writeCompressedImage(packed, offset, numBytes, chunk) != numBytes)
+    {
+      perror(temporaryFileName);
+      rc = -1;
+    }
+  }
+  free(chunk);
+
+  if (rc == 0 && flushCompressedImage(packed) != 0)
+  {
+    perror(temporaryFileName);
+    rc = -1;
+  }
+  if (rc == 0)
+    getCompressedImageUsage(packed, &usage);
+  if (packed != NULL)
+    closeCompressedImage(packed);
+  if (fd != -1)
+    close(fd);
+
+  // Only replace the output once it is all there, which also makes packing
+  // an image into itself safe.
+  if (rc == 0 && rename(temporaryFileName, packedFileName) != 0)
+  {
+    perror(packedFileName);
+    rc = -1;
+  }
+  if (rc != 0)
+    unlink(temporaryFileName);
+  closeBlockDevice(device);
+  fclose(stream); // which unlocks it
+  free(freeSpace.freeClusterMap);
+
+  if (rc == 0)
+  {
+    printf("Packed %s (%llu KB) into %s (%llu KB, %.1f:1), with %llu of "
+           "%llu chunks empty\n", imageFileName, usage.imageSize / 1024,
+           packedFileName, usage.containerSize / 1024,
+           (double) usage.imageSize / usage.containerSize,
+           usage.numZeroChunks, usage.numChunks);
+  }
+  return rc;
+}
+
+/******************************************************************************
+ * unpack
+ *****************************************************************************/
+static int unpack(const char* packedFileName, const char* imageFileName)
+{
+  char temporaryFileName[strlen(imageFileName) + sizeof(TEMPORARY_SUFFIX)];
+  BlockDevice* device;
+  FILE* stream;
+  unsigned char* buffer;
+  long long imageSize;
+  long long offset;
+  long long numBytes;
+  int fd;
+  int rc = 0;
+
+  device = openImage(packedFileName, &stream);
+  if (device == NULL)
+    return -1;
+  if (device->type != BLOCK_DEVICE_COMPRESSED)
+  {
+    printf("Error: %s is not a compressed image\n", packedFileName);
+    closeBlockDevice(device);
+    fclose(stream);
+    return -1;
+  }
+  imageSize = getBlockDeviceSize(device);
+
+  // The image starts out as one big hole, and chunks of zeros are left as
+  // holes.
+  fd = createTemporaryFile(imageFileName, temporaryFileName, O_WRONLY);
+  if (fd == -1)
+  {
+    rc = -1;
+  }
+  else if (ftruncate(fd, imageSize) != 0)
+  {
+    perror(temporaryFileName);
+    rc = -1;
+  }
+  buffer = (unsigned char*) malloc(UNPACK_COPY_SIZE);
+  for (offset = 0; rc == 0 && offset < imageSize; offset += numBytes)
+  {
+    numBytes = imageSize - offset;
+    if (numBytes > UNPACK_COPY_SIZE)
+      numBytes = UNPACK_COPY_SIZE;
+    if (readBlockDevice(device, offset, numBytes, buffer) != numBytes)
+    {
+      printf("Error: %s: unable to read compressed image\n", packedFileName);
+      rc = -1;
+    }
+    else if ((buffer[0] != 0 ||
+              memcmp(buffer, buffer + 1, numBytes - 1) != 0) &&
+             pwrite(fd, buffer, numBytes, offset) != numBytes)
+    {
+      perror(temporaryFileName);
+      rc = -1;
+    }
+  }
+  free(buffer);
+
+  if (rc == 0 && fsync(fd) != 0)
+  {
+    perror(temporaryFileName);
+    rc = -1;
+  }
+  if (fd != -1)
+    close(fd);
+  if (rc == 0 && rename(temporaryFileName, imageFileName) != 0)
+  {
+    perror(imageFileName);
+    rc = -1;
+  }
+  if (rc != 0)
+    unlink(temporaryFileName);
+  closeBlockDevice(device);
+  fclose(stream); // which unlocks it
+  return rc;
+}
+
+/******************************************************************************
+ * printStatus
+ *****************************************************************************/
+static int printStatus(const char* packedFileName)
+{
+  CompressedImage* packed;
+  CompressedImageUsage usage;
+  FILE* stream;
+  BlockDevice* device;
+
+  device = openImage(packedFileName, &stream);
+  if (device == NULL)
+    return -1;
+  packed = device->compressedImage;
+  if (device->type != BLOCK_DEVICE_COMPRESSED)
+  {
+    printf("Error: %s is not a compressed image\n", packedFileName);
+    closeBlockDevice(device);
+    fclose(stream);
+    return -1;
+  }
+
+  getCompressedImageUsage(packed, &usage);
+  printf("Image size:      %llu KB\n", usage.imageSize / 1024);
+  printf("Compressed size: %llu KB (%.1f:1)\n", usage.containerSize / 1024,
+         (double) usage.imageSize / usage.containerSize);
+  printf("Chunks:          %llu of %u KB (%llu empty, %llu not compressed)\n",
+         usage.numChunks, usage.chunkSize / 1024, usage.numZeroChunks,
+         usage.numRawChunks);
+  printf("Chunk data:      %llu KB\n", usage.numBytesStored / 1024);
+  printf("Unused:          %llu KB\n", usage.numUnusedBytes / 1024);
+
+  closeBlockDevice(device);
+  fclose(stream); // which unlocks it
+  return 0;
+}
+
+/******************************************************************************
+ * findFreeSpace
+ *****************************************************************************/
+static int findFreeSpace(const char* imageFileName, FreeSpace* freeSpace)
+{
+  unsigned int mapSize;
+
+  if (createFatSession(imageFileName) != 0)
+    return -1;
+  if (initializeFatFileSystem(FAT_LOCK_SHARED) != 0)
+  {
+    destroyFatSession();
+    return -1;
+  }
+
+  freeSpace->dataRegion = (unsigned long long)
+                          fatFileSystem.sectorOffsets.dataRegion *
+                          fatFileSystem.bootSector.bytesPerSector;
+  freeSpace->bytesPerCluster = fatFileSystem.geometry.bytesPerCluster;
+  freeSpace->numClusters = fatFileSystem.geometry.numClusters;
+  mapSize = (freeSpace->numClusters + 7) / 8;
+  freeSpace->freeClusterMap = (unsigned char*) malloc(mapSize);
+  memcpy(freeSpace->freeClusterMap, fatFileSystem.freeClusterMap, mapSize);
+
+  terminateFatFileSystem();
+  destroyFatSession();
+  return 0;
+}
+
+/******************************************************************************
+ * clearFreeSpace
+ *****************************************************************************/
+static void clearFreeSpace(FreeSpace* freeSpace, long long offset,
+                           unsigned int numBytes, unsigned char* data)
+{
+  long long end = offset + numBytes;
+  long long clusterStart;
+  long long clusterEnd;
+  unsigned int cluster;
+
+  if (end <= (long long) freeSpace->dataRegion)
+    return;
+  cluster = 2;
+  if (offset > (long long) freeSpace->dataRegion)
+    cluster += (offset - freeSpace->dataRegion) / freeSpace->bytesPerCluster;
+
+  // Zero the part of each free cluster that overlaps.
+  for (; cluster < freeSpace->numClusters; cluster++)
+  {
+    clusterStart = freeSpace->dataRegion +
+                   (long long) (cluster - 2) * freeSpace->bytesPerCluster;
+    if (clusterStart >= end)
+      break;
+    if (!(freeSpace->freeClusterMap[cluster / 8] & (1 << (cluster % 8))))
+      continue;
+    clusterEnd = clusterStart + freeSpace->bytesPerCluster;
+    if (clusterStart < offset)
+      clusterStart = offset;
+    if (clusterEnd > end)
+      clusterEnd = end;
+    memset(data + (clusterStart - offset), 0, clusterEnd - clusterStart);
+  }
+}
+
+/******************************************************************************
+ * createTemporaryFile
+ *****************************************************************************/
+static int createTemporaryFile(const char* fileName, char* temporaryFileName,
+                               int flags)
+{
+  struct stat fileStat;
+  int fd;
+
+  if (stat(fileName, &fileStat) == 0 && !S_ISREG(fileStat.st_mode))
+  {
+    printf("Error: %s is not a regular file\n", fileName);
+    return -1;
+  }
+
+  strcpy(temporaryFileName, fileName);
+  strcat(temporaryFileName, TEMPORARY_SUFFIX);
+  fd = open(temporaryFileName, flags | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1)
+    perror(temporaryFileName);
+  return fd;
+}
+
+/******************************************************************************
+ * openImage
+ *****************************************************************************/
+static BlockDevice* openImage(const char* imageFileName, FILE** stream)
+{
+  BlockDevice* device;
+  struct flock lock;
+
+  *stream = fopen(imageFileName, "r");
+  if (*stream == NULL)
+  {
+    perror(imageFileName);
+    return NULL;
+  }
+
+  // Hold the same lock commands take to read the image.
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type   = F_RDLCK;
+  lock.l_whence = SEEK_SET;
+  while (fcntl(fileno(*stream), F_SETLKW, &lock) == -1 && errno == EINTR)
+    ;
+  if (isFatJournalPending(imageFileName))
+  {
+    printf("Error: %s has a journal waiting to be checkpointed; exit the "
+           "shell first\n", imageFileName);
+    fclose(*stream);
+    return NULL;
+  }
+
+  device = openBlockDevice(BLOCK_DEVICE_PREAD, *stream, imageFileName, NULL,
+                           0);
+  if (device == NULL)
+  {
+    printf("Error: %s: unable to open disk image file\n", imageFileName);
+    fclose(*stream);
+  }
+  return device;
+}
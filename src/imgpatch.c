@@ -0,0 +1,280 @@
+/******************************************************************************
+ * imgpatch.c: Image patch
+ *
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Applies a patch written by imgdiff to a disk image, turning a
+ *              copy of the patch's old image into its new one (see
+ *              imageDiff.h). This runs on its own, outside of the shell:
+ *
+ *              Usage: imgpatch [-j THREADS] [-f] IMAGE PATCH
+ *
+ *                -j THREADS  number of threads to hash with (default: one
+ *                            per CPU)
+ *                -f          apply the patch without checking the image
+ *
+ *              The image is hashed first to make sure it is the one the
+ *              patch was made from (a patch that was already applied is
+ *              left alone), and again afterwards to make sure it came out
+ *              the same as the patch's new image. The image is locked while
+ *              this runs, and an image with a snapshot is patched through
+ *              its overlay, like any other change.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ *****************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "imageDiff.h"
+#include "journal.h"
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+static void usage();
+
+/******************************************************************************
+ * hashImage - hashes the whole of a disk image.
+ *
+ * device - the image
+ * numThreads - the number of threads to hash with
+ * hash - where to store the hash (see getImageSignatureHash())
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int hashImage(BlockDevice* device, int numThreads,
+                     unsigned long long* hash);
+
+/******************************************************************************
+ * applyRuns - writes each run of sectors in a patch to the image.
+ *
+ * patch - the patch, just past its header
+ * header - the patch's header
+ * device - the image
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int applyRuns(FILE* patch, ImagePatchHeader* header,
+                     BlockDevice* device);
+
+
+/******************************************************************************
+ * main - runs the imgpatch program.
+ *****************************************************************************/
+int main(int argc, char* argv[])
+{
+  const char* imageFileName;
+  const char* patchFileName;
+  int numThreads = 0;
+  int isChecked = 1;
+  ImagePatchHeader header;
+  BlockDevice* device;
+  FILE* patch;
+  FILE* stream;
+  struct flock lock;
+  unsigned long long hash;
+  int rc = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "j:f")) != -1)
+  {
+    switch (opt)
+    {
+      case 'j': numThreads = strtol(optarg, NULL, 10); break;
+      case 'f': isChecked = 0; break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+  if (optind != argc - 2 || numThreads < 0)
+  {
+    usage();
+    return -1;
+  }
+  imageFileName = argv[optind];
+  patchFileName = argv[optind + 1];
+
+  patch = fopen(patchFileName, "r");
+  if (patch == NULL)
+  {
+    perror(patchFileName);
+    return -1;
+  }
+  if (fread(&header, sizeof(header), 1, patch) != 1 ||
+      header.magic != FAT12_IMAGE_PATCH_MAGIC ||
+      header.version != FAT12_IMAGE_DIFF_VERSION)
+  {
+    printf("Error: %s is not a disk image patch\n", patchFileName);
+    fclose(patch);
+    return -1;
+  }
+
+  // Hold the same lock commands take to write the image.
+  stream = fopen(imageFileName, "r+");
+  if (stream == NULL)
+  {
+    perror(imageFileName);
+    fclose(patch);
+    return -1;
+  }
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type   = F_WRLCK;
+  lock.l_whence = SEEK_SET;
+  while (fcntl(fileno(stream), F_SETLKW, &lock) == -1 && errno == EINTR)
+    ;
+  if (isFatJournalPending(imageFileName))
+  {
+    printf("Error: %s has a journal waiting to be checkpointed; exit the "
+           "shell first\n", imageFileName);
+    fclose(stream);
+    fclose(patch);
+    return -1;
+  }
+  device = openBlockDevice(BLOCK_DEVICE_PREAD, stream, imageFileName, NULL,
+                           1);
+  if (device == NULL)
+  {
+    printf("Error: %s: unable to open disk image file\n", imageFileName);
+    fclose(stream);
+    fclose(patch);
+    return -1;
+  }
+
+  // Make sure it is the image the patch was made from.
+  if (isChecked)
+  {
+    if (hashImage(device, numThreads, &hash) != 0)
+    {
+      printf("Error: %s: unable to read disk image file\n", imageFileName);
+      rc = -1;
+    }
+    else if (hash == header.newImageHash)
+    {
+      printf("%s is already patched\n", imageFileName);
+      isChecked = 0;
+      header.numRuns = 0;
+    }
+    else if (hash != header.oldImageHash)
+    {
+      printf("Error: %s is not the image %s was made from (use -f to apply "
+             "it anyway)\n", imageFileName, patchFileName);
+      rc = -1;
+    }
+  }
+
+  // The image takes the new size before the runs are written, which only
+  // works on the image itself, not through a snapshot's overlay or a
+  // compressed image.
+  if (rc == 0 && header.numRuns > 0 &&
+      (long long) header.newImageSize != getBlockDeviceSize(device))
+  {
+    if (device->type == BLOCK_DEVICE_OVERLAY ||
+        device->type == BLOCK_DEVICE_COMPRESSED ||
+        ftruncate(fileno(stream), header.newImageSize) != 0)
+    {
+      printf("Error: %s: unable to resize disk image file\n", imageFileName);
+      rc = -1;
+    }
+  }
+
+  if (rc == 0 && header.numRuns > 0)
+  {
+    if (applyRuns(patch, &header, device) != 0 ||
+        flushBlockDevice(device, 1) != 0)
+    {
+      printf("Error: %s: unable to apply %s\n", imageFileName, patchFileName);
+      rc = -1;
+    }
+    else
+    {
+      printf("Patched %llu sectors in %llu runs\n", header.numSectors,
+             header.numRuns);
+    }
+  }
+
+  // And that it came out right.
+  if (rc == 0 && isChecked &&
+      (hashImage(device, numThreads, &hash) != 0 ||
+       hash != header.newImageHash))
+  {
+    printf("Error: %s doesn't match the patched image\n", imageFileName);
+    rc = -1;
+  }
+
+  closeBlockDevice(device);
+  fclose(stream); // which unlocks it
+  fclose(patch);
+  return rc;
+}
+
+/******************************************************************************
+ * usage - prints how to run the program.
+ *****************************************************************************/
+static void usage()
+{
+  printf("Usage: imgpatch [-j THREADS] [-f] IMAGE PATCH\n");
+}
+
+/******************************************************************************
+ * hashImage
+ *****************************************************************************/
+static int hashImage(BlockDevice* device, int numThreads,
+                     unsigned long long* hash)
+{
+  ImageSignature signature;
+
+  if (computeImageSignature(device, numThreads, &signature) != 0)
+    return -1;
+  *hash = getImageSignatureHash(&signature);
+  freeImageSignature(&signature);
+  return 0;
+}
+
+/******************************************************************************
+ * applyRuns
+ *****************************************************************************/
+static int applyRuns(FILE* patch, ImagePatchHeader* header,
+                     BlockDevice* device)
+{
+  unsigned long long numSectors = (header->newImageSize +
+                                   IMAGE_DIFF_SECTOR_SIZE - 1) /
+                                  IMAGE_DIFF_SECTOR_SIZE;
+  unsigned char* buffer = (unsigned char*) malloc(
+    IMAGE_DIFF_CHUNK_SECTORS * IMAGE_DIFF_SECTOR_SIZE);
+  ImagePatchRun run;
+  long long offset;
+  long long numBytes;
+  unsigned long long i;
+  int rc = 0;
+
+  for (i = 0; rc == 0 && i < header->numRuns; i++)
+  {
+    if (fread(&run, sizeof(run), 1, patch) != 1 || run.numSectors == 0 ||
+        run.numSectors > IMAGE_DIFF_CHUNK_SECTORS ||
+        run.firstSector >= numSectors ||
+        run.numSectors > numSectors - run.firstSector)
+    {
+      rc = -1;
+      break;
+    }
+
+    // The last sector may be cut short by the end of the image.
+    offset = run.firstSector * IMAGE_DIFF_SECTOR_SIZE;
+    numBytes = run.numSectors * IMAGE_DIFF_SECTOR_SIZE;
+    if (offset + numBytes > (long long) header->newImageSize)
+      numBytes = header->newImageSize - offset;
+    if (fread(buffer, 1, numBytes, patch) != (size_t) numBytes ||
+        writeBlockDevice(device, offset, numBytes, buffer) != numBytes)
+      rc = -1;
+  }
+  free(buffer);
+  return rc;
+}
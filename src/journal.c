@@ -0,0 +1,663 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function definitions for the metadata journal.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fat.h"
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * PendingSector - a sector written during the current transaction.
+ *****************************************************************************/
+typedef struct
+{
+  unsigned int   sector;
+  unsigned char* data;
+} PendingSector;
+
+
+//-----------------------------------------------------------------------------
+// Variables
+//-----------------------------------------------------------------------------
+
+static int            journalFd = -1;
+static int            isTransactionActive = 0;
+static PendingSector* pendingSectors = NULL;
+static unsigned int   numPendingSectors = 0;
+static unsigned int   maxPendingSectors = 0;
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * openJournalFile - open the disk image's journal file.
+ *
+ * flags - flags for open(), besides O_RDWR
+ *
+ * Return - the file descriptor, or -1 on failure
+ *****************************************************************************/
+static int openJournalFile(int flags);
+
+/******************************************************************************
+ * getPendingSector - find a sector in the current transaction.
+ *
+ * sector - the sector number to look for
+ *
+ * Return - the pending sector, or NULL if it isn't in the transaction
+ *****************************************************************************/
+static PendingSector* getPendingSector(unsigned int sector);
+
+/******************************************************************************
+ * addPendingSector - add a sector to the current transaction, reading its
+ *                    current contents if it isn't already in it.
+ *
+ * sector - the sector number to add
+ *
+ * Return - the pending sector
+ *****************************************************************************/
+static PendingSector* addPendingSector(unsigned int sector);
+
+/******************************************************************************
+ * findIndexEntry - find the index entry of a journaled sector.
+ *
+ * sector - the sector number to look for
+ *
+ * Return - the entry's index, or -1 if the sector isn't journaled
+ *****************************************************************************/
+static int findIndexEntry(unsigned int sector);
+
+/******************************************************************************
+ * computeChecksum - compute a 32-bit FNV-1a checksum, continuing from a
+ *                   previous checksum.
+ *
+ * checksum - the checksum so far (2166136261 to start)
+ * data - the data to add to the checksum
+ * numBytes - the number of bytes of data
+ *
+ * Return - the new checksum
+ *****************************************************************************/
+static unsigned int computeChecksum(unsigned int checksum,
+                                    const unsigned char* data,
+                                    unsigned int numBytes);
+
+/******************************************************************************
+ * discardTransaction - forget the current transaction's pending sectors.
+ *
+ * Return - none
+ *****************************************************************************/
+static void discardTransaction();
+
+/******************************************************************************
+ * isTransactionFull - check if the current transaction has no room for more
+ *                     sectors, counting every copy of the FAT sectors that
+ *                     will be added to it when it is committed.
+ *
+ * numNewSectors - the number of sectors about to be added
+ * numNewFatSectors - the number of FAT sectors about to be changed
+ *
+ * Return - 1 if they don't fit, 0 if they do
+ *****************************************************************************/
+static int isTransactionFull(unsigned int numNewSectors,
+                             unsigned int numNewFatSectors);
+
+
+//-----------------------------------------------------------------------------
+// Journal interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * enableFatJournal
+ *****************************************************************************/
+void enableFatJournal(int isGroupCommit)
+{
+  fatFileSystem.session->journal.isEnabled = 1;
+  fatFileSystem.session->journal.isGroupCommit = isGroupCommit;
+}
+
+/******************************************************************************
+ * replayFatJournal
+ *****************************************************************************/
+int replayFatJournal()
+{
+  JournalRecordHeader header;
+  JournalRecordFooter footer;
+  unsigned int bytesPerSector = fatFileSystem.bootSector.bytesPerSector;
+  unsigned int* sectorNumbers;
+  unsigned char* data;
+  unsigned int checksum;
+  unsigned int i;
+  long long offset = 0;
+  int numReplayed = 0;
+  int fd;
+
+  fd = openJournalFile(0);
+  if (fd == -1)
+    return (errno == ENOENT ? 0 : -1);
+
+  // Apply each transaction, stopping at the first one that wasn't committed.
+  while (pread(fd, &header, sizeof(header), offset) == sizeof(header) &&
+         header.magic == FAT12_JOURNAL_HEADER_MAGIC)
+  {
+    offset += sizeof(header);
+    sectorNumbers = (unsigned int*) malloc(header.numSectors *
+                                           sizeof(unsigned int));
+    data = (unsigned char*) malloc(header.numSectors * bytesPerSector);
+
+    if (pread(fd, sectorNumbers, header.numSectors * sizeof(unsigned int),
+              offset) != header.numSectors * sizeof(unsigned int) ||
+        pread(fd, data, header.numSectors * bytesPerSector, offset +
+              header.numSectors * sizeof(unsigned int)) !=
+              header.numSectors * bytesPerSector)
+    {
+      free(sectorNumbers);
+      free(data);
+      break;
+    }
+    offset += header.numSectors * (sizeof(unsigned int) + bytesPerSector);
+
+    checksum = computeChecksum(2166136261u, (unsigned char*) sectorNumbers,
+                               header.numSectors * sizeof(unsigned int));
+    checksum = computeChecksum(checksum, data,
+                               header.numSectors * bytesPerSector);
+    if (checksum != header.checksum ||
+        pread(fd, &footer, sizeof(footer), offset) != sizeof(footer) ||
+        footer.magic != FAT12_JOURNAL_FOOTER_MAGIC ||
+        footer.sequence != header.sequence)
+    {
+      free(sectorNumbers);
+      free(data);
+      break;
+    }
+    offset += sizeof(footer);
+
+    for (i = 0; i < header.numSectors; i++)
+      write_sector(sectorNumbers[i], data + (i * bytesPerSector),
+                   bytesPerSector);
+    numReplayed++;
+
+    free(sectorNumbers);
+    free(data);
+  }
+
+  // Make the replayed sectors durable before throwing the journal away.
+  if (numReplayed > 0)
+  {
+    flushBlockDevice(fatFileSystem.blockDevice, 1);
+  }
+  if (ftruncate(fd, 0) == -1)
+  {
+    close(fd);
+    return -1;
+  }
+  close(fd);
+
+  return numReplayed;
+}
+
+/******************************************************************************
+ * isFatJournalPending
+ *****************************************************************************/
+int isFatJournalPending(const char* diskImageFileName)
+{
+  char path[strlen(diskImageFileName) + sizeof(FAT12_JOURNAL_SUFFIX)];
+  struct stat journalStat;
+
+  // Checkpointing empties the journal rather than removing it.
+  strcpy(path, diskImageFileName);
+  strcat(path, FAT12_JOURNAL_SUFFIX);
+  return (stat(path, &journalStat) == 0 && journalStat.st_size > 0);
+}
+
+/******************************************************************************
+ * openFatJournal
+ *****************************************************************************/
+int openFatJournal()
+{
+  if (!fatFileSystem.session->journal.isEnabled || journalFd != -1)
+    return 0;
+
+  journalFd = openJournalFile(O_CREAT);
+  if (journalFd == -1)
+  {
+    perror("Error opening journal");
+    return -1;
+  }
+  return 0;
+}
+
+/******************************************************************************
+ * closeFatJournal
+ *****************************************************************************/
+void closeFatJournal()
+{
+  discardTransaction();
+  free(pendingSectors);
+  pendingSectors = NULL;
+  maxPendingSectors = 0;
+
+  if (journalFd != -1)
+    close(journalFd);
+  journalFd = -1;
+}
+
+/******************************************************************************
+ * beginFatTransaction
+ *****************************************************************************/
+void beginFatTransaction()
+{
+  if (journalFd == -1)
+    return;
+
+  discardTransaction();
+  memset(fatFileSystem.dirtyFatSectors, 0,
+         fatFileSystem.geometry.sectorsPerFAT);
+  fatFileSystem.numDirtyFatSectors = 0;
+  isTransactionActive = 1;
+}
+
+/******************************************************************************
+ * isFatTransactionActive
+ *****************************************************************************/
+int isFatTransactionActive()
+{
+  return isTransactionActive;
+}
+
+/******************************************************************************
+ * commitFatTransaction
+ *****************************************************************************/
+int commitFatTransaction()
+{
+  JournalState* journal = &fatFileSystem.session->journal;
+  JournalRecordHeader* header;
+  JournalRecordFooter* footer;
+  PendingSector* pending;
+  unsigned int bytesPerSector = fatFileSystem.bootSector.bytesPerSector;
+  unsigned int sectorsPerFAT = fatFileSystem.geometry.sectorsPerFAT;
+  unsigned int* sectorNumbers;
+  unsigned char* data;
+  unsigned char* record;
+  unsigned int recordSize;
+  unsigned int numNewEntries;
+  unsigned int i, j;
+  long long dataOffset;
+
+  if (!isTransactionActive)
+    return 0;
+
+  // Add the changed sectors of every copy of the FAT table.
+  for (i = 0; i < sectorsPerFAT; i++)
+  {
+    if (!fatFileSystem.dirtyFatSectors[i])
+      continue;
+    for (j = 0; j < fatFileSystem.bootSector.numFATs; j++)
+    {
+      pending = addPendingSector(fatFileSystem.sectorOffsets.fatTables +
+                                 (j * sectorsPerFAT) + i);
+      memcpy(pending->data, fatFileSystem.fatTable + (i * bytesPerSector),
+             bytesPerSector);
+    }
+  }
+  isTransactionActive = 0;
+
+  if (numPendingSectors == 0)
+    return 0;
+
+  // Make room in the index, if needed, by checkpointing what's there.
+  numNewEntries = 0;
+  for (i = 0; i < numPendingSectors; i++)
+  {
+    if (findIndexEntry(pendingSectors[i].sector) < 0)
+      numNewEntries++;
+  }
+  if (journal->numIndexEntries + numNewEntries > FAT12_JOURNAL_MAX_SECTORS &&
+      checkpointFatJournal() != 0)
+  {
+    discardTransaction();
+    return -1;
+  }
+
+  // Build the transaction record.
+  recordSize = sizeof(JournalRecordHeader) + sizeof(JournalRecordFooter) +
+               numPendingSectors * (sizeof(unsigned int) + bytesPerSector);
+  record = (unsigned char*) malloc(recordSize);
+  header = (JournalRecordHeader*) record;
+  sectorNumbers = (unsigned int*) (header + 1);
+  data = (unsigned char*) (sectorNumbers + numPendingSectors);
+  footer = (JournalRecordFooter*) (data + numPendingSectors * bytesPerSector);
+
+  for (i = 0; i < numPendingSectors; i++)
+  {
+    sectorNumbers[i] = pendingSectors[i].sector;
+    memcpy(data + (i * bytesPerSector), pendingSectors[i].data,
+           bytesPerSector);
+  }
+  header->magic      = FAT12_JOURNAL_HEADER_MAGIC;
+  header->sequence   = journal->sequence + 1;
+  header->numSectors = numPendingSectors;
+  header->checksum   = computeChecksum(2166136261u,
+    (unsigned char*) sectorNumbers, numPendingSectors * sizeof(unsigned int));
+  header->checksum   = computeChecksum(header->checksum, data,
+                                       numPendingSectors * bytesPerSector);
+  footer->magic      = FAT12_JOURNAL_FOOTER_MAGIC;
+  footer->sequence   = header->sequence;
+
+  // Append it. When group committing, the shell makes it durable later
+  // along with the rest of the batch.
+  if (pwrite(journalFd, record, recordSize, journal->size) != recordSize ||
+      (!journal->isGroupCommit && fdatasync(journalFd) != 0))
+  {
+    perror("Error writing journal");
+    free(record);
+    discardTransaction();
+    return -1;
+  }
+  free(record);
+
+  // Point the index at the new copies of the sectors.
+  dataOffset = journal->size + sizeof(JournalRecordHeader) +
+               numPendingSectors * sizeof(unsigned int);
+  for (i = 0; i < numPendingSectors; i++)
+  {
+    int index = findIndexEntry(pendingSectors[i].sector);
+    if (index < 0)
+    {
+      index = journal->numIndexEntries++;
+      journal->index[index].sector = pendingSectors[i].sector;
+    }
+    journal->index[index].offset = dataOffset + (i * bytesPerSector);
+  }
+  journal->size += recordSize;
+  journal->sequence++;
+  journal->numTransactions++;
+  FAT_STAT_ADD(FAT_STAT_JOURNAL_COMMITS, 1);
+
+  discardTransaction();
+  return 0;
+}
+
+/******************************************************************************
+ * checkpointFatJournal
+ *****************************************************************************/
+int checkpointFatJournal()
+{
+  JournalState* journal = &fatFileSystem.session->journal;
+  unsigned int bytesPerSector = fatFileSystem.bootSector.bytesPerSector;
+  unsigned char* data;
+  int wasTransactionActive = isTransactionActive;
+  int fd = journalFd;
+  unsigned int i;
+  int rc = 0;
+
+  if (journal->numIndexEntries == 0)
+    return 0;
+
+  // The shell doesn't keep the journal open between checkpoints.
+  if (fd == -1)
+  {
+    fd = openJournalFile(O_CREAT);
+    if (fd == -1)
+    {
+      perror("Error opening journal");
+      return -1;
+    }
+  }
+
+  // One fsync makes every transaction since the last checkpoint durable.
+  if (fdatasync(fd) != 0)
+    rc = -1;
+
+  // Write the latest copy of each journaled sector in place.
+  isTransactionActive = 0;
+  data = (unsigned char*) malloc(bytesPerSector);
+  for (i = 0; rc == 0 && i < journal->numIndexEntries; i++)
+  {
+    if (pread(fd, data, bytesPerSector, journal->index[i].offset) !=
+        bytesPerSector ||
+        write_sector(journal->index[i].sector, data, bytesPerSector) == -1)
+    {
+      rc = -1;
+    }
+  }
+  free(data);
+  isTransactionActive = wasTransactionActive;
+
+  // Only empty the journal once the image itself is durable.
+  if (rc == 0 && (flushBlockDevice(fatFileSystem.blockDevice, 1) != 0 ||
+                  ftruncate(fd, 0) != 0))
+  {
+    rc = -1;
+  }
+  if (rc == 0)
+  {
+    journal->size = 0;
+    journal->numTransactions = 0;
+    journal->numIndexEntries = 0;
+  }
+  else
+  {
+    perror("Error checkpointing journal");
+  }
+
+  if (fd != journalFd)
+    close(fd);
+  return rc;
+}
+
+/******************************************************************************
+ * journalReadSector
+ *****************************************************************************/
+int journalReadSector(unsigned int sector, unsigned char* buffer)
+{
+  unsigned int bytesPerSector = fatFileSystem.bootSector.bytesPerSector;
+  PendingSector* pending;
+  int index;
+
+  if (journalFd == -1)
+    return 0;
+
+  // Our own uncommitted writes come first.
+  pending = getPendingSector(sector);
+  if (pending != NULL)
+  {
+    memcpy(buffer, pending->data, bytesPerSector);
+    return 1;
+  }
+
+  // Then anything committed to the journal but not yet checkpointed.
+  index = findIndexEntry(sector);
+  if (index >= 0 && pread(journalFd, buffer, bytesPerSector,
+      fatFileSystem.session->journal.index[index].offset) == bytesPerSector)
+  {
+    return 1;
+  }
+
+  return 0;
+}
+
+/******************************************************************************
+ * journalWriteSector
+ *****************************************************************************/
+int journalWriteSector(unsigned int sector, unsigned char* buffer,
+                       unsigned int bufferSize)
+{
+  PendingSector* pending;
+  unsigned int numBytes = fatFileSystem.bootSector.bytesPerSector;
+
+  if (!isTransactionActive)
+    return 0;
+
+  if (bufferSize < numBytes)
+    numBytes = bufferSize;
+
+  // A transaction can't hold more sectors than the journal's index, so a
+  // very large write is split: what we have so far (with the FAT sectors
+  // changed so far) is committed, and the rest goes into a new transaction.
+  if (getPendingSector(sector) == NULL && isTransactionFull(1, 0))
+  {
+    commitFatTransaction();
+    beginFatTransaction();
+  }
+
+  pending = addPendingSector(sector);
+  memcpy(pending->data, buffer, numBytes);
+  return 1;
+}
+
+
+/******************************************************************************
+ * journalReserveFatSectors
+ *****************************************************************************/
+void journalReserveFatSectors(unsigned int numSectors)
+{
+  if (!isTransactionActive)
+    return;
+
+  // The FAT table of a FAT16 or FAT32 image can be much larger than the
+  // journal, so only the sectors that actually change are counted.
+  if (isTransactionFull(0, numSectors))
+  {
+    commitFatTransaction();
+    beginFatTransaction();
+  }
+}
+
+
+//-----------------------------------------------------------------------------
+// Internal Functions
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * openJournalFile
+ *****************************************************************************/
+static int openJournalFile(int flags)
+{
+  char path[FAT12_MAX_IMAGE_PATH_LENGTH + sizeof(FAT12_JOURNAL_SUFFIX)];
+
+  strcpy(path, fatFileSystem.diskImageFileName);
+  strcat(path, FAT12_JOURNAL_SUFFIX);
+  return open(path, O_RDWR | flags, 0644);
+}
+
+/******************************************************************************
+ * getPendingSector
+ *****************************************************************************/
+static PendingSector* getPendingSector(unsigned int sector)
+{
+  unsigned int i;
+
+  for (i = 0; i < numPendingSectors; i++)
+  {
+    if (pendingSectors[i].sector == sector)
+      return &pendingSectors[i];
+  }
+  return NULL;
+}
+
+/******************************************************************************
+ * addPendingSector
+ *****************************************************************************/
+static PendingSector* addPendingSector(unsigned int sector)
+{
+  unsigned int bytesPerSector = fatFileSystem.bootSector.bytesPerSector;
+  PendingSector* pending = getPendingSector(sector);
+
+  if (pending != NULL)
+    return pending;
+
+  if (numPendingSectors == maxPendingSectors)
+  {
+    maxPendingSectors = (maxPendingSectors == 0 ? 16 : maxPendingSectors * 2);
+    pendingSectors = (PendingSector*) realloc(pendingSectors,
+      maxPendingSectors * sizeof(PendingSector));
+  }
+
+  // Start with the sector's current contents, since a write may only cover
+  // part of it.
+  pending = &pendingSectors[numPendingSectors];
+  pending->sector = sector;
+  pending->data = (unsigned char*) malloc(bytesPerSector);
+  if (read_sector(sector, pending->data) == -1)
+    memset(pending->data, 0, bytesPerSector);
+  numPendingSectors++;
+
+  return pending;
+}
+
+/******************************************************************************
+ * findIndexEntry
+ *****************************************************************************/
+static int findIndexEntry(unsigned int sector)
+{
+  JournalState* journal = &fatFileSystem.session->journal;
+  unsigned int i;
+
+  for (i = 0; i < journal->numIndexEntries; i++)
+  {
+    if (journal->index[i].sector == sector)
+      return (int) i;
+  }
+  return -1;
+}
+
+/******************************************************************************
+ * computeChecksum
+ *****************************************************************************/
+static unsigned int computeChecksum(unsigned int checksum,
+                                    const unsigned char* data,
+                                    unsigned int numBytes)
+{
+  unsigned int i;
+
+  for (i = 0; i < numBytes; i++)
+  {
+    checksum ^= data[i];
+    checksum *= 16777619u;
+  }
+  return checksum;
+}
+
+/******************************************************************************
+ * discardTransaction
+ *****************************************************************************/
+static void discardTransaction()
+{
+  unsigned int i;
+
+  for (i = 0; i < numPendingSectors; i++)
+    free(pendingSectors[i].data);
+  numPendingSectors = 0;
+  isTransactionActive = 0;
+}
+
+/******************************************************************************
+ * isTransactionFull
+ *****************************************************************************/
+static int isTransactionFull(unsigned int numNewSectors,
+                             unsigned int numNewFatSectors)
+{
+  unsigned int numFatSectors = fatFileSystem.numDirtyFatSectors +
+                               numNewFatSectors;
+
+  return (numPendingSectors + numNewSectors +
+          (numFatSectors * fatFileSystem.bootSector.numFATs) >
+          FAT12_JOURNAL_MAX_SECTORS);
+}
@@ -0,0 +1,230 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function headers for the metadata journal, an optional
+ *              write-ahead log kept in a sidecar file next to the disk image
+ *              (named "<image>.journal").
+ *
+ *              While journaling is enabled for a session, a command holding
+ *              the exclusive lock doesn't write sectors to the disk image.
+ *              Instead, its sector writes (and the FAT sectors it changed)
+ *              are collected into one transaction, which is appended to the
+ *              journal when the command unlocks the image. Later commands
+ *              read those sectors back from the journal, using an index kept
+ *              in the session. The shell checkpoints the journal (writes its
+ *              sectors in place and empties it) when it syncs the session,
+ *              so a whole batch of commands costs one journal fsync.
+ *
+ *              The journal is a sequence of transaction records:
+ *
+ *                JournalRecordHeader
+ *                unsigned int sectorNumbers[numSectors]
+ *                unsigned char data[numSectors][bytesPerSector]
+ *                JournalRecordFooter
+ *
+ *              A record whose checksum or footer doesn't match was cut short
+ *              by a crash, and it and everything after it are ignored.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+
+// Appended to the disk image's path name to get the journal's path name.
+#define FAT12_JOURNAL_SUFFIX ".journal"
+
+// The maximum number of distinct sectors that can be waiting in the journal
+// to be checkpointed. A command that would go over this checkpoints first.
+#define FAT12_JOURNAL_MAX_SECTORS 512
+
+// Magic numbers marking the start and end of a transaction record.
+#define FAT12_JOURNAL_HEADER_MAGIC 0x4E524A46 // "FJRN"
+#define FAT12_JOURNAL_FOOTER_MAGIC 0x4D434A46 // "FJCM"
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * JournalRecordHeader - the start of a transaction record in the journal.
+ *****************************************************************************/
+typedef struct
+{
+  unsigned int magic;
+  unsigned int sequence;
+  unsigned int numSectors;
+  unsigned int checksum; // of the sector numbers and data
+} JournalRecordHeader;
+
+/******************************************************************************
+ * JournalRecordFooter - the end of a transaction record in the journal. A
+ *                       record is only committed once its footer is written.
+ *****************************************************************************/
+typedef struct
+{
+  unsigned int magic;
+  unsigned int sequence;
+} JournalRecordFooter;
+
+/******************************************************************************
+ * JournalIndexEntry - where the latest journaled copy of a sector is.
+ *****************************************************************************/
+typedef struct
+{
+  unsigned int sector;
+  long long    offset; // offset of the sector's data in the journal file
+} JournalIndexEntry;
+
+/******************************************************************************
+ * JournalState - the journal's state, shared by all processes of a session.
+ *****************************************************************************/
+typedef struct
+{
+  int               isEnabled;
+  int               isGroupCommit; // if set, commits don't fsync the journal
+  unsigned int      sequence; // of the last committed transaction
+  long long         size; // number of bytes of committed transactions
+  unsigned int      numTransactions; // committed but not checkpointed
+  unsigned int      numIndexEntries;
+  JournalIndexEntry index[FAT12_JOURNAL_MAX_SECTORS];
+} JournalState;
+
+
+//-----------------------------------------------------------------------------
+// Journal interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * enableFatJournal - Turn on journaling for the session. This is done by the
+ *                    shell, after creating the session.
+ *
+ * isGroupCommit - 1 if commands shouldn't fsync the journal themselves (the
+ *                 journal is then made durable when the shell syncs), or 0
+ *                 to fsync it after every command
+ *
+ * Return - none
+ *****************************************************************************/
+void enableFatJournal(int isGroupCommit);
+
+/******************************************************************************
+ * replayFatJournal - Apply every committed transaction in the disk image's
+ *                    journal to the image, then empty the journal. This must
+ *                    be done when mounting, with the image open for writing
+ *                    and locked exclusively.
+ *
+ * Return - the number of transactions replayed, or -1 on failure
+ *****************************************************************************/
+int replayFatJournal();
+
+/******************************************************************************
+ * isFatJournalPending - Check if a disk image has transactions in its
+ *                       journal that haven't been checkpointed, such as
+ *                       before changing the image from outside of a session.
+ *                       The image needn't be mounted.
+ *
+ * diskImageFileName - the image's host path name
+ *
+ * Return - 1 if it has, 0 if not
+ *****************************************************************************/
+int isFatJournalPending(const char* diskImageFileName);
+
+/******************************************************************************
+ * openFatJournal - Open the session's journal file, if journaling is enabled.
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+int openFatJournal();
+
+/******************************************************************************
+ * closeFatJournal - Close the journal file, discarding any transaction that
+ *                   was not committed.
+ *
+ * Return - none
+ *****************************************************************************/
+void closeFatJournal();
+
+/******************************************************************************
+ * beginFatTransaction - Start collecting sector writes into a transaction.
+ *                       Does nothing if journaling is disabled.
+ *
+ * Return - none
+ *****************************************************************************/
+void beginFatTransaction();
+
+/******************************************************************************
+ * commitFatTransaction - Append the current transaction, along with any FAT
+ *                        sectors that have changed, to the journal. The
+ *                        journal is only fsync'ed if the session isn't group
+ *                        committing.
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+int commitFatTransaction();
+
+/******************************************************************************
+ * isFatTransactionActive - Check if sector writes are currently being
+ *                          collected into a transaction.
+ *
+ * Return - 1 if they are, 0 if they go straight to the disk image
+ *****************************************************************************/
+int isFatTransactionActive();
+
+/******************************************************************************
+ * checkpointFatJournal - Make the journal durable with one fsync, write every
+ *                        journaled sector in place in the disk image, then
+ *                        empty the journal. The image must be open for
+ *                        writing and locked exclusively.
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+int checkpointFatJournal();
+
+/******************************************************************************
+ * journalReadSector - Read a sector from the current transaction or from the
+ *                     journal, if it has been journaled.
+ *
+ * sector - the number of the sector to read
+ * buffer - the buffer to read the sector into
+ *
+ * Return - 1 if the sector was read from the journal, 0 if it must be read
+ *          from the disk image
+ *****************************************************************************/
+int journalReadSector(unsigned int sector, unsigned char* buffer);
+
+/******************************************************************************
+ * journalWriteSector - Add a sector write to the current transaction.
+ *
+ * sector - the number of the sector to write
+ * buffer - the data to write
+ * bufferSize - the number of bytes to write (the rest of the sector keeps
+ *              its current contents)
+ *
+ * Return - 1 if the write was added to the transaction, 0 if there is no
+ *          transaction and it must be written to the disk image
+ *****************************************************************************/
+int journalWriteSector(unsigned int sector, unsigned char* buffer,
+                       unsigned int bufferSize);
+
+/******************************************************************************
+ * journalReserveFatSectors - Make room in the current transaction for more
+ *                            changed sectors of the FAT table (one copy of
+ *                            each per FAT), committing what it holds so far
+ *                            and starting a new one if it is full. Called
+ *                            just before FAT sectors are first changed.
+ *
+ * numSectors - the number of FAT sectors about to be changed
+ *
+ * Return - none
+ *****************************************************************************/
+void journalReserveFatSectors(unsigned int numSectors);
+
+
+#endif //_JOURNAL_H_
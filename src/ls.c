@@ -27,7 +27,7 @@ void printEntryInfo(DirectoryEntry* entry);
 
 int main(int argc, char* argv[])
 {
-  if (initializeFatFileSystem() != 0)
+  if (initializeFatFileSystem(FAT_LOCK_SHARED) != 0)
     return -1;
   
   // Validate the number of arguments.
@@ -72,7 +72,7 @@ int main(int argc, char* argv[])
 void listFileInfo(FilePath* filePath)
 {
   // Open the parent directory.
-  unsigned short flcOfParent = filePath->dirLevels[
+  unsigned int flcOfParent = filePath->dirLevels[
     filePath->depthLevel - 2].firstLogicalCluster;
   DirectoryEntry* parentDir = openDirectory(flcOfParent);
 
@@ -97,7 +97,7 @@ void listDirectoryContents(FilePath* filePath)
   int index = 0;
     
   // Open the directory's data.
-  unsigned short flc = filePath->dirLevels[
+  unsigned int flc = filePath->dirLevels[
     filePath->depthLevel - 1].firstLogicalCluster;
   DirectoryEntry* directory = openDirectory(flc);
   if (directory == NULL)
@@ -133,6 +133,6 @@ void printEntryInfo(DirectoryEntry* entry)
   else
     type = "File";
 
-  printf("%-14s%4s%14d%13d\n", name, type, entry->fileSize,
-         entry->firstLogicalCluster);  
+  printf("%-14s%4s%14u%13u\n", name, type, entry->fileSize,
+         getEntryCluster(entry));  
 }
@@ -26,7 +26,7 @@ int main(int argc, char* argv[])
     return -1;
   }
   
-  if (initializeFatFileSystem() != 0)
+  if (initializeFatFileSystem(FAT_LOCK_EXCLUSIVE) != 0)
     return -1;
   
   int rc =  mkdirCommand(argv[1]);
@@ -71,7 +71,7 @@ int mkdirCommand(char* pathName)
   }
     
   // Open the parent directory.
-  unsigned short flcOfParentDir = filePath.dirLevels[filePath.depthLevel - 1]
+  unsigned int flcOfParentDir = filePath.dirLevels[filePath.depthLevel - 1]
     .firstLogicalCluster;
   DirectoryEntry* parentDir = openDirectory(flcOfParentDir); 
   
@@ -98,14 +98,20 @@ int mkdirCommand(char* pathName)
   dirEntry->fileSize = 0;
   
   // Open the new subdirectory
-  DirectoryEntry* directory = openDirectory(dirEntry->firstLogicalCluster);
+  DirectoryEntry* directory = openDirectory(getEntryCluster(dirEntry));
+  if (directory == NULL)
+  {
+    closeDirectory(parentDir);
+    free(directoryName);
+    return -1;
+  }
   
   // Create the '.' entry.
   memset(directory[0].name, ' ', sizeof(directory[0].name));
   memset(directory[0].extension, ' ', sizeof(directory[0].extension));
   directory[0].name[0] = '.';
   directory[0].attributes = DIR_ENTRY_ATTRIB_SUBDIRECTORY;
-  directory[0].firstLogicalCluster = dirEntry->firstLogicalCluster;
+  setEntryCluster(&directory[0], getEntryCluster(dirEntry));
   directory[0].fileSize = 0;
   
   // Create the '..' entry.
@@ -114,14 +120,14 @@ int mkdirCommand(char* pathName)
   directory[1].name[0] = '.';
   directory[1].name[1] = '.';
   directory[1].attributes = DIR_ENTRY_ATTRIB_SUBDIRECTORY;
-  directory[1].firstLogicalCluster = flcOfParentDir;
+  setEntryCluster(&directory[1], flcOfParentDir);
   directory[1].fileSize = 0;
   
   // Terminate the subdirectory.
   directory[2].name[0] = DIR_ENTRY_END_OF_ENTRIES;
   
   // Close the subdirectory.
-  saveDirectory(dirEntry->firstLogicalCluster, directory);
+  saveDirectory(getEntryCluster(dirEntry), directory);
   closeDirectory(directory);
   
   // Close the parent directory.
@@ -0,0 +1,793 @@
+/******************************************************************************
+ * mkfs.c: Make file system
+ *
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Writes a new FAT12, FAT16 or FAT32 disk image, optionally
+ *              filled with a generated tree of directories and files for
+ *              benchmarking. Only the sectors that hold something are
+ *              written, so the rest of a large image is left as a hole in
+ *              the file. This runs on its own, outside of the shell:
+ *
+ *              Usage: mkfs [OPTIONS] IMAGE
+ *
+ *              Geometry:
+ *                -b BYTES    bytes per sector (default 512)
+ *                -c SECTORS  sectors per cluster, a power of 2 up to 128
+ *                            (default 1)
+ *                -t SECTORS  total number of sectors (default 2880)
+ *                -T TYPE     type of FAT: 12, 16 or 32 (default: the
+ *                            smallest that can hold every cluster)
+ *                -e ENTRIES  maximum number of root directory entries
+ *                            (default 224; FAT32 has no limit)
+ *                -f FATS     number of FAT table copies (default 2)
+ *                -L LABEL    volume label (default "NO NAME")
+ *
+ *              Contents:
+ *                -s SEED     seed for the generator (default 1)
+ *                -d DIRS     number of directories to create (default 0)
+ *                -n FILES    number of files to create (default 0)
+ *                -D DEPTH    depth the directory tree reaches (default 4)
+ *                -z MIN:MAX  range of file sizes in bytes, drawn so that
+ *                            each power of 2 is equally likely (default
+ *                            0:16384)
+ *                -F PERCENT  chance that each cluster after a file's first
+ *                            is placed somewhere else on the disk instead of
+ *                            right after the one before (default 0)
+ *
+ *              The same options and seed always produce the same image.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ *****************************************************************************/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fat.h"
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+
+// The most clusters a FAT32 file system can have.
+#define FAT32_MAX_DATA_CLUSTERS 0x0FFFFFF5
+
+// Where FAT32 keeps its FSInfo sector and its backup boot sectors.
+#define FAT32_RESERVED_SECTORS 32
+#define FAT32_FSINFO_SECTOR 1
+#define FAT32_BACKUP_BOOT_SECTOR 6
+
+// The media descriptor byte (0xF0 for removable media).
+#define MEDIA_DESCRIPTOR 0xF0
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * Geometry - the layout of the image to write.
+ *****************************************************************************/
+typedef struct
+{
+  int          fatType; // FAT_TYPE_12, FAT_TYPE_16 or FAT_TYPE_32
+  unsigned int bytesPerSector;
+  unsigned int sectorsPerCluster;
+  unsigned int bytesPerCluster;
+  unsigned int totalSectors;
+  unsigned int numReservedSectors;
+  unsigned int numRootEntries; // 0 for FAT32
+  unsigned int numFATs;
+  unsigned int sectorsPerFAT;
+  unsigned int numRootSectors;
+  unsigned int dataRegion; // first sector of the data region
+  unsigned int numClusters; // number of FAT entries, including 0 and 1
+  unsigned int rootCluster; // FAT32 only
+  const char*  label;
+} Geometry;
+
+/******************************************************************************
+ * Directory - a directory being generated.
+ *****************************************************************************/
+typedef struct
+{
+  int             parent; // index of the parent directory (-1 for root)
+  unsigned int    depth; // 0 for the root directory
+  unsigned int    numEntries; // including '.' and '..'
+  unsigned int    numClusters;
+  unsigned int*   clusters; // the directory's chain (none for a fixed root)
+  unsigned char*  data; // the contents of its clusters
+  unsigned int    nextEntry; // the next entry to fill in
+} Directory;
+
+
+//-----------------------------------------------------------------------------
+// Variables
+//-----------------------------------------------------------------------------
+
+static Geometry       geometry;
+static const FatEntryCodec* codec;
+static int            imageFd;
+static unsigned char* systemArea; // every sector before the data region
+static unsigned char* fatTable;
+static unsigned char* isClusterUsed;
+static unsigned int   nextFreeCluster = 2;
+static unsigned int   numUsedClusters = 0;
+static unsigned int   numFragmentedFiles = 0;
+static unsigned long long randomState;
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+static void usage();
+static int computeGeometry();
+static unsigned int layOutRegions();
+static void writeBootSector(unsigned int seed);
+static unsigned long long nextRandom();
+static unsigned int randomBelow(unsigned int limit);
+static unsigned int randomFileSize(unsigned int minSize, unsigned int maxSize);
+static int allocateChain(unsigned int numClusters, unsigned int percent,
+                         unsigned int* clusters);
+static int writeCluster(unsigned int cluster, unsigned char* data);
+static DirectoryEntry* addEntry(Directory* directories, int index);
+
+
+/******************************************************************************
+ * main - runs the mkfs program.
+ *****************************************************************************/
+int main(int argc, char* argv[])
+{
+  unsigned int seed = 1;
+  unsigned int numDirectories = 0;
+  unsigned int numFiles = 0;
+  unsigned int depth = 4;
+  unsigned int minFileSize = 0;
+  unsigned int maxFileSize = 16384;
+  unsigned int fragmentation = 0;
+  const char* imageFileName = NULL;
+  Directory* directories;
+  unsigned int* fileParents;
+  unsigned int i;
+  int opt;
+
+  geometry.fatType = 0;
+  geometry.bytesPerSector = 512;
+  geometry.sectorsPerCluster = 1;
+  geometry.totalSectors = 2880;
+  geometry.numRootEntries = 224;
+  geometry.numFATs = 2;
+  geometry.label = "NO NAME";
+
+  while ((opt = getopt(argc, argv, "b:c:t:T:e:f:L:s:d:n:D:z:F:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'b': geometry.bytesPerSector = strtoul(optarg, NULL, 10); break;
+      case 'c': geometry.sectorsPerCluster = strtoul(optarg, NULL, 10); break;
+      case 't': geometry.totalSectors = strtoul(optarg, NULL, 10); break;
+      case 'T': geometry.fatType = strtoul(optarg, NULL, 10); break;
+      case 'e': geometry.numRootEntries = strtoul(optarg, NULL, 10); break;
+      case 'f': geometry.numFATs = strtoul(optarg, NULL, 10); break;
+      case 'L': geometry.label = optarg; break;
+      case 's': seed = strtoul(optarg, NULL, 10); break;
+      case 'd': numDirectories = strtoul(optarg, NULL, 10); break;
+      case 'n': numFiles = strtoul(optarg, NULL, 10); break;
+      case 'D': depth = strtoul(optarg, NULL, 10); break;
+      case 'F': fragmentation = strtoul(optarg, NULL, 10); break;
+      case 'z':
+        if (sscanf(optarg, "%u:%u", &minFileSize, &maxFileSize) != 2 ||
+            minFileSize > maxFileSize)
+        {
+          usage();
+          return -1;
+        }
+        break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+  if (optind != argc - 1)
+  {
+    usage();
+    return -1;
+  }
+  imageFileName = argv[optind];
+
+  if (depth < 1)
+    depth = 1;
+  if (depth >= FAT12_MAX_DIRECTORY_DEPTH)
+    depth = FAT12_MAX_DIRECTORY_DEPTH - 1;
+  if (fragmentation > 100)
+    fragmentation = 100;
+  if (computeGeometry() != 0)
+    return -1;
+  codec = (geometry.fatType == FAT_TYPE_12 ? &fat12EntryCodec :
+           geometry.fatType == FAT_TYPE_16 ? &fat16EntryCodec :
+           &fat32EntryCodec);
+  fatFileSystem.geometry.fatType = geometry.fatType; // for setEntryCluster()
+
+  // Size the image up front, leaving it all as a hole to fill in.
+  imageFd = open(imageFileName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (imageFd == -1 || ftruncate(imageFd, (off_t) geometry.totalSectors *
+                                 geometry.bytesPerSector) != 0)
+  {
+    perror(imageFileName);
+    return -1;
+  }
+
+  systemArea = (unsigned char*) calloc(geometry.dataRegion,
+                                       geometry.bytesPerSector);
+  isClusterUsed = (unsigned char*) calloc(geometry.numClusters, 1);
+  fatTable = systemArea + (geometry.numReservedSectors *
+                           geometry.bytesPerSector);
+  codec->setEntry(0, 0x0FFFFF00 | MEDIA_DESCRIPTOR, fatTable);
+  codec->setEntry(1, FAT_END_OF_CHAIN, fatTable);
+  randomState = seed * 0x9E3779B97F4A7C15ULL + 1;
+
+  // Plan the tree. The first directories form a path down to the target
+  // depth, and the rest hang off random directories above it. Files go in
+  // random directories. The FAT12 and FAT16 root directory can't grow, so
+  // once it is full, everything goes elsewhere.
+  unsigned int maxRootEntries = (geometry.fatType == FAT_TYPE_32 ? (unsigned
+    int) -1 : geometry.numRootEntries);
+  directories = (Directory*) calloc(numDirectories + 1, sizeof(Directory));
+  directories[0].parent = -1;
+  for (i = 1; i <= numDirectories; i++)
+  {
+    int parent = (i <= depth ? i - 1 : randomBelow(i));
+    while (directories[parent].depth >= depth ||
+           (parent == 0 && directories[0].numEntries >= maxRootEntries))
+    {
+      parent = randomBelow(i);
+    }
+    directories[i].parent = parent;
+    directories[i].depth = directories[parent].depth + 1;
+    directories[i].numEntries = 2;
+    directories[parent].numEntries++;
+  }
+  fileParents = (unsigned int*) malloc((numFiles + 1) * sizeof(unsigned int));
+  for (i = 0; i < numFiles; i++)
+  {
+    unsigned int parent = randomBelow(numDirectories + 1);
+    if (parent == 0 && directories[0].numEntries >= maxRootEntries)
+    {
+      if (numDirectories == 0)
+      {
+        printf("Error: the root directory can only hold %u entries\n",
+               geometry.numRootEntries);
+        return -1;
+      }
+      parent = 1 + randomBelow(numDirectories);
+    }
+    fileParents[i] = parent;
+    directories[parent].numEntries++;
+  }
+
+  // Allocate each directory's clusters (with room for an end-of-entries
+  // marker), then fill in their entries. The FAT32 root directory comes
+  // first, so it starts at the first cluster.
+  unsigned int entriesPerCluster = geometry.bytesPerCluster /
+                                   sizeof(DirectoryEntry);
+  for (i = (geometry.fatType == FAT_TYPE_32 ? 0 : 1); i <= numDirectories; i++)
+  {
+    Directory* directory = &directories[i];
+    directory->numClusters = directory->numEntries / entriesPerCluster + 1;
+    directory->clusters = (unsigned int*) malloc(directory->numClusters *
+                                                 sizeof(unsigned int));
+    directory->data = (unsigned char*) calloc(directory->numClusters,
+                                              geometry.bytesPerCluster);
+    if (allocateChain(directory->numClusters, fragmentation,
+                      directory->clusters) != 0)
+      return -1;
+  }
+  geometry.rootCluster = (geometry.fatType == FAT_TYPE_32 ?
+                          directories[0].clusters[0] : 0);
+  for (i = 1; i <= numDirectories; i++)
+  {
+    Directory* directory = &directories[i];
+    DirectoryEntry* entry;
+    char name[FAT12_MAX_FILE_NAME_LENGTH];
+    unsigned int parentFlc = (directory->parent == 0 ? 0 :
+      directories[directory->parent].clusters[0]);
+
+    entry = addEntry(directories, i);
+    memset(entry->name, ' ', sizeof(entry->name) + sizeof(entry->extension));
+    entry->name[0] = '.';
+    entry->attributes = DIR_ENTRY_ATTRIB_SUBDIRECTORY;
+    setEntryCluster(entry, directory->clusters[0]);
+    entry = addEntry(directories, i);
+    memset(entry->name, ' ', sizeof(entry->name) + sizeof(entry->extension));
+    entry->name[0] = '.';
+    entry->name[1] = '.';
+    entry->attributes = DIR_ENTRY_ATTRIB_SUBDIRECTORY;
+    setEntryCluster(entry, parentFlc);
+
+    snprintf(name, sizeof(name), "D%07u", i);
+    entry = addEntry(directories, directory->parent);
+    setEntryName(entry, name);
+    entry->attributes = DIR_ENTRY_ATTRIB_SUBDIRECTORY;
+    setEntryCluster(entry, directory->clusters[0]);
+  }
+
+  // Then create the files, filling each one with its own name.
+  unsigned long long numFileBytes = 0;
+  unsigned int* clusters = (unsigned int*) malloc(
+    geometry.numClusters * sizeof(unsigned int));
+  unsigned char* data = (unsigned char*) malloc(geometry.bytesPerCluster);
+  for (i = 0; i < numFiles; i++)
+  {
+    char name[FAT12_MAX_FILE_NAME_LENGTH];
+    unsigned int size = randomFileSize(minFileSize, maxFileSize);
+    unsigned int numClusters = (size + geometry.bytesPerCluster - 1) /
+                               geometry.bytesPerCluster;
+    unsigned int j;
+    unsigned int k;
+
+    snprintf(name, sizeof(name), "F%07u.DAT", i);
+    DirectoryEntry* entry = addEntry(directories, fileParents[i]);
+    setEntryName(entry, name);
+    entry->attributes = DIR_ENTRY_ATTRIB_ARCHIVE;
+    entry->fileSize = size;
+    if (numClusters == 0)
+      continue;
+
+    if (allocateChain(numClusters, fragmentation, clusters) != 0)
+      return -1;
+    setEntryCluster(entry, clusters[0]);
+    for (j = 0; j < numClusters; j++)
+    {
+      memset(data, 0, geometry.bytesPerCluster);
+      for (k = 0; k < geometry.bytesPerCluster &&
+           j * geometry.bytesPerCluster + k < size; k++)
+      {
+        data[k] = (k % 16 == 15 ? '\n' : name[k % 16 % 12]);
+      }
+      if (writeCluster(clusters[j], data) != 0)
+      {
+        perror(imageFileName);
+        return -1;
+      }
+    }
+    numFileBytes += size;
+  }
+
+  // Write out the directories, now that all of their entries are filled in.
+  for (i = 0; i <= numDirectories; i++)
+  {
+    unsigned int j;
+    for (j = 0; j < directories[i].numClusters; j++)
+    {
+      if (writeCluster(directories[i].clusters[j], directories[i].data +
+                       (j * geometry.bytesPerCluster)) != 0)
+      {
+        perror(imageFileName);
+        return -1;
+      }
+    }
+  }
+
+  // Every copy of the FAT table is the same.
+  for (i = 1; i < geometry.numFATs; i++)
+  {
+    memcpy(fatTable + (i * geometry.sectorsPerFAT * geometry.bytesPerSector),
+           fatTable, geometry.sectorsPerFAT * geometry.bytesPerSector);
+  }
+
+  // Then write everything before the data region.
+  size_t systemAreaSize = (size_t) geometry.dataRegion *
+                          geometry.bytesPerSector;
+  writeBootSector(seed);
+  if (pwrite(imageFd, systemArea, systemAreaSize, 0) != systemAreaSize ||
+      close(imageFd) != 0)
+  {
+    perror(imageFileName);
+    return -1;
+  }
+
+  printf("%s: FAT%d, %u sectors of %u bytes, %u clusters (%u used)\n",
+         imageFileName, geometry.fatType, geometry.totalSectors,
+         geometry.bytesPerSector, geometry.numClusters - 2, numUsedClusters);
+  printf("%u directories (depth %u), %u files (%llu bytes, %u fragmented)\n",
+         numDirectories, (numDirectories < depth ? numDirectories : depth),
+         numFiles, numFileBytes, numFragmentedFiles);
+
+  for (i = 0; i <= numDirectories; i++)
+  {
+    free(directories[i].clusters);
+    free(directories[i].data);
+  }
+  free(directories);
+  free(fileParents);
+  free(clusters);
+  free(data);
+  free(isClusterUsed);
+  free(systemArea);
+  return 0;
+}
+
+/******************************************************************************
+ * usage - prints the usage statement.
+ *****************************************************************************/
+static void usage()
+{
+  printf("Usage: mkfs [-b BYTES] [-c SECTORS] [-t SECTORS] [-T 12|16|32] "
+         "[-e ENTRIES]\n");
+  printf("            [-f FATS] [-L LABEL]\n");
+  printf("            [-s SEED] [-d DIRS] [-n FILES] [-D DEPTH] "
+         "[-z MIN:MAX] [-F PERCENT]\n");
+  printf("            IMAGE\n");
+}
+
+/******************************************************************************
+ * computeGeometry - work out the type of FAT and where each region of the
+ *                   image goes.
+ *
+ * Return - 0 on success, -1 if the geometry isn't valid
+ *****************************************************************************/
+static int computeGeometry()
+{
+  unsigned int bytesPerSector = geometry.bytesPerSector;
+  unsigned int numDataClusters;
+
+  if (bytesPerSector < 512 || bytesPerSector > 4096 ||
+      (bytesPerSector & (bytesPerSector - 1)) != 0)
+  {
+    printf("Error: bytes per sector must be a power of 2 from 512 to "
+           "4096\n");
+    return -1;
+  }
+  if (geometry.sectorsPerCluster < 1 || geometry.sectorsPerCluster > 128 ||
+      (geometry.sectorsPerCluster & (geometry.sectorsPerCluster - 1)) != 0)
+  {
+    printf("Error: sectors per cluster must be a power of 2 from 1 to "
+           "128\n");
+    return -1;
+  }
+  geometry.bytesPerCluster = geometry.sectorsPerCluster * bytesPerSector;
+  if (geometry.numFATs < 1 || geometry.numFATs > 4)
+  {
+    printf("Error: there must be 1 to 4 FAT tables\n");
+    return -1;
+  }
+  if (geometry.fatType != 0 && geometry.fatType != FAT_TYPE_12 &&
+      geometry.fatType != FAT_TYPE_16 && geometry.fatType != FAT_TYPE_32)
+  {
+    printf("Error: the type of FAT must be 12, 16 or 32\n");
+    return -1;
+  }
+
+  // Unless asked for a type, use the smallest that can hold every cluster
+  // (the FAT table, and so the number of clusters left, changes with it).
+  if (geometry.fatType != 0)
+  {
+    numDataClusters = layOutRegions();
+  }
+  else
+  {
+    geometry.fatType = FAT_TYPE_12;
+    numDataClusters = layOutRegions();
+    if (numDataClusters > FAT12_MAX_DATA_CLUSTERS)
+    {
+      geometry.fatType = FAT_TYPE_16;
+      numDataClusters = layOutRegions();
+    }
+    if (numDataClusters > FAT16_MAX_DATA_CLUSTERS)
+    {
+      geometry.fatType = FAT_TYPE_32;
+      numDataClusters = layOutRegions();
+    }
+  }
+  if (numDataClusters == 0)
+  {
+    printf("Error: %u sectors is too small\n", geometry.totalSectors);
+    return -1;
+  }
+
+  // The type is worked out from the number of clusters when the image is
+  // mounted, so it has to be in the type's range.
+  if (geometry.fatType == FAT_TYPE_12 &&
+      numDataClusters > FAT12_MAX_DATA_CLUSTERS)
+  {
+    printf("Error: %u clusters is too many for FAT12 (the most is %u)\n",
+           numDataClusters, FAT12_MAX_DATA_CLUSTERS);
+    return -1;
+  }
+  if (geometry.fatType == FAT_TYPE_16 &&
+      (numDataClusters <= FAT12_MAX_DATA_CLUSTERS ||
+       numDataClusters > FAT16_MAX_DATA_CLUSTERS))
+  {
+    printf("Error: FAT16 needs %u to %u clusters, not %u\n",
+           FAT12_MAX_DATA_CLUSTERS + 1, FAT16_MAX_DATA_CLUSTERS,
+           numDataClusters);
+    return -1;
+  }
+  if (geometry.fatType == FAT_TYPE_32 &&
+      (numDataClusters <= FAT16_MAX_DATA_CLUSTERS ||
+       numDataClusters > FAT32_MAX_DATA_CLUSTERS))
+  {
+    printf("Error: FAT32 needs %u to %u clusters, not %u\n",
+           FAT16_MAX_DATA_CLUSTERS + 1, FAT32_MAX_DATA_CLUSTERS,
+           numDataClusters);
+    return -1;
+  }
+
+  return 0;
+}
+
+/******************************************************************************
+ * layOutRegions - place the reserved sectors, FAT tables and root directory
+ *                 for the geometry's type of FAT, making the FAT tables just
+ *                 big enough for the clusters left over after them.
+ *
+ * Return - the number of data clusters, or 0 if the image is too small
+ *****************************************************************************/
+static unsigned int layOutRegions()
+{
+  unsigned int bytesPerSector = geometry.bytesPerSector;
+  unsigned int bitsPerEntry = geometry.fatType;
+  unsigned int sectorsPerFAT = 1;
+  unsigned long long numClusters;
+
+  // FAT32 keeps its root directory in the data region, and has room for
+  // an FSInfo sector and a backup boot sector before the FAT tables.
+  unsigned int entriesPerSector = bytesPerSector / sizeof(DirectoryEntry);
+  if (geometry.fatType == FAT_TYPE_32)
+  {
+    geometry.numReservedSectors = FAT32_RESERVED_SECTORS;
+    geometry.numRootEntries = 0;
+  }
+  else
+  {
+    geometry.numReservedSectors = 1;
+    if (geometry.numRootEntries == 0)
+      geometry.numRootEntries = 224;
+  }
+
+  // The root directory fills whole sectors.
+  geometry.numRootEntries = (geometry.numRootEntries + entriesPerSector - 1) /
+                            entriesPerSector * entriesPerSector;
+  geometry.numRootSectors = geometry.numRootEntries / entriesPerSector;
+
+  // The FAT table has to be big enough for the clusters left over after it.
+  while (1)
+  {
+    unsigned long long dataRegion = geometry.numReservedSectors +
+      ((unsigned long long) geometry.numFATs * sectorsPerFAT) +
+      geometry.numRootSectors;
+    if (dataRegion >= geometry.totalSectors)
+      return 0;
+    geometry.dataRegion = dataRegion;
+    numClusters = (geometry.totalSectors - geometry.dataRegion) /
+                  geometry.sectorsPerCluster + 2;
+    if ((numClusters * bitsPerEntry + 7) / 8 <=
+        (unsigned long long) sectorsPerFAT * bytesPerSector)
+      break;
+    sectorsPerFAT++;
+  }
+
+  geometry.sectorsPerFAT = sectorsPerFAT;
+  geometry.numClusters = numClusters;
+  return numClusters - 2;
+}
+
+/******************************************************************************
+ * writeBootSector - fill in the boot sector (and for FAT32, the FSInfo
+ *                   sector and the backup copies of both).
+ *****************************************************************************/
+static void writeBootSector(unsigned int seed)
+{
+  FatBootSector* bootSector = (FatBootSector*) systemArea;
+  unsigned int bytesPerSector = geometry.bytesPerSector;
+  char label[12];
+
+  snprintf(label, sizeof(label), "%-11s", geometry.label);
+  memcpy(bootSector->ignore1, (geometry.fatType == FAT_TYPE_32 ?
+         "\xEB\x58\x90" "MSDOS5.0" : "\xEB\x3C\x90" "MSDOS5.0"), 11);
+  bootSector->bytesPerSector = bytesPerSector;
+  bootSector->sectorsPerCluster = geometry.sectorsPerCluster;
+  bootSector->numReservedSectors = geometry.numReservedSectors;
+  bootSector->numFATs = geometry.numFATs;
+  bootSector->maxNumRootDirEntries = geometry.numRootEntries;
+  bootSector->ignore2[0] = MEDIA_DESCRIPTOR;
+  bootSector->sectorsPerTrack = 18;
+  bootSector->numHeads = 2;
+
+  // The 16-bit counts are left as 0 when the values don't fit.
+  if (geometry.totalSectors <= 0xFFFF)
+    bootSector->totalSectorCount = geometry.totalSectors;
+  else
+    bootSector->totalSectorCountForFAT32 = geometry.totalSectors;
+
+  if (geometry.fatType != FAT_TYPE_32)
+  {
+    bootSector->sectorsPerFAT = geometry.sectorsPerFAT;
+    bootSector->bootSignature = 0x29;
+    bootSector->volumeID = (unsigned int) (seed * 2654435761u);
+    memcpy(bootSector->volumeLabel, label, 11);
+    memcpy(bootSector->fileSystemType, (geometry.fatType == FAT_TYPE_12 ?
+           "FAT12   " : "FAT16   "), 8);
+    systemArea[510] = 0x55;
+    systemArea[511] = 0xAA;
+    return;
+  }
+
+  bootSector->sectorsPerFAT32 = geometry.sectorsPerFAT;
+  bootSector->rootDirectoryCluster = geometry.rootCluster;
+  bootSector->fsInfoSector = FAT32_FSINFO_SECTOR;
+  bootSector->backupBootSector = FAT32_BACKUP_BOOT_SECTOR;
+  bootSector->bootSignature32 = 0x29;
+  bootSector->volumeID32 = (unsigned int) (seed * 2654435761u);
+  memcpy(bootSector->volumeLabel32, label, 11);
+  memcpy(bootSector->fileSystemType32, "FAT32   ", 8);
+  systemArea[510] = 0x55;
+  systemArea[511] = 0xAA;
+
+  // The FSInfo sector holds hints about the free clusters.
+  FatFsInfo* fsInfo = (FatFsInfo*) (systemArea + (FAT32_FSINFO_SECTOR *
+                                                  bytesPerSector));
+  fsInfo->leadSignature = FAT_FSINFO_LEAD_SIGNATURE;
+  fsInfo->structSignature = FAT_FSINFO_STRUCT_SIGNATURE;
+  fsInfo->numFreeClusters = geometry.numClusters - 2 - numUsedClusters;
+  fsInfo->nextFreeCluster = nextFreeCluster;
+  fsInfo->trailSignature = FAT_FSINFO_TRAIL_SIGNATURE;
+
+  // Keep a backup of both.
+  memcpy(systemArea + (FAT32_BACKUP_BOOT_SECTOR * bytesPerSector),
+         systemArea, 2 * bytesPerSector);
+}
+
+/******************************************************************************
+ * nextRandom - get the next number from the seeded generator (xorshift64*),
+ *              which gives the same sequence on every platform.
+ *****************************************************************************/
+static unsigned long long nextRandom()
+{
+  randomState ^= randomState >> 12;
+  randomState ^= randomState << 25;
+  randomState ^= randomState >> 27;
+  return randomState * 0x2545F4914F6CDD1DULL;
+}
+
+/******************************************************************************
+ * randomBelow - get a random number from 0 to limit - 1.
+ *****************************************************************************/
+static unsigned int randomBelow(unsigned int limit)
+{
+  return (unsigned int) ((nextRandom() >> 32) % limit);
+}
+
+/******************************************************************************
+ * randomFileSize - get a random file size in a range, with each power of 2
+ *                  in the range equally likely, so there are as many small
+ *                  files as large ones.
+ *****************************************************************************/
+static unsigned int randomFileSize(unsigned int minSize, unsigned int maxSize)
+{
+  unsigned int minBits = 0;
+  unsigned int maxBits = 0;
+  unsigned int bits;
+  unsigned long long low;
+  unsigned long long high;
+
+  while ((1ULL << minBits) <= minSize)
+    minBits++;
+  while ((1ULL << maxBits) <= maxSize)
+    maxBits++;
+
+  // Pick a power of 2, then a size within it (and within the range).
+  bits = minBits + randomBelow(maxBits - minBits + 1);
+  low = (bits == 0 ? 0 : 1ULL << (bits - 1));
+  high = (1ULL << bits) - 1;
+  if (low < minSize)
+    low = minSize;
+  if (high > maxSize)
+    high = maxSize;
+  if (high < low)
+    return minSize;
+  return (unsigned int) (low + (nextRandom() >> 32) % (high - low + 1));
+}
+
+/******************************************************************************
+ * allocateChain - allocate a chain of clusters. Each cluster goes right after
+ *                 the one before it, except that with the given chance, it
+ *                 goes to a random free cluster instead.
+ *
+ * numClusters - the number of clusters in the chain
+ * percent - the chance of each cluster (after the first) being fragmented
+ * clusters - set to the clusters of the chain
+ *
+ * Return - 0 on success, -1 if the image is full
+ *****************************************************************************/
+static int allocateChain(unsigned int numClusters, unsigned int percent,
+                         unsigned int* clusters)
+{
+  unsigned int cluster = nextFreeCluster;
+  int isFragmented = 0;
+  unsigned int i;
+
+  if (numUsedClusters + numClusters > geometry.numClusters - 2)
+  {
+    printf("Error: the image is full (try more sectors or smaller files)\n");
+    return -1;
+  }
+
+  for (i = 0; i < numClusters; i++)
+  {
+    if (i > 0 && percent > 0 && randomBelow(100) < percent)
+    {
+      cluster = 2 + randomBelow(geometry.numClusters - 2);
+      isFragmented = 1;
+    }
+
+    // Take the first free cluster from there on, wrapping around.
+    while (isClusterUsed[cluster])
+    {
+      cluster++;
+      if (cluster >= geometry.numClusters)
+        cluster = 2;
+    }
+    isClusterUsed[cluster] = 1;
+    clusters[i] = cluster;
+    if (i > 0)
+      codec->setEntry(clusters[i - 1], cluster, fatTable);
+  }
+  codec->setEntry(clusters[numClusters - 1], FAT_END_OF_CHAIN, fatTable);
+
+  // Unfragmented allocation carries on from the end of the last chain.
+  while (nextFreeCluster < geometry.numClusters &&
+         isClusterUsed[nextFreeCluster])
+    nextFreeCluster++;
+  if (nextFreeCluster >= geometry.numClusters)
+    nextFreeCluster = 2;
+
+  numUsedClusters += numClusters;
+  numFragmentedFiles += isFragmented;
+  return 0;
+}
+
+/******************************************************************************
+ * writeCluster - write a cluster's data into its place in the image.
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int writeCluster(unsigned int cluster, unsigned char* data)
+{
+  off_t offset = ((off_t) geometry.dataRegion + ((off_t) (cluster - 2) *
+                 geometry.sectorsPerCluster)) * geometry.bytesPerSector;
+
+  if (pwrite(imageFd, data, geometry.bytesPerCluster, offset) !=
+      geometry.bytesPerCluster)
+    return -1;
+  return 0;
+}
+
+/******************************************************************************
+ * addEntry - get the next unused entry of a directory.
+ *****************************************************************************/
+static DirectoryEntry* addEntry(Directory* directories, int index)
+{
+  Directory* directory = &directories[index];
+  unsigned int entryIndex = directory->nextEntry++;
+  DirectoryEntry* entry;
+
+  if (directory->data == NULL)
+  {
+    // The fixed root directory region of FAT12 and FAT16.
+    entry = (DirectoryEntry*) (systemArea + ((geometry.numReservedSectors +
+      geometry.numFATs * geometry.sectorsPerFAT) * geometry.bytesPerSector)) +
+      entryIndex;
+  }
+  else
+  {
+    entry = (DirectoryEntry*) directory->data + entryIndex;
+  }
+
+  return entry;
+}
@@ -0,0 +1,616 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function definitions for copy-on-write overlays.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "overlay.h"
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+
+// The most bytes copied at once when committing.
+#define OVERLAY_COPY_SIZE (1024 * 1024)
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * Overlay - an open delta.
+ *****************************************************************************/
+struct Overlay
+{
+  int            deltaFd;
+  int            imageFd; // not owned
+  OverlayHeader  header;
+  unsigned char* mapping; // the header and bitmap, shared with the delta
+  unsigned char* bitmap; // within mapping
+};
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * mapOverlay - Open a delta and map its header and bitmap.
+ *
+ * overlay - where to store the open delta
+ * imageFileName - the image's host path name
+ * isWritable - 1 to open it for writing too, 0 for reading only
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int mapOverlay(Overlay* overlay, const char* imageFileName,
+                      int isWritable);
+
+/******************************************************************************
+ * unmapOverlay - Unmap and close a delta opened by mapOverlay().
+ *
+ * overlay - the open delta
+ *
+ * Return - none
+ *****************************************************************************/
+static void unmapOverlay(Overlay* overlay);
+
+/******************************************************************************
+ * isSectorInOverlay - Check if a sector has been written to the delta.
+ *
+ * overlay - the open delta
+ * sector - the sector number in the image
+ *
+ * Return - 1 if it has, 0 if not
+ *****************************************************************************/
+static int isSectorInOverlay(Overlay* overlay, unsigned long long sector);
+
+/******************************************************************************
+ * getRunLength - Count the sectors from one that are all in the delta, or
+ *                all not.
+ *
+ * overlay - the open delta
+ * sector - the first sector number
+ * maxSectors - the most sectors to count
+ *
+ * Return - the number of sectors, at least 1
+ *****************************************************************************/
+static unsigned long long getRunLength(Overlay* overlay,
+                                       unsigned long long sector,
+                                       unsigned long long maxSectors);
+
+/******************************************************************************
+ * readFully - pread() until every byte asked for is read or the file ends.
+ *
+ * fd - the file
+ * buffer - where to store the bytes
+ * numBytes - the number of bytes to read
+ * offset - where in the file to start reading
+ *
+ * Return - the number of bytes read, or -1 on failure
+ *****************************************************************************/
+static long long readFully(int fd, unsigned char* buffer, size_t numBytes,
+                           long long offset);
+
+/******************************************************************************
+ * writeFully - pwrite() until every byte is written.
+ *
+ * fd - the file
+ * buffer - the bytes
+ * numBytes - the number of bytes to write
+ * offset - where in the file to start writing
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int writeFully(int fd, unsigned char* buffer, size_t numBytes,
+                      long long offset);
+
+/******************************************************************************
+ * writePartialSector - Write part of one sector into the delta, first
+ *                      copying the rest of it from the image if the sector
+ *                      isn't in the delta yet.
+ *
+ * overlay - the open delta
+ * offset - where in the image to start writing
+ * numBytes - the number of bytes to write, all within one sector
+ * buffer - the bytes
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int writePartialSector(Overlay* overlay, long long offset,
+                              unsigned int numBytes, unsigned char* buffer);
+
+
+//-----------------------------------------------------------------------------
+// Overlay interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * getOverlayFileName
+ *****************************************************************************/
+void getOverlayFileName(const char* imageFileName, char* deltaFileName)
+{
+  strcpy(deltaFileName, imageFileName);
+  strcat(deltaFileName, FAT12_OVERLAY_SUFFIX);
+}
+
+/******************************************************************************
+ * hasOverlay
+ *****************************************************************************/
+int hasOverlay(const char* imageFileName)
+{
+  char deltaFileName[strlen(imageFileName) + sizeof(FAT12_OVERLAY_SUFFIX)];
+
+  getOverlayFileName(imageFileName, deltaFileName);
+  return (access(deltaFileName, F_OK) == 0);
+}
+
+/******************************************************************************
+ * createOverlay
+ *****************************************************************************/
+int createOverlay(const char* imageFileName, int imageFd)
+{
+  char deltaFileName[strlen(imageFileName) + sizeof(FAT12_OVERLAY_SUFFIX)];
+  OverlayHeader header;
+  struct stat imageStat;
+  unsigned long long bitmapSize;
+  int fd;
+
+  if (fstat(imageFd, &imageStat) != 0)
+    return -1;
+
+  memset(&header, 0, sizeof(header));
+  header.magic = FAT12_OVERLAY_MAGIC;
+  header.version = FAT12_OVERLAY_VERSION;
+  header.imageSize = imageStat.st_size;
+  header.numSectors = (header.imageSize + OVERLAY_SECTOR_SIZE - 1) /
+                      OVERLAY_SECTOR_SIZE;
+  bitmapSize = (header.numSectors + 7) / 8;
+  header.bitmapOffset = OVERLAY_ALIGNMENT;
+  header.dataOffset = header.bitmapOffset +
+                      (bitmapSize + OVERLAY_ALIGNMENT - 1) /
+                      OVERLAY_ALIGNMENT * OVERLAY_ALIGNMENT;
+
+  // Setting the size leaves the bitmap and every sector a hole, so the delta
+  // starts out empty without anything but the header being written.
+  getOverlayFileName(imageFileName, deltaFileName);
+  fd = open(deltaFileName, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd == -1)
+    return -1;
+  if (writeFully(fd, (unsigned char*) &header, sizeof(header), 0) != 0 ||
+      ftruncate(fd, header.dataOffset +
+                    header.numSectors * OVERLAY_SECTOR_SIZE) != 0 ||
+      fsync(fd) != 0)
+  {
+    close(fd);
+    unlink(deltaFileName);
+    return -1;
+  }
+  close(fd);
+  return 0;
+}
+
+/******************************************************************************
+ * rollbackOverlay
+ *****************************************************************************/
+int rollbackOverlay(const char* imageFileName)
+{
+  char deltaFileName[strlen(imageFileName) + sizeof(FAT12_OVERLAY_SUFFIX)];
+  Overlay overlay;
+
+  // Make sure it really is a delta before removing it.
+  if (mapOverlay(&overlay, imageFileName, 0) != 0)
+    return -1;
+  unmapOverlay(&overlay);
+
+  getOverlayFileName(imageFileName, deltaFileName);
+  return (unlink(deltaFileName) == 0 ? 0 : -1);
+}
+
+/******************************************************************************
+ * commitOverlay
+ *****************************************************************************/
+int commitOverlay(const char* imageFileName, int imageFd)
+{
+  char deltaFileName[strlen(imageFileName) + sizeof(FAT12_OVERLAY_SUFFIX)];
+  Overlay overlay;
+  unsigned char* buffer;
+  unsigned long long sector = 0;
+  unsigned long long numSectors;
+  long long offset;
+  long long numBytes;
+  long long numRead;
+  int rc = 0;
+
+  if (mapOverlay(&overlay, imageFileName, 0) != 0)
+    return -1;
+  overlay.imageFd = imageFd;
+  buffer = (unsigned char*) malloc(OVERLAY_COPY_SIZE);
+
+  // Copy each run of sectors in the delta over the image. If this stops
+  // part way, the delta is kept and committing again finishes the job.
+  while (rc == 0 && sector < overlay.header.numSectors)
+  {
+    numSectors = getRunLength(&overlay, sector,
+                              OVERLAY_COPY_SIZE / OVERLAY_SECTOR_SIZE);
+    if (isSectorInOverlay(&overlay, sector))
+    {
+      offset = sector * OVERLAY_SECTOR_SIZE;
+      numBytes = numSectors * OVERLAY_SECTOR_SIZE;
+      if (offset + numBytes > (long long) overlay.header.imageSize)
+        numBytes = overlay.header.imageSize - offset;
+      numRead = readFully(overlay.deltaFd, buffer, numBytes,
+                          overlay.header.dataOffset + offset);
+      if (numRead != numBytes ||
+          writeFully(imageFd, buffer, numBytes, offset) != 0)
+        rc = -1;
+    }
+    sector += numSectors;
+  }
+
+  free(buffer);
+  unmapOverlay(&overlay);
+  if (rc == 0 && fsync(imageFd) != 0)
+    rc = -1;
+  if (rc == 0)
+  {
+    getOverlayFileName(imageFileName, deltaFileName);
+    rc = (unlink(deltaFileName) == 0 ? 0 : -1);
+  }
+  return rc;
+}
+
+/******************************************************************************
+ * openOverlay
+ *****************************************************************************/
+Overlay* openOverlay(const char* imageFileName, int imageFd, int isWritable)
+{
+  Overlay* overlay = (Overlay*) malloc(sizeof(Overlay));
+
+  if (mapOverlay(overlay, imageFileName, isWritable) != 0)
+  {
+    free(overlay);
+    return NULL;
+  }
+  overlay->imageFd = imageFd;
+  return overlay;
+}
+
+/******************************************************************************
+ * closeOverlay
+ *****************************************************************************/
+void closeOverlay(Overlay* overlay)
+{
+  unmapOverlay(overlay);
+  free(overlay);
+}
+
+/******************************************************************************
+ * readOverlay
+ *****************************************************************************/
+long long readOverlay(Overlay* overlay, long long offset,
+                      unsigned int numBytes, unsigned char* buffer)
+{
+  unsigned long long sector;
+  unsigned long long lastSector;
+  long long runEnd;
+  long long numRead;
+  unsigned int numDone = 0;
+
+  if (offset < 0)
+    return -1;
+  if (offset >= (long long) overlay->header.imageSize)
+    return 0;
+  if (offset + numBytes > overlay->header.imageSize)
+    numBytes = overlay->header.imageSize - offset;
+  if (numBytes == 0)
+    return 0;
+
+  // Read each run of sectors from wherever they are, the delta or the image.
+  lastSector = (offset + numBytes - 1) / OVERLAY_SECTOR_SIZE;
+  while (numDone < numBytes)
+  {
+    sector = (offset + numDone) / OVERLAY_SECTOR_SIZE;
+    runEnd = (sector + getRunLength(overlay, sector, lastSector - sector + 1)) *
+             OVERLAY_SECTOR_SIZE;
+    if (runEnd > offset + numBytes)
+      runEnd = offset + numBytes;
+
+    if (isSectorInOverlay(overlay, sector))
+      numRead = readFully(overlay->deltaFd, buffer + numDone,
+                          runEnd - offset - numDone,
+                          overlay->header.dataOffset + offset + numDone);
+    else
+      numRead = readFully(overlay->imageFd, buffer + numDone,
+                          runEnd - offset - numDone, offset + numDone);
+    if (numRead < 0)
+      return -1;
+
+    // The image only ends early if it was truncated under the snapshot, and
+    // the delta never does.
+    if (numRead < runEnd - offset - numDone)
+      memset(buffer + numDone + numRead, 0,
+             runEnd - offset - numDone - numRead);
+    numDone = runEnd - offset;
+  }
+  return numBytes;
+}
+
+/******************************************************************************
+ * writeOverlay
+ *****************************************************************************/
+long long writeOverlay(Overlay* overlay, long long offset,
+                       unsigned int numBytes, unsigned char* buffer)
+{
+  unsigned long long sector;
+  unsigned long long endSector;
+  long long end = offset + numBytes;
+  long long headEnd;
+  long long tailStart;
+
+  // The image can't grow.
+  if (offset < 0 || end > (long long) overlay->header.imageSize)
+    return -1;
+  if (numBytes == 0)
+    return 0;
+
+  // A partial sector at either end has to be filled in from the image first,
+  // and the whole sectors between go straight into the delta.
+  headEnd = (offset + OVERLAY_SECTOR_SIZE - 1) / OVERLAY_SECTOR_SIZE *
+            OVERLAY_SECTOR_SIZE;
+  if (headEnd > end)
+    headEnd = end;
+  tailStart = end / OVERLAY_SECTOR_SIZE * OVERLAY_SECTOR_SIZE;
+  if (tailStart < headEnd)
+    tailStart = headEnd;
+
+  if (headEnd > offset &&
+      writePartialSector(overlay, offset, headEnd - offset, buffer) != 0)
+    return -1;
+  if (tailStart > headEnd &&
+      writeFully(overlay->deltaFd, buffer + (headEnd - offset),
+                 tailStart - headEnd,
+                 overlay->header.dataOffset + headEnd) != 0)
+    return -1;
+  if (end > tailStart &&
+      writePartialSector(overlay, tailStart, end - tailStart,
+                         buffer + (tailStart - offset)) != 0)
+    return -1;
+
+  // Only mark the sectors once they are in the delta, so no one reads one
+  // before it is there.
+  endSector = (end + OVERLAY_SECTOR_SIZE - 1) / OVERLAY_SECTOR_SIZE;
+  for (sector = offset / OVERLAY_SECTOR_SIZE; sector < endSector; sector++)
+    __atomic_fetch_or(&overlay->bitmap[sector / 8],
+                      (unsigned char) (1 << (sector % 8)), __ATOMIC_RELEASE);
+  return numBytes;
+}
+
+/******************************************************************************
+ * flushOverlay
+ *****************************************************************************/
+int flushOverlay(Overlay* overlay)
+{
+  // The sectors have to be durable before the bits that say they are there.
+  if (fdatasync(overlay->deltaFd) != 0 ||
+      msync(overlay->mapping, overlay->header.dataOffset, MS_SYNC) != 0)
+    return -1;
+  return 0;
+}
+
+/******************************************************************************
+ * getOverlaySize
+ *****************************************************************************/
+long long getOverlaySize(Overlay* overlay)
+{
+  return overlay->header.imageSize;
+}
+
+/******************************************************************************
+ * getOverlayUsage
+ *****************************************************************************/
+int getOverlayUsage(const char* imageFileName, unsigned long long* numSectors,
+                    unsigned long long* numBytesUsed)
+{
+  Overlay overlay;
+  struct stat deltaStat;
+  unsigned long long bitmapSize;
+  unsigned long long i;
+
+  if (mapOverlay(&overlay, imageFileName, 0) != 0)
+    return -1;
+
+  *numSectors = 0;
+  bitmapSize = (overlay.header.numSectors + 7) / 8;
+  for (i = 0; i < bitmapSize; i++)
+    *numSectors += __builtin_popcount(overlay.bitmap[i]);
+  *numBytesUsed = 0;
+  if (fstat(overlay.deltaFd, &deltaStat) == 0)
+    *numBytesUsed = (unsigned long long) deltaStat.st_blocks * 512;
+
+  unmapOverlay(&overlay);
+  return 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Internal Functions
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * mapOverlay
+ *****************************************************************************/
+static int mapOverlay(Overlay* overlay, const char* imageFileName,
+                      int isWritable)
+{
+  char deltaFileName[strlen(imageFileName) + sizeof(FAT12_OVERLAY_SUFFIX)];
+  struct stat deltaStat;
+  OverlayHeader* header = &overlay->header;
+  void* mapping;
+
+  getOverlayFileName(imageFileName, deltaFileName);
+  overlay->deltaFd = open(deltaFileName, (isWritable ? O_RDWR : O_RDONLY));
+  if (overlay->deltaFd == -1)
+    return -1;
+  overlay->imageFd = -1;
+
+  if (readFully(overlay->deltaFd, (unsigned char*) header, sizeof(*header),
+                0) != sizeof(*header) ||
+      fstat(overlay->deltaFd, &deltaStat) != 0 ||
+      header->magic != FAT12_OVERLAY_MAGIC ||
+      header->version != FAT12_OVERLAY_VERSION ||
+      header->bitmapOffset < sizeof(*header) ||
+      header->dataOffset < header->bitmapOffset + (header->numSectors + 7) / 8 ||
+      (unsigned long long) deltaStat.st_size <
+        header->dataOffset + header->numSectors * OVERLAY_SECTOR_SIZE)
+  {
+    close(overlay->deltaFd);
+    return -1;
+  }
+
+  mapping = mmap(NULL, header->dataOffset,
+                 PROT_READ | (isWritable ? PROT_WRITE : 0), MAP_SHARED,
+                 overlay->deltaFd, 0);
+  if (mapping == MAP_FAILED)
+  {
+    close(overlay->deltaFd);
+    return -1;
+  }
+  overlay->mapping = (unsigned char*) mapping;
+  overlay->bitmap = overlay->mapping + header->bitmapOffset;
+  return 0;
+}
+
+/******************************************************************************
+ * unmapOverlay
+ *****************************************************************************/
+static void unmapOverlay(Overlay* overlay)
+{
+  munmap(overlay->mapping, overlay->header.dataOffset);
+  close(overlay->deltaFd);
+}
+
+/******************************************************************************
+ * isSectorInOverlay
+ *****************************************************************************/
+static int isSectorInOverlay(Overlay* overlay, unsigned long long sector)
+{
+  unsigned char bits = __atomic_load_n(&overlay->bitmap[sector / 8],
+                                       __ATOMIC_ACQUIRE);
+
+  return ((bits >> (sector % 8)) & 1);
+}
+
+/******************************************************************************
+ * getRunLength
+ *****************************************************************************/
+static unsigned long long getRunLength(Overlay* overlay,
+                                       unsigned long long sector,
+                                       unsigned long long maxSectors)
+{
+  int isInOverlay = isSectorInOverlay(overlay, sector);
+  unsigned long long numSectors = 1;
+
+  if (sector + maxSectors > overlay->header.numSectors)
+    maxSectors = overlay->header.numSectors - sector;
+  while (numSectors < maxSectors)
+  {
+    // Skip whole bytes of the bitmap that are all one way.
+    if ((sector + numSectors) % 8 == 0 && numSectors + 8 <= maxSectors &&
+        overlay->bitmap[(sector + numSectors) / 8] ==
+          (isInOverlay ? 0xFF : 0x00))
+    {
+      numSectors += 8;
+      continue;
+    }
+    if (isSectorInOverlay(overlay, sector + numSectors) != isInOverlay)
+      break;
+    numSectors++;
+  }
+  return numSectors;
+}
+
+/******************************************************************************
+ * readFully
+ *****************************************************************************/
+static long long readFully(int fd, unsigned char* buffer, size_t numBytes,
+                           long long offset)
+{
+  size_t numRead = 0;
+  ssize_t numTransferred;
+
+  while (numRead < numBytes)
+  {
+    numTransferred = pread(fd, buffer + numRead, numBytes - numRead,
+                           offset + numRead);
+    if (numTransferred < 0 && errno == EINTR)
+      continue;
+    if (numTransferred < 0)
+      return -1;
+    if (numTransferred == 0)
+      break;
+    numRead += numTransferred;
+  }
+  return numRead;
+}
+
+/******************************************************************************
+ * writeFully
+ *****************************************************************************/
+static int writeFully(int fd, unsigned char* buffer, size_t numBytes,
+                      long long offset)
+{
+  size_t numWritten = 0;
+  ssize_t numTransferred;
+
+  while (numWritten < numBytes)
+  {
+    numTransferred = pwrite(fd, buffer + numWritten, numBytes - numWritten,
+                            offset + numWritten);
+    if (numTransferred < 0 && errno == EINTR)
+      continue;
+    if (numTransferred <= 0)
+      return -1;
+    numWritten += numTransferred;
+  }
+  return 0;
+}
+
+/******************************************************************************
+ * writePartialSector
+ *****************************************************************************/
+static int writePartialSector(Overlay* overlay, long long offset,
+                              unsigned int numBytes, unsigned char* buffer)
+{
+  unsigned char sectorData[OVERLAY_SECTOR_SIZE];
+  long long sector = offset / OVERLAY_SECTOR_SIZE;
+  long long sectorStart = sector * OVERLAY_SECTOR_SIZE;
+  long long numRead;
+
+  // Once the sector is in the delta, only the bytes given need writing.
+  if (isSectorInOverlay(overlay, sector))
+    return writeFully(overlay->deltaFd, buffer, numBytes,
+                      overlay->header.dataOffset + offset);
+
+  numRead = readFully(overlay->imageFd, sectorData, OVERLAY_SECTOR_SIZE,
+                      sectorStart);
+  if (numRead < 0)
+    return -1;
+  memset(sectorData + numRead, 0, OVERLAY_SECTOR_SIZE - numRead);
+  memcpy(sectorData + (offset - sectorStart), buffer, numBytes);
+  return writeFully(overlay->deltaFd, sectorData, OVERLAY_SECTOR_SIZE,
+                    overlay->header.dataOffset + sectorStart);
+}
@@ -0,0 +1,219 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function headers for copy-on-write overlays, which give a
+ *              disk image a snapshot without copying it.
+ *
+ *              Taking a snapshot of an image creates an empty delta file
+ *              next to it (named "<image>.delta"). From then on the image
+ *              itself is only ever read: every sector written goes to the
+ *              delta instead, and reads take each sector from the delta if
+ *              it has been written since the snapshot, or else from the
+ *              image. Rolling back throws the delta away, and committing
+ *              copies the sectors in it into the image (then throws it
+ *              away). An image with a delta is always opened through its
+ *              overlay, whatever block device was asked for (see
+ *              blockDevice.h), and the snapshot program manages them.
+ *
+ *              The delta is a sparse file laid out as:
+ *
+ *                OverlayHeader, padded to OVERLAY_ALIGNMENT bytes
+ *                a bitmap with a set bit for each sector in the delta,
+ *                  padded to a multiple of OVERLAY_ALIGNMENT bytes
+ *                each sector of the image, at the same offset from the
+ *                  start of the data as it has in the image (a hole if it
+ *                  isn't in the delta)
+ *
+ *              so creating it and throwing it away take the same time for
+ *              any size of image, and it only takes up space on the host
+ *              for the sectors written. The bitmap is shared through a
+ *              mapping, so every command sees the others' writes as soon as
+ *              they are made.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#ifndef _OVERLAY_H_
+#define _OVERLAY_H_
+
+
+//-----------------------------------------------------------------------------
+// Constants
+//-----------------------------------------------------------------------------
+
+// Appended to the disk image's path name to get the delta's path name.
+#define FAT12_OVERLAY_SUFFIX ".delta"
+
+// Magic number and version at the start of a delta.
+#define FAT12_OVERLAY_MAGIC 0x544C4446 // "FDLT"
+#define FAT12_OVERLAY_VERSION 1
+
+// The size of the sectors the delta tracks. This is the smallest sector a
+// FAT file system can have, so it works for any of them.
+#define OVERLAY_SECTOR_SIZE 512
+
+// The alignment of the bitmap and data in the delta (a page).
+#define OVERLAY_ALIGNMENT 4096
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * OverlayHeader - the start of a delta.
+ *****************************************************************************/
+typedef struct
+{
+  unsigned int       magic;
+  unsigned int       version;
+  unsigned long long imageSize; // of the image when the snapshot was taken
+  unsigned long long numSectors; // covering imageSize
+  unsigned long long bitmapOffset;
+  unsigned long long dataOffset;
+} OverlayHeader;
+
+typedef struct Overlay Overlay;
+
+
+//-----------------------------------------------------------------------------
+// Overlay interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * getOverlayFileName - Get the path name of a disk image's delta.
+ *
+ * imageFileName - the image's host path name
+ * deltaFileName - where to store the delta's path name (of at least
+ *                 strlen(imageFileName) + sizeof(FAT12_OVERLAY_SUFFIX))
+ *
+ * Return - none
+ *****************************************************************************/
+void getOverlayFileName(const char* imageFileName, char* deltaFileName);
+
+/******************************************************************************
+ * hasOverlay - Check if a disk image has a snapshot.
+ *
+ * imageFileName - the image's host path name
+ *
+ * Return - 1 if it has a delta, 0 if not
+ *****************************************************************************/
+int hasOverlay(const char* imageFileName);
+
+/******************************************************************************
+ * createOverlay - Take a snapshot of a disk image, by creating an empty
+ *                 delta for it.
+ *
+ * imageFileName - the image's host path name
+ * imageFd - a descriptor of the image, for its size
+ *
+ * Return - 0 on success, -1 on failure (such as if it already has one)
+ *****************************************************************************/
+int createOverlay(const char* imageFileName, int imageFd);
+
+/******************************************************************************
+ * rollbackOverlay - Throw away every change made to a disk image since its
+ *                   snapshot, by removing its delta.
+ *
+ * imageFileName - the image's host path name
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+int rollbackOverlay(const char* imageFileName);
+
+/******************************************************************************
+ * commitOverlay - Write every change made to a disk image since its snapshot
+ *                 into the image, then remove its delta.
+ *
+ * imageFileName - the image's host path name
+ * imageFd - a descriptor of the image, open for writing
+ *
+ * Return - 0 on success, -1 on failure (the delta is kept)
+ *****************************************************************************/
+int commitOverlay(const char* imageFileName, int imageFd);
+
+/******************************************************************************
+ * openOverlay - Open a disk image's delta, to read and write the image
+ *               through it.
+ *
+ * imageFileName - the image's host path name
+ * imageFd - a descriptor of the image
+ * isWritable - 1 to open it for writing too, 0 for reading only
+ *
+ * Return - the overlay, or NULL on failure
+ *****************************************************************************/
+Overlay* openOverlay(const char* imageFileName, int imageFd, int isWritable);
+
+/******************************************************************************
+ * closeOverlay - Close an overlay.
+ *
+ * overlay - the overlay
+ *
+ * Return - none
+ *****************************************************************************/
+void closeOverlay(Overlay* overlay);
+
+/******************************************************************************
+ * readOverlay - Read consecutive bytes of the image through an overlay.
+ *
+ * overlay - the overlay
+ * offset - where in the image to start reading
+ * numBytes - the number of bytes to read
+ * buffer - where to store them
+ *
+ * Return - the number of bytes read (fewer at the end of the image), or -1
+ *          on failure
+ *****************************************************************************/
+long long readOverlay(Overlay* overlay, long long offset,
+                      unsigned int numBytes, unsigned char* buffer);
+
+/******************************************************************************
+ * writeOverlay - Write consecutive bytes of the image into an overlay's
+ *                delta. The image can't grow.
+ *
+ * overlay - the overlay
+ * offset - where in the image to start writing
+ * numBytes - the number of bytes to write
+ * buffer - the bytes
+ *
+ * Return - the number of bytes written, or -1 on failure
+ *****************************************************************************/
+long long writeOverlay(Overlay* overlay, long long offset,
+                       unsigned int numBytes, unsigned char* buffer);
+
+/******************************************************************************
+ * flushOverlay - Make the sectors written to an overlay's delta durable,
+ *                and then its bitmap.
+ *
+ * overlay - the overlay
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+int flushOverlay(Overlay* overlay);
+
+/******************************************************************************
+ * getOverlaySize - Get the size of the image seen through an overlay.
+ *
+ * overlay - the overlay
+ *
+ * Return - the size in bytes
+ *****************************************************************************/
+long long getOverlaySize(Overlay* overlay);
+
+/******************************************************************************
+ * getOverlayUsage - Count the sectors in a disk image's delta, and the space
+ *                   it takes up on the host.
+ *
+ * imageFileName - the image's host path name
+ * numSectors - where to store the number of sectors changed since the
+ *              snapshot
+ * numBytesUsed - where to store the space the delta takes up
+ *
+ * Return - 0 on success, -1 if the image has no delta
+ *****************************************************************************/
+int getOverlayUsage(const char* imageFileName, unsigned long long* numSectors,
+                    unsigned long long* numBytesUsed);
+
+
+#endif //_OVERLAY_H_
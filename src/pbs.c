@@ -15,23 +15,32 @@
 #include <string.h>
 
 
-int main()
+int main(int argc, char* argv[])
 {
-  if (initializeFatFileSystem() != 0)
+  if (initializeFatFileSystem(FAT_LOCK_SHARED) != 0)
     return -1;
   
   // Retreive the boot sector information.
   FatBootSector bootSector;    
   getFatBootSector(&bootSector);
 
+  // FAT32 keeps its extended fields further along in the boot sector.
+  int isFat32 = (fatFileSystem.geometry.fatType == FAT_TYPE_32);
+  unsigned char bootSignature = (isFat32 ? bootSector.bootSignature32 :
+                                 bootSector.bootSignature);
+  unsigned int volumeID = (isFat32 ? bootSector.volumeID32 :
+                           bootSector.volumeID);
+
   // Copy the volume-label into a null-terminated string.
   char volumeLabel[12];
-  memcpy(volumeLabel, bootSector.volumeLabel, 11);
+  memcpy(volumeLabel, (isFat32 ? bootSector.volumeLabel32 :
+                       bootSector.volumeLabel), 11);
   volumeLabel[11] = '\0';
 
   // Copy the file-system-type into a null-terminated string.
   char fileSystemType[9];
-  memcpy(fileSystemType, bootSector.fileSystemType, 8);
+  memcpy(fileSystemType, (isFat32 ? bootSector.fileSystemType32 :
+                          bootSector.fileSystemType), 8);
   fileSystemType[8] = '\0';
 
   // Print out the boot sector information.
@@ -40,14 +49,25 @@ int main()
   printf("Number of FATs             = %d\n", bootSector.numFATs);
   printf("Number of Reserved Sectors = %d\n", bootSector.numReservedSectors);
   printf("Number of Root Entries     = %d\n", bootSector.maxNumRootDirEntries);
-  printf("Total Sector Count         = %d\n", bootSector.totalSectorCount);
-  printf("Sectors Per Fat            = %d\n", bootSector.sectorsPerFAT);
+  printf("Total Sector Count         = %u\n",
+         fatFileSystem.geometry.totalSectors);
+  printf("Sectors Per Fat            = %u\n",
+         fatFileSystem.geometry.sectorsPerFAT);
   printf("Sectors Per Track          = %d\n", bootSector.sectorsPerTrack);
   printf("Number of Heads            = %d\n", bootSector.numHeads);
-  printf("Boot Signature (in hex)    = 0x%02X\n", bootSector.bootSignature);
-  printf("Volume ID (in hex)         = 0x%06X\n", bootSector.volumeID);
+  if (isFat32)
+  {
+    printf("Root Directory Cluster     = %u\n",
+           bootSector.rootDirectoryCluster);
+    printf("FSInfo Sector              = %d\n", bootSector.fsInfoSector);
+    printf("Backup Boot Sector         = %d\n", bootSector.backupBootSector);
+  }
+  printf("Boot Signature (in hex)    = 0x%02X\n", bootSignature);
+  printf("Volume ID (in hex)         = 0x%06X\n", volumeID);
   printf("Volume Label               = %s\n", volumeLabel);
   printf("File System Type           = %s\n", fileSystemType);
+  printf("FAT Type                   = FAT%d\n",
+         fatFileSystem.geometry.fatType);
 
   terminateFatFileSystem();
   return 0;
@@ -3,8 +3,9 @@
  *
  * Author: David Jordan
  *
- * Description: Performs the pfe command, which prints the 12-bit FAT entry
- *              values representing logical sectors X to Y.
+ * Description: Performs the pfe command, which prints the FAT entry values
+ *              (12, 16 or 32-bit, depending on the FAT type) representing
+ *              logical sectors X to Y.
  * 
  * Certification of Authenticity:
  * I certify that this assignment is entirely my own work.
@@ -22,7 +23,7 @@
 static void usage()
 {
 	printf("Usage: pfe X Y\n");
-	printf("Prints the 12-bit FAT entry values representing logical sectors X to Y.\n");
+	printf("Prints the FAT entry values representing logical sectors X to Y.\n");
 }
 
 
@@ -72,14 +73,15 @@ int main(int argc, char* argv[])
 		return -1;
 	}
 	
-  if (initializeFatFileSystem() != 0)
+  if (initializeFatFileSystem(FAT_LOCK_SHARED) != 0)
     return -1;
 	
 	// Print out the FAT entries.
 	int i;
 	for (i = x; i <= y; i++)
 	{
-		int entry = get_fat_entry((unsigned int) i, fatFileSystem.fatTable);
+		unsigned int entry = fatFileSystem.fatCodec->getEntry((unsigned int) i,
+		                                                      fatFileSystem.fatTable);
 		printf("Entry %d: %X\n", i, entry);
 	}
 
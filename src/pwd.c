@@ -16,7 +16,7 @@
 
 int main(int argc, char* argv[])
 {
-  if (initializeFatFileSystem() != 0)
+  if (initializeFatFileSystem(FAT_LOCK_SHARED) != 0)
     return -1;
     
   FilePath workingDir;
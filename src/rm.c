@@ -22,7 +22,7 @@ void rmCommand(char* pathName);
 
 int main(int argc, char* argv[])
 {
-  if (initializeFatFileSystem() != 0)
+  if (initializeFatFileSystem(FAT_LOCK_EXCLUSIVE) != 0)
     return -1;
   
   // Validate the number of arguments.
@@ -55,8 +55,8 @@ void rmCommand(char* pathName)
     return;
   
   // Open the parent directory.
-  unsigned short flcOfParentDir = filePath.dirLevels[filePath.depthLevel - 2]
-                                  .firstLogicalCluster;
+  unsigned int flcOfParentDir = filePath.dirLevels[filePath.depthLevel - 2]
+                                .firstLogicalCluster;
   DirectoryEntry* parentDir = openDirectory(flcOfParentDir); 
   
   int index = filePath.dirLevels[filePath.depthLevel - 1].indexInParentDirectory;
@@ -65,5 +65,6 @@ void rmCommand(char* pathName)
 	removeEntry(parentDir, index);
   organizeDirectory(parentDir);
   saveDirectory(flcOfParentDir, parentDir);
+  closeDirectory(parentDir);
 }
 
@@ -21,7 +21,7 @@ void rmdirCommand(char* pathName);
 
 int main(int argc, char* argv[])
 {
-  if (initializeFatFileSystem() != 0)
+  if (initializeFatFileSystem(FAT_LOCK_EXCLUSIVE) != 0)
     return -1;
   
   // Validate the number of arguments.
@@ -61,14 +61,14 @@ void rmdirCommand(char* pathName)
   }
     
   // Open the directory's parent directory.
-  unsigned short flcOfParentDir = dirPath.dirLevels[dirPath.depthLevel - 2]
-                                  .firstLogicalCluster;
+  unsigned int flcOfParentDir = dirPath.dirLevels[dirPath.depthLevel - 2]
+                                .firstLogicalCluster;
   DirectoryEntry* parentDir = openDirectory(flcOfParentDir); 
   
   int index = dirPath.dirLevels[dirPath.depthLevel - 1].indexInParentDirectory;
 	
 	// Check if the directory-to-remove is empty.
-	DirectoryEntry* toDelete = openDirectory(parentDir[index].firstLogicalCluster);
+	DirectoryEntry* toDelete = openDirectory(getEntryCluster(&parentDir[index]));
 	int isEmpty = isDirectoryEmpty(toDelete);
   closeDirectory(toDelete);
   
@@ -76,7 +76,7 @@ void rmdirCommand(char* pathName)
   
   // Make sure we are not removing the current working directory.
   if (dirPath.dirLevels[dirPath.depthLevel - 1].firstLogicalCluster == 
-     parentDir[index].firstLogicalCluster)
+     getEntryCluster(&parentDir[index]))
   {
     printf("Error: Cannot remove the current directory.\n");
   }
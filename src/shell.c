@@ -10,33 +10,119 @@
  * I certify that this assignment is entirely my own work.
  ****************************************************************************/
 
+#define _GNU_SOURCE // for pipe2()
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <sys/ipc.h>
-#include <sys/shm.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 #include "fat.h"
+#include "histogram.h"
+#ifdef FAT12_MULTI_CALL
+#include "fat12.h"
+#endif
 
 #define FALSE 0
 #define TRUE 1
 
+// The default number of FAT table changes commands let build up in the
+// session before one of them makes the FAT table durable with an fsync.
+// Each command writes the FAT sectors it changed to the image either way.
+// This can be overridden with the FAT12_FLUSH_INTERVAL environment variable
+// (0 = only on sync or exit, 1 = after every change).
+#define DEFAULT_FLUSH_INTERVAL 8
+
+// The maximum number of different command names the shell keeps timings for.
+#define MAX_TIMED_COMMANDS 64
+
+// The maximum number of command paths the shell remembers.
+#define MAX_RESOLVED_COMMANDS 64
+
+// The maximum number of commands in a pipeline, and of parameters for each.
+#define MAX_PIPELINE_STAGES 8
+#define MAX_PARAMS 32
+
+// The path to a command's executable, found the first time it is run.
+typedef struct
+{
+   char name[32];
+   char path[512];
+} ResolvedCommand;
+
+// Times and resource usage of every run of a command in this session.
+typedef struct
+{
+   char          name[32];
+   Histogram     wallTime; // in microseconds
+   double        userTime; // total, in seconds
+   double        systemTime; // total, in seconds
+   unsigned long minorFaults; // total
+   unsigned long majorFaults; // total
+} CommandTimings;
+
+// One command in a pipeline. A name starting with '!' runs a program on the
+// host (found through PATH) rather than one of the shell's commands.
+typedef struct
+{
+   char  name[32];
+   char* params[MAX_PARAMS + 1]; // the first is the program name
+   int   isHostCommand;
+} PipelineStage;
+
+// A line of input: commands connected by pipes ('|'), where the first one
+// reads its input from ('<'), and where the last one writes its output to
+// ('>' or '>>' to append). Files named in redirections are on the host.
+typedef struct
+{
+   PipelineStage stages[MAX_PIPELINE_STAGES];
+   int           numStages;
+   char*         inputFileName;
+   char*         outputFileName;
+   int           isAppending;
+   char*         tokens; // holds all of the strings above
+} Pipeline;
+
+extern char** environ;
+
+CommandTimings* commandTimings[MAX_TIMED_COMMANDS];
+int numTimedCommands = 0;
+
+char pathToCommands[512];
+ResolvedCommand resolvedCommands[MAX_RESOLVED_COMMANDS];
+int numResolvedCommands = 0;
+
 void displayPrompt();
-int readCommand(char* command, char** params);
+int readCommand(Pipeline* pipeline);
+int isBuiltInCommand(const char* commandName);
+void runPipeline(Pipeline* pipeline, int isTraced);
+const char* resolveCommand(const char* commandName);
+void forgetCommand(const char* commandName);
+double getTime();
+double getTimeValue(struct timeval* time);
+void recordTimings(const char* commandName, double wallTime,
+                   struct rusage* usage, int isTraced);
+void printTimings();
 
 
 int main(int argc, char** argv)
 {
-   char pathToCommands[512];
-   char pathToSpecificCommand[512];
-   char commandName[32];
-   char* params[32];
+   Pipeline pipeline;
+   const char* commandName;
    
-   int status;
+   int rc;
    int i;
    int exitShell = FALSE;
+   unsigned int flushInterval = DEFAULT_FLUSH_INTERVAL;
+   double startTime;
+   struct rusage usage;
+   struct rusage startUsage;
    
    // Validate the number of arguments.
    if (argc > 2)
@@ -59,77 +145,426 @@ int main(int argc, char** argv)
       return -1;
    }
    
+#ifdef FAT12_MULTI_CALL
+   // The commands are built into this same executable, which runs the one
+   // named by argv[0].
+   ssize_t pathLength = readlink("/proc/self/exe", pathToCommands,
+                                 sizeof(pathToCommands) - 1);
+   if (pathLength == -1)
+   {
+      perror("Error finding the shell's executable");
+      return -1;
+   }
+   pathToCommands[pathLength] = '\0';
+#else
    // Get the path to the directory where this shell executable is located.
    // This is also where the command executables are located.
    strcpy(pathToCommands, argv[0]);
    char* finalSlash = strrchr(pathToCommands, '/');
    if (finalSlash != NULL)
       finalSlash[1] = '\0';
+   else
+      pathToCommands[0] = '\0';
+#endif
       
-   // Create the shared memory.
-   key_t key = FAT12_SHARED_MEMORY_KEY;
-   fatFileSystem.sharedMemoryId = shmget(key, 1024, 0666 | IPC_CREAT);
-   if (fatFileSystem.sharedMemoryId == -1)
+   // Create this shell's session, which holds the disk image path and the
+   // current working directory for the command processes.
+   if (createFatSession(diskImageFileName) != 0)
+      return -1;
+   
+   // Pick how commands read and write the image, if asked to.
+   const char* blockDeviceName = getenv(FAT12_BLOCK_DEVICE_ENV_VAR);
+   int blockDeviceType = BLOCK_DEVICE_STDIO;
+   if (blockDeviceName == NULL && getenv(FAT12_DIRECT_IO_ENV_VAR) != NULL)
+      blockDeviceName = "direct";
+   if (blockDeviceName != NULL)
    {
-     perror("Error creating shared memory segment");
-     return -1;
+      blockDeviceType = getBlockDeviceType(blockDeviceName);
+      if (blockDeviceType == -1)
+         printf("Warning: unknown block device '%s', using stdio\n",
+                blockDeviceName);
+      if (blockDeviceType == -1 || setFatBlockDevice(blockDeviceType) != 0)
+         blockDeviceType = BLOCK_DEVICE_STDIO;
    }
-   fatFileSystem.sharedMemoryPtr = shmat(fatFileSystem.sharedMemoryId, (void *) 0, 0);
-   if (fatFileSystem.sharedMemoryPtr == (void*) -1)
+   
+   // Journal the commands' changes if asked to. When commands are being read
+   // from a script rather than typed in, they are group committed: the
+   // journal is only fsync'ed when the shell syncs. A copy of the image in
+   // memory is never written back, so it has nothing to journal.
+   if (getenv("FAT12_JOURNAL") != NULL &&
+       blockDeviceType != BLOCK_DEVICE_MEMORY)
    {
-     perror("Error attaching shared memory segment");
-     return -1;
+      enableFatJournal(!isatty(STDIN_FILENO));
    }
-   fatFileSystem.diskImageFileName = fatFileSystem.sharedMemoryPtr;
-   fatFileSystem.workingDirectoryPathName = fatFileSystem.sharedMemoryPtr + 512;
+
+   // Have commands give back the space of the clusters they free, if asked
+   // to, so that a sparse image stays sparse.
+   if (getenv("FAT12_DISCARD") != NULL)
+      enableFatDiscard();
+
+   // Get how often commands make the session's FAT table durable.
+   const char* flushIntervalString = getenv("FAT12_FLUSH_INTERVAL");
+   if (flushIntervalString != NULL)
+      flushInterval = (unsigned int) strtoul(flushIntervalString, NULL, 10);
+   setFatFlushInterval(flushInterval);
    
-   // Initialize the disk image path and current working directory.
-   strcpy(fatFileSystem.workingDirectoryPathName, "/");
-   strcpy(fatFileSystem.diskImageFileName, diskImageFileName);
+   // Print the timings of every command on exit, and of each command as it
+   // finishes if tracing, when asked to.
+   const char* timingsString = getenv("FAT12_TIMINGS");
+   int isTraced = (timingsString != NULL &&
+                   strcmp(timingsString, "trace") == 0);
    
    // Run the shell's main loop.
    while (exitShell != TRUE)
    {
       displayPrompt();
-      if (readCommand(commandName, params) != 0)
+      rc = readCommand(&pipeline);
+      if (rc < 0)
+         break; // end of input, which ends a batch of commands.
+      else if (rc != 0)
          continue;
-            
-      // Create a path to the command.
-      strcpy(pathToSpecificCommand, pathToCommands);
-      strcat(pathToSpecificCommand, commandName);
+      commandName = pipeline.stages[0].name;
       
+      // The hard-coded commands run in the shell itself, so they have no
+      // input or output to redirect.
+      if ((pipeline.numStages > 1 || pipeline.inputFileName != NULL ||
+           pipeline.outputFileName != NULL) &&
+          isBuiltInCommand(commandName))
+      {
+         printf("Error: '%s' can't be used in a pipeline\n", commandName);
+      }
       // A hard-coded exit command will quit the shell.
-      if (strcmp(commandName, "exit") == 0)
+      else if (strcmp(commandName, "exit") == 0)
       { 
          exitShell = TRUE;
       }
-      else if (access(pathToSpecificCommand, F_OK) == -1)
+      // A hard-coded sync command writes the FAT table to disk right away.
+      else if (strcmp(commandName, "sync") == 0)
+      {
+         startTime = getTime();
+         getrusage(RUSAGE_SELF, &startUsage);
+         syncFatSession();
+         getrusage(RUSAGE_SELF, &usage);
+         
+         // Count only what the sync itself used.
+         timersub(&usage.ru_utime, &startUsage.ru_utime, &usage.ru_utime);
+         timersub(&usage.ru_stime, &startUsage.ru_stime, &usage.ru_stime);
+         usage.ru_minflt -= startUsage.ru_minflt;
+         usage.ru_majflt -= startUsage.ru_majflt;
+         recordTimings(commandName, getTime() - startTime, &usage, isTraced);
+      }
+      // A hard-coded timings command prints the timings so far.
+      else if (strcmp(commandName, "timings") == 0)
       {
-         printf("Error: Unknown command '%s'\n", commandName);
+         printTimings();
       }
       else
       {
-         // Fork a child process to run the command executable.
-         if(fork() != 0)
-         {
-            waitpid(-1, &status, 0);
-         }
-         else
-         {
-            execve(pathToSpecificCommand, params, 0);
-      	 }
+         runPipeline(&pipeline, isTraced);
       }
       
       // Free up the previously allocated parameter strings.
-      for (i = 0; params[i] != NULL; i++)
+      free(pipeline.tokens);
+   }
+   
+   // Write any remaining FAT table changes, then destroy the session's
+   // shared memory.
+   syncFatSession();
+   destroyFatSession();
+   
+   if (timingsString != NULL)
+      printTimings();
+   for (i = 0; i < numTimedCommands; i++)
+      free(commandTimings[i]);
+   return 0;
+}
+
+
+int isBuiltInCommand(const char* commandName)
+{
+   return (strcmp(commandName, "exit") == 0 ||
+           strcmp(commandName, "sync") == 0 ||
+           strcmp(commandName, "timings") == 0);
+}
+
+
+void runPipeline(Pipeline* pipeline, int isTraced)
+{
+   const char* paths[MAX_PIPELINE_STAGES];
+   pid_t pids[MAX_PIPELINE_STAGES];
+   posix_spawn_file_actions_t fileActions;
+   PipelineStage* stage;
+   struct rusage usage;
+   double startTime;
+   int inputFd = -1;
+   int outputFd = -1;
+   int pipeFds[2];
+   int stageInputFd, stageOutputFd;
+   int numRunning = 0;
+   int status;
+   int rc;
+   int i;
+   pid_t pid;
+   
+   // Find every command before starting any of them.
+   for (i = 0; i < pipeline->numStages; i++)
+   {
+      stage = &pipeline->stages[i];
+      if (stage->isHostCommand)
+         paths[i] = stage->params[0];
+      else if ((paths[i] = resolveCommand(stage->name)) == NULL)
       {
-         free(params[i]);
+         printf("Error: Unknown command '%s'\n", stage->name);
+         return;
       }
    }
    
-   // Destroy the shared memory.
-   shmctl(fatFileSystem.sharedMemoryId, IPC_RMID, NULL);
-   return 0;
+   // Open the redirected files. Every descriptor the shell opens is closed
+   // on exec, so each command only inherits the ones it is given.
+   if (pipeline->inputFileName != NULL)
+   {
+      inputFd = open(pipeline->inputFileName, O_RDONLY | O_CLOEXEC);
+      if (inputFd == -1)
+      {
+         printf("Error: %s: %s\n", pipeline->inputFileName, strerror(errno));
+         return;
+      }
+   }
+   if (pipeline->outputFileName != NULL)
+   {
+      outputFd = open(pipeline->outputFileName, O_WRONLY | O_CREAT |
+                      O_CLOEXEC | (pipeline->isAppending ? O_APPEND : O_TRUNC),
+                      0666);
+      if (outputFd == -1)
+      {
+         printf("Error: %s: %s\n", pipeline->outputFileName, strerror(errno));
+         if (inputFd != -1)
+            close(inputFd);
+         return;
+      }
+   }
+   
+   // Spawn a child process for each command, all running at once, with a
+   // pipe from each one's output to the next one's input. posix_spawn()
+   // doesn't copy the shell's page tables like fork() would, and reports a
+   // failed exec here rather than in the child.
+   startTime = getTime();
+   stageInputFd = inputFd;
+   for (i = 0; i < pipeline->numStages; i++)
+   {
+      stage = &pipeline->stages[i];
+      
+      if (i == pipeline->numStages - 1)
+         stageOutputFd = outputFd;
+      else if (pipe2(pipeFds, O_CLOEXEC) == -1)
+      {
+         // The rest of the pipeline, including the stage that would have
+         // been given the output file, never starts.
+         perror("Error creating pipe");
+         if (outputFd != -1)
+            close(outputFd);
+         for (; i < pipeline->numStages; i++)
+            pids[i] = -1;
+         break;
+      }
+      else
+         stageOutputFd = pipeFds[1];
+      
+      posix_spawn_file_actions_init(&fileActions);
+      if (stageInputFd != -1)
+         posix_spawn_file_actions_adddup2(&fileActions, stageInputFd,
+                                          STDIN_FILENO);
+      if (stageOutputFd != -1)
+         posix_spawn_file_actions_adddup2(&fileActions, stageOutputFd,
+                                          STDOUT_FILENO);
+      if (stage->isHostCommand)
+         rc = posix_spawnp(&pid, paths[i], &fileActions, NULL, stage->params,
+                           environ);
+      else
+         rc = posix_spawn(&pid, paths[i], &fileActions, NULL, stage->params,
+                          environ);
+      posix_spawn_file_actions_destroy(&fileActions);
+      
+      if (rc != 0)
+      {
+         printf("Error: %s: %s\n", stage->name, strerror(rc));
+         forgetCommand(stage->name);
+         pids[i] = -1;
+      }
+      else
+      {
+         pids[i] = pid;
+         numRunning++;
+      }
+      
+      // The children have their own copies of the pipe ends now.
+      if (stageInputFd != -1)
+         close(stageInputFd);
+      if (stageOutputFd != -1)
+         close(stageOutputFd);
+      stageInputFd = (i < pipeline->numStages - 1 ? pipeFds[0] : -1);
+   }
+   if (stageInputFd != -1)
+      close(stageInputFd);
+   
+   // Wait for them all, timing each from the start of the pipeline to when
+   // it finishes.
+   while (numRunning > 0)
+   {
+      pid = wait4(-1, &status, 0, &usage);
+      if (pid == -1)
+      {
+         if (errno == EINTR)
+            continue;
+         break;
+      }
+      for (i = 0; i < pipeline->numStages; i++)
+      {
+         if (pids[i] == pid)
+         {
+            recordTimings(pipeline->stages[i].name, getTime() - startTime,
+                          &usage, isTraced);
+            numRunning--;
+            break;
+         }
+      }
+   }
+}
+
+
+const char* resolveCommand(const char* commandName)
+{
+   ResolvedCommand* command;
+   int i;
+   
+   for (i = 0; i < numResolvedCommands; i++)
+   {
+      if (strcmp(resolvedCommands[i].name, commandName) == 0)
+         return resolvedCommands[i].path;
+   }
+   
+   // Find the command for the first time. Unknown commands aren't
+   // remembered, in case they are added later.
+#ifdef FAT12_MULTI_CALL
+   if (findFat12Command(commandName) == NULL)
+      return NULL;
+#else
+   if (strchr(commandName, '/') != NULL ||
+       strlen(pathToCommands) + strlen(commandName) >= sizeof(command->path))
+      return NULL;
+#endif
+   if (numResolvedCommands == MAX_RESOLVED_COMMANDS)
+      numResolvedCommands = 0; // start over rather than stop remembering
+   command = &resolvedCommands[numResolvedCommands];
+   strcpy(command->name, commandName);
+   strcpy(command->path, pathToCommands);
+#ifndef FAT12_MULTI_CALL
+   strcat(command->path, commandName);
+   if (access(command->path, X_OK) == -1)
+      return NULL;
+#endif
+   numResolvedCommands++;
+   return command->path;
+}
+
+
+void forgetCommand(const char* commandName)
+{
+   int i;
+   
+   // Find the command's executable again next time, since it has moved.
+   for (i = 0; i < numResolvedCommands; i++)
+   {
+      if (strcmp(resolvedCommands[i].name, commandName) == 0)
+      {
+         resolvedCommands[i] = resolvedCommands[--numResolvedCommands];
+         return;
+      }
+   }
+}
+
+
+double getTime()
+{
+   struct timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return now.tv_sec + (now.tv_nsec / 1.0e9);
+}
+
+
+double getTimeValue(struct timeval* time)
+{
+   return time->tv_sec + (time->tv_usec / 1.0e6);
+}
+
+
+void recordTimings(const char* commandName, double wallTime,
+                   struct rusage* usage, int isTraced)
+{
+   CommandTimings* timings = NULL;
+   int i;
+   
+   // Find the command's timings, or start new ones.
+   for (i = 0; i < numTimedCommands; i++)
+   {
+      if (strcmp(commandTimings[i]->name, commandName) == 0)
+      {
+         timings = commandTimings[i];
+         break;
+      }
+   }
+   if (timings == NULL)
+   {
+      if (numTimedCommands == MAX_TIMED_COMMANDS)
+         return;
+      timings = (CommandTimings*) calloc(1, sizeof(CommandTimings));
+      strcpy(timings->name, commandName);
+      initHistogram(&timings->wallTime);
+      commandTimings[numTimedCommands++] = timings;
+   }
+   
+   recordHistogramValue(&timings->wallTime,
+                        (unsigned long long) (wallTime * 1.0e6 + 0.5));
+   timings->userTime += getTimeValue(&usage->ru_utime);
+   timings->systemTime += getTimeValue(&usage->ru_stime);
+   timings->minorFaults += usage->ru_minflt;
+   timings->majorFaults += usage->ru_majflt;
+   
+   if (isTraced)
+   {
+      fprintf(stderr, "[%s: %.3f ms wall, %.3f ms user, %.3f ms sys, "
+              "%ld minor / %ld major faults]\n", commandName,
+              wallTime * 1000.0, getTimeValue(&usage->ru_utime) * 1000.0,
+              getTimeValue(&usage->ru_stime) * 1000.0, usage->ru_minflt,
+              usage->ru_majflt);
+   }
+}
+
+
+void printTimings()
+{
+   int i;
+   
+   printf("%-10s%7s%10s%10s%10s%10s%10s%10s%8s%8s\n", "Command", "Runs",
+          "p50 ms", "p95 ms", "p99 ms", "max ms", "user ms", "sys ms",
+          "minflt", "majflt");
+   for (i = 0; i < numTimedCommands; i++)
+   {
+      CommandTimings* timings = commandTimings[i];
+      Histogram* histogram = &timings->wallTime;
+      double runs = (double) histogram->totalCount;
+      
+      // CPU times and faults are averages per run.
+      printf("%-10s%7llu%10.3f%10.3f%10.3f%10.3f%10.3f%10.3f%8.0f%8.0f\n",
+             timings->name, histogram->totalCount,
+             getHistogramPercentile(histogram, 50.0) / 1000.0,
+             getHistogramPercentile(histogram, 95.0) / 1000.0,
+             getHistogramPercentile(histogram, 99.0) / 1000.0,
+             histogram->maxValue / 1000.0,
+             timings->userTime * 1000.0 / runs,
+             timings->systemTime * 1000.0 / runs,
+             timings->minorFaults / runs, timings->majorFaults / runs);
+   }
 }
 
 
@@ -139,37 +574,161 @@ void displayPrompt()
 }
 
 
-int readCommand(char* command, char** params)
+int readCommand(Pipeline* pipeline)
 {
    char* lineOfInput = NULL; // getline() will allocate this string.
    size_t numBytes = 0;
-   int counter = 0;
+   ssize_t lineLength;
+   char* tokens[(MAX_PARAMS + 2) * MAX_PIPELINE_STAGES];
+   int numTokens = 0;
+   char* nextChar;
+   char* output;
+   int i;
  
-   // Get the user's line of input, then tokenize it, delimited by spaces.
-   getline(&lineOfInput, &numBytes, stdin);
-   char* token = strtok(lineOfInput, " \n");
+   // Get the user's line of input.
+   lineLength = getline(&lineOfInput, &numBytes, stdin);
+   if (lineLength == -1)
+   {
+     free(lineOfInput);
+     return -1;
+   }
    
-   if (token == NULL)
+   // Tokenize it, delimited by spaces. The operators '|', '<', '>' and '>>'
+   // are tokens of their own, even without spaces around them. Every token
+   // is copied into one block (at most twice the line's length, counting
+   // the terminators).
+   pipeline->tokens = (char*) malloc(2 * lineLength + 2);
+   output = pipeline->tokens;
+   nextChar = lineOfInput;
+   while (TRUE)
+   {
+      while (*nextChar == ' ' || *nextChar == '\t' || *nextChar == '\n')
+         nextChar++;
+      if (*nextChar == '\0')
+         break;
+      if (numTokens == sizeof(tokens) / sizeof(tokens[0]))
+      {
+         printf("Error: Too many parameters\n");
+         free(lineOfInput);
+         free(pipeline->tokens);
+         return 1;
+      }
+      
+      tokens[numTokens++] = output;
+      if (*nextChar == '|' || *nextChar == '<' || *nextChar == '>')
+      {
+         if (nextChar[0] == '>' && nextChar[1] == '>')
+            *output++ = *nextChar++;
+         *output++ = *nextChar++;
+      }
+      else
+      {
+         while (*nextChar != '\0' && strchr(" \t\n|<>", *nextChar) == NULL)
+            *output++ = *nextChar++;
+      }
+      *output++ = '\0';
+   }
+   free(lineOfInput);
+   
+   if (numTokens == 0)
    {
      // The user entered nothing at all!
+     free(pipeline->tokens);
      return 1;
    }
    
-   // The first token is always the command name.
-   strcpy(command, token);
-
-   // Read each parameter.
-   while (token != NULL)
+   // Split the tokens into the commands of a pipeline, and pick out the
+   // redirections.
+   PipelineStage* stage = &pipeline->stages[0];
+   int numParams = 0;
+   pipeline->numStages = 1;
+   pipeline->inputFileName = NULL;
+   pipeline->outputFileName = NULL;
+   pipeline->isAppending = FALSE;
+   for (i = 0; i <= numTokens; i++)
    {
-      params[counter] = (char*) malloc(strlen(token) + 1);
-      strcpy(params[counter], token);
-      token = strtok(NULL, " \n");
-      counter++;
+      if (i == numTokens || strcmp(tokens[i], "|") == 0)
+      {
+         // The end of a command.
+         if (numParams == 0)
+         {
+            printf("Error: Missing command in pipeline\n");
+            break;
+         }
+         if (i == numTokens)
+         {
+            stage->params[numParams] = NULL;
+            return 0;
+         }
+         if (pipeline->outputFileName != NULL)
+         {
+            printf("Error: Only the last command's output can be "
+                   "redirected\n");
+            break;
+         }
+         if (pipeline->numStages == MAX_PIPELINE_STAGES)
+         {
+            printf("Error: Too many commands in pipeline\n");
+            break;
+         }
+         stage->params[numParams] = NULL;
+         stage = &pipeline->stages[pipeline->numStages++];
+         numParams = 0;
+      }
+      else if (strcmp(tokens[i], "<") == 0 || strcmp(tokens[i], ">") == 0 ||
+               strcmp(tokens[i], ">>") == 0)
+      {
+         // A redirection, followed by the host file's name.
+         if (i + 1 == numTokens || strchr("|<>", tokens[i + 1][0]) != NULL)
+         {
+            printf("Error: Missing file name after '%s'\n", tokens[i]);
+            break;
+         }
+         if (tokens[i][0] == '<')
+         {
+            if (pipeline->numStages > 1)
+            {
+               printf("Error: Only the first command's input can be "
+                      "redirected\n");
+               break;
+            }
+            pipeline->inputFileName = tokens[++i];
+         }
+         else
+         {
+            pipeline->outputFileName = tokens[++i];
+            pipeline->isAppending = (tokens[i - 1][1] == '>');
+         }
+      }
+      else if (numParams == MAX_PARAMS)
+      {
+         printf("Error: Too many parameters\n");
+         break;
+      }
+      else
+      {
+         // The first token is always the command name.
+         if (numParams == 0)
+         {
+            if (strlen(tokens[i]) >= sizeof(stage->name))
+            {
+               printf("Error: Unknown command '%s'\n", tokens[i]);
+               break;
+            }
+            strcpy(stage->name, tokens[i]);
+            stage->isHostCommand = (tokens[i][0] == '!');
+            if (stage->isHostCommand)
+               tokens[i]++;
+            if (tokens[i][0] == '\0')
+            {
+               printf("Error: Missing command after '!'\n");
+               break;
+            }
+         }
+         stage->params[numParams++] = tokens[i];
+      }
    }
-   params[counter] = NULL; // Null terminate the parameter list.
    
-   free(lineOfInput);
-   return 0;
+   free(pipeline->tokens);
+   return 1;
 }
-
-
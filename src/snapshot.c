@@ -0,0 +1,184 @@
+/******************************************************************************
+ * snapshot.c: Snapshot
+ *
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Takes, rolls back and commits copy-on-write snapshots of a
+ *              disk image (see overlay.h). This runs on its own, outside of
+ *              the shell:
+ *
+ *              Usage: snapshot create IMAGE
+ *                 or: snapshot rollback IMAGE
+ *                 or: snapshot commit IMAGE
+ *                 or: snapshot status IMAGE
+ *
+ *              create takes a snapshot, after which every change to the
+ *              image goes to '<image>.delta' instead. rollback throws those
+ *              changes away, putting the image back as it was when the
+ *              snapshot was taken, and commit keeps them by writing them into
+ *              the image. Both end the snapshot. status prints how many
+ *              sectors have changed since the snapshot.
+ *
+ *              The image is locked while this runs, so no command sees it
+ *              half-done, and an image with a journal waiting to be
+ *              checkpointed (see journal.h) is left alone.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ *****************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "compressedImage.h"
+#include "journal.h"
+#include "overlay.h"
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+static void usage();
+static int lockImage(int fd, short type);
+
+
+/******************************************************************************
+ * main - runs the snapshot program.
+ *****************************************************************************/
+int main(int argc, char* argv[])
+{
+  const char* action;
+  const char* imageFileName;
+  int isStatus;
+  unsigned long long numSectors;
+  unsigned long long numBytesUsed;
+  int imageFd;
+  int rc = 0;
+
+  if (argc != 3)
+  {
+    usage();
+    return -1;
+  }
+  action = argv[1];
+  imageFileName = argv[2];
+  if (strcmp(action, "create") != 0 && strcmp(action, "rollback") != 0 &&
+      strcmp(action, "commit") != 0 && strcmp(action, "status") != 0)
+  {
+    usage();
+    return -1;
+  }
+
+  // Hold the same lock commands take to write the image (or to read it, for
+  // status), so none of them is part way through a change.
+  isStatus = (strcmp(action, "status") == 0);
+  imageFd = open(imageFileName, (isStatus ? O_RDONLY : O_RDWR));
+  if (imageFd == -1)
+  {
+    perror(imageFileName);
+    return -1;
+  }
+  if (lockImage(imageFd, (isStatus ? F_RDLCK : F_WRLCK)) != 0)
+  {
+    perror(imageFileName);
+    close(imageFd);
+    return -1;
+  }
+
+  if (isStatus)
+  {
+    if (getOverlayUsage(imageFileName, &numSectors, &numBytesUsed) != 0)
+    {
+      printf("%s has no snapshot\n", imageFileName);
+    }
+    else
+    {
+      printf("%s has a snapshot: %llu sectors (%llu KB) changed since, "
+             "taking up %llu KB\n", imageFileName, numSectors,
+             numSectors * OVERLAY_SECTOR_SIZE / 1024, numBytesUsed / 1024);
+    }
+  }
+  else if (isFatJournalPending(imageFileName))
+  {
+    printf("Error: %s has a journal waiting to be checkpointed; exit the "
+           "shell first\n", imageFileName);
+    rc = -1;
+  }
+  else if (strcmp(action, "create") == 0)
+  {
+    if (hasOverlay(imageFileName))
+    {
+      printf("Error: %s already has a snapshot\n", imageFileName);
+      rc = -1;
+    }
+    else if (isCompressedImage(imageFd))
+    {
+      printf("Error: %s is compressed; unpack it first\n", imageFileName);
+      rc = -1;
+    }
+    else if (createOverlay(imageFileName, imageFd) != 0)
+    {
+      perror(imageFileName);
+      rc = -1;
+    }
+  }
+  else if (!hasOverlay(imageFileName))
+  {
+    printf("Error: %s has no snapshot\n", imageFileName);
+    rc = -1;
+  }
+  else if (strcmp(action, "rollback") == 0)
+  {
+    if (rollbackOverlay(imageFileName) != 0)
+    {
+      printf("Error: could not roll back %s\n", imageFileName);
+      rc = -1;
+    }
+  }
+  else if (commitOverlay(imageFileName, imageFd) != 0)
+  {
+    printf("Error: could not commit %s; its snapshot is kept\n",
+           imageFileName);
+    rc = -1;
+  }
+
+  close(imageFd); // which unlocks it
+  return rc;
+}
+
+/******************************************************************************
+ * usage - prints how to run the program.
+ *****************************************************************************/
+static void usage()
+{
+  printf("Usage: snapshot create|rollback|commit|status IMAGE\n");
+}
+
+/******************************************************************************
+ * lockImage - takes a lock on the disk image, waiting for commands to
+ *             finish with it.
+ *
+ * fd - the image's file descriptor
+ * type - F_RDLCK or F_WRLCK
+ *
+ * Return - 0 on success, -1 on failure
+ *****************************************************************************/
+static int lockImage(int fd, short type)
+{
+  struct flock lock;
+
+  memset(&lock, 0, sizeof(lock));
+  lock.l_type   = type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start  = 0;
+  lock.l_len    = 0;
+  while (fcntl(fd, F_SETLKW, &lock) == -1)
+  {
+    if (errno != EINTR)
+      return -1;
+  }
+  return 0;
+}
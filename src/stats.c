@@ -0,0 +1,57 @@
+/******************************************************************************
+ * stats.c: Statistics
+ *
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Performs the stats command, which prints the I/O and FAT
+ *              operation counters of every command run so far in the
+ *              session.
+ *
+ *              Usage: stats [-j] [-r]
+ *                -j  print the counters as JSON
+ *                -r  reset the counters after printing them
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "fat.h"
+
+
+int main(int argc, char* argv[])
+{
+  int format = FAT_STATS_FORMAT_HUMAN;
+  int reset = 0;
+  int i;
+
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-j") == 0)
+    {
+      format = FAT_STATS_FORMAT_JSON;
+    }
+    else if (strcmp(argv[i], "-r") == 0)
+    {
+      reset = 1;
+    }
+    else
+    {
+      printf("Usage: stats [-j] [-r]\n");
+      return -1;
+    }
+  }
+
+  if (initializeFatFileSystem(FAT_LOCK_SHARED) != 0)
+    return -1;
+
+  // This command's own counters are added when it terminates, so they show
+  // up the next time.
+  printFatStats(stdout, "session", &fatFileSystem.session->stats, format);
+  if (reset)
+    resetFatStats(&fatFileSystem.session->stats);
+
+  terminateFatFileSystem();
+  return 0;
+}
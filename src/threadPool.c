@@ -0,0 +1,376 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function definitions for the work-stealing thread pool.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "threadPool.h"
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * Task - a function to run, and its argument.
+ *****************************************************************************/
+typedef struct
+{
+  ThreadPoolFunction function;
+  void*              argument;
+} Task;
+
+/******************************************************************************
+ * TaskQueue - a worker's double-ended queue of tasks. The worker takes tasks
+ *             from the back, and other workers steal them from the front.
+ *****************************************************************************/
+typedef struct
+{
+  pthread_mutex_t mutex;
+  Task*           tasks; // circular buffer
+  int             capacity;
+  int             front;
+  int             count;
+} TaskQueue;
+
+/******************************************************************************
+ * Worker - a worker thread and its task queue.
+ *****************************************************************************/
+typedef struct
+{
+  ThreadPool* threadPool;
+  int         index;
+  pthread_t   thread;
+  TaskQueue   queue;
+} Worker;
+
+/******************************************************************************
+ * ThreadPool - a pool of worker threads.
+ *****************************************************************************/
+struct ThreadPool
+{
+  Worker*         workers;
+  int             numWorkers;
+  pthread_mutex_t mutex;
+  pthread_cond_t  taskAvailable; // signaled when a task is submitted
+  pthread_cond_t  allTasksDone; // signaled when numPendingTasks hits 0
+  int             numQueuedTasks; // waiting in a queue
+  int             numPendingTasks; // queued or running
+  int             nextQueue; // round-robin queue for outside submissions
+  int             isShuttingDown;
+};
+
+
+//-----------------------------------------------------------------------------
+// Variables
+//-----------------------------------------------------------------------------
+
+// The worker that is running on the current thread (NULL if not a worker).
+static __thread Worker* currentWorker = NULL;
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * runWorker - the main loop of a worker thread.
+ *****************************************************************************/
+static void* runWorker(void* argument);
+
+/******************************************************************************
+ * pushBack - add a task to the back of a queue.
+ *****************************************************************************/
+static void pushBack(TaskQueue* queue, Task task);
+
+/******************************************************************************
+ * popBack - take the newest task from the back of a queue.
+ *
+ * Return - 1 if a task was taken, 0 if the queue was empty
+ *****************************************************************************/
+static int popBack(TaskQueue* queue, Task* task);
+
+/******************************************************************************
+ * popFront - steal the oldest task from the front of a queue.
+ *
+ * Return - 1 if a task was taken, 0 if the queue was empty
+ *****************************************************************************/
+static int popFront(TaskQueue* queue, Task* task);
+
+/******************************************************************************
+ * findTask - find a task for a worker, first from its own queue, then by
+ *            stealing from the other workers.
+ *
+ * Return - 1 if a task was found, 0 if every queue was empty
+ *****************************************************************************/
+static int findTask(Worker* worker, Task* task);
+
+
+//-----------------------------------------------------------------------------
+// Thread Pool interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * createThreadPool
+ *****************************************************************************/
+ThreadPool* createThreadPool(int numThreads)
+{
+  ThreadPool* threadPool;
+  int i;
+
+  if (numThreads <= 0)
+    numThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (numThreads <= 0)
+    numThreads = 1;
+
+  threadPool = (ThreadPool*) calloc(1, sizeof(ThreadPool));
+  threadPool->numWorkers = numThreads;
+  threadPool->workers = (Worker*) calloc(numThreads, sizeof(Worker));
+  pthread_mutex_init(&threadPool->mutex, NULL);
+  pthread_cond_init(&threadPool->taskAvailable, NULL);
+  pthread_cond_init(&threadPool->allTasksDone, NULL);
+
+  for (i = 0; i < numThreads; i++)
+  {
+    Worker* worker = &threadPool->workers[i];
+    worker->threadPool = threadPool;
+    worker->index = i;
+    pthread_mutex_init(&worker->queue.mutex, NULL);
+  }
+
+  // Start the threads once every worker's queue is ready to be stolen from.
+  for (i = 0; i < numThreads; i++)
+  {
+    Worker* worker = &threadPool->workers[i];
+    if (pthread_create(&worker->thread, NULL, runWorker, worker) != 0)
+    {
+      threadPool->numWorkers = i;
+      destroyThreadPool(threadPool);
+      return NULL;
+    }
+  }
+
+  return threadPool;
+}
+
+/******************************************************************************
+ * destroyThreadPool
+ *****************************************************************************/
+void destroyThreadPool(ThreadPool* threadPool)
+{
+  int i;
+
+  waitForTasks(threadPool);
+
+  pthread_mutex_lock(&threadPool->mutex);
+  threadPool->isShuttingDown = 1;
+  pthread_cond_broadcast(&threadPool->taskAvailable);
+  pthread_mutex_unlock(&threadPool->mutex);
+
+  for (i = 0; i < threadPool->numWorkers; i++)
+  {
+    pthread_join(threadPool->workers[i].thread, NULL);
+    pthread_mutex_destroy(&threadPool->workers[i].queue.mutex);
+    free(threadPool->workers[i].queue.tasks);
+  }
+
+  pthread_cond_destroy(&threadPool->allTasksDone);
+  pthread_cond_destroy(&threadPool->taskAvailable);
+  pthread_mutex_destroy(&threadPool->mutex);
+  free(threadPool->workers);
+  free(threadPool);
+}
+
+/******************************************************************************
+ * submitTask
+ *****************************************************************************/
+void submitTask(ThreadPool* threadPool, ThreadPoolFunction function,
+                void* argument)
+{
+  Task task;
+  Worker* worker = currentWorker;
+
+  task.function = function;
+  task.argument = argument;
+
+  // Count the task before it can possibly run, so waitForTasks() can't see
+  // zero pending tasks in between.
+  pthread_mutex_lock(&threadPool->mutex);
+  threadPool->numPendingTasks++;
+  threadPool->numQueuedTasks++;
+  if (worker == NULL || worker->threadPool != threadPool)
+  {
+    worker = &threadPool->workers[threadPool->nextQueue];
+    threadPool->nextQueue = (threadPool->nextQueue + 1) %
+                            threadPool->numWorkers;
+  }
+  pushBack(&worker->queue, task);
+  pthread_cond_signal(&threadPool->taskAvailable);
+  pthread_mutex_unlock(&threadPool->mutex);
+}
+
+/******************************************************************************
+ * waitForTasks
+ *****************************************************************************/
+void waitForTasks(ThreadPool* threadPool)
+{
+  pthread_mutex_lock(&threadPool->mutex);
+  while (threadPool->numPendingTasks > 0)
+    pthread_cond_wait(&threadPool->allTasksDone, &threadPool->mutex);
+  pthread_mutex_unlock(&threadPool->mutex);
+}
+
+/******************************************************************************
+ * getThreadPoolSize
+ *****************************************************************************/
+int getThreadPoolSize(ThreadPool* threadPool)
+{
+  return threadPool->numWorkers;
+}
+
+
+//-----------------------------------------------------------------------------
+// Internal Functions
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * runWorker
+ *****************************************************************************/
+static void* runWorker(void* argument)
+{
+  Worker* worker = (Worker*) argument;
+  ThreadPool* threadPool = worker->threadPool;
+  Task task;
+
+  currentWorker = worker;
+
+  while (1)
+  {
+    // Sleep until there is something to do.
+    pthread_mutex_lock(&threadPool->mutex);
+    while (threadPool->numQueuedTasks == 0 && !threadPool->isShuttingDown)
+      pthread_cond_wait(&threadPool->taskAvailable, &threadPool->mutex);
+    if (threadPool->numQueuedTasks == 0 && threadPool->isShuttingDown)
+    {
+      pthread_mutex_unlock(&threadPool->mutex);
+      break;
+    }
+    pthread_mutex_unlock(&threadPool->mutex);
+
+    // Another worker may get to the task first, in which case we go back
+    // to sleep.
+    if (!findTask(worker, &task))
+      continue;
+
+    pthread_mutex_lock(&threadPool->mutex);
+    threadPool->numQueuedTasks--;
+    pthread_mutex_unlock(&threadPool->mutex);
+
+    task.function(task.argument);
+
+    pthread_mutex_lock(&threadPool->mutex);
+    threadPool->numPendingTasks--;
+    if (threadPool->numPendingTasks == 0)
+      pthread_cond_broadcast(&threadPool->allTasksDone);
+    pthread_mutex_unlock(&threadPool->mutex);
+  }
+
+  currentWorker = NULL;
+  return NULL;
+}
+
+/******************************************************************************
+ * pushBack
+ *****************************************************************************/
+static void pushBack(TaskQueue* queue, Task task)
+{
+  pthread_mutex_lock(&queue->mutex);
+
+  // Grow the circular buffer, unwrapping it into the new one.
+  if (queue->count == queue->capacity)
+  {
+    int newCapacity = (queue->capacity == 0 ? 64 : queue->capacity * 2);
+    Task* tasks = (Task*) malloc(newCapacity * sizeof(Task));
+    int i;
+    for (i = 0; i < queue->count; i++)
+      tasks[i] = queue->tasks[(queue->front + i) % queue->capacity];
+    free(queue->tasks);
+    queue->tasks = tasks;
+    queue->capacity = newCapacity;
+    queue->front = 0;
+  }
+
+  queue->tasks[(queue->front + queue->count) % queue->capacity] = task;
+  queue->count++;
+
+  pthread_mutex_unlock(&queue->mutex);
+}
+
+/******************************************************************************
+ * popBack
+ *****************************************************************************/
+static int popBack(TaskQueue* queue, Task* task)
+{
+  int found = 0;
+
+  pthread_mutex_lock(&queue->mutex);
+  if (queue->count > 0)
+  {
+    queue->count--;
+    *task = queue->tasks[(queue->front + queue->count) % queue->capacity];
+    found = 1;
+  }
+  pthread_mutex_unlock(&queue->mutex);
+
+  return found;
+}
+
+/******************************************************************************
+ * popFront
+ *****************************************************************************/
+static int popFront(TaskQueue* queue, Task* task)
+{
+  int found = 0;
+
+  pthread_mutex_lock(&queue->mutex);
+  if (queue->count > 0)
+  {
+    *task = queue->tasks[queue->front];
+    queue->front = (queue->front + 1) % queue->capacity;
+    queue->count--;
+    found = 1;
+  }
+  pthread_mutex_unlock(&queue->mutex);
+
+  return found;
+}
+
+/******************************************************************************
+ * findTask
+ *****************************************************************************/
+static int findTask(Worker* worker, Task* task)
+{
+  ThreadPool* threadPool = worker->threadPool;
+  int i;
+
+  if (popBack(&worker->queue, task))
+    return 1;
+
+  // Steal from the other workers, starting with the next one over.
+  for (i = 1; i < threadPool->numWorkers; i++)
+  {
+    Worker* victim = &threadPool->workers[(worker->index + i) %
+                                          threadPool->numWorkers];
+    if (popFront(&victim->queue, task))
+      return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,93 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function headers for a work-stealing thread pool, used by
+ *              commands that walk the directory tree in parallel.
+ *
+ *              Each worker thread has its own queue of tasks. Tasks submitted
+ *              from a worker (such as a task for each subdirectory found
+ *              while scanning a directory) go onto that worker's queue, which
+ *              it works through newest-first. A worker with nothing left to
+ *              do steals the oldest task from another worker's queue, which
+ *              tends to be the biggest remaining subtree.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * ThreadPoolFunction - a function to run as a task in a thread pool.
+ *****************************************************************************/
+typedef void (*ThreadPoolFunction)(void* argument);
+
+/******************************************************************************
+ * ThreadPool - a pool of worker threads (defined in threadPool.c).
+ *****************************************************************************/
+typedef struct ThreadPool ThreadPool;
+
+
+//-----------------------------------------------------------------------------
+// Thread Pool interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * createThreadPool - Create a thread pool and start its worker threads
+ *
+ * numThreads - the number of worker threads, or 0 to use one per CPU
+ *
+ * Return - the new thread pool, or NULL on failure
+ *****************************************************************************/
+ThreadPool* createThreadPool(int numThreads);
+
+/******************************************************************************
+ * destroyThreadPool - Wait for all of a thread pool's tasks to finish, then
+ *                     stop its worker threads and free it
+ *
+ * threadPool - the thread pool to destroy
+ *
+ * Return - none
+ *****************************************************************************/
+void destroyThreadPool(ThreadPool* threadPool);
+
+/******************************************************************************
+ * submitTask - Add a task to a thread pool. This may be called from inside
+ *              another task.
+ *
+ * threadPool - the thread pool to run the task
+ * function - the function to run
+ * argument - the argument to pass to the function
+ *
+ * Return - none
+ *****************************************************************************/
+void submitTask(ThreadPool* threadPool, ThreadPoolFunction function,
+                void* argument);
+
+/******************************************************************************
+ * waitForTasks - Wait until every task submitted to a thread pool, including
+ *                tasks submitted by other tasks, has finished
+ *
+ * threadPool - the thread pool to wait for
+ *
+ * Return - none
+ *****************************************************************************/
+void waitForTasks(ThreadPool* threadPool);
+
+/******************************************************************************
+ * getThreadPoolSize - Get the number of worker threads in a thread pool
+ *
+ * threadPool - the thread pool
+ *
+ * Return - the number of worker threads
+ *****************************************************************************/
+int getThreadPoolSize(ThreadPool* threadPool);
+
+
+#endif //_THREAD_POOL_H_
@@ -26,7 +26,7 @@ int main(int argc, char* argv[])
     return -1;
   }
   
-  if (initializeFatFileSystem() != 0)
+  if (initializeFatFileSystem(FAT_LOCK_EXCLUSIVE) != 0)
     return -1;
   
   int rc =  touchCommand(argv[1]);
@@ -71,7 +71,7 @@ int touchCommand(char* pathName)
   }
     
   // Open the parent directory.
-  unsigned short flcOfParentDir = filePath.dirLevels[filePath.depthLevel - 1]
+  unsigned int flcOfParentDir = filePath.dirLevels[filePath.depthLevel - 1]
     .firstLogicalCluster;
   DirectoryEntry* parentDir = openDirectory(flcOfParentDir); 
   
@@ -79,6 +79,7 @@ int touchCommand(char* pathName)
   if (findEntryByName(parentDir, fileName) >= 0)
   {
     printf("Error: cannot create file '%s': File exists\n", fileName);
+    closeDirectory(parentDir);
     free(fileName);
     return -1;
   }
@@ -89,6 +90,7 @@ int touchCommand(char* pathName)
                           &newEntryIndex);
   if (rc != 0)
   {
+    closeDirectory(parentDir);
     free(fileName);
     return rc;
   }
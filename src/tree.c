@@ -0,0 +1,159 @@
+/******************************************************************************
+ * tree.c: List a directory tree
+ *
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Performs the tree command, which draws the tree of files and
+ *              directories under a path (defaulting to the current working
+ *              directory).
+ *
+ *              Usage: tree [-s] [-j THREADS] [PATH]
+ *                -s          print each entry's size and allocated space
+ *                -j THREADS  the number of threads to use (default: one per
+ *                            CPU)
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fat.h"
+#include "treeWalk.h"
+
+
+//-----------------------------------------------------------------------------
+// Variables
+//-----------------------------------------------------------------------------
+
+static int isPrintingSizes = 0;
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+static void usage();
+static void printNode(TreeNode* node);
+static void printChildren(TreeNode* node, char* prefix, size_t prefixLength);
+
+
+/******************************************************************************
+ * main - runs the tree command.
+ *****************************************************************************/
+int main(int argc, char* argv[])
+{
+  const char* pathName = NULL;
+  int numThreads = 0;
+  int i;
+
+  // Parse the arguments.
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-s") == 0)
+      isPrintingSizes = 1;
+    else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+    {
+      char* endptr;
+      numThreads = strtol(argv[++i], &endptr, 10);
+      if (*endptr != '\0' || numThreads < 1)
+      {
+        printf("THREADS must be a positive number\n");
+        usage();
+        return -1;
+      }
+    }
+    else if (argv[i][0] != '-' && pathName == NULL)
+      pathName = argv[i];
+    else
+    {
+      usage();
+      return -1;
+    }
+  }
+
+  if (initializeFatFileSystem(FAT_LOCK_SHARED) != 0)
+    return -1;
+
+  // Find the path to start at.
+  FilePath filePath;
+  getWorkingDirectory(&filePath);
+  if (pathName != NULL &&
+      changeFilePath(&filePath, pathName, PATH_TYPE_ANY) != 0)
+  {
+    terminateFatFileSystem();
+    return -1;
+  }
+
+  TreeNode* root = walkTree(&filePath, numThreads);
+  if (root == NULL)
+  {
+    terminateFatFileSystem();
+    return -1;
+  }
+
+  // Draw the tree, starting with the path as it was given.
+  char prefix[FAT12_MAX_DIRECTORY_DEPTH * 4 + 1] = "";
+  printNode(root);
+  printf("%s\n", (pathName != NULL ? pathName : filePath.pathName));
+  printChildren(root, prefix, 0);
+  printf("\n%u directories, %u files\n", root->totalDirectories,
+         root->totalFiles);
+
+  freeTree(root);
+  terminateFatFileSystem();
+  return 0;
+}
+
+/******************************************************************************
+ * usage - prints the usage statement.
+ *****************************************************************************/
+static void usage()
+{
+  printf("Usage: tree [-s] [-j THREADS] [PATH]\n");
+  printf("Lists the files and directories under a directory as a tree.\n");
+}
+
+/******************************************************************************
+ * printNode - print the part of a node's line that comes before its name.
+ *
+ * node - the node
+ *****************************************************************************/
+static void printNode(TreeNode* node)
+{
+  if (isPrintingSizes)
+    printf("[%10llu %10llu]  ", node->totalSize, getAllocatedSize(node));
+}
+
+/******************************************************************************
+ * printChildren - print a line for each of a node's children, and under each
+ *                 directory, its own children.
+ *
+ * node - the node
+ * prefix - the lines drawn to the left of the node's children, in a buffer
+ *          long enough to add to
+ * prefixLength - the length of the prefix
+ *****************************************************************************/
+static void printChildren(TreeNode* node, char* prefix, size_t prefixLength)
+{
+  unsigned int i;
+
+  for (i = 0; i < node->numChildren; i++)
+  {
+    TreeNode* child = &node->children[i];
+    int isLast = (i == node->numChildren - 1);
+
+    printf("%s%s", prefix, (isLast ? "`-- " : "|-- "));
+    printNode(child);
+    printf("%s%s\n", child->name, (child->isDirectory ? "/" : ""));
+
+    if (child->numChildren > 0 &&
+        prefixLength + 4 < FAT12_MAX_DIRECTORY_DEPTH * 4)
+    {
+      strcpy(prefix + prefixLength, (isLast ? "    " : "|   "));
+      printChildren(child, prefix, prefixLength + 4);
+      prefix[prefixLength] = '\0';
+    }
+  }
+}
@@ -0,0 +1,399 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function definitions for walking the directory tree in
+ *              parallel.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "treeWalk.h"
+#include "threadPool.h"
+
+
+//-----------------------------------------------------------------------------
+// Definitions
+//-----------------------------------------------------------------------------
+
+// How many clusters of a subdirectory to ask the kernel to read ahead when
+// it is queued, so they are likely in memory by the time a thread gets to
+// it.
+#define READAHEAD_CLUSTERS 16
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * WalkTask - a directory for a worker thread to read.
+ *****************************************************************************/
+typedef struct
+{
+  TreeNode*    node;
+  unsigned int depth;
+} WalkTask;
+
+
+//-----------------------------------------------------------------------------
+// Variables
+//-----------------------------------------------------------------------------
+
+static ThreadPool*          threadPool;
+
+// The read-only mapping of the disk image, or NULL to read through the
+// image's stream instead.
+static const unsigned char* imageData = NULL;
+static size_t               imageSize = 0;
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * walkDirectory - read a directory's entries into its node's children,
+ *                 submitting a new task for each of its subdirectories.
+ *                 This runs on a worker thread.
+ *
+ * argument - the WalkTask for the directory, which is freed
+ *
+ * Return - none
+ *****************************************************************************/
+static void walkDirectory(void* argument);
+
+/******************************************************************************
+ * readMappedDirectory - read a whole directory out of the image mapping,
+ *                       ending it with an empty entry.
+ *
+ * flc - the directory's first logical cluster
+ *
+ * Return - the directory's entries, to be freed with closeDirectory()
+ *****************************************************************************/
+static DirectoryEntry* readMappedDirectory(unsigned int flc);
+
+/******************************************************************************
+ * readAheadMappedDirectory - ask the kernel to start reading the first
+ *                            clusters of a directory into the image mapping.
+ *
+ * flc - the directory's first logical cluster
+ *
+ * Return - none
+ *****************************************************************************/
+static void readAheadMappedDirectory(unsigned int flc);
+
+/******************************************************************************
+ * addTotals - add up the totals of a node and everything under it.
+ *
+ * node - the node
+ *
+ * Return - none
+ *****************************************************************************/
+static void addTotals(TreeNode* node);
+
+/******************************************************************************
+ * freeChildren - free a node's children and everything under them.
+ *
+ * node - the node
+ *
+ * Return - none
+ *****************************************************************************/
+static void freeChildren(TreeNode* node);
+
+
+//-----------------------------------------------------------------------------
+// Tree Walk interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * walkTree
+ *****************************************************************************/
+TreeNode* walkTree(FilePath* filePath, int numThreads)
+{
+  TreeNode* root = (TreeNode*) calloc(1, sizeof(TreeNode));
+  struct stat imageStat;
+
+  // Make a node for the starting point, from its entry in its parent
+  // directory (the root directory has no entry of its own).
+  if (filePath->depthLevel == 1)
+  {
+    strcpy(root->name, "/");
+    root->entry.attributes = DIR_ENTRY_ATTRIB_SUBDIRECTORY;
+    root->isDirectory = 1;
+  }
+  else
+  {
+    DirectoryEntry* parentDir = openDirectory(
+      filePath->dirLevels[filePath->depthLevel - 2].firstLogicalCluster);
+    if (parentDir == NULL)
+    {
+      free(root);
+      return NULL;
+    }
+    root->entry = parentDir[filePath->dirLevels[filePath->depthLevel - 1]
+                            .indexInParentDirectory];
+    closeDirectory(parentDir);
+    getEntryName(&root->entry, root->name);
+    root->isDirectory = isEntryADirectory(&root->entry);
+  }
+  if (root->isDirectory || getEntryCluster(&root->entry) != 0)
+    root->numClusters = getFatEntryChainLength(getEntryCluster(&root->entry));
+
+  if (root->isDirectory)
+  {
+    // Map the image so every thread can read it at once, unless its block
+    // device already has it in memory, or is meant to keep it out of the
+    // page cache.
+    if (fatFileSystem.blockDevice->data != NULL)
+    {
+      imageSize = fatFileSystem.blockDevice->size;
+      imageData = fatFileSystem.blockDevice->data;
+    }
+    else if (fatFileSystem.blockDevice->fd != -1 &&
+             fstat(fileno(fatFileSystem.fileSystemId), &imageStat) == 0 &&
+             imageStat.st_size > 0)
+    {
+      imageSize = imageStat.st_size;
+      imageData = (const unsigned char*) mmap(NULL, imageSize, PROT_READ,
+        MAP_SHARED, fileno(fatFileSystem.fileSystemId), 0);
+      if (imageData == MAP_FAILED)
+        imageData = NULL;
+    }
+
+    threadPool = createThreadPool(numThreads);
+    if (threadPool == NULL)
+    {
+      printf("Error: could not start threads\n");
+      freeTree(root);
+      root = NULL;
+    }
+    else
+    {
+      WalkTask* task = (WalkTask*) malloc(sizeof(WalkTask));
+      task->node = root;
+      task->depth = filePath->depthLevel - 1;
+      submitTask(threadPool, walkDirectory, task);
+      waitForTasks(threadPool);
+      destroyThreadPool(threadPool);
+    }
+
+    if (imageData != NULL && imageData != fatFileSystem.blockDevice->data)
+      munmap((void*) imageData, imageSize);
+    imageData = NULL;
+  }
+
+  if (root != NULL)
+    addTotals(root);
+  return root;
+}
+
+/******************************************************************************
+ * freeTree
+ *****************************************************************************/
+void freeTree(TreeNode* root)
+{
+  freeChildren(root);
+  free(root);
+}
+
+/******************************************************************************
+ * getAllocatedSize
+ *****************************************************************************/
+unsigned long long getAllocatedSize(TreeNode* node)
+{
+  return node->totalClusters * fatFileSystem.geometry.bytesPerCluster;
+}
+
+
+//-----------------------------------------------------------------------------
+// Internal Functions
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * walkDirectory
+ *****************************************************************************/
+static void walkDirectory(void* argument)
+{
+  WalkTask* task = (WalkTask*) argument;
+  TreeNode* node = task->node;
+  DirectoryEntry* directory;
+  DirectoryEntry* entry;
+  TreeNode* child;
+  char name[FAT12_MAX_FILE_NAME_LENGTH];
+  unsigned int numEntries = 0;
+  int index = 0;
+
+  if (imageData != NULL)
+    directory = readMappedDirectory(getEntryCluster(&node->entry));
+  else
+  {
+    unsigned int numBytes;
+    directory = readDirectory(getEntryCluster(&node->entry), &numBytes);
+  }
+
+  // Count the entries, then fill them in.
+  for (entry = getFirstValidEntry(directory, &index); entry != NULL;
+       entry = getNextValidEntry(entry, &index))
+  {
+    numEntries++;
+  }
+  node->children = (TreeNode*) calloc(numEntries + 1, sizeof(TreeNode));
+
+  index = 0;
+  for (entry = getFirstValidEntry(directory, &index); entry != NULL;
+       entry = getNextValidEntry(entry, &index))
+  {
+    if (entry->attributes & DIR_ENTRY_ATTRIB_VOLUME_LABEL)
+      continue;
+    getEntryName(entry, name);
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+      continue;
+
+    child = &node->children[node->numChildren++];
+    strcpy(child->name, name);
+    child->entry = *entry;
+    child->isDirectory = isEntryADirectory(entry);
+
+    // Empty files don't need a chain at all.
+    if (getEntryCluster(entry) != 0)
+      child->numClusters = getFatEntryChainLength(getEntryCluster(entry));
+
+    // Read the subdirectory on another task.
+    if (child->isDirectory && getEntryCluster(entry) != 0 &&
+        task->depth + 1 < FAT12_MAX_DIRECTORY_DEPTH)
+    {
+      WalkTask* subtask = (WalkTask*) malloc(sizeof(WalkTask));
+      subtask->node = child;
+      subtask->depth = task->depth + 1;
+      if (imageData != NULL)
+        readAheadMappedDirectory(getEntryCluster(entry));
+      submitTask(threadPool, walkDirectory, subtask);
+    }
+  }
+
+  closeDirectory(directory);
+  free(task);
+}
+
+/******************************************************************************
+ * readMappedDirectory
+ *****************************************************************************/
+static DirectoryEntry* readMappedDirectory(unsigned int flc)
+{
+  unsigned int bytesPerSector = fatFileSystem.bootSector.bytesPerSector;
+  unsigned int sectorsPerCluster = fatFileSystem.geometry.sectorsPerCluster;
+  unsigned int numBytes = getFatEntryChainSize(flc);
+  unsigned int numSectors = numBytes / bytesPerSector;
+  unsigned char* data;
+  unsigned int cluster = flc;
+  unsigned int entryValue;
+  int entryType;
+  unsigned int sector;
+  unsigned int i;
+
+  // The session already has a copy of the FAT12 and FAT16 root directory,
+  // and the FAT32 one is a chain like any other.
+  if (flc == 0 && fatFileSystem.geometry.fatType != FAT_TYPE_32)
+    return readDirectory(0, &numBytes);
+  if (flc == 0)
+    cluster = fatFileSystem.geometry.rootDirectoryCluster;
+
+  data = (unsigned char*) malloc(numBytes + sizeof(DirectoryEntry));
+  FAT_STAT_ADD(FAT_STAT_DIRECTORY_READS, 1);
+  for (i = 0; i < numSectors; i++)
+  {
+    sector = logicalToPhysicalCluster(cluster) + (i % sectorsPerCluster);
+    if (i % sectorsPerCluster == sectorsPerCluster - 1)
+    {
+      getFatEntry(cluster, &entryValue, &entryType);
+      cluster = entryValue;
+    }
+
+    // Sectors still in the journal are newer than the image.
+    unsigned char* sectorData = data + (i * bytesPerSector);
+    size_t offset = (size_t) sector * bytesPerSector;
+    if (journalReadSector(sector, sectorData))
+      FAT_STAT_ADD(FAT_STAT_JOURNAL_READS, 1);
+    else if (offset + bytesPerSector <= imageSize)
+      memcpy(sectorData, imageData + offset, bytesPerSector);
+    else
+      memset(sectorData, 0, bytesPerSector);
+  }
+  FAT_STAT_ADD(FAT_STAT_SECTORS_READ, numSectors);
+  FAT_STAT_ADD(FAT_STAT_BYTES_READ, numBytes);
+
+  memset(data + numBytes, 0, sizeof(DirectoryEntry));
+  return (DirectoryEntry*) data;
+}
+
+/******************************************************************************
+ * readAheadMappedDirectory
+ *****************************************************************************/
+static void readAheadMappedDirectory(unsigned int flc)
+{
+  SectorRun runs[READAHEAD_CLUSTERS];
+  size_t pageSize = sysconf(_SC_PAGESIZE);
+  unsigned int numClusters;
+  unsigned int numRuns;
+  unsigned int i;
+
+  // Only the run boundaries matter here, not where the data would go.
+  numRuns = getClusterRuns(&flc, READAHEAD_CLUSTERS, NULL, runs,
+                           &numClusters);
+  for (i = 0; i < numRuns; i++)
+  {
+    size_t start = (size_t) runs[i].sector *
+                   fatFileSystem.bootSector.bytesPerSector;
+    size_t end = start + runs[i].numBytes;
+    if (end > imageSize)
+      end = imageSize;
+    if (start >= end)
+      continue;
+    start -= start % pageSize;
+    madvise((void*) (imageData + start), end - start, MADV_WILLNEED);
+  }
+}
+
+/******************************************************************************
+ * addTotals
+ *****************************************************************************/
+static void addTotals(TreeNode* node)
+{
+  unsigned int i;
+
+  node->totalSize = node->entry.fileSize;
+  node->totalClusters = node->numClusters;
+  node->totalFiles = 0;
+  node->totalDirectories = 0;
+
+  for (i = 0; i < node->numChildren; i++)
+  {
+    TreeNode* child = &node->children[i];
+    addTotals(child);
+    node->totalSize += child->totalSize;
+    node->totalClusters += child->totalClusters;
+    node->totalFiles += child->totalFiles + (child->isDirectory ? 0 : 1);
+    node->totalDirectories += child->totalDirectories +
+                              (child->isDirectory ? 1 : 0);
+  }
+}
+
+/******************************************************************************
+ * freeChildren
+ *****************************************************************************/
+static void freeChildren(TreeNode* node)
+{
+  unsigned int i;
+
+  for (i = 0; i < node->numChildren; i++)
+    freeChildren(&node->children[i]);
+  free(node->children);
+}
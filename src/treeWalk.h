@@ -0,0 +1,85 @@
+/*****************************************************************************
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Function headers for walking the directory tree in parallel,
+ *              used by the du, tree and find commands.
+ *
+ *              The whole tree under a path is read into memory, with sibling
+ *              subdirectories read in parallel on a thread pool. Directories
+ *              are read straight out of a read-only mapping of the disk image
+ *              shared by every thread, rather than one sector at a time
+ *              through the image's stream. Once the walk is done the tree
+ *              keeps each directory's entries in the same order as on disk,
+ *              so the output doesn't depend on which thread got where first.
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ ****************************************************************************/
+
+#ifndef _TREE_WALK_H_
+#define _TREE_WALK_H_
+
+#include "fat.h"
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * TreeNode - a file or directory in a walked tree, with totals for it and
+ *            everything under it. Sizes come from the entries' fileSize,
+ *            and allocations from the actual lengths of their chains, so
+ *            files holding more clusters than they need show up.
+ *****************************************************************************/
+typedef struct TreeNode
+{
+  char               name[FAT12_MAX_FILE_NAME_LENGTH];
+  DirectoryEntry     entry;
+  int                isDirectory;
+  unsigned int       numClusters; // the length of its own chain
+  struct TreeNode*   children; // in directory order
+  unsigned int       numChildren;
+  unsigned long long totalSize;
+  unsigned long long totalClusters;
+  unsigned int       totalFiles;
+  unsigned int       totalDirectories; // not counting itself
+} TreeNode;
+
+
+//-----------------------------------------------------------------------------
+// Tree Walk interface
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * walkTree - Read the tree of files and directories under a path. The file
+ *            system must be initialized.
+ *
+ * filePath - the path to start at, which may be a file or a directory
+ * numThreads - the number of threads to use, or 0 to use one per CPU
+ *
+ * Return - the root of the tree (named after the path), or NULL on failure
+ *****************************************************************************/
+TreeNode* walkTree(FilePath* filePath, int numThreads);
+
+/******************************************************************************
+ * freeTree - Free a tree returned by walkTree()
+ *
+ * root - the root of the tree
+ *
+ * Return - none
+ *****************************************************************************/
+void freeTree(TreeNode* root);
+
+/******************************************************************************
+ * getAllocatedSize - Get the number of bytes allocated to a node and
+ *                    everything under it
+ *
+ * node - the node
+ *
+ * Return - the number of bytes
+ *****************************************************************************/
+unsigned long long getAllocatedSize(TreeNode* node);
+
+
+#endif //_TREE_WALK_H_
@@ -0,0 +1,396 @@
+/******************************************************************************
+ * write.c: Write standard input into a file
+ *
+ * Author: David Jordan & Joey Gallahan
+ *
+ * Description: Performs the write command, which creates a file (or empties
+ *              an existing one) and copies everything read from standard
+ *              input into it, such as the output of another command in a
+ *              pipeline (see shell.c).
+ *
+ *              Usage: write PATH
+ *
+ * Certification of Authenticity:
+ * I certify that this assignment is entirely my own work.
+ *****************************************************************************/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "fat.h"
+
+
+//-----------------------------------------------------------------------------
+// Definitions
+//-----------------------------------------------------------------------------
+
+// How much input to collect before appending it to the file. The image is
+// only locked while appending, not while waiting for input, so that the
+// command writing into the pipe can lock the image too.
+#define WRITE_CHUNK_SIZE 65536
+
+
+//-----------------------------------------------------------------------------
+// Type Defines
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * OutputFile - the file being written, and where its data ends.
+ *****************************************************************************/
+typedef struct
+{
+  const char*    pathName;
+  unsigned int   flcOfParentDir;
+  unsigned int   indexInParentDirectory;
+  unsigned int   lastCluster;
+  unsigned int   fileSize;
+} OutputFile;
+
+
+//-----------------------------------------------------------------------------
+// Function Prototypes
+//-----------------------------------------------------------------------------
+
+static int createOutputFile(OutputFile* file, const char* pathName);
+static int reopenOutputFile(OutputFile* file);
+static int appendToOutputFile(OutputFile* file, unsigned char* data,
+                              unsigned int numBytes);
+
+
+//-----------------------------------------------------------------------------
+// Main
+//-----------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+  if (argc != 2)
+  {
+    printf("Error: invalid number of arguments\n");
+    printf("Usage: write [PATH]\n");
+    return -1;
+  }
+
+  if (initializeFatFileSystem(FAT_LOCK_EXCLUSIVE) != 0)
+    return -1;
+
+  OutputFile file;
+  if (createOutputFile(&file, argv[1]) != 0)
+  {
+    terminateFatFileSystem();
+    return -1;
+  }
+
+  unsigned int capacity = WRITE_CHUNK_SIZE;
+  unsigned int wanted = WRITE_CHUNK_SIZE;
+  unsigned int length = 0;
+  unsigned char* buffer = (unsigned char*) malloc(capacity);
+  unsigned int generation, newGeneration, flushedGeneration;
+  int isEndOfInput = 0;
+  int rc = 0;
+
+  getFatSessionGenerations(&generation, &flushedGeneration);
+  unlockFatFileSystem();
+
+  while (rc == 0)
+  {
+    // Collect a chunk of input, or whatever is left of it.
+    while (!isEndOfInput && length < wanted)
+    {
+      ssize_t numRead = read(STDIN_FILENO, buffer + length, capacity - length);
+      if (numRead > 0)
+        length += numRead;
+      else if (numRead == 0)
+        isEndOfInput = 1;
+      else if (errno != EINTR)
+      {
+        perror("Error reading input");
+        rc = -1;
+        break;
+      }
+    }
+    if (rc != 0 || length == 0)
+      break;
+
+    // If the image is busy, the lock may belong to the command writing into
+    // our input, which could be waiting for us to read more of it. So keep
+    // reading instead of waiting, until the input ends.
+    int lockRc;
+    if (isEndOfInput)
+      lockRc = lockFatFileSystem(FAT_LOCK_EXCLUSIVE);
+    else
+      lockRc = tryLockFatFileSystem(FAT_LOCK_EXCLUSIVE);
+    if (lockRc == 1)
+    {
+      wanted = length + WRITE_CHUNK_SIZE;
+      if (wanted > capacity)
+      {
+        capacity = wanted;
+        buffer = (unsigned char*) realloc(buffer, capacity);
+      }
+      continue;
+    }
+    else if (lockRc != 0)
+    {
+      rc = -1;
+      break;
+    }
+
+    // Someone else may have moved things around while we weren't looking.
+    getFatSessionGenerations(&newGeneration, &flushedGeneration);
+    if (newGeneration != generation)
+      rc = reopenOutputFile(&file);
+    if (rc == 0)
+      rc = appendToOutputFile(&file, buffer, length);
+
+    getFatSessionGenerations(&generation, &flushedGeneration);
+    unlockFatFileSystem();
+    length = 0;
+    wanted = WRITE_CHUNK_SIZE;
+    if (isEndOfInput)
+      break;
+  }
+
+  free(buffer);
+  terminateFatFileSystem();
+  return rc;
+}
+
+
+//-----------------------------------------------------------------------------
+// Functions
+//-----------------------------------------------------------------------------
+
+/******************************************************************************
+ * createOutputFile - Create the file, or empty it if it already exists
+ *****************************************************************************/
+static int createOutputFile(OutputFile* file, const char* pathName)
+{
+  char* parentPathName;
+  const char* fileName;
+  unsigned int cluster;
+  int index;
+
+  // Separate the file name from the path name.
+  parentPathName = (char*) malloc(strlen(pathName) + 2);
+  strcpy(parentPathName, pathName);
+  char* finalSlash = strrchr(parentPathName, '/');
+  if (finalSlash != NULL)
+  {
+    fileName = pathName + (finalSlash - parentPathName) + 1;
+    if (finalSlash == parentPathName)
+      finalSlash[1] = '\0';
+    else
+      finalSlash[0] = '\0';
+  }
+  else
+  {
+    fileName = pathName;
+    parentPathName[0] = '\0';
+  }
+
+  // Locate and open the parent directory.
+  FilePath filePath;
+  getWorkingDirectory(&filePath);
+  int rc = changeFilePath(&filePath, parentPathName, PATH_TYPE_DIRECTORY);
+  free(parentPathName);
+  if (rc != 0)
+    return -1;
+  unsigned int flcOfParentDir = filePath.dirLevels[filePath.depthLevel - 1]
+    .firstLogicalCluster;
+  DirectoryEntry* parentDir = openDirectory(flcOfParentDir);
+  if (parentDir == NULL)
+    return -1;
+
+  index = findEntryByName(parentDir, fileName);
+  if (index < 0)
+  {
+    // Create a new, empty file.
+    if (createNewEntry(flcOfParentDir, &parentDir, fileName, &index) != 0)
+    {
+      closeDirectory(parentDir);
+      return -1;
+    }
+  }
+  else if (isEntryADirectory(&parentDir[index]))
+  {
+    printf("Error: cannot write to '%s': Is a directory\n", pathName);
+    closeDirectory(parentDir);
+    return -1;
+  }
+  else if (getEntryCluster(&parentDir[index]) >= 2)
+  {
+    // Empty the existing file, keeping only its first cluster.
+    writeFileContents(getEntryCluster(&parentDir[index]), NULL, 0);
+  }
+  else if (findUnusedFatEntry(&cluster) == 0)
+  {
+    // The existing file has no clusters at all yet.
+    setFatEntry(cluster, FAT_END_OF_CHAIN);
+    setEntryCluster(&parentDir[index], cluster);
+  }
+  else
+  {
+    printf("Error: not enough available blocks to write '%s'\n", pathName);
+    closeDirectory(parentDir);
+    return -1;
+  }
+  parentDir[index].fileSize = 0;
+
+  file->pathName = pathName;
+  file->flcOfParentDir = flcOfParentDir;
+  file->indexInParentDirectory = index;
+  file->lastCluster = getEntryCluster(&parentDir[index]);
+  file->fileSize = 0;
+
+  rc = saveDirectory(flcOfParentDir, parentDir);
+  closeDirectory(parentDir);
+  return rc;
+}
+
+/******************************************************************************
+ * reopenOutputFile - Find the file again after the image has changed
+ *****************************************************************************/
+static int reopenOutputFile(OutputFile* file)
+{
+  FilePath filePath;
+  unsigned int entryValue;
+  int entryType;
+
+  getWorkingDirectory(&filePath);
+  if (changeFilePath(&filePath, file->pathName, PATH_TYPE_FILE) != 0)
+    return -1;
+
+  DirectoryLevel* fileLevel = &filePath.dirLevels[filePath.depthLevel - 1];
+  file->flcOfParentDir = filePath.dirLevels[filePath.depthLevel - 2]
+    .firstLogicalCluster;
+  file->indexInParentDirectory = fileLevel->indexInParentDirectory;
+
+  // Make sure nobody else has written to it in the meantime.
+  DirectoryEntry* parentDir = openDirectory(file->flcOfParentDir);
+  if (parentDir == NULL)
+    return -1;
+  unsigned int fileSize = parentDir[file->indexInParentDirectory].fileSize;
+  closeDirectory(parentDir);
+  if (fileSize != file->fileSize)
+  {
+    printf("Error: '%s' was changed while writing it\n", file->pathName);
+    return -1;
+  }
+
+  // Follow its chain to the last cluster.
+  file->lastCluster = fileLevel->firstLogicalCluster;
+  getFatEntry(file->lastCluster, &entryValue, &entryType);
+  while (entryType == FAT_ENTRY_TYPE_NEXT_SECTOR)
+  {
+    file->lastCluster = entryValue;
+    getFatEntry(file->lastCluster, &entryValue, &entryType);
+  }
+  return 0;
+}
+
+/******************************************************************************
+ * appendToOutputFile - Add data to the end of the file, first filling up its
+ *                      last cluster, then allocating as many more as needed
+ *                      and writing each run of consecutive ones at once
+ *****************************************************************************/
+static int appendToOutputFile(OutputFile* file, unsigned char* data,
+                              unsigned int numBytes)
+{
+  unsigned int bytesPerCluster = fatFileSystem.geometry.bytesPerCluster;
+  unsigned int offset = file->fileSize % bytesPerCluster;
+  unsigned int numClusters, runLength, i;
+  unsigned int* clusters;
+  unsigned int previousLastCluster;
+  SectorRun* runs;
+  unsigned int numRuns = 0;
+  int rc;
+
+  // Fill up the last cluster (the first one of an empty file is free).
+  if (file->fileSize == 0 || offset != 0)
+  {
+    unsigned char* cluster = (unsigned char*) calloc(bytesPerCluster, 1);
+    unsigned int numToCopy = bytesPerCluster - offset;
+    if (numToCopy > numBytes)
+      numToCopy = numBytes;
+    if (offset != 0 && readClusters(file->lastCluster, 1, cluster) == -1)
+    {
+      free(cluster);
+      return -1;
+    }
+    memcpy(cluster + offset, data, numToCopy);
+    rc = writeClusters(file->lastCluster, cluster, bytesPerCluster);
+    free(cluster);
+    if (rc != 0)
+    {
+      printf("Error: could not write '%s'\n", file->pathName);
+      return -1;
+    }
+
+    data += numToCopy;
+    numBytes -= numToCopy;
+    file->fileSize += numToCopy;
+  }
+
+  // Allocate the rest of the clusters, extending the chain.
+  numClusters = (numBytes + bytesPerCluster - 1) / bytesPerCluster;
+  if (numClusters > fatFileSystem.session->numFreeClusters)
+  {
+    printf("Error: not enough available blocks to write '%s'\n",
+           file->pathName);
+    return -1;
+  }
+  clusters = (unsigned int*) malloc((numClusters + 1) * sizeof(*clusters));
+  previousLastCluster = file->lastCluster;
+  for (i = 0; i < numClusters; i++)
+  {
+    findUnusedFatEntry(&clusters[i]);
+    setFatEntry(clusters[i], FAT_END_OF_CHAIN);
+    setFatEntry(file->lastCluster, clusters[i]);
+    file->lastCluster = clusters[i];
+  }
+
+  // Write the clusters a run at a time (the last may be partial), with all
+  // of the runs in flight at once.
+  runs = (SectorRun*) malloc((numClusters + 1) * sizeof(*runs));
+  for (i = 0; i < numClusters; i += runLength)
+  {
+    runLength = 1;
+    while (i + runLength < numClusters &&
+           clusters[i + runLength] == clusters[i] + runLength)
+      runLength++;
+
+    unsigned int runBytes = runLength * bytesPerCluster;
+    if (runBytes > numBytes - (i * bytesPerCluster))
+      runBytes = numBytes - (i * bytesPerCluster);
+    runs[numRuns].sector = logicalToPhysicalCluster(clusters[i]);
+    runs[numRuns].numBytes = runBytes;
+    runs[numRuns].buffer = data + (i * bytesPerCluster);
+    numRuns++;
+  }
+  rc = writeSectorRuns(runs, numRuns);
+  free(runs);
+  if (rc != 0)
+  {
+    // Give back the clusters, leaving the file as it was before them.
+    printf("Error: could not write '%s'\n", file->pathName);
+    setFatEntry(previousLastCluster, FAT_END_OF_CHAIN);
+    for (i = 0; i < numClusters; i++)
+      setFatEntry(clusters[i], 0x000);
+    file->lastCluster = previousLastCluster;
+    free(clusters);
+    return -1;
+  }
+  free(clusters);
+  file->fileSize += numBytes;
+
+  // Record the new size.
+  DirectoryEntry* parentDir = openDirectory(file->flcOfParentDir);
+  if (parentDir == NULL)
+    return -1;
+  parentDir[file->indexInParentDirectory].fileSize = file->fileSize;
+  rc = saveDirectory(file->flcOfParentDir, parentDir);
+  closeDirectory(parentDir);
+  return rc;
+}